@@ -5,6 +5,17 @@
  * @hwref     U3 (RP2040)
  * @schematic lamp_controller.SchDoc
  *  
+ * Every edge (re)arms a per button alarm BUTTONS_DEBOUNCE_TIME_US_C later, the 
+ * alarm samples the settled level and queues an event stamped with the first 
+ * edge time. buttons_update() turns the queue into the global states, so a 
+ * press is never lost to a long loop pass and the repeat timing follows the 
+ * stamps. The keypad input device reads its own copy of the events.
+ * 
+ * While the screen is dark the keypad gets no presses, so the wake press is 
+ * never replayed into the UI. A release is passed on only when its press was, 
+ * whatever the state, and a full keypad queue gives up its oldest complete 
+ * press and release, so the UI never sees a key stuck down.
+ *  
  */
 
 
@@ -13,9 +24,11 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <hardware/gpio.h>
+#include <hardware/irq.h>
 #include <pico/stdlib.h>
 #include "buttons.h"
 #include "pins.h"
+#include "m_idle.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
@@ -24,8 +37,11 @@ typedef struct {
 	int			pin;
 	BUTTONS_E	button;
 	uint64_t	last_pulsed_us;
-	uint64_t	first_down_us;
-	bool		down_last_frame;
+	uint64_t	first_edge_us;													/* Start of the bounce */
+	alarm_id_t	debounce_alarm;
+	bool		b_is_settled_down;												/* Level after debounce, interrupt side */
+	bool		b_is_down;														/* Level after the last event, main loop side */
+	bool		b_is_key_down;													/* Press passed on to the keypad, its release follows */
 } BTN_CTRL_T;
 
 
@@ -35,6 +51,12 @@ typedef struct {
 #define BUTTONS_PULSE_TIME_INITIAL_US_C   (1000 * 300)							/* Pulse time in micro seconds after system startup */
 #define BUTTONS_DEBOUNCE_TIME_US_C        (1000 * 5)							/* Debounce time in micro seconds */
 #define BUTTONS_COUNT_C 				  5										/* System's buttons count */
+#define BUTTONS_QUEUE_LEN_C 			  16
+#define BUTTONS_QUEUE_MASK_C 			  (BUTTONS_QUEUE_LEN_C - 1)
+
+#if (BUTTONS_QUEUE_LEN_C & BUTTONS_QUEUE_MASK_C)
+#warning "Buttons event queue size is not a base 2 size as expected."
+#endif
 
 
 /* Global variables  ---------------------------------------------------------*/
@@ -45,16 +67,35 @@ BUTTONS_E g_buttons_pressed, g_buttons_released, g_buttons_down, g_buttons_pulse
 /* Private variables  --------------------------------------------------------*/
 
 static BTN_CTRL_T buttons[BUTTONS_COUNT_C] = {
-	{PIN_BUTTON_UP, 	BUTTON_UP_C,     0, 0, false},
-	{PIN_BUTTON_DOWN, 	BUTTON_DOWN_C,   0, 0, false},
-	{PIN_BUTTON_LEFT, 	BUTTON_LEFT_C,   0, 0, false},
-	{PIN_BUTTON_RIGHT,	BUTTON_RIGHT_C,  0, 0, false},
-	{PIN_BUTTON_CENTER,	BUTTON_CENTER_C, 0, 0, false}
+	{PIN_BUTTON_UP, 	BUTTON_UP_C},
+	{PIN_BUTTON_DOWN, 	BUTTON_DOWN_C},
+	{PIN_BUTTON_LEFT, 	BUTTON_LEFT_C},
+	{PIN_BUTTON_RIGHT,	BUTTON_RIGHT_C},
+	{PIN_BUTTON_CENTER,	BUTTON_CENTER_C}
 };
 
+/* Debounced edges, interrupt in, buttons_update() out */
+static BUTTONS_EVENT_T 	buttons_queue[BUTTONS_QUEUE_LEN_C];
+static volatile uint8_t buttons_queue_head = 0;
+static volatile uint8_t buttons_queue_tail = 0;
+
+/* Copy for the keypad input device, main loop only */
+static BUTTONS_EVENT_T 	buttons_key_queue[BUTTONS_QUEUE_LEN_C];
+static uint8_t 			buttons_key_queue_head = 0;
+static uint8_t 			buttons_key_queue_tail = 0;
+static bool 			b_buttons_is_keypad_enabled = true;
+
+
+/* Callback prototypes -------------------------------------------------------*/
+
+static void buttons_gpio_irq_handler(void);
+static int64_t buttons_debounce_alarm_callback(alarm_id_t id, void* p_user_data);
+
 
 /* Private function prototypes -----------------------------------------------*/
 
+static void buttons_key_queue_put(BUTTONS_EVENT_T* p_event);
+static bool buttons_key_queue_drop_click(void);
 static const char * p_buttons_get_name_string(BUTTONS_E a_btn);
 
 
@@ -68,18 +109,39 @@ static const char * p_buttons_get_name_string(BUTTONS_E a_btn);
  */
 void buttons_init(void)
 {
+	uint32_t gpio_mask = 0;
+
 	for (int idx = 0; idx < BUTTONS_COUNT_C; idx++)
 	{
 		gpio_init(buttons[idx].pin);
 		gpio_set_dir(buttons[idx].pin, GPIO_IN);
 		gpio_set_pulls(buttons[idx].pin, true, false);
+
+		gpio_mask |= (1u << buttons[idx].pin);
+	}
+
+	gpio_add_raw_irq_handler_masked(gpio_mask, buttons_gpio_irq_handler);
+
+	for (int idx = 0; idx < BUTTONS_COUNT_C; idx++)
+	{
+		gpio_set_irq_enabled(buttons[idx].pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+
+		buttons[idx].first_edge_us  = time_us_64();
+		buttons[idx].debounce_alarm = add_alarm_in_us(BUTTONS_DEBOUNCE_TIME_US_C,
+													  buttons_debounce_alarm_callback,
+													  (void*)(intptr_t)idx,
+													  true);						/* Held at boot reads as a press */
 	}
+
+	irq_set_enabled(IO_IRQ_BANK0, true);
 }
 
 /**
  * @brief   Updates all system's buttons state
  * 
- * A debounce filter is applied to all buttons.
+ * Applies the queued debounced events, then the repeat pulses of the buttons 
+ * held down. The events are also passed on to the keypad queue, presses only 
+ * while the keypad is enabled.
  * 
  * Buttons current state will be available on global variables.
  * 
@@ -89,60 +151,111 @@ void buttons_update(void)
 {
 	g_buttons_pressed  = 0;
 	g_buttons_released = 0;
-	g_buttons_down 	   = 0;
 	g_buttons_pulsed   = 0;
 
 	uint64_t now = time_us_64();
 
-	for (int idx = 0; idx < BUTTONS_COUNT_C; idx++)
+	while (buttons_queue_tail != buttons_queue_head)
 	{
-		BUTTONS_E btn   = buttons[idx].button;
-		bool gpio_state = !gpio_get(buttons[idx].pin);
-		
-		if (gpio_state && (buttons[idx].first_down_us == 0))
-		{
-			buttons[idx].first_down_us = now;
-		}
-		else if (!gpio_state)
-		{
-			buttons[idx].first_down_us = 0;
-		}
+		BUTTONS_EVENT_T event = buttons_queue[buttons_queue_tail];
 
-		bool btn_is_down =  (buttons[idx].first_down_us != 0) &&
-			 				((now - buttons[idx].first_down_us) >
-							 BUTTONS_DEBOUNCE_TIME_US_C);
+		buttons_queue_tail = (buttons_queue_tail + 1) & BUTTONS_QUEUE_MASK_C;
 
-		if (btn_is_down)
+		for (int idx = 0; idx < BUTTONS_COUNT_C; idx++)
 		{
-			if (!buttons[idx].down_last_frame)
+			if (buttons[idx].button != event.button)
 			{
-				g_buttons_pressed |= btn;
+				continue;
+			}
+
+			if (event.b_is_down)
+			{
+				g_buttons_pressed |= event.button;
 
-				buttons[idx].last_pulsed_us = now + BUTTONS_PULSE_TIME_INITIAL_US_C;
+				buttons[idx].last_pulsed_us = event.time_us + BUTTONS_PULSE_TIME_INITIAL_US_C;
 			}
-			else if ((now - buttons[idx].last_pulsed_us) > BUTTONS_PULSE_TIME_US_C)
+			else
 			{
-				g_buttons_pulsed |= btn;
+				g_buttons_released |= event.button;								// Triggered on end of button press
 
-				buttons[idx].last_pulsed_us = now;
+				buttons[idx].last_pulsed_us = 0;
 			}
 
-			g_buttons_down |= btn;
-		}
-		else
-		{
-			if (buttons[idx].down_last_frame)
+			buttons[idx].b_is_down = event.b_is_down;
+
+			if (event.b_is_down ? b_buttons_is_keypad_enabled : buttons[idx].b_is_key_down)
 			{
-				g_buttons_released |= btn;										// Triggered on end of button press
+				buttons[idx].b_is_key_down = event.b_is_down;
+
+				buttons_key_queue_put(&event);
 			}
+		}
+	}
+
+	g_buttons_down = 0;
+
+	for (int idx = 0; idx < BUTTONS_COUNT_C; idx++)
+	{
+		if (!buttons[idx].b_is_down)
+		{
+			continue;
+		}
 
-			buttons[idx].last_pulsed_us = 0;
+		if ((now > buttons[idx].last_pulsed_us) && 
+			((now - buttons[idx].last_pulsed_us) > BUTTONS_PULSE_TIME_US_C))
+		{
+			g_buttons_pulsed |= buttons[idx].button;
+
+			buttons[idx].last_pulsed_us = now;
 		}
 
-		buttons[idx].down_last_frame = btn_is_down;
+		g_buttons_down |= buttons[idx].button;
 	}
 }
 
+/**
+ * @brief Takes the oldest event for the keypad input device
+ * 
+ * @param p_event Event taken
+ * @return true An event was queued
+ * @return false 
+ */
+bool buttons_get_key_event(BUTTONS_EVENT_T* p_event)
+{
+	if (buttons_key_queue_tail == buttons_key_queue_head)
+	{
+		return false;
+	}
+
+	*p_event = buttons_key_queue[buttons_key_queue_tail];
+	buttons_key_queue_tail = (buttons_key_queue_tail + 1) & BUTTONS_QUEUE_MASK_C;
+
+	return true;
+}
+
+/**
+ * @brief Enables or disables key presses for the keypad input device
+ * 
+ * Releases of the keys already pressed still get through while disabled
+ * 
+ * @param b_enable false while the screen is dark
+ */
+void buttons_set_keypad_enabled(bool b_enable)
+{
+	b_buttons_is_keypad_enabled = b_enable;
+}
+
+/**
+ * @brief Returns whether debounced events are waiting for buttons_update()
+ * 
+ * @return true 
+ * @return false 
+ */
+bool buttons_has_pending_events(void)
+{
+	return (buttons_queue_tail != buttons_queue_head);
+}
+
 /**
  * @brief Outputs the button's states
  * 
@@ -193,8 +306,151 @@ void buttons_print_states(void)
 }
 
 
+/* Callback functions --------------------------------------------------------*/
+
+/**
+ * @brief Edge on a button, restarts its debounce
+ * 
+ */
+static void buttons_gpio_irq_handler(void)
+{
+	for (int idx = 0; idx < BUTTONS_COUNT_C; idx++)
+	{
+		uint32_t events = gpio_get_irq_event_mask(buttons[idx].pin) & 
+						  (GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE);
+
+		if (events == 0)
+		{
+			continue;
+		}
+
+		gpio_acknowledge_irq(buttons[idx].pin, events);
+
+		if (buttons[idx].debounce_alarm > 0)
+		{
+			cancel_alarm(buttons[idx].debounce_alarm);
+		}
+		else
+		{
+			buttons[idx].first_edge_us = time_us_64();
+		}
+
+		buttons[idx].debounce_alarm = add_alarm_in_us(BUTTONS_DEBOUNCE_TIME_US_C,
+													  buttons_debounce_alarm_callback,
+													  (void*)(intptr_t)idx,
+													  true);
+	}
+}
+
+/**
+ * @brief No edge for the debounce time, queues the settled level if changed
+ * 
+ * @param id Not used
+ * @param p_user_data Button index
+ * @return int64_t 0, not rescheduled
+ */
+static int64_t buttons_debounce_alarm_callback(alarm_id_t id, void* p_user_data)
+{
+	BTN_CTRL_T* p_btn 	  = &buttons[(intptr_t)p_user_data];
+	bool 		b_is_down = !gpio_get(p_btn->pin);
+	uint8_t 	next 	  = (buttons_queue_head + 1) & BUTTONS_QUEUE_MASK_C;
+
+	if (b_is_down == p_btn->b_is_settled_down)
+	{
+		p_btn->debounce_alarm = 0;
+		return 0;
+	}
+
+	if (next == buttons_queue_tail)
+	{
+		return BUTTONS_DEBOUNCE_TIME_US_C;										/* Full, sampled again once drained */
+	}
+
+	p_btn->debounce_alarm 	 = 0;
+	p_btn->b_is_settled_down = b_is_down;
+
+	buttons_queue[buttons_queue_head] = (BUTTONS_EVENT_T){
+		.time_us   = p_btn->first_edge_us,
+		.button    = p_btn->button,
+		.b_is_down = b_is_down,
+	};
+	buttons_queue_head = next;
+
+	m_idle_wake(M_IDLE_WAKE_BUTTON_C);
+
+	return 0;
+}
+
+
 /* Private functions ---------------------------------------------------------*/
 
+/**
+ * @brief Queues an event for the keypad input device
+ * 
+ * When the keypad is not read for long, the oldest complete press and release 
+ * make room
+ * 
+ * @param p_event Event to queue
+ */
+static void buttons_key_queue_put(BUTTONS_EVENT_T* p_event)
+{
+	uint8_t next = (buttons_key_queue_head + 1) & BUTTONS_QUEUE_MASK_C;
+
+	if ((next == buttons_key_queue_tail) && !buttons_key_queue_drop_click())
+	{
+		return;
+	}
+
+	buttons_key_queue[buttons_key_queue_head] = *p_event;
+	buttons_key_queue_head = (buttons_key_queue_head + 1) & BUTTONS_QUEUE_MASK_C;
+}
+
+/**
+ * @brief Removes the oldest press queued together with its release
+ * 
+ * A full queue always holds one, some button has three events or more and 
+ * they alternate
+ * 
+ * @return true A press and its release were removed
+ * @return false 
+ */
+static bool buttons_key_queue_drop_click(void)
+{
+	for (uint8_t press = buttons_key_queue_tail; press != buttons_key_queue_head; press = (press + 1) & BUTTONS_QUEUE_MASK_C)
+	{
+		if (!buttons_key_queue[press].b_is_down)
+		{
+			continue;
+		}
+
+		for (uint8_t release = (press + 1) & BUTTONS_QUEUE_MASK_C; release != buttons_key_queue_head; release = (release + 1) & BUTTONS_QUEUE_MASK_C)
+		{
+			if (buttons_key_queue[release].button != buttons_key_queue[press].button)
+			{
+				continue;
+			}
+
+			/* Next event of the button, a release, both go and the rest closes up */
+			uint8_t dst = press;
+
+			for (uint8_t src = (press + 1) & BUTTONS_QUEUE_MASK_C; src != buttons_key_queue_head; src = (src + 1) & BUTTONS_QUEUE_MASK_C)
+			{
+				if (src != release)
+				{
+					buttons_key_queue[dst] = buttons_key_queue[src];
+					dst = (dst + 1) & BUTTONS_QUEUE_MASK_C;
+				}
+			}
+
+			buttons_key_queue_head = dst;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
 /**
  * @brief 	Gets a button's name string
  * 
@@ -9,6 +9,12 @@
 #define _D_BUTTONS_H_
 
 
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
 /* Exported typedef ----------------------------------------------------------*/
 
 typedef enum {
@@ -19,6 +25,17 @@ typedef enum {
 	BUTTON_CENTER_C = (1 << 4)
 } BUTTONS_E;
 
+/**
+ * @struct BUTTONS_EVENT_T
+ * @brief Debounced press or release
+ *
+ */
+typedef struct {
+	uint64_t	time_us;														/* First edge, since boot */
+	BUTTONS_E	button;
+	bool		b_is_down;
+} BUTTONS_EVENT_T;
+
 
 /* Exported variables --------------------------------------------------------*/
 
@@ -32,6 +49,9 @@ extern BUTTONS_E g_buttons_pulsed;
 
 void buttons_init();
 void buttons_update();
+bool buttons_get_key_event(BUTTONS_EVENT_T* p_event);
+void buttons_set_keypad_enabled(bool b_enable);
+bool buttons_has_pending_events(void);
 void buttons_print_states();
 
 
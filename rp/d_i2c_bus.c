@@ -0,0 +1,579 @@
+/**
+ * @file      d_i2c_bus.c
+ * @author    The OSLUV Project
+ * @brief     Driver for the I2C bus shared by accelerometer, magnet sensor and
+ *            USB PD controller
+ * @schematic lamp_controller.SchDoc
+ *
+ * Transactions are queued as descriptors and run back to back from the I2C
+ * interrupt, the FIFOs being refilled and drained as the transfer goes. The
+ * completion callbacks run from i2c_bus_update() in the main loop, so the
+ * drivers never wait on the bus. A device failing I2C_BUS_BACKOFF_AFTER_C
+ * times in a row is refused for a growing period instead of costing a
+ * timeout on every poll.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <hardware/i2c.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#include <pico/stdlib.h>
+
+#include <stdio.h>
+
+#include "pins.h"
+#include "d_i2c_bus.h"
+#include "m_idle.h"
+#include "d_sysclk.h"
+
+
+/* Private typedef -----------------------------------------------------------*/
+
+typedef struct {
+    uint8_t         addr;
+    uint32_t        baud;
+    uint8_t         fails;                                                      /* Consecutive */
+    absolute_time_t backoff_until;
+    I2C_BUS_STATS_T stats;
+} I2C_BUS_DEV_T;
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define I2C_BUS_PORT_C              I2C_INST
+#define I2C_BUS_IRQ_C               (I2C0_IRQ + i2c_hw_index(I2C_BUS_PORT_C))
+#define I2C_BUS_BAUD_C              (400*1000)                                  /* Until a device asks for another speed */
+
+#define I2C_BUS_FIFO_DEPTH_C        16
+#define I2C_BUS_TX_TL_C             (I2C_BUS_FIFO_DEPTH_C / 2)                  /* Refill when half empty */
+#define I2C_BUS_RX_TL_C             (I2C_BUS_FIFO_DEPTH_C / 2 - 1)              /* Drain at half full, the rest on stop */
+
+#define I2C_BUS_QUEUE_LEN_C         16
+#define I2C_BUS_QUEUE_MASK_C        (I2C_BUS_QUEUE_LEN_C - 1)
+
+#if (I2C_BUS_QUEUE_LEN_C & I2C_BUS_QUEUE_MASK_C)
+#warning "I2C bus queue size is not a base 2 size as expected."
+#endif
+
+#define I2C_BUS_TMOUT_BASE_US_C     1000
+#define I2C_BUS_TMOUT_BYTE_BITS_C   18                                          /* 9 bits per byte, twice for clock stretching */
+
+#define I2C_BUS_BACKOFF_AFTER_C     2                                           /* Consecutive failures */
+#define I2C_BUS_BACKOFF_MIN_MS_C    100
+#define I2C_BUS_BACKOFF_MAX_MS_C    5000
+
+#define I2C_BUS_INTR_C              (I2C_IC_INTR_MASK_M_TX_ABRT_BITS | \
+                                     I2C_IC_INTR_MASK_M_STOP_DET_BITS | \
+                                     I2C_IC_INTR_MASK_M_RX_FULL_BITS)
+#define I2C_BUS_ABRT_NACK_C         (I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS | \
+                                     I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS)
+
+
+/* Global variables  ---------------------------------------------------------*/
+/* Private variables  --------------------------------------------------------*/
+
+static I2C_BUS_DEV_T i2c_bus_dev[I2C_BUS_DEV_MAX_C];
+static uint32_t      i2c_bus_baud;
+
+/* Pending, main loop in, interrupt out */
+static I2C_BUS_REQ_T* volatile i2c_bus_queue[I2C_BUS_QUEUE_LEN_C];
+static volatile uint8_t        i2c_bus_queue_head = 0;
+static volatile uint8_t        i2c_bus_queue_tail = 0;
+
+/* Completed with a callback, interrupt in, main loop out */
+static I2C_BUS_REQ_T* volatile i2c_bus_done[I2C_BUS_QUEUE_LEN_C];
+static volatile uint8_t        i2c_bus_done_head = 0;
+static volatile uint8_t        i2c_bus_done_tail = 0;
+
+/* Transaction on the bus */
+static volatile struct {
+    I2C_BUS_REQ_T*  p_req;
+    uint16_t        cmd_idx;                                                    /* Commands pushed, register address first */
+    uint16_t        rx_idx;                                                     /* Bytes read back */
+    uint32_t        abrt_src;
+    absolute_time_t deadline;
+} i2c_bus_xfer;
+
+
+/* Callback prototypes -------------------------------------------------------*/
+
+static void i2c_bus_irq_handler(void);
+static bool i2c_bus_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz);
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static void i2c_bus_configure(void);
+static void i2c_bus_start_next(void);
+static void i2c_bus_fill(void);
+static void i2c_bus_drain(void);
+static void i2c_bus_complete(I2C_BUS_RES_E result);
+static void i2c_bus_check_timeout(void);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Shared I2C bus initialization procedure
+ *
+ */
+void i2c_bus_init(void)
+{
+    gpio_set_function(PIN_I2C_SDA, GPIO_FUNC_I2C);
+    gpio_set_function(PIN_I2C_SCL, GPIO_FUNC_I2C);
+    gpio_pull_up(PIN_I2C_SDA);
+    gpio_pull_up(PIN_I2C_SCL);
+
+    i2c_bus_configure();
+
+    irq_set_exclusive_handler(I2C_BUS_IRQ_C, i2c_bus_irq_handler);
+    irq_set_enabled(I2C_BUS_IRQ_C, true);
+
+    sysclk_add_listener(i2c_bus_sysclk_callback);
+}
+
+/**
+ * @brief Runs the completion callbacks and recovers a stuck transaction
+ *
+ */
+void i2c_bus_update(void)
+{
+    i2c_bus_check_timeout();
+
+    while (i2c_bus_done_tail != i2c_bus_done_head)
+    {
+        I2C_BUS_REQ_T* p_req = i2c_bus_done[i2c_bus_done_tail];
+
+        i2c_bus_done_tail = (i2c_bus_done_tail + 1) & I2C_BUS_QUEUE_MASK_C;
+
+        p_req->p_callback(p_req);
+    }
+}
+
+/**
+ * @brief Declares a device, before its first transaction
+ *
+ * @param dev Device
+ * @param addr 7-bit address
+ * @param baud Bus speed for this device
+ */
+void i2c_bus_add_device(I2C_BUS_DEV_E dev, uint8_t addr, uint32_t baud)
+{
+    i2c_bus_dev[dev].addr          = addr;
+    i2c_bus_dev[dev].baud          = baud;
+    i2c_bus_dev[dev].fails         = 0;
+    i2c_bus_dev[dev].backoff_until = get_absolute_time();
+}
+
+/**
+ * @brief Queues a transaction
+ *
+ * @param p_req Descriptor, result set to pending until completion
+ * @return true Queued, the callback will be called
+ * @return false Refused, see the result
+ */
+bool i2c_bus_submit(I2C_BUS_REQ_T* p_req)
+{
+    I2C_BUS_DEV_T* p_dev = &i2c_bus_dev[p_req->dev];
+    uint32_t       save  = save_and_disable_interrupts();
+    uint8_t        next  = (i2c_bus_queue_head + 1) & I2C_BUS_QUEUE_MASK_C;
+
+    if (!time_reached(p_dev->backoff_until))
+    {
+        p_dev->stats.backoff++;
+        p_req->result = I2C_BUS_RES_BACKOFF_C;
+    }
+    else if (next == i2c_bus_queue_tail)
+    {
+        p_req->result = I2C_BUS_RES_FULL_C;
+    }
+    else
+    {
+        p_req->result = I2C_BUS_RES_PENDING_C;
+
+        i2c_bus_queue[i2c_bus_queue_head] = p_req;
+        i2c_bus_queue_head = next;
+
+        if (i2c_bus_xfer.p_req == NULL)
+        {
+            i2c_bus_start_next();
+        }
+    }
+
+    restore_interrupts(save);
+
+    return (p_req->result == I2C_BUS_RES_PENDING_C);
+}
+
+/**
+ * @brief Queues a transaction and waits for it
+ *
+ * For init sequences and rare writes, the periodic reads go through
+ * i2c_bus_submit()
+ *
+ * @param dev Device
+ * @param reg Register address
+ * @param b_is_read Read, otherwise write
+ * @param p_data Data read or to write
+ * @param len Data length
+ * @return I2C_BUS_RES_E
+ */
+I2C_BUS_RES_E i2c_bus_xfer_blocking(I2C_BUS_DEV_E dev, uint8_t reg, bool b_is_read, uint8_t* p_data, uint16_t len)
+{
+    I2C_BUS_REQ_T req = {
+        .dev        = dev,
+        .reg        = reg,
+        .b_is_read  = b_is_read,
+        .len        = len,
+        .p_data     = p_data,
+        .p_callback = NULL,
+    };
+
+    if (i2c_bus_submit(&req))
+    {
+        while (req.result == I2C_BUS_RES_PENDING_C)
+        {
+            i2c_bus_check_timeout();
+            tight_loop_contents();
+        }
+    }
+
+    return req.result;
+}
+
+/**
+ * @brief Returns a device's transaction counters
+ *
+ * @param dev Device
+ * @param p_stats Counters
+ */
+void i2c_bus_get_stats(I2C_BUS_DEV_E dev, I2C_BUS_STATS_T* p_stats)
+{
+    *p_stats = i2c_bus_dev[dev].stats;
+}
+
+/**
+ * @brief Formats the per device counters as a single line
+ * @note This function can be called via external command
+ *
+ * Each device as ok/nack/abort/timeout/backoff
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t i2c_bus_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+    static const char* dev_str[I2C_BUS_DEV_MAX_C] = {"IMU", "MAG", "PD"};
+    I2C_BUS_STATS_T    stats;
+    int                text_len = 0;
+
+    for (int dev = 0; (dev < I2C_BUS_DEV_MAX_C) && (text_len < len); dev++)
+    {
+        i2c_bus_get_stats(dev, &stats);
+
+        text_len += snprintf((char*)p_buf + text_len, len - text_len,
+                             "%s=%lu/%lu/%lu/%lu/%lu,",
+                             dev_str[dev],
+                             (unsigned long)stats.ok,
+                             (unsigned long)stats.nack,
+                             (unsigned long)stats.abort,
+                             (unsigned long)stats.timeout,
+                             (unsigned long)stats.backoff);
+    }
+
+    return MIN(text_len, len - 1);
+}
+
+
+/* Callback functions --------------------------------------------------------*/
+
+/**
+ * @brief I2C interrupt, FIFO levels, abort and stop
+ *
+ */
+static void i2c_bus_irq_handler(void)
+{
+    i2c_hw_t* p_hw = i2c_get_hw(I2C_BUS_PORT_C);
+    uint32_t  stat = p_hw->intr_stat;
+
+    if (i2c_bus_xfer.p_req == NULL)
+    {
+        p_hw->intr_mask = 0;
+        (void)p_hw->clr_intr;
+        return;
+    }
+
+    if (stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS)
+    {
+        i2c_bus_xfer.abrt_src = p_hw->tx_abrt_source;
+        (void)p_hw->clr_tx_abrt;                                                /* The controller sends the stop itself */
+        hw_clear_bits(&p_hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+    }
+
+    i2c_bus_drain();
+
+    if (i2c_bus_xfer.abrt_src == 0)
+    {
+        i2c_bus_fill();
+    }
+
+    if (stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS)
+    {
+        I2C_BUS_REQ_T* p_req  = i2c_bus_xfer.p_req;
+        I2C_BUS_RES_E  result = I2C_BUS_RES_OK_C;
+
+        (void)p_hw->clr_stop_det;
+
+        if (i2c_bus_xfer.abrt_src & I2C_BUS_ABRT_NACK_C)
+        {
+            result = I2C_BUS_RES_NACK_C;
+        }
+        else if ((i2c_bus_xfer.abrt_src != 0) ||
+                 (p_req->b_is_read && (i2c_bus_xfer.rx_idx < p_req->len)))
+        {
+            result = I2C_BUS_RES_ABORT_C;
+        }
+
+        i2c_bus_complete(result);
+        i2c_bus_start_next();
+    }
+}
+
+
+/**
+ * @brief Keeps the bus speed across system clock changes
+ *
+ * The change waits for the transaction on the bus, if any. From the main
+ * loop nothing else starts one, the interrupt only chains a queued one on
+ * completion.
+ *
+ * @param phase @ref SYSCLK_PHASE_E
+ * @param sys_hz New system clock
+ * @return true Ready / done
+ * @return false Transaction on the bus, defer the change
+ */
+static bool i2c_bus_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz)
+{
+    if (phase == SYSCLK_PHASE_PREPARE_C)
+    {
+        return (i2c_bus_xfer.p_req == NULL);
+    }
+
+    i2c_set_baudrate(I2C_BUS_PORT_C, i2c_bus_baud);
+
+    return true;
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Resets and sets up the peripheral, interrupts masked
+ *
+ */
+static void i2c_bus_configure(void)
+{
+    i2c_hw_t* p_hw = i2c_get_hw(I2C_BUS_PORT_C);
+
+    i2c_init(I2C_BUS_PORT_C, I2C_BUS_BAUD_C);
+    i2c_bus_baud = I2C_BUS_BAUD_C;
+
+    p_hw->intr_mask = 0;
+    p_hw->tx_tl     = I2C_BUS_TX_TL_C;
+    p_hw->rx_tl     = I2C_BUS_RX_TL_C;
+}
+
+/**
+ * @brief Puts the next queued transaction on the bus
+ *
+ * From the interrupt, or with interrupts disabled
+ *
+ */
+static void i2c_bus_start_next(void)
+{
+    i2c_hw_t*      p_hw = i2c_get_hw(I2C_BUS_PORT_C);
+    I2C_BUS_REQ_T* p_req;
+    I2C_BUS_DEV_T* p_dev;
+
+    i2c_bus_xfer.p_req = NULL;
+
+    if (i2c_bus_queue_tail == i2c_bus_queue_head)
+    {
+        return;
+    }
+
+    p_req = i2c_bus_queue[i2c_bus_queue_tail];
+    p_dev = &i2c_bus_dev[p_req->dev];
+    i2c_bus_queue_tail = (i2c_bus_queue_tail + 1) & I2C_BUS_QUEUE_MASK_C;
+
+    p_hw->enable = 0;                                                           /* Target and speed only change while disabled */
+    p_hw->tar    = p_dev->addr;
+
+    if (p_dev->baud != i2c_bus_baud)
+    {
+        i2c_set_baudrate(I2C_BUS_PORT_C, p_dev->baud);
+        i2c_bus_baud = p_dev->baud;
+    }
+
+    p_hw->enable = 1;
+    (void)p_hw->clr_intr;
+
+    i2c_bus_xfer.p_req    = p_req;
+    i2c_bus_xfer.cmd_idx  = 0;
+    i2c_bus_xfer.rx_idx   = 0;
+    i2c_bus_xfer.abrt_src = 0;
+    i2c_bus_xfer.deadline = make_timeout_time_us(I2C_BUS_TMOUT_BASE_US_C +
+                                                 ((uint64_t)(p_req->len + 2) * I2C_BUS_TMOUT_BYTE_BITS_C * 1000000) / p_dev->baud);
+
+    p_hw->intr_mask = I2C_BUS_INTR_C;
+
+    i2c_bus_fill();
+}
+
+/**
+ * @brief Pushes the next commands into the TX FIFO
+ *
+ * The register address, then a write or read command per byte, restart on
+ * the first read and stop on the last command. No more reads are issued than
+ * the RX FIFO can hold.
+ *
+ */
+static void i2c_bus_fill(void)
+{
+    i2c_hw_t*      p_hw  = i2c_get_hw(I2C_BUS_PORT_C);
+    I2C_BUS_REQ_T* p_req = i2c_bus_xfer.p_req;
+    uint16_t       total = p_req->len + 1;
+    bool           b_is_held = false;
+
+    while ((i2c_bus_xfer.cmd_idx < total) && (p_hw->txflr < I2C_BUS_FIFO_DEPTH_C))
+    {
+        uint16_t idx = i2c_bus_xfer.cmd_idx;
+        uint32_t cmd;
+
+        if (idx == 0)
+        {
+            cmd = p_req->reg;
+        }
+        else if (p_req->b_is_read)
+        {
+            if ((idx - 1 - i2c_bus_xfer.rx_idx) >= I2C_BUS_FIFO_DEPTH_C)
+            {
+                b_is_held = true;                                               /* Resumed by the RX level interrupt */
+                break;
+            }
+
+            cmd = I2C_IC_DATA_CMD_CMD_BITS | ((idx == 1) ? I2C_IC_DATA_CMD_RESTART_BITS : 0);
+        }
+        else
+        {
+            cmd = p_req->p_data[idx - 1];
+        }
+
+        if (idx == (total - 1))
+        {
+            cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        }
+
+        p_hw->data_cmd = cmd;
+        i2c_bus_xfer.cmd_idx++;
+    }
+
+    if ((i2c_bus_xfer.cmd_idx < total) && !b_is_held)
+    {
+        hw_set_bits(&p_hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+    }
+    else
+    {
+        hw_clear_bits(&p_hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+    }
+}
+
+/**
+ * @brief Empties the RX FIFO into the request data
+ *
+ */
+static void i2c_bus_drain(void)
+{
+    i2c_hw_t*      p_hw  = i2c_get_hw(I2C_BUS_PORT_C);
+    I2C_BUS_REQ_T* p_req = i2c_bus_xfer.p_req;
+
+    while (p_hw->rxflr > 0)
+    {
+        uint8_t data = (uint8_t)p_hw->data_cmd;
+
+        if (p_req->b_is_read && (i2c_bus_xfer.rx_idx < p_req->len))
+        {
+            p_req->p_data[i2c_bus_xfer.rx_idx++] = data;
+        }
+    }
+}
+
+/**
+ * @brief Ends the transaction on the bus, counters and backoff
+ *
+ * @param result
+ */
+static void i2c_bus_complete(I2C_BUS_RES_E result)
+{
+    I2C_BUS_REQ_T* p_req = i2c_bus_xfer.p_req;
+    I2C_BUS_DEV_T* p_dev = &i2c_bus_dev[p_req->dev];
+
+    switch (result)
+    {
+        case I2C_BUS_RES_OK_C:      p_dev->stats.ok++;      break;
+        case I2C_BUS_RES_NACK_C:    p_dev->stats.nack++;    break;
+        case I2C_BUS_RES_TIMEOUT_C: p_dev->stats.timeout++; break;
+        default:                    p_dev->stats.abort++;   break;
+    }
+
+    if (result == I2C_BUS_RES_OK_C)
+    {
+        p_dev->fails = 0;
+    }
+    else if (++p_dev->fails >= I2C_BUS_BACKOFF_AFTER_C)
+    {
+        uint8_t  shift      = MIN(p_dev->fails - I2C_BUS_BACKOFF_AFTER_C, 8);
+        uint32_t backoff_ms = MIN(I2C_BUS_BACKOFF_MIN_MS_C << shift, I2C_BUS_BACKOFF_MAX_MS_C);
+
+        p_dev->fails         = MIN(p_dev->fails, I2C_BUS_BACKOFF_AFTER_C + 8);
+        p_dev->backoff_until = make_timeout_time_ms(backoff_ms);
+    }
+
+    i2c_bus_xfer.p_req = NULL;
+    p_req->result      = result;
+
+    if (p_req->p_callback != NULL)
+    {
+        i2c_bus_done[i2c_bus_done_head] = p_req;
+        i2c_bus_done_head = (i2c_bus_done_head + 1) & I2C_BUS_QUEUE_MASK_C;
+
+        m_idle_wake(M_IDLE_WAKE_I2C_C);
+    }
+}
+
+/**
+ * @brief Resets the peripheral if the transaction on the bus overran
+ *
+ * A missing stop, i.e. a device stretching the clock for ever, would stall
+ * the queue otherwise
+ *
+ */
+static void i2c_bus_check_timeout(void)
+{
+    uint32_t save = save_and_disable_interrupts();
+
+    if ((i2c_bus_xfer.p_req != NULL) && time_reached(i2c_bus_xfer.deadline))
+    {
+        i2c_bus_configure();
+        i2c_bus_complete(I2C_BUS_RES_TIMEOUT_C);
+        i2c_bus_start_next();
+    }
+
+    restore_interrupts(save);
+}
+
+/*** END OF FILE ***/
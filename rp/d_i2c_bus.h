@@ -0,0 +1,95 @@
+/**
+ * @file      d_i2c_bus.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for shared I2C bus driver
+ *
+ */
+
+#ifndef _D_I2C_BUS_H_
+#define _D_I2C_BUS_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum I2C_BUS_DEV_E
+ * @brief Devices on the shared bus
+ *
+ */
+typedef enum {
+    I2C_BUS_DEV_IMU_C = 0,
+    I2C_BUS_DEV_MAG_C,
+    I2C_BUS_DEV_USBPD_C,
+    I2C_BUS_DEV_MAX_C
+} I2C_BUS_DEV_E;
+
+/**
+ * @enum I2C_BUS_RES_E
+ * @brief Transaction result
+ *
+ */
+typedef enum {
+    I2C_BUS_RES_OK_C = 0,
+    I2C_BUS_RES_PENDING_C,                                                      /* Queued or on the bus */
+    I2C_BUS_RES_NACK_C,                                                         /* Address or data not acknowledged */
+    I2C_BUS_RES_ABORT_C,                                                        /* Other abort, i.e. arbitration lost */
+    I2C_BUS_RES_TIMEOUT_C,                                                      /* No stop in time, peripheral reset */
+    I2C_BUS_RES_BACKOFF_C,                                                      /* Not queued, device backed off */
+    I2C_BUS_RES_FULL_C                                                          /* Not queued, queue full */
+} I2C_BUS_RES_E;
+
+typedef struct I2C_BUS_REQ_S I2C_BUS_REQ_T;
+
+/**
+ * @struct I2C_BUS_REQ_T
+ * @brief Transaction descriptor, a register address then data read or written
+ *
+ * Owned by the caller, it and its data must stay valid until the result is
+ * no longer pending
+ *
+ */
+struct I2C_BUS_REQ_S {
+    I2C_BUS_DEV_E   dev;
+    uint8_t         reg;                                                        /* Register address, first byte written */
+    bool            b_is_read;
+    uint16_t        len;
+    uint8_t*        p_data;
+    void            (*p_callback)(I2C_BUS_REQ_T* p_req);                        /* Called from i2c_bus_update(), may be NULL */
+    volatile I2C_BUS_RES_E result;
+};
+
+/**
+ * @struct I2C_BUS_STATS_T
+ * @brief Per device transaction counters
+ *
+ */
+typedef struct {
+    uint32_t ok;
+    uint32_t nack;
+    uint32_t abort;
+    uint32_t timeout;
+    uint32_t backoff;                                                           /* Refused while backed off */
+} I2C_BUS_STATS_T;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void i2c_bus_init(void);
+void i2c_bus_update(void);
+void i2c_bus_add_device(I2C_BUS_DEV_E dev, uint8_t addr, uint32_t baud);
+bool i2c_bus_submit(I2C_BUS_REQ_T* p_req);
+I2C_BUS_RES_E i2c_bus_xfer_blocking(I2C_BUS_DEV_E dev, uint8_t reg, bool b_is_read, uint8_t* p_data, uint16_t len);
+void i2c_bus_get_stats(I2C_BUS_DEV_E dev, I2C_BUS_STATS_T* p_stats);
+
+uint16_t i2c_bus_cmd_get_text(uint8_t* p_buf, uint16_t len);
+
+
+#endif /* _D_I2C_BUS_H_ */
+
+/*** END OF FILE ***/
@@ -0,0 +1,231 @@
+/**
+ * @file      d_sysclk.c
+ * @author    The OSLUV Project
+ * @brief     Driver for scaling the system clock with the UI load
+ *
+ * Modules vote for a clock level with sysclk_request(), a vote is held for
+ * SYSCLK_HOLD_MS_C and sysclk_update() runs the highest one still held, the
+ * low level when none. Raising is immediate, lowering waits for the hold so
+ * a render burst does not relock the PLL on every frame.
+ *
+ * clk_peri follows clk_sys, so every PWM, UART, SPI and I2C user registers a
+ * listener. A listener may defer the change while its peripheral is mid
+ * transfer, and recomputes its dividers once the clock has changed. The
+ * levels are multiples of 62.5 MHz so that the 1 MHz and 15.625 MHz PWM
+ * counters keep exact dividers.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <pico/stdlib.h>
+#include <hardware/clocks.h>
+#include <hardware/vreg.h>
+#include "d_sysclk.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define SYSCLK_MAX_LISTENERS_C      12
+#define SYSCLK_HOLD_MS_C            500                                         /* Vote lifetime */
+#define SYSCLK_VREG_SETTLE_US_C     1000                                        /* Core voltage raise before the PLL */
+#define SYSCLK_FAST_VREG_C          VREG_VOLTAGE_1_15                           /* Above 133 MHz */
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static const uint32_t   sysclk_level_khz[SYSCLK_LEVEL_MAX_C] = {
+    [SYSCLK_LEVEL_LOW_C]     = 62500,
+    [SYSCLK_LEVEL_NOMINAL_C] = 125000,
+    [SYSCLK_LEVEL_FAST_C]    = 187500,
+};
+
+static SYSCLK_LISTENER_T sysclk_listeners[SYSCLK_MAX_LISTENERS_C];
+static uint8_t          sysclk_listener_cnt = 0;
+
+static absolute_time_t  sysclk_vote_until[SYSCLK_LEVEL_MAX_C];
+static SYSCLK_LEVEL_E   sysclk_level = SYSCLK_LEVEL_NOMINAL_C;
+static uint32_t         sysclk_hz;
+
+static uint32_t         sysclk_switches = 0;
+static uint32_t         sysclk_deferred = 0;
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static bool sysclk_set_level(SYSCLK_LEVEL_E level);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief System clock driver initialization procedure
+ *
+ * Must run before any listener is added, the boot clock is the nominal level
+ *
+ */
+void sysclk_init(void)
+{
+    sysclk_hz    = clock_get_hz(clk_sys);
+    sysclk_level = SYSCLK_LEVEL_NOMINAL_C;
+
+    for (int idx = 0; idx < SYSCLK_LEVEL_MAX_C; idx++)
+    {
+        sysclk_vote_until[idx] = get_absolute_time();
+    }
+
+    sysclk_request(SYSCLK_LEVEL_NOMINAL_C);
+}
+
+/**
+ * @brief Switches to the highest level still voted for
+ *
+ * From the main loop only, never while a blocking transfer is running
+ *
+ */
+void sysclk_update(void)
+{
+    SYSCLK_LEVEL_E target = SYSCLK_LEVEL_LOW_C;
+
+    for (int idx = SYSCLK_LEVEL_MAX_C - 1; idx > SYSCLK_LEVEL_LOW_C; idx--)
+    {
+        if (!time_reached(sysclk_vote_until[idx]))
+        {
+            target = (SYSCLK_LEVEL_E)idx;
+            break;
+        }
+    }
+
+    if (target != sysclk_level)
+    {
+        sysclk_set_level(target);
+    }
+}
+
+/**
+ * @brief Registers a clock change listener
+ *
+ * @param p_listener Called on each change, see @ref SYSCLK_PHASE_E
+ * @return true Registered
+ * @return false Table full
+ */
+bool sysclk_add_listener(SYSCLK_LISTENER_T p_listener)
+{
+    if (sysclk_listener_cnt >= SYSCLK_MAX_LISTENERS_C)
+    {
+        return false;
+    }
+
+    sysclk_listeners[sysclk_listener_cnt++] = p_listener;
+
+    return true;
+}
+
+/**
+ * @brief Votes for a clock level for the next SYSCLK_HOLD_MS_C
+ *
+ * @param level @ref SYSCLK_LEVEL_E
+ */
+void sysclk_request(SYSCLK_LEVEL_E level)
+{
+    if (level < SYSCLK_LEVEL_MAX_C)
+    {
+        sysclk_vote_until[level] = make_timeout_time_ms(SYSCLK_HOLD_MS_C);
+    }
+}
+
+/**
+ * @brief Returns the current system clock
+ *
+ * @return uint32_t Hz
+ */
+uint32_t sysclk_get_hz(void)
+{
+    return sysclk_hz;
+}
+
+/**
+ * @brief Returns the PWM divider for a counter clock at the current level
+ *
+ * @param counter_hz PWM counter clock
+ * @return float Divider for pwm_config_set_clkdiv() / pwm_set_clkdiv()
+ */
+float sysclk_get_pwm_div(uint32_t counter_hz)
+{
+    return (float)sysclk_hz / (float)counter_hz;
+}
+
+/**
+ * @brief Gets the clock level and switch counters as text
+ *
+ * @param p_buf Text buffer
+ * @param len Buffer length
+ * @return uint16_t Text length
+ *
+ * @note This function can be called via external command
+ */
+uint16_t sysclk_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+    int text_len = snprintf((char*)p_buf, len, "%d,%lu,%lu,%lu",
+                            sysclk_level,
+                            (unsigned long)(sysclk_hz / 1000),
+                            (unsigned long)sysclk_switches,
+                            (unsigned long)sysclk_deferred);
+
+    return MIN(text_len, len - 1);
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Changes the system clock and notifies the listeners
+ *
+ * @param level @ref SYSCLK_LEVEL_E
+ * @return true Changed
+ * @return false Deferred by a listener or not reachable
+ */
+static bool sysclk_set_level(SYSCLK_LEVEL_E level)
+{
+    uint32_t khz = sysclk_level_khz[level];
+
+    for (int idx = 0; idx < sysclk_listener_cnt; idx++)
+    {
+        if (!sysclk_listeners[idx](SYSCLK_PHASE_PREPARE_C, khz * 1000))
+        {
+            sysclk_deferred++;
+            return false;
+        }
+    }
+
+    if (level == SYSCLK_LEVEL_FAST_C)
+    {
+        vreg_set_voltage(SYSCLK_FAST_VREG_C);
+        busy_wait_us(SYSCLK_VREG_SETTLE_US_C);
+    }
+
+    if (!set_sys_clock_khz(khz, false))
+    {
+        return false;
+    }
+
+    if (level != SYSCLK_LEVEL_FAST_C)
+    {
+        vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+    }
+
+    sysclk_level = level;
+    sysclk_hz    = clock_get_hz(clk_sys);
+    sysclk_switches++;
+
+    for (int idx = 0; idx < sysclk_listener_cnt; idx++)
+    {
+        sysclk_listeners[idx](SYSCLK_PHASE_CHANGED_C, sysclk_hz);
+    }
+
+    return true;
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,59 @@
+/**
+ * @file      d_sysclk.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for system clock scaling driver
+ *
+ */
+
+#ifndef _D_SYSCLK_H_
+#define _D_SYSCLK_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum SYSCLK_LEVEL_E
+ * @brief System clock levels, in increasing frequency
+ *
+ */
+typedef enum {
+    SYSCLK_LEVEL_LOW_C = 0,                                                     /* Display dark */
+    SYSCLK_LEVEL_NOMINAL_C,                                                     /* Display on, boot clock */
+    SYSCLK_LEVEL_FAST_C,                                                        /* LVGL rendering and flushing */
+    SYSCLK_LEVEL_MAX_C
+} SYSCLK_LEVEL_E;
+
+/**
+ * @enum SYSCLK_PHASE_E
+ * @brief Clock change phases reported to listeners
+ *
+ */
+typedef enum {
+    SYSCLK_PHASE_PREPARE_C = 0,                                                 /* Return false to defer the change */
+    SYSCLK_PHASE_CHANGED_C                                                      /* Recompute dividers, return ignored */
+} SYSCLK_PHASE_E;
+
+typedef bool (*SYSCLK_LISTENER_T)(SYSCLK_PHASE_E phase, uint32_t sys_hz);
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void sysclk_init(void);
+void sysclk_update(void);
+bool sysclk_add_listener(SYSCLK_LISTENER_T p_listener);
+void sysclk_request(SYSCLK_LEVEL_E level);
+uint32_t sysclk_get_hz(void);
+float sysclk_get_pwm_div(uint32_t counter_hz);
+
+uint16_t sysclk_cmd_get_text(uint8_t* p_buf, uint16_t len);
+
+
+#endif /* _D_SYSCLK_H_ */
+
+/*** END OF FILE ***/
@@ -3,7 +3,12 @@
  * @author    The OSLUV Project
  * @brief     Driver for external command's UART peripheral
  * @schematic lamp_controller.SchDoc
- *  
+ *
+ * Reception and transmission both go through circular buffers serviced by
+ * the UART interrupt. Sending only queues the data and tops up the TX FIFO,
+ * the TX interrupt drains the rest, so a reply never holds the main loop for
+ * its time on the wire.
+ *
  */
 
 
@@ -13,6 +18,8 @@
 #include <hardware/irq.h>
 #include <pico/stdlib.h>
 #include "d_uart_cmd.h"
+#include "m_idle.h"
+#include "d_sysclk.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
@@ -22,16 +29,22 @@
 #define UART_CMD_PORT_C             uart1
 #define UART_CMD_TX_PIN_C           9                                           /* UART_RX */
 #define UART_CMD_RX_PIN_C           8                                           /* UART_TX */
-#define UART_CMD_BAUDRATE_C         9600
+#define UART_CMD_DEF_BAUDRATE_C     9600                                        /* At power up and on link fallback */
 #define UART_CMD_IRQ_C              UART1_IRQ
 
 #define UART_CMD_BUF_MAX_DATA_LEN_C 1024
+#define UART_CMD_TX_BUF_LEN_C       1024
 
 #if (UART_CMD_BUF_MAX_DATA_LEN_C == 0) || \
     (UART_CMD_BUF_MAX_DATA_LEN_C & (UART_CMD_BUF_MAX_DATA_LEN_C - 1))
 #warning "UART commands reception buffer size is not a base 2 size as expected."
 #endif
 
+#if (UART_CMD_TX_BUF_LEN_C == 0) || \
+    (UART_CMD_TX_BUF_LEN_C & (UART_CMD_TX_BUF_LEN_C - 1))
+#warning "UART commands transmission buffer size is not a base 2 size as expected."
+#endif
+
 
 /* Global variables  ---------------------------------------------------------*/
 /* Private variables  --------------------------------------------------------*/
@@ -42,10 +55,21 @@ volatile struct {
     uint8_t  data[UART_CMD_BUF_MAX_DATA_LEN_C];
 } uart_cmd_buf;
 
+volatile struct {
+    uint16_t head;                                                              /* Written by the main loop */
+    uint16_t tail;                                                              /* Written by the TX interrupt */
+    uint8_t  data[UART_CMD_TX_BUF_LEN_C];
+} uart_cmd_tx_buf;
+
+static uint32_t uart_cmd_tx_dropped = 0;                                        /* Messages not queued, buffer full */
+static uint32_t uart_cmd_baudrate = UART_CMD_DEF_BAUDRATE_C;                    /* Requested */
+static uint32_t uart_cmd_actual_baudrate = UART_CMD_DEF_BAUDRATE_C;             /* From the divisor at the current clock */
+
 
 /* Callback prototypes -------------------------------------------------------*/
 
-static void __isr uart_cmd_rx_isr(void);
+static void __isr uart_cmd_isr(void);
+static bool uart_cmd_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz);
 
 
 /* Private function prototypes -----------------------------------------------*/
@@ -53,8 +77,10 @@ static void __isr uart_cmd_rx_isr(void);
 static inline void uart_cmd_put_char(uint8_t data);
 static inline char uart_cmd_get_char(void);
 static inline void uart_cmd_rx_flush(void);
-static inline void uart_cmd_enable_rx_isr(void);
-static inline void uart_cmd_disable_rx_isr(void);
+static inline void uart_cmd_tx_fill_fifo(void);
+static inline uint16_t uart_cmd_get_tx_used(void);
+static inline void uart_cmd_enable_isr(void);
+static inline void uart_cmd_disable_isr(void);
 
 
 /* Exported functions --------------------------------------------------------*/
@@ -65,10 +91,13 @@ static inline void uart_cmd_disable_rx_isr(void);
  */
 void uart_cmd_init(void)
 {
-    uart_cmd_buf.head = 0;
-    uart_cmd_buf.tail = 0;
+    uart_cmd_buf.head    = 0;
+    uart_cmd_buf.tail    = 0;
+    uart_cmd_tx_buf.head = 0;
+    uart_cmd_tx_buf.tail = 0;
 
-    uart_init(UART_CMD_PORT_C, UART_CMD_BAUDRATE_C);
+    uart_cmd_baudrate        = UART_CMD_DEF_BAUDRATE_C;
+    uart_cmd_actual_baudrate = uart_init(UART_CMD_PORT_C, uart_cmd_baudrate);
 
     gpio_set_function(UART_CMD_TX_PIN_C, GPIO_FUNC_UART);
     gpio_set_function(UART_CMD_RX_PIN_C, GPIO_FUNC_UART); 
@@ -79,25 +108,133 @@ void uart_cmd_init(void)
 
     uart_cmd_rx_flush();
 
-    irq_set_exclusive_handler(UART_CMD_IRQ_C, uart_cmd_rx_isr);
-    uart_cmd_enable_rx_isr();
+    irq_set_exclusive_handler(UART_CMD_IRQ_C, uart_cmd_isr);
+    uart_cmd_enable_isr();
 
     uart_set_irqs_enabled(UART_CMD_PORT_C, true, false);
+
+    sysclk_add_listener(uart_cmd_sysclk_callback);
 }
 
 /**
- * @brief Handles the sending of a required amount of data bytes through the 
- * commands UART peripheral
+ * @brief Queues data bytes to be sent through the commands UART peripheral
+ * 
+ * Never blocks. The data is queued whole or not at all, so a reply is never
+ * cut; producers streaming data should check uart_cmd_get_tx_free() first.
  * 
  * @param p_data_buf Data to send in bytes
  * @param data_len   Data bytes length to send
+ * @return uint16_t Data bytes length queued, 0 if the buffer is too full
  */
-void uart_cmd_send_data(uint8_t *p_data_buf, uint16_t data_len)
+uint16_t uart_cmd_send_data(uint8_t *p_data_buf, uint16_t data_len)
 {
+    uint16_t head;
+
+    if (data_len > uart_cmd_get_tx_free())
+    {
+        uart_cmd_tx_dropped++;
+
+        return 0;
+    }
+
+    head = uart_cmd_tx_buf.head;
+
     for (uint16_t idx = 0; idx < data_len; idx++)
     {
-        uart_putc_raw(UART_CMD_PORT_C, p_data_buf[idx]);
+        uart_cmd_tx_buf.data[head] = p_data_buf[idx];
+
+        head++;
+        head &= (UART_CMD_TX_BUF_LEN_C - 1);
     }
+
+    uart_cmd_disable_isr();
+
+    uart_cmd_tx_buf.head = head;
+
+    uart_cmd_tx_fill_fifo();                                                    /* TX interrupt only fires on FIFO level crossing */
+
+    uart_cmd_enable_isr();
+
+    return data_len;
+}
+
+/**
+ * @brief Returns how many data bytes can still be queued for sending
+ * 
+ * @return uint16_t Free space in the transmission buffer
+ */
+uint16_t uart_cmd_get_tx_free(void)
+{
+    return (UART_CMD_TX_BUF_LEN_C - 1) - uart_cmd_get_tx_used();
+}
+
+/**
+ * @brief Returns how many queued messages were dropped since boot
+ * 
+ * @return uint32_t Messages dropped for lack of transmission buffer space
+ */
+uint32_t uart_cmd_get_tx_dropped(void)
+{
+    return uart_cmd_tx_dropped;
+}
+
+/**
+ * @brief Switches the commands UART peripheral to another baud rate now
+ * 
+ * Whatever is still being sent or received is garbled, so callers wait for
+ * uart_cmd_is_tx_idle() first. The reception buffer is flushed.
+ * 
+ * @param baud Requested baud rate
+ * @return uint32_t Actual baud rate from the divisor
+ */
+uint32_t uart_cmd_set_baudrate(uint32_t baud)
+{
+    uart_cmd_disable_isr();
+
+    uart_cmd_baudrate        = baud;
+    uart_cmd_actual_baudrate = uart_set_baudrate(UART_CMD_PORT_C, baud);
+
+    uart_cmd_rx_flush();
+
+    uart_cmd_buf.tail = 0;
+    uart_cmd_buf.head = 0;
+
+    uart_cmd_enable_isr();
+
+    return uart_cmd_actual_baudrate;
+}
+
+/**
+ * @brief Returns the requested baud rate
+ * 
+ * @return uint32_t Baud rate
+ */
+uint32_t uart_cmd_get_baudrate(void)
+{
+    return uart_cmd_baudrate;
+}
+
+/**
+ * @brief Returns the baud rate actually produced by the divisor, it moves 
+ * with the system clock
+ * 
+ * @return uint32_t Baud rate
+ */
+uint32_t uart_cmd_get_actual_baudrate(void)
+{
+    return uart_cmd_actual_baudrate;
+}
+
+/**
+ * @brief Checks that everything queued has left the line
+ * 
+ * @return true Transmission buffer empty and the last character shifted out
+ * @return false
+ */
+bool uart_cmd_is_tx_idle(void)
+{
+    return (uart_cmd_get_tx_used() == 0) &&
+           !(uart_get_hw(UART_CMD_PORT_C)->fr & UART_UARTFR_BUSY_BITS);
 }
 
 /**
@@ -119,14 +256,14 @@ uint16_t uart_cmd_get_data(uint8_t *p_data_buf, uint16_t data_len)
             return count;
         }
 
-        uart_cmd_disable_rx_isr();
+        uart_cmd_disable_isr();
 
         p_data_buf[idx] = uart_cmd_buf.data[uart_cmd_buf.tail];
 
         uart_cmd_buf.tail++;
         uart_cmd_buf.tail &= (UART_CMD_BUF_MAX_DATA_LEN_C - 1);
 
-        uart_cmd_enable_rx_isr();
+        uart_cmd_enable_isr();
 
         count++;
     }
@@ -167,23 +304,23 @@ uint16_t uart_cmd_get_rcvd_data_len(void)
  */
 void uart_cmd_flush(void)
 {
-    uart_cmd_disable_rx_isr();
+    uart_cmd_disable_isr();
 
     uart_cmd_buf.tail = 0;
     uart_cmd_buf.head = 0;
 
-    uart_cmd_enable_rx_isr();
+    uart_cmd_enable_isr();
 }
 
 
 /* Callback functions --------------------------------------------------------*/
 
 /**
- * @brief UART peripheral receiving ISR. It puts received data on a local 
- * circular buffer
+ * @brief UART peripheral ISR. It puts received data on a local circular 
+ * buffer and moves queued data to the TX FIFO
  * 
  */
-static void __isr uart_cmd_rx_isr(void)
+static void __isr uart_cmd_isr(void)
 {
     while (uart_is_readable(UART_CMD_PORT_C)) 
     {
@@ -197,6 +334,33 @@ static void __isr uart_cmd_rx_isr(void)
             uart_cmd_buf.tail &= (UART_CMD_BUF_MAX_DATA_LEN_C - 1);
         }
     }
+
+    uart_cmd_tx_fill_fifo();
+
+    if (uart_cmd_buf.head != uart_cmd_buf.tail)
+    {
+        m_idle_wake(M_IDLE_WAKE_CMD_C);
+    }
+}
+
+/**
+ * @brief Keeps the baud rate across system clock changes
+ * 
+ * @param phase @ref SYSCLK_PHASE_E
+ * @param sys_hz New system clock
+ * @return true Ready / done
+ * @return false Still transmitting or data queued, defer the change
+ */
+static bool uart_cmd_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz)
+{
+    if (phase == SYSCLK_PHASE_PREPARE_C)
+    {
+        return uart_cmd_is_tx_idle();
+    }
+
+    uart_cmd_actual_baudrate = uart_set_baudrate(UART_CMD_PORT_C, uart_cmd_baudrate);
+
+    return true;
 }
 
 
@@ -240,19 +404,50 @@ static inline void uart_cmd_rx_flush(void)
 }
 
 /**
- * @brief Enables UART RX ISR
+ * @brief Moves queued data to the TX FIFO while it has room, the TX 
+ * interrupt is only left enabled while data remains queued
+ * 
+ * @note Called from the ISR or with the UART ISR disabled
+ */
+static inline void uart_cmd_tx_fill_fifo(void)
+{
+    while ((uart_cmd_tx_buf.tail != uart_cmd_tx_buf.head) &&
+           uart_is_writable(UART_CMD_PORT_C))
+    {
+        uart_cmd_put_char(uart_cmd_tx_buf.data[uart_cmd_tx_buf.tail]);
+
+        uart_cmd_tx_buf.tail++;
+        uart_cmd_tx_buf.tail &= (UART_CMD_TX_BUF_LEN_C - 1);
+    }
+
+    uart_set_irqs_enabled(UART_CMD_PORT_C, true, 
+                          (uart_cmd_tx_buf.tail != uart_cmd_tx_buf.head));
+}
+
+/**
+ * @brief Returns how many data bytes are queued for sending
+ * 
+ * @return uint16_t Data bytes length in the transmission buffer
+ */
+static inline uint16_t uart_cmd_get_tx_used(void)
+{
+    return (uart_cmd_tx_buf.head - uart_cmd_tx_buf.tail) & (UART_CMD_TX_BUF_LEN_C - 1);
+}
+
+/**
+ * @brief Enables UART ISR
  * 
  */
-static inline void uart_cmd_enable_rx_isr(void)
+static inline void uart_cmd_enable_isr(void)
 {
     irq_set_enabled(UART_CMD_IRQ_C, true);
 }
 
 /**
- * @brief Disables UART RX ISR
+ * @brief Disables UART ISR
  * 
  */
-static inline void uart_cmd_disable_rx_isr(void)
+static inline void uart_cmd_disable_isr(void)
 {
     irq_set_enabled(UART_CMD_IRQ_C, false);
 }
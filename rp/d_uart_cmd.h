@@ -12,13 +12,20 @@
 /* Exported includes ---------------------------------------------------------*/
 
 #include <stdint.h>
+#include <stdbool.h>
 
 
 /* Exported variables --------------------------------------------------------*/
 /* Exported functions prototypes ---------------------------------------------*/
 
 void uart_cmd_init(void);
-void uart_cmd_send_data(uint8_t *p_data_buf, uint16_t data_len);
+uint16_t uart_cmd_send_data(uint8_t *p_data_buf, uint16_t data_len);
+uint16_t uart_cmd_get_tx_free(void);
+uint32_t uart_cmd_get_tx_dropped(void);
+uint32_t uart_cmd_set_baudrate(uint32_t baud);
+uint32_t uart_cmd_get_baudrate(void);
+uint32_t uart_cmd_get_actual_baudrate(void);
+bool uart_cmd_is_tx_idle(void);
 uint16_t uart_cmd_get_data(uint8_t *p_data_buf, uint16_t data_len);
 uint16_t uart_cmd_get_rcvd_data_len(void);
 void uart_cmd_flush(void);
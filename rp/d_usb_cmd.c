@@ -0,0 +1,304 @@
+/**
+ * @file      d_usb_cmd.c
+ * @author    The OSLUV Project
+ * @brief     Driver for external commands over the USB CDC stdio port
+ *
+ * Commands share the USB CDC interface with the debug printf output, nothing
+ * else reads its input. Sending never blocks: replies are queued whole or not
+ * at all in a transmission buffer, and usb_cmd_update() moves them into the
+ * CDC FIFO as the host reads. A reply only starts once the FIFO can take it
+ * whole, so printf text does not land in the middle of it; only a reply
+ * longer than the FIFO may be split when the host is slow. A tool reads the
+ * debug text lines around ASCII replies, or picks binary frames out of it by
+ * their delimiter byte, which printf text never contains.
+ *
+ * If the host stops reading for USB_CMD_STALL_MS_C the queued replies are
+ * dropped, so a closed terminal does not keep the main loop awake.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <pico/stdlib.h>
+#include <pico/stdio_usb.h>
+#include <hardware/sync.h>
+#include "tusb.h"
+#include "d_usb_cmd.h"
+#include "m_idle.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define USB_CMD_RX_CHUNK_C          64                                          /* One full speed packet */
+#define USB_CMD_TX_BUF_LEN_C        1024
+#define USB_CMD_TX_MSGS_C           16                                          /* Queued replies */
+#define USB_CMD_CDC_FIFO_C          CFG_TUD_CDC_TX_BUFSIZE
+#define USB_CMD_DRAIN_MS_C          4                                           /* A FIFO is a few 1 ms frames */
+#define USB_CMD_STALL_MS_C          500                                         /* As the stdio USB output timeout */
+
+#if (USB_CMD_TX_BUF_LEN_C & (USB_CMD_TX_BUF_LEN_C - 1)) || \
+    (USB_CMD_TX_MSGS_C & (USB_CMD_TX_MSGS_C - 1))
+#warning "USB commands transmission buffers sizes are not base 2 sizes as expected."
+#endif
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static uint8_t  usb_cmd_rx_buf[USB_CMD_RX_CHUNK_C];                             /* Pulled from the CDC, not handled yet */
+static uint16_t usb_cmd_rx_len;
+static uint16_t usb_cmd_rx_idx;
+
+static struct {
+    uint16_t head;
+    uint16_t tail;
+    uint8_t  data[USB_CMD_TX_BUF_LEN_C];
+    uint16_t msg_len[USB_CMD_TX_MSGS_C];                                        /* Reply boundaries */
+    uint8_t  msg_head;
+    uint8_t  msg_tail;
+    uint16_t msg_left;                                                          /* Of the reply going out */
+} usb_cmd_tx_buf;
+
+static absolute_time_t usb_cmd_tx_progress;                                     /* Last time the host took data */
+static uint32_t        usb_cmd_tx_dropped = 0;                                  /* Replies not queued or flushed */
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static inline uint16_t usb_cmd_get_tx_used(void);
+static void usb_cmd_tx_flush(void);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief USB commands driver initialization procedure
+ *
+ * @note The CDC itself is brought up by stdio_init_all()
+ *
+ */
+void usb_cmd_init(void)
+{
+    usb_cmd_rx_len = 0;
+    usb_cmd_rx_idx = 0;
+
+    usb_cmd_tx_flush();
+}
+
+/**
+ * @brief Moves queued replies into the CDC FIFO, from the main loop
+ *
+ * The CDC is written with interrupts masked, the stdio USB background task
+ * runs from an interrupt and flushes the same FIFO.
+ *
+ */
+void usb_cmd_update(void)
+{
+    uint16_t used = usb_cmd_get_tx_used();
+
+    if (used == 0)
+    {
+        return;
+    }
+
+    if (!stdio_usb_connected() ||
+        (absolute_time_diff_us(usb_cmd_tx_progress, get_absolute_time()) > (USB_CMD_STALL_MS_C * 1000LL)))
+    {
+        usb_cmd_tx_flush();                                                     /* Nobody reading */
+        return;
+    }
+
+    uint32_t irq_status = save_and_disable_interrupts();
+    uint32_t room       = tud_cdc_write_available();
+    uint16_t sent       = 0;
+
+    while (used > 0)
+    {
+        if (usb_cmd_tx_buf.msg_left == 0)
+        {
+            uint16_t len = usb_cmd_tx_buf.msg_len[usb_cmd_tx_buf.msg_tail];
+
+            if (room < MIN(len, USB_CMD_CDC_FIFO_C))
+            {
+                break;                                                          /* Not whole, wait for the FIFO */
+            }
+
+            usb_cmd_tx_buf.msg_left = len;
+            usb_cmd_tx_buf.msg_tail = (usb_cmd_tx_buf.msg_tail + 1) & (USB_CMD_TX_MSGS_C - 1);
+        }
+
+        uint16_t chunk = MIN(usb_cmd_tx_buf.msg_left, USB_CMD_TX_BUF_LEN_C - usb_cmd_tx_buf.tail);
+
+        chunk = MIN(chunk, room);
+
+        if (chunk == 0)
+        {
+            break;
+        }
+
+        chunk = tud_cdc_write(&usb_cmd_tx_buf.data[usb_cmd_tx_buf.tail], chunk);
+
+        usb_cmd_tx_buf.tail      = (usb_cmd_tx_buf.tail + chunk) & (USB_CMD_TX_BUF_LEN_C - 1);
+        usb_cmd_tx_buf.msg_left -= chunk;
+        room                    -= chunk;
+        used                    -= chunk;
+        sent                    += chunk;
+    }
+
+    if (sent > 0)
+    {
+        tud_cdc_write_flush();
+
+        usb_cmd_tx_progress = get_absolute_time();
+    }
+
+    restore_interrupts(irq_status);
+
+    if (used > 0)
+    {
+        m_idle_wake_by(make_timeout_time_ms(USB_CMD_DRAIN_MS_C));
+    }
+}
+
+/**
+ * @brief Queues data bytes to be sent through the USB CDC port
+ *
+ * Never blocks. The data is queued whole or not at all, so a reply is never
+ * cut; producers streaming data should check usb_cmd_get_tx_free() first.
+ *
+ * @param p_data_buf Data to send in bytes
+ * @param data_len   Data bytes length to send
+ * @return uint16_t Data bytes length queued, 0 without a host or if the buffer is too full
+ */
+uint16_t usb_cmd_send_data(uint8_t *p_data_buf, uint16_t data_len)
+{
+    uint8_t msg_next = (usb_cmd_tx_buf.msg_head + 1) & (USB_CMD_TX_MSGS_C - 1);
+
+    if ((data_len == 0) ||
+        (data_len > usb_cmd_get_tx_free()) ||
+        (msg_next == usb_cmd_tx_buf.msg_tail))
+    {
+        usb_cmd_tx_dropped++;
+
+        return 0;
+    }
+
+    if (usb_cmd_get_tx_used() == 0)
+    {
+        usb_cmd_tx_progress = get_absolute_time();                              /* Stall timed from the first reply */
+    }
+
+    for (uint16_t idx = 0; idx < data_len; idx++)
+    {
+        usb_cmd_tx_buf.data[usb_cmd_tx_buf.head] = p_data_buf[idx];
+        usb_cmd_tx_buf.head = (usb_cmd_tx_buf.head + 1) & (USB_CMD_TX_BUF_LEN_C - 1);
+    }
+
+    usb_cmd_tx_buf.msg_len[usb_cmd_tx_buf.msg_head] = data_len;
+    usb_cmd_tx_buf.msg_head = msg_next;
+
+    usb_cmd_update();
+
+    return data_len;
+}
+
+/**
+ * @brief Returns how many data bytes can still be queued for sending
+ *
+ * @return uint16_t Free space in the transmission buffer, 0 without a host
+ */
+uint16_t usb_cmd_get_tx_free(void)
+{
+    if (!stdio_usb_connected())
+    {
+        return 0;
+    }
+
+    return (USB_CMD_TX_BUF_LEN_C - 1) - usb_cmd_get_tx_used();
+}
+
+/**
+ * @brief Checks that everything queued was handed to the CDC
+ *
+ * @return true Transmission buffer empty
+ * @return false
+ */
+bool usb_cmd_is_tx_idle(void)
+{
+    return usb_cmd_get_tx_used() == 0;
+}
+
+/**
+ * @brief Returns how many replies were dropped since boot
+ *
+ * @return uint32_t Replies not queued for lack of space, or flushed unread
+ */
+uint32_t usb_cmd_get_tx_dropped(void)
+{
+    return usb_cmd_tx_dropped;
+}
+
+/**
+ * @brief Handles data pull from the USB CDC port
+ *
+ * @param p_data_buf  Data buffer to deliver data
+ * @param data_len    Data bytes length to pull
+ * @return uint16_t Data bytes length pulled
+ */
+uint16_t usb_cmd_get_data(uint8_t *p_data_buf, uint16_t data_len)
+{
+    uint16_t count = 0;
+
+    while (count < data_len)
+    {
+        if (usb_cmd_rx_idx == usb_cmd_rx_len)
+        {
+            int rcvd = stdio_usb.in_chars((char*)usb_cmd_rx_buf, sizeof(usb_cmd_rx_buf));
+
+            usb_cmd_rx_idx = 0;
+            usb_cmd_rx_len = (rcvd > 0) ? rcvd : 0;
+
+            if (usb_cmd_rx_len == 0)
+            {
+                break;
+            }
+        }
+
+        p_data_buf[count++] = usb_cmd_rx_buf[usb_cmd_rx_idx++];
+    }
+
+    return count;
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Returns how many data bytes are queued for sending
+ *
+ * @return uint16_t
+ */
+static inline uint16_t usb_cmd_get_tx_used(void)
+{
+    return (usb_cmd_tx_buf.head - usb_cmd_tx_buf.tail) & (USB_CMD_TX_BUF_LEN_C - 1);
+}
+
+/**
+ * @brief Drops whatever is queued for sending
+ *
+ */
+static void usb_cmd_tx_flush(void)
+{
+    if (usb_cmd_tx_buf.msg_head != usb_cmd_tx_buf.msg_tail)
+    {
+        usb_cmd_tx_dropped += (usb_cmd_tx_buf.msg_head - usb_cmd_tx_buf.msg_tail) & (USB_CMD_TX_MSGS_C - 1);
+    }
+
+    usb_cmd_tx_buf.head     = 0;
+    usb_cmd_tx_buf.tail     = 0;
+    usb_cmd_tx_buf.msg_head = 0;
+    usb_cmd_tx_buf.msg_tail = 0;
+    usb_cmd_tx_buf.msg_left = 0;
+}
+
+/*** END OF FILE ***/
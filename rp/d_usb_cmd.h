@@ -0,0 +1,31 @@
+/**
+ * @file      d_usb_cmd.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for external command's USB CDC driver
+ *
+ */
+
+#ifndef _D_USB_CMD_H_
+#define _D_USB_CMD_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void usb_cmd_init(void);
+void usb_cmd_update(void);
+uint16_t usb_cmd_send_data(uint8_t *p_data_buf, uint16_t data_len);
+uint16_t usb_cmd_get_tx_free(void);
+bool usb_cmd_is_tx_idle(void);
+uint32_t usb_cmd_get_tx_dropped(void);
+uint16_t usb_cmd_get_data(uint8_t *p_data_buf, uint16_t data_len);
+
+
+#endif /* _D_USB_CMD_H_ */
+
+/*** END OF FILE ***/
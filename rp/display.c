@@ -19,6 +19,7 @@
 #include <lvgl.h>
 #include "pins.h"
 #include "buttons.h"
+#include "d_sysclk.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
@@ -27,7 +28,9 @@
 #define DISPLAY_LCD_WIDTH_C 				240
 #define DISPLAY_LCD_HEIGHT_C 				240
 #define DISPLAY_LCD_SPI_PORT_C 				spi0
+#define DISPLAY_LCD_SPI_BAUD_C 				(64 * 1000 * 1000)					/* Upper bound, clk_peri / 2 at most */
 #define DISPLAY_BACKLIGHT_WRAP_C           	1000      							/* Counter counts 0…1000  (≈1 kHz) */
+#define DISPLAY_BACKLIGHT_CLOCK_HZ_C 		(1000 * 1000)						/* PWM counter clock */
 #define DISPLAY_BACKLIGHT_MAX_BRIGHTNESS_C 	100       							/* User-facing range 0-100 */
 #define DISPLAY_STARTUP_BRIGHTNESS_C		0									/* In percentage (%) */
 #define DISPLAY_TURN_ON_BRIGHTNESS_C		33
@@ -50,6 +53,8 @@ lv_group_t * the_group;
 
 uint32_t display_lvgl_tick_callback(void);
 void display_read_keypad_callback(lv_indev_t * p_indev, lv_indev_data_t * p_data);
+static void display_invalidate_callback(lv_event_t* p_event);
+static bool display_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz);
 
 
 /* Private function prototypes -----------------------------------------------*/
@@ -92,7 +97,7 @@ void display_init(void)
 	gpio_set_dir(PIN_LCD_DC, GPIO_OUT);
 	gpio_put(PIN_LCD_DC, 1);
 
-	spi_init(DISPLAY_LCD_SPI_PORT_C, 64 * 1000 * 1000);
+	spi_init(DISPLAY_LCD_SPI_PORT_C, DISPLAY_LCD_SPI_BAUD_C);
 	gpio_set_function(PIN_LCD_MOSI, GPIO_FUNC_SPI);
 	gpio_set_function(PIN_LCD_SCK, GPIO_FUNC_SPI);
 	display_driver_config_spi(8);
@@ -119,6 +124,7 @@ void display_init(void)
 	
 	display_send_cmd(disp, &invon, 1, NULL, 0);
 	lv_display_set_rotation(disp, LV_DISPLAY_ROTATION_0);
+	lv_display_add_event_cb(disp, display_invalidate_callback, LV_EVENT_INVALIDATE_AREA, NULL);
 	lv_display_set_buffers(disp, 
 						   display_draw_buffer,
 						   NULL, 
@@ -128,6 +134,8 @@ void display_init(void)
 	indev_keypad = lv_indev_create();
     lv_indev_set_type(indev_keypad, LV_INDEV_TYPE_KEYPAD);
     lv_indev_set_read_cb(indev_keypad, display_read_keypad_callback);
+
+	sysclk_add_listener(display_sysclk_callback);
 }
 
 /**
@@ -205,43 +213,79 @@ uint32_t display_lvgl_tick_callback(void)
 }
 
 
+/**
+ * @brief Keypad input device read, one button event per call
+ * 
+ * LVGL is asked to read again while events are queued, so a press and its 
+ * release in the same frame both get through. Without events the last key 
+ * keeps its state.
+ * 
+ * @param p_indev_drv Not used
+ * @param p_data Key and state
+ */
 void display_read_keypad_callback(lv_indev_t * p_indev_drv, lv_indev_data_t * p_data)
 {
-	static int last_key = 0;
-
-	if (g_buttons_down)
+	static const uint8_t key_map[5] = {
+		LV_KEY_PREV,      /* bit 0  (BUTTON_UP)     */
+		LV_KEY_NEXT,      /* bit 1  (BUTTON_DOWN)   */
+		LV_KEY_LEFT,      /* bit 2  (BUTTON_LEFT)   */
+		LV_KEY_RIGHT,     /* bit 3  (BUTTON_RIGHT)  */
+		LV_KEY_ENTER      /* bit 4  (BUTTON_CENTER) */
+	};
+	static int 			   last_key   = 0;
+	static lv_indev_state_t last_state = LV_INDEV_STATE_RELEASED;
+	BUTTONS_EVENT_T 	   event;
+
+	if (buttons_get_key_event(&event))
 	{
 		int bit = 0;
-		while (bit < 5)
+		while ((bit < 5) && !(event.button & (1 << bit)))
 		{
-			if (g_buttons_down & (1 << bit))
-			{
-				break;
-			}
 			bit++;
 		}
 
-		p_data->state = LV_INDEV_STATE_PRESSED;
+		last_key   = key_map[bit % 5];
+		last_state = event.b_is_down ? LV_INDEV_STATE_PRESSED : LV_INDEV_STATE_RELEASED;
 
-		static const uint8_t key_map[5] = {
-			LV_KEY_PREV,      /* bit 2  (BUTTON_UP)     */
-			LV_KEY_NEXT,      /* bit 3  (BUTTON_DOWN)   */
-			LV_KEY_LEFT,      /* bit 0  (BUTTON_LEFT)   */
-			LV_KEY_RIGHT,     /* bit 1  (BUTTON_RIGHT)  */
-			LV_KEY_ENTER      /* bit 4  (BUTTON_CENTER) */
-		};
+		p_data->continue_reading = true;
+	}
 
-		last_key = key_map[bit];
+	p_data->state = last_state;
+	p_data->key   = last_key;
+}
 
-		// printf("Produce PRESSED %d\n", last_key);
-	}
-	else
+/**
+ * @brief Votes for the fast system clock while LVGL has areas to redraw
+ * 
+ * The vote is held long enough to cover the render and flush that follow
+ * 
+ * @param p_event Not used
+ */
+static void display_invalidate_callback(lv_event_t* p_event)
+{
+	sysclk_request(SYSCLK_LEVEL_FAST_C);
+}
+
+/**
+ * @brief Keeps the backlight PWM frequency and the SPI clock across system 
+ * clock changes
+ * 
+ * Flushes are blocking, so the SPI is idle whenever the clock changes
+ * 
+ * @param phase @ref SYSCLK_PHASE_E
+ * @param sys_hz New system clock
+ * @return true Never defers
+ */
+static bool display_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz)
+{
+	if (phase == SYSCLK_PHASE_CHANGED_C)
 	{
-		p_data->state = LV_INDEV_STATE_RELEASED;
-		// printf("Produce RELEASED %d\n", last_key);
+		pwm_set_clkdiv(pwm_gpio_to_slice_num(PIN_LCD_BACKLIGHT), 
+					   sysclk_get_pwm_div(DISPLAY_BACKLIGHT_CLOCK_HZ_C));
+		spi_set_baudrate(DISPLAY_LCD_SPI_PORT_C, DISPLAY_LCD_SPI_BAUD_C);
 	}
 
-	p_data->key = last_key;
+	return true;
 }
 
 
@@ -262,8 +306,8 @@ static void display_set_init_config(void)
 
     pwm_cfg = pwm_get_default_config();
 
-    /* 125 MHz / 125 = 1 MHz → 1 MHz / (DISPLAY_BACKLIGHT_WRAP_C+1) ≈ 999 Hz */
-    pwm_config_set_clkdiv(&pwm_cfg, 125.0f);
+    /* 1 MHz / (DISPLAY_BACKLIGHT_WRAP_C+1) ≈ 999 Hz, whatever the system clock */
+    pwm_config_set_clkdiv(&pwm_cfg, sysclk_get_pwm_div(DISPLAY_BACKLIGHT_CLOCK_HZ_C));
 
     pwm_init(slice, &pwm_cfg, false);
     pwm_set_wrap(slice, DISPLAY_BACKLIGHT_WRAP_C);
@@ -12,12 +12,14 @@
 #include <hardware/pwm.h>
 #include <hardware/gpio.h>
 #include "pins.h"
+#include "d_sysclk.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 
 #define FAN_STEPCOUNT_C		1000
+#define FAN_PWM_CLOCK_HZ_C	(1000*1000)											/* Counter clock, 1 kHz with FAN_STEPCOUNT_C */
 
 
 /* Global variables  ---------------------------------------------------------*/
@@ -26,6 +28,11 @@
 static int fan_curr_speed = 0;
 
 
+/* Callback prototypes -------------------------------------------------------*/
+
+static bool fan_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz);
+
+
 /* Private function prototypes -----------------------------------------------*/
 /* Exported functions --------------------------------------------------------*/
 
@@ -42,7 +49,7 @@ void fan_init(void)
 
 	pwm_config config = pwm_get_default_config();
     // Set divider, reduces counter clock to sysclock/this value
-    pwm_config_set_clkdiv(&config, 125);
+    pwm_config_set_clkdiv(&config, sysclk_get_pwm_div(FAN_PWM_CLOCK_HZ_C));
 
     pwm_config_set_wrap(&config, FAN_STEPCOUNT_C); // 1kHz
 
@@ -52,6 +59,8 @@ void fan_init(void)
     pwm_set_gpio_level(PIN_FAN_PWM, 0);
 
     pwm_set_enabled(slice_num, true);
+
+    sysclk_add_listener(fan_sysclk_callback);
 }
 
 /**
@@ -88,6 +97,25 @@ int fan_get_speed(void)
 }
 
 
+/* Callback functions --------------------------------------------------------*/
+
+/**
+ * @brief Keeps the fan PWM frequency across system clock changes
+ * 
+ * @param phase @ref SYSCLK_PHASE_E
+ * @param sys_hz New system clock
+ * @return true Never defers
+ */
+static bool fan_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz)
+{
+	if (phase == SYSCLK_PHASE_CHANGED_C)
+	{
+		pwm_set_clkdiv(pwm_gpio_to_slice_num(PIN_FAN_PWM), sysclk_get_pwm_div(FAN_PWM_CLOCK_HZ_C));
+	}
+
+	return true;
+}
+
 /* Private functions ---------------------------------------------------------*/
 
 /*** END OF FILE ***/
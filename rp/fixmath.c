@@ -0,0 +1,186 @@
+/**
+ * @file      fixmath.c
+ * @author    The OSLUV Project
+ * @brief     Fixed-point helpers for sensor math
+ *
+ * The arccosine is built from an arcsine table over [0, 0.75]: near +/-1 the
+ * arccosine slope is unbounded and a direct table would be coarse there, so
+ * acos(x) = asin(sqrt(1 - x^2)) is used above 1/sqrt(2) instead.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "fixmath.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define FIXMATH_ASIN_STEP_BITS_C	9											/* Q15 input step of 1/64 */
+#define FIXMATH_ASIN_LAST_C			48											/* Table covers [0, 48/64] */
+#define FIXMATH_COS45_Q15_C			23170										/* 1/sqrt(2) */
+
+#if defined(_FIXMATH_ENABLE_BENCH_)
+#include <stdio.h>
+#include <math.h>
+#include <pico/stdlib.h>
+#include <hardware/clocks.h>
+#endif
+
+
+/* Private variables  --------------------------------------------------------*/
+
+/* asin(i/64) in centidegrees */
+static const uint16_t fixmath_asin_lut[FIXMATH_ASIN_LAST_C + 1] = {
+        0,    90,   179,   269,   358,   448,   538,   628,
+      718,   808,   899,   990,  1081,  1172,  1264,  1355,
+     1448,  1540,  1633,  1727,  1821,  1916,  2011,  2106,
+     2202,  2299,  2397,  2495,  2594,  2694,  2795,  2897,
+     3000,  3104,  3209,  3315,  3423,  3532,  3642,  3754,
+     3868,  3984,  4101,  4221,  4343,  4468,  4595,  4725,
+     4859,
+};
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static int32_t fixmath_asin_cdeg(int32_t sin_q15);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Integer square root, rounded down
+ *
+ * @param value
+ * @return uint32_t
+ */
+uint32_t fixmath_isqrt(uint32_t value)
+{
+	uint32_t root = 0;
+	uint32_t bit  = 1UL << 30;
+
+	while (bit > value)
+	{
+		bit >>= 2;
+	}
+
+	while (bit != 0)
+	{
+		if (value >= root + bit)
+		{
+			value -= root + bit;
+			root   = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+/**
+ * @brief Arccosine in centidegrees
+ *
+ * @param cos_q15 Cosine, Q15, clamped to [-1, 1]
+ * @return int32_t 0 to 18000
+ */
+int32_t fixmath_acos_cdeg(int32_t cos_q15)
+{
+	int32_t abs_q15 = (cos_q15 < 0) ? -cos_q15 : cos_q15;
+	int32_t angle;
+
+	if (abs_q15 > FIXMATH_Q15_ONE_C)
+	{
+		abs_q15 = FIXMATH_Q15_ONE_C;
+	}
+
+	if (abs_q15 <= FIXMATH_COS45_Q15_C)
+	{
+		angle = 9000 - fixmath_asin_cdeg(abs_q15);
+	}
+	else
+	{
+		uint32_t one_q30 = (uint32_t)FIXMATH_Q15_ONE_C * FIXMATH_Q15_ONE_C;
+
+		angle = fixmath_asin_cdeg(fixmath_isqrt(one_q30 - (uint32_t)(abs_q15 * abs_q15)));
+	}
+
+	return (cos_q15 < 0) ? (18000 - angle) : angle;
+}
+
+#if defined(_FIXMATH_ENABLE_BENCH_)
+/**
+ * @brief Checks the fixed-point paths against float and times both
+ *
+ * Prints the worst arccosine error and the cost per call in system clock
+ * cycles
+ *
+ * @return 	void
+ */
+void fixmath_bench(void)
+{
+	const int 		  loops = 1000;
+	volatile int32_t  sink_i = 0;
+	volatile float 	  sink_f = 0;
+	int32_t 		  max_err_cdeg = 0;
+	uint32_t 		  cycles_per_us = clock_get_hz(clk_sys) / (1000 * 1000);
+
+	for (int32_t cos_q15 = -FIXMATH_Q15_ONE_C; cos_q15 <= FIXMATH_Q15_ONE_C; cos_q15 += 7)
+	{
+		int32_t ref_cdeg = acosf(cos_q15 / (float)FIXMATH_Q15_ONE_C) * (18000.f / (float)M_PI);
+		int32_t err_cdeg = fixmath_acos_cdeg(cos_q15) - ref_cdeg;
+
+		max_err_cdeg = MAX(max_err_cdeg, (err_cdeg < 0) ? -err_cdeg : err_cdeg);
+	}
+
+	uint32_t start_us = time_us_32();
+	for (int idx = 0; idx < loops; idx++)
+	{
+		sink_f = acosf(sinf(idx) * 0.999f);
+	}
+	uint32_t float_us = time_us_32() - start_us;
+
+	start_us = time_us_32();
+	for (int idx = 0; idx < loops; idx++)
+	{
+		sink_i = fixmath_acos_cdeg(((idx * 97) & 0xffff) - FIXMATH_Q15_ONE_C);
+	}
+	uint32_t fixed_us = time_us_32() - start_us;
+
+	printf("fixmath: acos max err %d cdeg, float %lu cycles, fixed %lu cycles\n",
+		   max_err_cdeg,
+		   (unsigned long)(float_us * cycles_per_us / loops),
+		   (unsigned long)(fixed_us * cycles_per_us / loops));
+}
+#endif
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Arcsine in centidegrees, table interpolation
+ *
+ * @param sin_q15 Sine, Q15, 0 to 0.75
+ * @return int32_t
+ */
+static int32_t fixmath_asin_cdeg(int32_t sin_q15)
+{
+	int32_t idx  = sin_q15 >> FIXMATH_ASIN_STEP_BITS_C;
+	int32_t frac = sin_q15 & ((1 << FIXMATH_ASIN_STEP_BITS_C) - 1);
+
+	if (idx >= FIXMATH_ASIN_LAST_C)
+	{
+		return fixmath_asin_lut[FIXMATH_ASIN_LAST_C];
+	}
+
+	return fixmath_asin_lut[idx] +
+		   (((fixmath_asin_lut[idx + 1] - fixmath_asin_lut[idx]) * frac) >> FIXMATH_ASIN_STEP_BITS_C);
+}
+
+/*** END OF FILE ***/
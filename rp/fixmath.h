@@ -0,0 +1,59 @@
+/**
+ * @file      fixmath.h
+ * @author    The OSLUV Project
+ * @brief     Fixed-point helpers for sensor math
+ *
+ * The RP2040 cores have no FPU, so the periodic sensor paths keep integer
+ * units (mV, mg) and Qn fractions instead of float. Qn means n fractional
+ * bits, i.e. Q15 1.0 is 32768.
+ *
+ */
+
+#ifndef _FIXMATH_H_
+#define _FIXMATH_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+
+
+/* Exported defines ----------------------------------------------------------*/
+
+//#define _FIXMATH_ENABLE_BENCH_												/* Boot time check against float */
+
+#define FIXMATH_Q8_ONE_C		(1 << 8)
+#define FIXMATH_Q15_ONE_C		(1 << 15)
+
+#define FIXMATH_TO_Q8(value)	((int32_t)(value) * FIXMATH_Q8_ONE_C)
+#define FIXMATH_FROM_Q8(value)	((int32_t)(value) / FIXMATH_Q8_ONE_C)
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+uint32_t fixmath_isqrt(uint32_t value);
+int32_t fixmath_acos_cdeg(int32_t cos_q15);
+#if defined(_FIXMATH_ENABLE_BENCH_)
+void fixmath_bench(void);
+#endif
+
+
+/* Exported inline functions -------------------------------------------------*/
+
+/**
+ * @brief One-pole low-pass, y[n] = y[n-1] + alpha * (x[n] - y[n-1])
+ *
+ * @param y_q8 Previous output, Q8
+ * @param x Input, same unit as the output integer part
+ * @param alpha_q8 Filter coefficient, Q8
+ * @return int32_t New output, Q8
+ */
+static inline int32_t fixmath_lpf_q8(int32_t y_q8, int32_t x, int32_t alpha_q8)
+{
+	return y_q8 + (((FIXMATH_TO_Q8(x) - y_q8) * alpha_q8) / FIXMATH_Q8_ONE_C);
+}
+
+
+#endif /* _FIXMATH_H_ */
+
+/*** END OF FILE ***/
@@ -0,0 +1,141 @@
+/*
+ * fixmath_test.c — Host checks for the fixed-point helpers in fixmath.c,
+ *                  against the C library float math.
+ *
+ * Build:  cc -o fixmath_test rp/fixmath_test.c rp/fixmath.c -lm
+ *
+ * Usage:  ./fixmath_test      (exit status 0 when every check passes)
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fixmath.h"
+
+#define ACOS_MAX_ERR_CDEG 3  /* Table interpolation plus the integer sqrt */
+
+static int failures;
+
+#define CHECK(cond, ...)                    \
+    do {                                    \
+        if (!(cond)) {                      \
+            printf("FAIL: " __VA_ARGS__);   \
+            printf("\n");                   \
+            failures++;                     \
+        }                                   \
+    } while (0)
+
+/* ------------------------------------------------------------------ */
+/* Checks                                                             */
+/* ------------------------------------------------------------------ */
+
+/* floor(sqrt(v)), exact for every 32-bit value. */
+static uint32_t ref_isqrt(uint32_t v)
+{
+    uint64_t r = (uint64_t)sqrt((double)v);
+
+    while (r * r > v)
+        r--;
+    while ((r + 1) * (r + 1) <= v)
+        r++;
+
+    return (uint32_t)r;
+}
+
+static void test_isqrt(void)
+{
+    static const uint32_t edges[] = {
+        0, 1, 2, 3, 4, 15, 16, 17, 65535, 65536, 1u << 30,
+        (1u << 30) - 1, 0xfffe0001u, 0xfffe0000u, 0xffffffffu,
+    };
+
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+        CHECK(fixmath_isqrt(edges[i]) == ref_isqrt(edges[i]),
+              "isqrt(%lu) = %lu, expected %lu", (unsigned long)edges[i],
+              (unsigned long)fixmath_isqrt(edges[i]),
+              (unsigned long)ref_isqrt(edges[i]));
+
+    /* Every square and its neighbours, then a stride over the full range. */
+    for (uint32_t r = 1; r < 65536; r++) {
+        uint32_t sq = r * r;
+
+        CHECK(fixmath_isqrt(sq) == r, "isqrt(%lu^2)", (unsigned long)r);
+        CHECK(fixmath_isqrt(sq - 1) == r - 1, "isqrt(%lu^2 - 1)",
+              (unsigned long)r);
+    }
+
+    for (uint64_t v = 0; v <= 0xffffffffu; v += 65521)
+        CHECK(fixmath_isqrt((uint32_t)v) == ref_isqrt((uint32_t)v),
+              "isqrt(%lu)", (unsigned long)v);
+}
+
+static void test_acos(void)
+{
+    int32_t max_err = 0;
+
+    for (int32_t c = -FIXMATH_Q15_ONE_C; c <= FIXMATH_Q15_ONE_C; c++) {
+        int32_t ref = (int32_t)lround(acos(c / (double)FIXMATH_Q15_ONE_C) *
+                                      (18000.0 / M_PI));
+        int32_t got = fixmath_acos_cdeg(c);
+        int32_t err = (got > ref) ? got - ref : ref - got;
+
+        if (err > max_err)
+            max_err = err;
+    }
+
+    printf("acos max err %ld cdeg\n", (long)max_err);
+    CHECK(max_err <= ACOS_MAX_ERR_CDEG, "acos max err %ld cdeg over %d",
+          (long)max_err, ACOS_MAX_ERR_CDEG);
+
+    /* Exact end points, and inputs past +/-1 clamp to them. */
+    CHECK(fixmath_acos_cdeg(FIXMATH_Q15_ONE_C) == 0, "acos(1)");
+    CHECK(fixmath_acos_cdeg(-FIXMATH_Q15_ONE_C) == 18000, "acos(-1)");
+    CHECK(fixmath_acos_cdeg(0) == 9000, "acos(0)");
+    CHECK(fixmath_acos_cdeg(FIXMATH_Q15_ONE_C + 1000) == 0, "acos(>1)");
+    CHECK(fixmath_acos_cdeg(-FIXMATH_Q15_ONE_C - 1000) == 18000, "acos(<-1)");
+
+    /* Monotonic, decreasing over the whole input range. */
+    for (int32_t c = -FIXMATH_Q15_ONE_C; c < FIXMATH_Q15_ONE_C; c++)
+        CHECK(fixmath_acos_cdeg(c + 1) <= fixmath_acos_cdeg(c),
+              "acos not monotonic at %ld", (long)c);
+}
+
+static void test_lpf(void)
+{
+    int32_t y = 0;
+
+    /* A step settles on the input, from above and from below. */
+    for (int i = 0; i < 200; i++)
+        y = fixmath_lpf_q8(y, 1000, FIXMATH_Q8_ONE_C / 8);
+    CHECK(FIXMATH_FROM_Q8(y) >= 999 && FIXMATH_FROM_Q8(y) <= 1000,
+          "lpf step up settled at %ld", (long)FIXMATH_FROM_Q8(y));
+
+    for (int i = 0; i < 200; i++)
+        y = fixmath_lpf_q8(y, -1000, FIXMATH_Q8_ONE_C / 8);
+    CHECK(FIXMATH_FROM_Q8(y) >= -1000 && FIXMATH_FROM_Q8(y) <= -999,
+          "lpf step down settled at %ld", (long)FIXMATH_FROM_Q8(y));
+
+    /* Alpha of one passes the input straight through. */
+    CHECK(fixmath_lpf_q8(y, 1234, FIXMATH_Q8_ONE_C) == FIXMATH_TO_Q8(1234),
+          "lpf alpha 1");
+}
+
+/* ------------------------------------------------------------------ */
+/* Main                                                               */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    test_isqrt();
+    test_acos();
+    test_lpf();
+
+    if (failures) {
+        printf("fixmath_test: %d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("fixmath_test: all checks passed\n");
+    return 0;
+}
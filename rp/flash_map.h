@@ -0,0 +1,41 @@
+/**
+ * @file      flash_map.h
+ * @author    The OSLUV Project
+ * @brief     Layout of the data regions at the end of the flash
+ *
+ * Regions grow downwards from the end of the flash, away from the image.
+ * Offsets are relative to the flash start, as used by flash_range_erase/program.
+ * The single sector persistance region is only read once, to migrate it into
+ * the persistance log.
+ *
+ */
+
+#ifndef _FLASH_MAP_H_
+#define _FLASH_MAP_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <hardware/flash.h>
+
+
+/* Exported defines ----------------------------------------------------------*/
+
+#define FLASH_MAP_PERSISTANCE_SIZE_C	FLASH_SECTOR_SIZE
+#define FLASH_MAP_PERSISTANCE_OFFSET_C	(PICO_FLASH_SIZE_BYTES - FLASH_MAP_PERSISTANCE_SIZE_C)
+
+#define FLASH_MAP_LAMP_STATS_SIZE_C		(2 * FLASH_SECTOR_SIZE)
+#define FLASH_MAP_LAMP_STATS_OFFSET_C	(FLASH_MAP_PERSISTANCE_OFFSET_C - FLASH_MAP_LAMP_STATS_SIZE_C)
+
+#define FLASH_MAP_PERSISTANCE_LOG_SIZE_C	(4 * FLASH_SECTOR_SIZE)
+#define FLASH_MAP_PERSISTANCE_LOG_OFFSET_C	(FLASH_MAP_LAMP_STATS_OFFSET_C - FLASH_MAP_PERSISTANCE_LOG_SIZE_C)
+
+#define FLASH_MAP_BLACKBOX_SIZE_C		(4 * FLASH_SECTOR_SIZE)
+#define FLASH_MAP_BLACKBOX_OFFSET_C		(FLASH_MAP_PERSISTANCE_LOG_OFFSET_C - FLASH_MAP_BLACKBOX_SIZE_C)
+
+#define FLASH_MAP_DATA_START_C			FLASH_MAP_BLACKBOX_OFFSET_C				/* Lowest address used for data */
+
+
+#endif /* _FLASH_MAP_H_ */
+
+/*** END OF FILE ***/
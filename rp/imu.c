@@ -5,19 +5,34 @@
  * @hwref     U7 (LIS3DHTR)
  * @schematic lamp_controller.SchDoc
  *  
+ * The device samples into its FIFO (stream mode) and the samples are drained 
+ * in batches, so the tilt filter runs at the true sample rate whatever the 
+ * main loop timing. The batch is signalled by the FIFO watermark on INT1 when 
+ * PIN_IMU_INT1 is defined in pins.h, otherwise it is due every batch period.
+ * 
+ * The inertial wake-up (IA1, high-passed) and 6D orientation (IA2) engines 
+ * flag bumps and re-aiming. Either one switches the device to the fast rate, 
+ * drains the FIFO at once and raises a motion event for the main loop; after 
+ * IMU_IDLE_MS_C without motion the device drops back to the slow rate. Both 
+ * are routed to INT1 and latched, without the pin their sources are polled.
+ * 
+ * The periodic reads are queued on the shared bus and handled on completion, 
+ * so a missing device does not hold up the main loop.
+ *  
  */
 
 
 /* Includes ------------------------------------------------------------------*/
 
-#include <hardware/i2c.h>
 #include <pico/stdlib.h>
 
 #include <stdio.h>
 #include <stdint.h>
-#include <math.h>
 
 #include "pins.h"
+#include "fixmath.h"
+#include "d_i2c_bus.h"
+#include "m_idle.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
@@ -26,7 +41,7 @@
 //#define _IMU_ENABLE_ADC_
 
 #define IMU_IC_ADDR_C           0x19
-#define IMU_I2C_PORT_C          I2C_INST
+#define IMU_I2C_BAUD_C          (400*1000)                                      /* Fast mode, all devices on the bus support it */
 #define IMU_REG_OUT_ADC1_L_C    0x08
 #define IMU_REG_OUT_ADC1_H_C    0x09
 #define IMU_REG_OUT_ADC2_L_C    0x0A
@@ -34,24 +49,101 @@
 #define IMU_REG_OUT_ADC3_L_C    0x0C
 #define IMU_REG_OUT_ADC3_H_C    0x0D
 #define IMU_REG_CTRL_REG_1_C    0x20
+#define IMU_REG_CTRL_REG_2_C    0x21
+#define IMU_REG_CTRL_REG_3_C    0x22
 #define IMU_REG_CTRL_REG_4_C    0x23
+#define IMU_REG_CTRL_REG_5_C    0x24
 #define IMU_REG_TEMP_CFG_REG_C  0x1F
+#define IMU_REG_REFERENCE_C     0x26                                            /* Read resets the high-pass filter */
 #define IMU_REG_OUT_X_L_C       0x28
 #define IMU_REG_OUT_X_H_C       0x29
 #define IMU_REG_OUT_Y_L_C       0x2A
 #define IMU_REG_OUT_Y_H_C       0x2B
 #define IMU_REG_OUT_Z_L_C       0x2C
 #define IMU_REG_OUT_Z_H_C       0x2D
+#define IMU_REG_FIFO_CTRL_C     0x2E
+#define IMU_REG_FIFO_SRC_C      0x2F
+#define IMU_REG_INT1_CFG_C      0x30
+#define IMU_REG_INT1_SRC_C      0x31
+#define IMU_REG_INT1_THS_C      0x32
+#define IMU_REG_INT1_DURATION_C 0x33
+#define IMU_REG_INT2_CFG_C      0x34
+#define IMU_REG_INT2_SRC_C      0x35
+#define IMU_REG_INT2_THS_C      0x36
+#define IMU_REG_INT2_DURATION_C 0x37
+#define IMU_REG_AUTO_INC_C      0x80                                            /* Sub-address MSB, multi-byte access */
+
+#define IMU_FIFO_MODE_BYPASS_C  (0 << 6)
+#define IMU_FIFO_MODE_STREAM_C  (2 << 6)
+#define IMU_FIFO_SRC_OVRN_C     (1 << 6)                                        /* All 32 slots filled, oldest overwritten */
+#define IMU_FIFO_SRC_FSS_C      0x1F                                            /* Unread samples */
+#define IMU_FIFO_DEPTH_C        32
+#define IMU_INT_SRC_IA_C        (1 << 6)                                        /* INTx_SRC: interrupt active */
+
+#define IMU_INT1_THS_C          4                                               /* 16 mg/LSB, ~64 mg bump */
+#define IMU_INT2_THS_C          33                                              /* 16 mg/LSB, ~0.53 g = sin(32 deg) */
+#define IMU_INT2_DURATION_C     2                                               /* Samples the new position must hold */
+
+#define IMU_ODR_FAST_HZ_C       50
+#define IMU_ODR_FAST_REG_C      ((4 << 4) | (7 << 0))                           /* ODR: 50 Hz, Zen: Enabled, Yen: Enabled, Xen: Enabled */
+#define IMU_ODR_SLOW_HZ_C       10
+#define IMU_ODR_SLOW_REG_C      ((2 << 4) | (7 << 0))                           /* ODR: 10 Hz, Zen: Enabled, Yen: Enabled, Xen: Enabled */
+#define IMU_BATCH_LEN_C         5                                               /* FIFO watermark */
+#define IMU_IDLE_MS_C           (10 * 1000)                                     /* No motion for this long selects the slow rate */
+
+#if defined(PIN_IMU_INT1)
+#define IMU_BATCH_TMOUT_MUL_C   2                                               /* Drains anyway if an edge was missed, the sources with it */
+#else
+#define IMU_BATCH_TMOUT_MUL_C   1
+#define IMU_MOTION_POLL_MS_C    250                                             /* Sources are latched, only the reaction time is at stake */
+#endif
+
+#define IMU_MG_PER_LSB_C        4                                               /* Normal mode, +/-2 g */
+#define IMU_LPF_FAST_ALPHA_Q8_C 13                                              /* ~0.05, tau ~0.4 s at IMU_ODR_FAST_HZ_C */
+#define IMU_LPF_SLOW_ALPHA_Q8_C 57                                              /* ~0.22, tau ~0.4 s at IMU_ODR_SLOW_HZ_C */
 
 
 /* Global variables  ---------------------------------------------------------*/
 
-float g_imu_x, g_imu_y, g_imu_z;
+int16_t g_imu_x_mg, g_imu_y_mg, g_imu_z_mg;
 
 
 /* Private variables  --------------------------------------------------------*/
 
-static float imu_fx = 0.0f, imu_fy = 0.0f, imu_fz = 1.0f;                                   /* Filtered g-vector */
+static int32_t imu_fx_q8 = 0, imu_fy_q8 = 0, imu_fz_q8 = FIXMATH_TO_Q8(1000);  /* Filtered g-vector, mg Q8 */
+
+static bool            b_imu_is_fast = true;
+static int32_t         imu_alpha_q8 = IMU_LPF_FAST_ALPHA_Q8_C;
+static uint32_t        imu_batch_tmout_ms;
+static absolute_time_t imu_next_batch;
+#if !defined(PIN_IMU_INT1)
+static absolute_time_t imu_next_motion_poll;
+#endif
+static absolute_time_t imu_last_motion;
+static bool            b_imu_motion_event = false;
+
+static I2C_BUS_REQ_T   imu_req_status;                                          /* FIFO_SRC .. INT2_SRC */
+static I2C_BUS_REQ_T   imu_req_fifo;
+static I2C_BUS_REQ_T   imu_req_rate[3];                                         /* CTRL_REG1, REFERENCE, sources */
+static uint8_t         imu_status[IMU_REG_INT2_SRC_C - IMU_REG_FIFO_SRC_C + 1];
+static uint8_t         imu_fifo[IMU_FIFO_DEPTH_C * 6];                          /* OUT_X_L .. OUT_Z_H per sample */
+static uint8_t         imu_rate_reg;                                            /* CTRL_REG1 value being written */
+static uint8_t         imu_rate_sink[IMU_REG_INT2_SRC_C - IMU_REG_INT1_SRC_C + 1];
+static bool            b_imu_drain_is_due = false;
+static bool            b_imu_is_moved = false;                                  /* Reported once the batch is in */
+static bool            b_imu_is_reoriented = false;
+#if defined(PIN_IMU_INT1)
+static volatile bool   b_imu_int1_is_pending = false;
+#endif
+
+
+/* Callback prototypes -------------------------------------------------------*/
+
+static void imu_on_status(I2C_BUS_REQ_T* p_req);
+static void imu_on_fifo(I2C_BUS_REQ_T* p_req);
+#if defined(PIN_IMU_INT1)
+static void imu_int1_irq_handler(void);
+#endif
 
 
 /* Private function prototypes -----------------------------------------------*/
@@ -61,8 +153,8 @@ static inline int imu_write(uint8_t dev_addr, uint8_t data_wr);
 #if defined(_IMU_ENABLE_ADC_)
 static inline int16_t imu_adjust_adc(int16_t adc_data);
 #endif
-static void imu_read_data(uint8_t reg, float *p_data_val, bool b_is_accel);
-static void imu_calc_value(uint16_t raw_value, float *p_calc_value, bool b_is_accel);
+static void imu_calc_value(uint16_t raw_value, int16_t *p_calc_value, bool b_is_accel);
+static void imu_set_rate(bool b_fast);
 static void imu_read_raw_data(uint8_t reg, int16_t *p_data);
 
 
@@ -75,34 +167,137 @@ static void imu_read_raw_data(uint8_t reg, int16_t *p_data);
  */
 void imu_init(void)
 {
-    i2c_init(I2C_INST, 100*1000);
-    gpio_set_function(PIN_I2C_SDA, GPIO_FUNC_I2C);
-    gpio_set_function(PIN_I2C_SCL, GPIO_FUNC_I2C);
-    gpio_pull_up(PIN_I2C_SDA);
-    gpio_pull_up(PIN_I2C_SCL);
-
-    imu_write(IMU_REG_CTRL_REG_1_C, (9 << 4) | (7 << 0));                       /* ODR: HR / normal (1.344 kHz) Low-power mode (5.376 kHz), Zen: Enabled, Yen: Enabled, Xen: Enabled */
+    i2c_bus_add_device(I2C_BUS_DEV_IMU_C, IMU_IC_ADDR_C, IMU_I2C_BAUD_C);
+
+    imu_req_status = (I2C_BUS_REQ_T){
+        .dev        = I2C_BUS_DEV_IMU_C,
+        .reg        = IMU_REG_FIFO_SRC_C | IMU_REG_AUTO_INC_C,
+        .b_is_read  = true,
+        .len        = sizeof(imu_status),
+        .p_data     = imu_status,
+        .p_callback = imu_on_status,
+    };
+    imu_req_fifo = (I2C_BUS_REQ_T){
+        .dev        = I2C_BUS_DEV_IMU_C,
+        .reg        = IMU_REG_OUT_X_L_C | IMU_REG_AUTO_INC_C,
+        .b_is_read  = true,
+        .p_data     = imu_fifo,
+        .p_callback = imu_on_fifo,
+    };
+    imu_req_rate[0] = (I2C_BUS_REQ_T){
+        .dev        = I2C_BUS_DEV_IMU_C,
+        .reg        = IMU_REG_CTRL_REG_1_C,
+        .len        = 1,
+        .p_data     = &imu_rate_reg,
+    };
+    imu_req_rate[1] = (I2C_BUS_REQ_T){
+        .dev        = I2C_BUS_DEV_IMU_C,
+        .reg        = IMU_REG_REFERENCE_C,
+        .b_is_read  = true,
+        .len        = 1,
+        .p_data     = imu_rate_sink,
+    };
+    imu_req_rate[2] = (I2C_BUS_REQ_T){
+        .dev        = I2C_BUS_DEV_IMU_C,
+        .reg        = IMU_REG_INT1_SRC_C | IMU_REG_AUTO_INC_C,
+        .b_is_read  = true,
+        .len        = sizeof(imu_rate_sink),
+        .p_data     = imu_rate_sink,
+    };
+
+    imu_write(IMU_REG_CTRL_REG_1_C, IMU_ODR_FAST_REG_C);
+    imu_write(IMU_REG_CTRL_REG_2_C, (1 << 0));                                  /* HPM: normal, FDS: bypassed, HPIS1: high-pass on IA1 */
     imu_write(IMU_REG_CTRL_REG_4_C, (1 << 7));                                  /* BDU: output registers not updated until MSB and LSB reading */
     imu_write(IMU_REG_TEMP_CFG_REG_C, (1 << 7) | (0 << 6));                     /* ADC_EN: Enabled, TEMP_EN: Disabled, */
+    imu_write(IMU_REG_CTRL_REG_5_C, (1 << 6) | (1 << 3) | (1 << 1));            /* FIFO_EN: Enabled, LIR_INT1: Latched, LIR_INT2: Latched */
+    imu_write(IMU_REG_FIFO_CTRL_C, IMU_FIFO_MODE_BYPASS_C);                     /* Clears the FIFO */
+    imu_write(IMU_REG_FIFO_CTRL_C, IMU_FIFO_MODE_STREAM_C | IMU_BATCH_LEN_C);   /* FM: Stream, FTH: watermark */
+    imu_write(IMU_REG_INT1_THS_C, IMU_INT1_THS_C);
+    imu_write(IMU_REG_INT1_DURATION_C, 0);
+    imu_write(IMU_REG_INT1_CFG_C, (1 << 5) | (1 << 3) | (1 << 1));              /* AOI: OR, ZHIE, YHIE, XHIE: wake-up on any axis */
+    imu_write(IMU_REG_INT2_THS_C, IMU_INT2_THS_C);
+    imu_write(IMU_REG_INT2_DURATION_C, IMU_INT2_DURATION_C);
+    imu_write(IMU_REG_INT2_CFG_C, (1 << 6) | 0x3F);                             /* AOI: 0, 6D: movement, all axes */
+    imu_write(IMU_REG_CTRL_REG_3_C, (1 << 6) | (1 << 5) | (1 << 2));            /* I1_IA1, I1_IA2, I1_WTM: on INT1 */
+
+#if defined(PIN_IMU_INT1)
+    gpio_init(PIN_IMU_INT1);
+    gpio_set_dir(PIN_IMU_INT1, GPIO_IN);
+    gpio_add_raw_irq_handler(PIN_IMU_INT1, imu_int1_irq_handler);
+    gpio_set_irq_enabled(PIN_IMU_INT1, GPIO_IRQ_EDGE_RISE, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+#endif
+
+    imu_batch_tmout_ms   = IMU_BATCH_TMOUT_MUL_C * (IMU_BATCH_LEN_C * 1000) / IMU_ODR_FAST_HZ_C;
+    imu_next_batch       = make_timeout_time_ms(imu_batch_tmout_ms);
+#if !defined(PIN_IMU_INT1)
+    imu_next_motion_poll = make_timeout_time_ms(IMU_MOTION_POLL_MS_C);
+#endif
+    imu_last_motion      = get_absolute_time();
 }
 
 /**
  * @brief   Updates accelerometer readings
  * 
+ * Queues a status read when INT1 fires or a batch is due, the rest follows 
+ * from imu_on_status(). Without the INT1 line the sources are also polled 
+ * every IMU_MOTION_POLL_MS_C. A quiet IMU_IDLE_MS_C selects the slow rate.
+ * 
  * @return 	void  
  */
 void imu_update(void)
 {
-    imu_read_data(IMU_REG_OUT_X_L_C, &g_imu_x, true);
-    imu_read_data(IMU_REG_OUT_Y_L_C, &g_imu_y, true);
-    imu_read_data(IMU_REG_OUT_Z_L_C, &g_imu_z, true);
-	
-	const float alpha = 0.05f;
+    bool b_is_due      = (absolute_time_diff_us(get_absolute_time(), imu_next_batch) <= 0);
+#if defined(PIN_IMU_INT1)
+    bool b_is_poll_due = false;
+#else
+    bool b_is_poll_due = (absolute_time_diff_us(get_absolute_time(), imu_next_motion_poll) <= 0);
+#endif
+
+    if (b_imu_is_fast && 
+        (absolute_time_diff_us(imu_last_motion, get_absolute_time()) > (IMU_IDLE_MS_C * 1000LL)))
+    {
+        imu_set_rate(false);
+    }
+
+#if defined(PIN_IMU_INT1)
+    if (b_imu_int1_is_pending)
+    {
+        b_is_due      = true;
+        b_is_poll_due = true;
+    }
+#endif
+
+    if (!(b_is_due || b_is_poll_due) ||
+        (imu_req_status.result == I2C_BUS_RES_PENDING_C) ||
+        (imu_req_fifo.result == I2C_BUS_RES_PENDING_C))
+    {
+        m_idle_wake_by(imu_next_batch);
+#if !defined(PIN_IMU_INT1)
+        m_idle_wake_by(imu_next_motion_poll);
+#endif
+        return;
+    }
+
+#if defined(PIN_IMU_INT1)
+    b_imu_int1_is_pending = false;
+#else
+    imu_next_motion_poll = make_timeout_time_ms(IMU_MOTION_POLL_MS_C);
+#endif
+
+    if (b_is_due)
+    {
+        imu_next_batch = make_timeout_time_ms(imu_batch_tmout_ms);
+    }
+
+    m_idle_wake_by(imu_next_batch);
+#if !defined(PIN_IMU_INT1)
+    m_idle_wake_by(imu_next_motion_poll);
+#endif
 
-    // one-pole low-pass:  y[n] = y[n-1] + α(x[n] – y[n-1])
-    imu_fx += alpha * (g_imu_x - imu_fx);
-    imu_fy += alpha * (g_imu_y - imu_fy);
-    imu_fz += alpha * (g_imu_z - imu_fz);
+    b_imu_drain_is_due = b_is_due;
+
+    i2c_bus_submit(&imu_req_status);
 
 #if defined(_IMU_ENABLE_ADC_)
     int16_t adc1, adc2, adc3;
@@ -117,6 +312,23 @@ void imu_update(void)
 #endif
 }
 
+/**
+ * @brief Returns and clears the motion event
+ * 
+ * Set on a bump or a change of orientation, the tilt is already updated then
+ * 
+ * @return true Moved since the last call
+ * @return false 
+ */
+bool imu_get_motion_event(void)
+{
+    bool b_event = b_imu_motion_event;
+
+    b_imu_motion_event = false;
+
+    return b_event;
+}
+
 /**
  * @brief Calculates the pointing down angle
  * 1/-1 Z and 1/-1 Y are the pointing-horizontal axes
@@ -126,20 +338,135 @@ void imu_update(void)
  */
 int imu_get_pointing_down_angle(void)
 {
-    float x = imu_fx;
-    float y = imu_fy;
-    float z = imu_fz;
+    int32_t x = FIXMATH_FROM_Q8(imu_fx_q8);
+    int32_t y = FIXMATH_FROM_Q8(imu_fy_q8);
+    int32_t z = FIXMATH_FROM_Q8(imu_fz_q8);
+
+    uint32_t mag = fixmath_isqrt((x * x) + (y * y) + (z * z));
+
+    if (mag == 0)
+    {
+        return 0;
+    }
+
+    int32_t cos_q15 = (x * FIXMATH_Q15_ONE_C) / (int32_t)mag;                   /* Dot product with +X */
+
+    return fixmath_acos_cdeg(cos_q15) / 100;
+}
+
+
+/* Callback functions --------------------------------------------------------*/
+
+/**
+ * @brief Status read completed, FIFO level and latched motion sources
+ * 
+ * Reading the sources released their latch. Queues the FIFO burst when a 
+ * batch is due or motion was seen, motion also selects the fast rate.
+ * 
+ * @param p_req Status request
+ */
+static void imu_on_status(I2C_BUS_REQ_T* p_req)
+{
+    uint8_t fifo_src = imu_status[0];
+    int     count;
+
+    if (p_req->result != I2C_BUS_RES_OK_C)
+    {
+        return;
+    }
+
+    b_imu_is_reoriented = (imu_status[IMU_REG_INT2_SRC_C - IMU_REG_FIFO_SRC_C] & IMU_INT_SRC_IA_C) != 0;
+    b_imu_is_moved      = ((imu_status[IMU_REG_INT1_SRC_C - IMU_REG_FIFO_SRC_C] & IMU_INT_SRC_IA_C) != 0) ||
+                          b_imu_is_reoriented;
+
+    count = (fifo_src & IMU_FIFO_SRC_OVRN_C) ? IMU_FIFO_DEPTH_C : (fifo_src & IMU_FIFO_SRC_FSS_C);
+
+    if (b_imu_is_moved)
+    {
+        imu_last_motion = get_absolute_time();
+    }
+
+    if ((b_imu_drain_is_due || b_imu_is_moved) && (count > 0))                  /* Tilt must be current right away */
+    {
+        imu_req_fifo.len = count * 6;
+
+        if (!i2c_bus_submit(&imu_req_fifo))
+        {
+            b_imu_motion_event |= b_imu_is_moved;
+        }
+    }
+    else
+    {
+        b_imu_motion_event |= b_imu_is_moved;
+    }
+
+    if (b_imu_is_moved && !b_imu_is_fast)
+    {
+        imu_set_rate(true);
+    }
+}
+
+/**
+ * @brief FIFO burst completed, every sample goes through the filter in order
+ * 
+ * The address wraps from OUT_Z_H back to OUT_X_L in FIFO mode. After a 6D 
+ * change the filter is set to the batch mean instead.
+ * 
+ * @param p_req FIFO request
+ */
+static void imu_on_fifo(I2C_BUS_REQ_T* p_req)
+{
+    int32_t sum_x = 0, sum_y = 0, sum_z = 0;
+    int     count = p_req->len / 6;
+
+    if (p_req->result == I2C_BUS_RES_OK_C)
+    {
+        for (int idx = 0; idx < count; idx++)
+        {
+            uint8_t* p_sample = &imu_fifo[idx * 6];
+
+            imu_calc_value((p_sample[1] << 8) | p_sample[0], &g_imu_x_mg, true);
+            imu_calc_value((p_sample[3] << 8) | p_sample[2], &g_imu_y_mg, true);
+            imu_calc_value((p_sample[5] << 8) | p_sample[4], &g_imu_z_mg, true);
+
+            // one-pole low-pass:  y[n] = y[n-1] + α(x[n] – y[n-1])
+            imu_fx_q8 = fixmath_lpf_q8(imu_fx_q8, g_imu_x_mg, imu_alpha_q8);
+            imu_fy_q8 = fixmath_lpf_q8(imu_fy_q8, g_imu_y_mg, imu_alpha_q8);
+            imu_fz_q8 = fixmath_lpf_q8(imu_fz_q8, g_imu_z_mg, imu_alpha_q8);
+
+            sum_x += g_imu_x_mg;
+            sum_y += g_imu_y_mg;
+            sum_z += g_imu_z_mg;
+        }
+
+        if (b_imu_is_reoriented)
+        {
+            imu_fx_q8 = FIXMATH_TO_Q8(sum_x) / count;
+            imu_fy_q8 = FIXMATH_TO_Q8(sum_y) / count;
+            imu_fz_q8 = FIXMATH_TO_Q8(sum_z) / count;
+        }
+    }
 
-    float mag = sqrtf((x * x) + (y * y) + (z * z));
+    b_imu_motion_event |= b_imu_is_moved;
+}
 
-    x /= mag;
-    y /= mag;
-    z /= mag;
+#if defined(PIN_IMU_INT1)
+/**
+ * @brief FIFO watermark, wake-up or 6D event on INT1
+ * 
+ */
+static void imu_int1_irq_handler(void)
+{
+    if (gpio_get_irq_event_mask(PIN_IMU_INT1) & GPIO_IRQ_EDGE_RISE)
+    {
+        gpio_acknowledge_irq(PIN_IMU_INT1, GPIO_IRQ_EDGE_RISE);
 
-    float angle = acosf((1 * x) + (0 * y) + (0 * z)) * (180.0 / M_PI);
+        b_imu_int1_is_pending = true;
 
-    return angle;
+        m_idle_wake(M_IDLE_WAKE_IMU_C);
+    }
 }
+#endif
 
 
 /* Private functions ---------------------------------------------------------*/
@@ -155,19 +482,7 @@ int imu_get_pointing_down_angle(void)
  */
 static inline int imu_read(uint8_t dev_addr, int data_len, uint8_t* p_data_rd)
 {
-    if (i2c_write_timeout_us(IMU_I2C_PORT_C, IMU_IC_ADDR_C, &dev_addr, 1, true, 1000) < 0)
-    {
-        printf("imu_read fail: addr\n");
-        return 1;
-    }
-
-    if (i2c_read_timeout_us(IMU_I2C_PORT_C, IMU_IC_ADDR_C, p_data_rd, data_len, false, 1000) < 0)
-    {
-        printf("imu_read fail: data\n");
-        return 1;
-    }
-
-    return 0;
+    return (i2c_bus_xfer_blocking(I2C_BUS_DEV_IMU_C, dev_addr, true, p_data_rd, data_len) != I2C_BUS_RES_OK_C);
 }
 
 /**
@@ -180,15 +495,7 @@ static inline int imu_read(uint8_t dev_addr, int data_len, uint8_t* p_data_rd)
  */
 static inline int imu_write(uint8_t dev_addr, uint8_t data_wr)
 {
-    uint8_t buf[] = {dev_addr, data_wr};
-
-    if (i2c_write_timeout_us(IMU_I2C_PORT_C, IMU_IC_ADDR_C, buf, 2, false, 1000) < 0)
-    {
-        printf("imu_write fail\n");
-        return 1;
-    }
-
-    return 0;
+    return (i2c_bus_xfer_blocking(I2C_BUS_DEV_IMU_C, dev_addr, false, &data_wr, 1) != I2C_BUS_RES_OK_C);
 }
 
 #if defined(_IMU_ENABLE_ADC_)
@@ -204,50 +511,62 @@ static inline int16_t imu_adjust_adc(int16_t adc_data)
 #endif
 
 /**
- * @brief Reads two bytes of data from accelerometer device
+ * @brief Convert with respect to the value being temperature or acceleration reading 
  * 
- * @param reg Register address to read from device
- * @param p_data_val Pointer to calculated data value
+ * @param raw_value Raw read value to be converted
+ * @param p_calc_value Pointer to put the calculated value, mg for acceleration
  * @param b_is_accel Flag for accelereometer or temperature reading
  */
-static void imu_read_data(uint8_t reg, float *p_data_val, bool b_is_accel)
+static void imu_calc_value(uint16_t raw_value, int16_t *p_calc_value, bool b_is_accel)
 {
-    uint8_t lsb;
-    uint8_t msb;
-    uint16_t raw_accel;
-    imu_read(reg, 1, &lsb);
-
-    reg |= 0x01;
-    imu_read(reg, 1, &msb);
+    // raw_value is signed, left-justified 10 bits
+    int16_t counts = ((int16_t) raw_value) / 64;
 
-    raw_accel = (msb << 8) | lsb;
-
-    imu_calc_value(raw_accel, p_data_val, b_is_accel);
+    if (b_is_accel == true)
+    {
+        *p_calc_value = counts * IMU_MG_PER_LSB_C;
+    } 
+    else 
+    {
+        *p_calc_value = counts;
+    }
 }
 
 /**
- * @brief Convert with respect to the value being temperature or acceleration reading 
+ * @brief Selects the output data rate and the matching filter coefficient
  * 
- * @param raw_value Raw read value to be converted
- * @param p_calc_value Pointer to put the calculated value
- * @param b_is_accel Flag for accelereometer or temperature reading
+ * Queued behind any FIFO burst, so the batch in flight is still taken at the 
+ * old rate. The high-pass filter is reset and stale sources cleared so the 
+ * rate step does not read as a bump.
+ * 
+ * @param b_fast IMU_ODR_FAST_HZ_C or IMU_ODR_SLOW_HZ_C
  */
-static void imu_calc_value(uint16_t raw_value, float *p_calc_value, bool b_is_accel)
+static void imu_set_rate(bool b_fast)
 {
-    float scaling;
-    float senstivity = 0.004f; // g per unit
+    int odr_hz = b_fast ? IMU_ODR_FAST_HZ_C : IMU_ODR_SLOW_HZ_C;
 
-    if (b_is_accel == true)
+    for (int idx = 0; idx < 3; idx++)
     {
-        scaling = 64 / senstivity;
-    } 
-    else 
+        if (imu_req_rate[idx].result == I2C_BUS_RES_PENDING_C)
+        {
+            return;
+        }
+    }
+
+    imu_rate_reg = b_fast ? IMU_ODR_FAST_REG_C : IMU_ODR_SLOW_REG_C;
+
+    if (!i2c_bus_submit(&imu_req_rate[0]))
     {
-        scaling = 64;
+        return;
     }
 
-    // raw_value is signed
-    *p_calc_value = (float) ((int16_t) raw_value) / scaling;
+    i2c_bus_submit(&imu_req_rate[1]);
+    i2c_bus_submit(&imu_req_rate[2]);
+
+    b_imu_is_fast      = b_fast;
+    imu_alpha_q8       = b_fast ? IMU_LPF_FAST_ALPHA_Q8_C : IMU_LPF_SLOW_ALPHA_Q8_C;
+    imu_batch_tmout_ms = IMU_BATCH_TMOUT_MUL_C * (IMU_BATCH_LEN_C * 1000) / odr_hz;
+    imu_next_batch     = make_timeout_time_ms(imu_batch_tmout_ms);
 }
 
 #if defined(_IMU_ENABLE_ADC_)
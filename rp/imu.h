@@ -9,9 +9,15 @@
 #define _D_IMU_H_
 
 
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
 /* Exported variables --------------------------------------------------------*/
 
-extern float g_imu_x, g_imu_y, g_imu_z;
+extern int16_t g_imu_x_mg, g_imu_y_mg, g_imu_z_mg;
 
 
 /* Exported functions prototypes ---------------------------------------------*/
@@ -19,6 +25,7 @@ extern float g_imu_x, g_imu_y, g_imu_z;
 void imu_init(void);
 void imu_update(void);
 int imu_get_pointing_down_angle(void);
+bool imu_get_motion_event(void);
 
 
 #endif /* _D_IMU_H_ */
@@ -14,6 +14,7 @@
 #include <pico/stdlib.h>
 #include <hardware/gpio.h>
 #include <hardware/pwm.h>
+#include <hardware/sync.h>
 
 #include "lamp.h"
 #include "pins.h"
@@ -21,20 +22,20 @@
 #include "sense.h"
 #include "radar.h"
 #include "persistance.h"
+#include "lamp_cal.h"
+#include "lamp_stats.h"
+#include "m_idle.h"
+#include "d_sysclk.h"
+#include "m_blackbox.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
 
-typedef struct {
-	int pwm;
-	int power;
-} LAMP_PWR_CTL_T;
-
-
 /* Private define ------------------------------------------------------------*/
 
 #define LAMP_RESTRIKE_COOLDOWN_MS_TIME_C 	5000
 #define LAMP_START_MS_TIME_C 				10000
+#define LAMP_PWM_CLOCK_HZ_C 				(15625*1000)						/* Counter clock, 125 MHz / 8 */
 
 
 /* Global variables  ---------------------------------------------------------*/
@@ -45,12 +46,12 @@ typedef struct {
 const int 				LAMP_STEPCOUNT_SOFTSTART_C = 64;
 const int 				LAMP_STEPCOUNT_DIMMING_C   = 100;
 
-const LAMP_PWR_CTL_T 	lamp_pwr_settings[LAMP_PWR_MAX_SETTINGS_C] = {
-							[LAMP_PWR_OFF_C]    = {0,     0},
-							[LAMP_PWR_20PCT_C]  = {100,  20},
-							[LAMP_PWR_40PCT_C]  = {83,   40},
-							[LAMP_PWR_70PCT_C]  = {50,   70},
-							[LAMP_PWR_100PCT_C] = {0,   100},
+static const uint8_t 	lamp_pwr_pct[LAMP_PWR_MAX_SETTINGS_C] = {				/* PWM comes from the calibration curve */
+							[LAMP_PWR_OFF_C]    = 0,
+							[LAMP_PWR_20PCT_C]  = 20,
+							[LAMP_PWR_40PCT_C]  = 40,
+							[LAMP_PWR_70PCT_C]  = 70,
+							[LAMP_PWR_100PCT_C] = 100,
 						};
 
 static bool 			b_lamp_is_12v_on = false;
@@ -63,6 +64,10 @@ static LAMP_PWR_LEVEL_E lamp_requested_power_level = LAMP_PWR_OFF_C;
 static LAMP_PWR_LEVEL_E lamp_commanded_power_level = LAMP_PWR_OFF_C;
 static LAMP_PWR_LEVEL_E lamp_reported_power_level  = LAMP_PWR_UNKNOWN_C;
 
+static uint8_t 			lamp_requested_pct = 0;
+static uint8_t 			lamp_commanded_pct = 0;
+static int 				lamp_reported_pct  = -1;
+
 static uint64_t 		lamp_state_transition_time = 0;
 
 static uint64_t 		lamp_last_update = 0;
@@ -74,11 +79,14 @@ volatile int 			lamp_status_events  = 0;
 /* Callback prototypes -------------------------------------------------------*/
 
 void lamp_status_gpio_callback(uint gpio, uint32_t events);
+static bool lamp_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz);
 
 
 /* Private function prototypes -----------------------------------------------*/
 
 static inline void lamp_go_to_state(LAMP_STATE_E state);
+static void lamp_handle_supply_cutoff(const SENSE_CUTOFF_EVENT_T* p_event);
+static LAMP_PWR_LEVEL_E lamp_pct_to_level(uint8_t pct);
 static void lamp_perform_type_test_inner(void);
 static bool lamp_is_test_state_failure(LAMP_STATE_E state);
 static bool lamp_power_is_too_low(void);
@@ -102,6 +110,8 @@ void lamp_init(void)
 	uint slice_num;
 	pwm_config pwm_cfg;
 
+	lamp_cal_load();
+
 	gpio_init(PIN_ENABLE_24V);
 	gpio_set_dir(PIN_ENABLE_24V, GPIO_OUT);
 	gpio_put(PIN_ENABLE_24V, false);
@@ -124,7 +134,7 @@ void lamp_init(void)
 
 	pwm_cfg = pwm_get_default_config();
 	// Set divider, reduces counter clock to sysclock/this value
-	pwm_config_set_clkdiv(&pwm_cfg, 8);
+	pwm_config_set_clkdiv(&pwm_cfg, sysclk_get_pwm_div(LAMP_PWM_CLOCK_HZ_C));
 
 	pwm_config_set_wrap(&pwm_cfg, LAMP_STEPCOUNT_SOFTSTART_C); // ~244kHz
 
@@ -141,7 +151,7 @@ void lamp_init(void)
 
 	pwm_cfg = pwm_get_default_config();
 	// Set divider, reduces counter clock to sysclock/this value
-	pwm_config_set_clkdiv(&pwm_cfg, 8);
+	pwm_config_set_clkdiv(&pwm_cfg, sysclk_get_pwm_div(LAMP_PWM_CLOCK_HZ_C));
 
 	pwm_config_set_wrap(&pwm_cfg, LAMP_STEPCOUNT_DIMMING_C-1); // 244kHz
 
@@ -151,6 +161,8 @@ void lamp_init(void)
 	pwm_set_gpio_level(PIN_PWM_LAMP, 0);
 
 	pwm_set_enabled(slice_num, true);
+
+	sysclk_add_listener(lamp_sysclk_callback);
 }
 
 /**
@@ -161,6 +173,7 @@ void lamp_init(void)
 void lamp_update(void)
 {
 	uint64_t now = time_us_64();
+	SENSE_CUTOFF_EVENT_T cutoff_event;
 
 	if ((now - lamp_last_update) > (1000*1000))
 	{
@@ -191,21 +204,27 @@ void lamp_update(void)
 					lamp_reported_power_level = LAMP_PWR_OFF_C;
 				}
 			}
-			else if (lamp_latched_freq_hz > 900 && lamp_latched_freq_hz < 1100) 
+			else
 			{
-				lamp_reported_power_level = LAMP_PWR_70PCT_C;
-			}
-			else if (lamp_latched_freq_hz > 400 && lamp_latched_freq_hz < 600)
-			{
-				lamp_reported_power_level = LAMP_PWR_40PCT_C;
-			}
-			else if (lamp_latched_freq_hz > 150 && lamp_latched_freq_hz < 250) 
-			{
-				lamp_reported_power_level = LAMP_PWR_20PCT_C;
+				lamp_reported_power_level = lamp_cal_classify_freq(lamp_latched_freq_hz);
 			}
 		}
+
+		if ((lamp_reported_power_level == LAMP_PWR_OFF_C) || 
+			(lamp_reported_power_level == LAMP_PWR_100PCT_C))
+		{
+			lamp_reported_pct = lamp_pwr_pct[lamp_reported_power_level];
+		}
+		else
+		{
+			lamp_reported_pct = lamp_cal_freq_to_pct(lamp_latched_freq_hz);
+		}
+
+		lamp_cal_band_sweep_on_latch(lamp_latched_freq_hz);
 	}
 
+	m_idle_wake_by(from_us_since_boot(lamp_last_update + (1000*1000)));
+
 	uint64_t elapsed_ms_in_state = (time_us_64() - lamp_state_transition_time) / 1000;
 
 	switch (lamp_state)
@@ -248,8 +267,22 @@ void lamp_update(void)
 
 			if (lamp_requested_power_level == LAMP_PWR_OFF_C)
 			{
+				lamp_cal_band_sweep_abort();
 				lamp_go_to_state(LAMP_STATE_OFF_C);
 			}
+			else if (lamp_cal_band_sweep_is_running())
+			{
+				LAMP_PWR_LEVEL_E sweep_level = lamp_cal_band_sweep_get_level();
+
+				if (lamp_pwr_pct[sweep_level] > lamp_requested_pct)				/* Safety cap dropped mid-sweep */
+				{
+					lamp_cal_band_sweep_abort();								/* A clamped level would record the wrong band */
+				}
+				else
+				{
+					lamp_commanded_power_level = sweep_level;
+				}
+			}
 		break;
 
 		case LAMP_STATE_FULLPOWER_TEST_C:
@@ -386,17 +419,33 @@ void lamp_update(void)
 		break;
 	}
 
-	pwm_set_gpio_level(PIN_PWM_LAMP, lamp_pwr_settings[lamp_commanded_power_level].pwm);
-	gpio_put(PIN_ENABLE_LAMP, lamp_commanded_power_level != LAMP_PWR_OFF_C);
+	if (sense_get_cutoff_event(&cutoff_event))
+	{
+		lamp_handle_supply_cutoff(&cutoff_event);
+	}
 
-	if ((g_sense_12v < 10.5) || (g_sense_12v > 13.5))
+	if ((lamp_state == LAMP_STATE_RUNNING_C) && !lamp_cal_band_sweep_is_running())
 	{
-		gpio_put(PIN_ENABLE_LAMP, true);
-		sleep_ms(10);
-		lamp_set_switched_24v(false);
-		lamp_set_switched_12v(false);
-		lamp_go_to_state(LAMP_STATE_OFF_C);
+		lamp_commanded_pct = lamp_requested_pct;
+	}
+	else
+	{
+		lamp_commanded_pct = lamp_pwr_pct[lamp_commanded_power_level];
 	}
+
+	/* The cutoff interrupt may trip after the check above; the latched state
+	 * is checked again with interrupts masked so the outputs are never driven
+	 * back on behind it, the next pass handles the event */
+	uint8_t    pwm_level  = lamp_cal_pct_to_pwm(lamp_commanded_pct);
+	uint32_t   irq_status = save_and_disable_interrupts();
+
+	if (!sense_get_cutoff_event(&cutoff_event))
+	{
+		pwm_set_gpio_level(PIN_PWM_LAMP, pwm_level);
+		gpio_put(PIN_ENABLE_LAMP, lamp_commanded_power_level != LAMP_PWR_OFF_C);
+	}
+
+	restore_interrupts(irq_status);
 }
 
 /**
@@ -439,7 +488,7 @@ void lamp_perform_type_test(void)
 		if (lamp_get_type() != LAMP_TYPE_UNKNOWN_C)
 		{
 			printf("Writing concluded type\n");
-			g_persistance_region.factory_lamp_type = lamp_get_type();
+			persistance_set_factory_lamp_type(lamp_get_type());
 			persistance_write_region();
 		}
 	}
@@ -456,7 +505,7 @@ void lamp_perform_type_test(void)
  */
 void lamp_set_switched_12v(bool b_on)
 {
-	if (((g_sense_12v < 11.5) || (g_sense_12v > 12.5)) && b_on)
+	if (((g_sense_12v_mv < 11500) || (g_sense_12v_mv > 12500)) && b_on)
 	{
 		printf("Reject turn on 12V when 12v not OK\n");
 	}
@@ -468,9 +517,13 @@ void lamp_set_switched_12v(bool b_on)
 			sleep_ms(8);
 		}
 		b_lamp_is_12v_on = b_on;
+
+		sense_set_cutoff_armed(true);
 	}
 	else if (b_lamp_is_12v_on && !b_on)
 	{
+		sense_set_cutoff_armed(false);
+
 		for (int idx = LAMP_STEPCOUNT_SOFTSTART_C + 1; idx >= 0; idx--)
 		{
 			pwm_set_gpio_level(PIN_ENABLE_12V, idx);
@@ -536,7 +589,39 @@ bool lamp_get_switched_24v(void)
  */
 bool lamp_request_power_level(LAMP_PWR_LEVEL_E pwr_level)
 {
-	if (lamp_requested_power_level == pwr_level) 
+	if (pwr_level >= LAMP_PWR_MAX_SETTINGS_C)
+	{
+		return false;
+	}
+
+	return lamp_request_power_pct(lamp_pwr_pct[pwr_level]);
+}
+
+/**
+ * @brief Request lamp to set an output in 1 % steps
+ * 
+ * The output is never raised above the request: a dimmed output below the 
+ * lowest calibrated point of the curve can't be reached and turns the lamp 
+ * off. If requested output is already satisfied, the process will return true
+ * 
+ * @param pct Output in percentage, 0 is off
+ * @return true 
+ * @return false 
+ */
+bool lamp_request_power_pct(uint8_t pct)
+{
+	if (pct > 100)
+	{
+		pct = 100;
+	}
+	if ((pct != 0) && (pct < lamp_cal_get_min_pct()))
+	{
+		pct = 0;																// e.g. a safety cap under the curve
+	}
+
+	LAMP_PWR_LEVEL_E pwr_level = lamp_pct_to_level(pct);
+
+	if (lamp_requested_pct == pct) 
 	{
 		return true;
 	}
@@ -545,8 +630,6 @@ bool lamp_request_power_level(LAMP_PWR_LEVEL_E pwr_level)
 		return false; // dead
 	}
 
-	bool requested_on = pwr_level != LAMP_PWR_OFF_C;
-
 	if (lamp_get_type() == LAMP_TYPE_NON_DIMMABLE_C)
 	{
 		if (pwr_level != LAMP_PWR_OFF_C && pwr_level != LAMP_PWR_100PCT_C)
@@ -571,11 +654,13 @@ bool lamp_request_power_level(LAMP_PWR_LEVEL_E pwr_level)
 	if (lamp_requested_power_level == LAMP_PWR_OFF_C && pwr_level != LAMP_PWR_OFF_C)
 	{
 		printf("Lamp goes to LAMP_STATE_STARTING_C\n");
-		lamp_state = LAMP_STATE_STARTING_C;
-		lamp_state_transition_time = time_us_64();
+		lamp_go_to_state(LAMP_STATE_STARTING_C);
 	}
 
-	lamp_requested_power_level = pwr_level;	
+	lamp_requested_power_level = pwr_level;
+	lamp_requested_pct 		   = pct;
+
+	return true;
 }
 
 /**
@@ -598,6 +683,48 @@ LAMP_PWR_LEVEL_E lamp_get_commanded_power_level()
 	return lamp_commanded_power_level;
 }
 
+/**
+ * @brief Returns the previously requested output in percentage
+ * 
+ * @return uint8_t 
+ */
+uint8_t lamp_get_requested_power_pct(void)
+{
+	return lamp_requested_pct;
+}
+
+/**
+ * @brief Returns the output in percentage currently sent to the ballast
+ * 
+ * @return uint8_t 
+ */
+uint8_t lamp_get_commanded_power_pct(void)
+{
+	return lamp_commanded_pct;
+}
+
+/**
+ * @brief Returns whether the reported output could be resolved in percentage
+ * 
+ * Dimmed outputs are resolved through the calibration curve. Returns false if
+ * unsure
+ * 
+ * @param p_pct The current reported output in percentage
+ * @return true 
+ * @return false 
+ */
+bool lamp_get_reported_power_pct(uint8_t *p_pct)
+{
+	if (lamp_reported_pct < 0)
+	{
+		return false;
+	}
+
+	*p_pct = lamp_reported_pct;
+
+	return true;
+}
+
 /**
  * @brief Returns whether the reported power level is a valid one or not
  * 
@@ -626,6 +753,22 @@ bool lamp_is_power_ok(void)
 	return (!lamp_power_is_too_low() && !lamp_power_is_too_high());
 }
 
+/**
+ * @brief Return the output of a power level
+ * 
+ * @param pwr_level @ref LAMP_PWR_LEVEL_E
+ * @return uint8_t Output in percentage, 0 for an unknown level
+ */
+uint8_t lamp_get_power_level_pct(LAMP_PWR_LEVEL_E pwr_level)
+{
+	if (pwr_level >= LAMP_PWR_MAX_SETTINGS_C)
+	{
+		return 0;
+	}
+
+	return lamp_pwr_pct[pwr_level];
+}
+
 /**
  * @brief Return the string ID for a power level
  * 
@@ -661,6 +804,20 @@ int lamp_get_raw_freq(void)
 	return lamp_latched_freq_hz;
 }
 
+/**
+ * @brief Discards the status events counted so far and starts a new 1 s window
+ * 
+ * Used after the interrupts were held off (i.e. flash writes) so a short 
+ * count is not classified as a level change. The last latched frequency is kept.
+ * 
+ * @return 	void
+ */
+void lamp_restart_status_window(void)
+{
+	lamp_status_events = 0;
+	lamp_last_update   = time_us_64();
+}
+
 /**
  * @brief Return the current lamp state
  * 
@@ -726,6 +883,25 @@ bool lamp_is_warming(void)
 		    (ms < LAMP_START_MS_TIME_C));
 }
 
+/**
+ * @brief Returns whether the lamp is settled, on or off, with no test pending
+ * 
+ * Nothing but the 1 s status latch needs the main loop then
+ * 
+ * @return true 
+ * @return false 
+ */
+bool lamp_is_steady(void)
+{
+	if (lamp_cal_band_sweep_is_running())
+	{
+		return false;
+	}
+
+	return (lamp_state == LAMP_STATE_OFF_C) ||
+		   ((lamp_state == LAMP_STATE_RUNNING_C) && !lamp_is_warming());
+}
+
 
 /* Callback functions --------------------------------------------------------*/
 
@@ -747,6 +923,27 @@ void lamp_status_gpio_callback(uint gpio, uint32_t events)
 	}
 }
 
+/**
+ * @brief Keeps the 12V soft-start and lamp dimming PWM frequencies across 
+ * system clock changes
+ * 
+ * @param phase @ref SYSCLK_PHASE_E
+ * @param sys_hz New system clock
+ * @return true Never defers
+ */
+static bool lamp_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz)
+{
+	if (phase == SYSCLK_PHASE_CHANGED_C)
+	{
+		float div = sysclk_get_pwm_div(LAMP_PWM_CLOCK_HZ_C);
+
+		pwm_set_clkdiv(pwm_gpio_to_slice_num(PIN_ENABLE_12V), div);
+		pwm_set_clkdiv(pwm_gpio_to_slice_num(PIN_PWM_LAMP), div);
+	}
+
+	return true;
+}
+
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -764,11 +961,67 @@ static inline void lamp_go_to_state(LAMP_STATE_E state)
 	if (state != lamp_state) 
 	{
 		printf("State transition to %s\n", lamp_get_lamp_state_str(state));
+
+		lamp_stats_on_transition(lamp_state, state);
+		m_blackbox_log(M_BLACKBOX_EVT_LAMP_STATE_C, state, lamp_state, 0);
 	}
 	lamp_state = state;
 	lamp_state_transition_time = time_us_64();
 }
 
+/**
+ * @brief Brings the lamp state in line with a supply cutoff
+ * 
+ * The sense driver already cut the lamp enable, 24V and 12V from its 
+ * interrupt, only the bookkeeping is left. 12V stays off until switched on 
+ * again, as before.
+ * 
+ * @param p_event Cutoff record
+ * 
+ * @return 	void
+ */
+static void lamp_handle_supply_cutoff(const SENSE_CUTOFF_EVENT_T* p_event)
+{
+	printf("Supply cutoff, rail %d out of window: %d/%d/%dmV\n", 
+		   p_event->rail,
+		   p_event->rail_mv[SENSE_RAIL_VBUS_C],
+		   p_event->rail_mv[SENSE_RAIL_12V_C],
+		   p_event->rail_mv[SENSE_RAIL_24V_C]);
+
+	b_lamp_is_24v_on = false;
+	b_lamp_is_12v_on = false;
+
+	lamp_commanded_power_level = LAMP_PWR_OFF_C;
+	lamp_cal_band_sweep_abort();
+	lamp_go_to_state(LAMP_STATE_OFF_C);
+
+	lamp_stats_on_supply_cutoff(p_event);
+	m_blackbox_log(M_BLACKBOX_EVT_SUPPLY_CUTOFF_C,
+				   p_event->rail,
+				   p_event->rail_mv[SENSE_RAIL_12V_C],
+				   ((uint32_t)p_event->rail_mv[SENSE_RAIL_VBUS_C] << 16) | p_event->rail_mv[SENSE_RAIL_24V_C]);
+	sense_clear_cutoff();
+}
+
+/**
+ * @brief Maps an output percentage to the nearest lower power level
+ * 
+ * @param pct Output in percentage
+ * @return LAMP_PWR_LEVEL_E 
+ */
+static LAMP_PWR_LEVEL_E lamp_pct_to_level(uint8_t pct)
+{
+	for (LAMP_PWR_LEVEL_E level = LAMP_PWR_100PCT_C; level > LAMP_PWR_OFF_C; level--)
+	{
+		if (pct >= lamp_pwr_pct[level])
+		{
+			return level;
+		}
+	}
+
+	return (pct == 0) ? LAMP_PWR_OFF_C : LAMP_PWR_20PCT_C;
+}
+
 /**
  * @brief 
  * 
@@ -869,7 +1122,7 @@ static bool lamp_is_test_state_failure(LAMP_STATE_E state)
  */
 static bool lamp_power_is_too_low(void)
 {
-	return g_sense_12v < 10.5;
+	return g_sense_12v_mv < 10500;
 }
 
 /**
@@ -880,7 +1133,7 @@ static bool lamp_power_is_too_low(void)
  */
 static bool lamp_power_is_too_high(void)
 {
-	return g_sense_12v > 13.5;
+	return g_sense_12v_mv > 13500;
 }
 
 /**
@@ -15,7 +15,7 @@
  * @enum LAMP_TYPE_E
  * @brief Available types of lamps
  * 
- * Used in persistance region; bump magic if changed
+ * Used in persistance region; bump its key version if changed
  * 
  */
 typedef enum {
@@ -76,17 +76,24 @@ bool lamp_get_switched_12v(void);
 bool lamp_get_switched_24v(void);
 
 bool lamp_request_power_level(LAMP_PWR_LEVEL_E pwr_level);
+bool lamp_request_power_pct(uint8_t pct);
 LAMP_PWR_LEVEL_E lamp_get_requested_power_level(void);
 LAMP_PWR_LEVEL_E lamp_get_commanded_power_level(void);
+uint8_t lamp_get_requested_power_pct(void);
+uint8_t lamp_get_commanded_power_pct(void);
 bool lamp_get_reported_power_level(LAMP_PWR_LEVEL_E *p_pwr_level);
+bool lamp_get_reported_power_pct(uint8_t *p_pct);
 bool lamp_is_power_ok(void);
+uint8_t lamp_get_power_level_pct(LAMP_PWR_LEVEL_E pwr_level);
 const char* lamp_get_power_level_string(LAMP_PWR_LEVEL_E pwr_level);
 
 int lamp_get_raw_freq(void);
+void lamp_restart_status_window(void);
 LAMP_STATE_E lamp_get_lamp_state(void);
 const char* lamp_get_lamp_state_str(LAMP_STATE_E state);
 int lamp_get_state_elapsed_ms(void);
 bool lamp_is_warming(void);
+bool lamp_is_steady(void);
 
 
 #endif /* _D_LAMP_H_ */
@@ -0,0 +1,784 @@
+/**
+ * @file      lamp_cal.c
+ * @author    The OSLUV Project
+ * @brief     Per-unit lamp dimming calibration
+ * @schematic lamp_controller.SchDoc
+ *
+ * The ballast output is not linear with the PIN_PWM_LAMP duty cycle, and the
+ * relation drifts from unit to unit. A short curve of measured points
+ * (PWM level -> status frequency -> optical output) is kept in the persistance
+ * region and interpolated at runtime so any output between the lowest
+ * calibrated point and 100% can be commanded.
+ *
+ * The status frequency windows used to classify the reported level are
+ * fitted per unit by a sweep over the dimmed levels, so ballasts that drift
+ * away from the nominal frequencies are not mistaken for a lamp out.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <pico/stdlib.h>
+
+#include "lamp_cal.h"
+#include "persistance.h"
+
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+#define LAMP_CAL_PWM_MAX_C			100											/* PIN_PWM_LAMP slice step count */
+#define LAMP_CAL_MIN_POINTS_C		2
+
+#define LAMP_CAL_SWEEP_SETTLE_C		3											/* Latches (s) discarded after a level change */
+#define LAMP_CAL_SWEEP_SAMPLES_C	10											/* Latches (s) recorded per level */
+#define LAMP_CAL_SWEEP_MIN_HZ_C		100											/* Below this the status line is steady */
+#define LAMP_CAL_BAND_MARGIN_HZ_C	20											/* Minimum margin around observed spread */
+
+
+/* Global variables  ---------------------------------------------------------*/
+/* Private variables  --------------------------------------------------------*/
+
+/* Factory curve, matches the original hand-picked 20/40/70/100 % settings */
+static const LAMP_CAL_CURVE_T lamp_cal_default = {
+	.count  = 4,
+	.points = {
+		{100,  20,  200},
+		{ 83,  40,  500},
+		{ 50,  70, 1000},
+		{  0, 100,    0},
+	}
+};
+
+/* Factory bands, the original fixed classification windows */
+static const LAMP_CAL_BANDS_T lamp_cal_bands_default = {
+	.level = {
+		[LAMP_PWR_20PCT_C] = { 150,  250},
+		[LAMP_PWR_40PCT_C] = { 400,  600},
+		[LAMP_PWR_70PCT_C] = { 900, 1100},
+	}
+};
+
+static const LAMP_PWR_LEVEL_E lamp_cal_sweep_levels[] = {
+	LAMP_PWR_20PCT_C,
+	LAMP_PWR_40PCT_C,
+	LAMP_PWR_70PCT_C
+};
+
+static LAMP_CAL_CURVE_T lamp_cal_curve;											/* Active curve */
+static LAMP_CAL_BANDS_T lamp_cal_bands;											/* Active classification bands */
+static LAMP_CAL_CURVE_T lamp_cal_edit;											/* Working copy for the command port */
+static uint8_t 			lamp_cal_edit_idx = 0;
+
+static LAMP_CAL_SWEEP_E lamp_cal_sweep_state = LAMP_CAL_SWEEP_IDLE_C;
+static uint8_t 			lamp_cal_sweep_step  = 0;								/* Index in lamp_cal_sweep_levels */
+static uint8_t 			lamp_cal_sweep_count = 0;								/* Latches seen on current step */
+static struct {
+	uint16_t min_hz;
+	uint16_t max_hz;
+	uint32_t sum_hz;
+} 						lamp_cal_sweep_stats[count_of(lamp_cal_sweep_levels)];
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static bool lamp_cal_is_valid(const LAMP_CAL_CURVE_T* p_curve);
+static bool lamp_cal_bands_are_valid(const LAMP_CAL_BANDS_T* p_bands);
+static bool lamp_cal_band_sweep_fit(void);
+static int lamp_cal_lerp(int x, int x0, int x1, int y0, int y1);
+static void lamp_cal_check_dim_pct(void);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Loads the calibration curve from the persistance region
+ *
+ * Falls back to the factory curve if the stored one is missing or invalid
+ *
+ * @return 	void
+ */
+void lamp_cal_load(void)
+{
+	if (lamp_cal_is_valid(&g_persistance_region.lamp_cal))
+	{
+		lamp_cal_curve = g_persistance_region.lamp_cal;
+	}
+	else
+	{
+		printf("Lamp calibration missing, using factory curve\n");
+		lamp_cal_curve = lamp_cal_default;
+	}
+
+	lamp_cal_edit = lamp_cal_curve;
+
+	lamp_cal_check_dim_pct();
+
+	if (lamp_cal_bands_are_valid(&g_persistance_region.lamp_bands))
+	{
+		lamp_cal_bands = g_persistance_region.lamp_bands;
+	}
+	else
+	{
+		printf("Lamp bands missing, using factory windows\n");
+		lamp_cal_bands = lamp_cal_bands_default;
+	}
+}
+
+/**
+ * @brief Returns the lowest output that the curve can reach
+ *
+ * @return uint8_t Output in percentage
+ */
+uint8_t lamp_cal_get_min_pct(void)
+{
+	return lamp_cal_curve.points[0].output_pct;
+}
+
+/**
+ * @brief Converts an output percentage into a PIN_PWM_LAMP level
+ *
+ * Outputs outside the calibrated range are clamped to the curve ends
+ *
+ * @param pct Requested output in percentage
+ * @return uint8_t PWM level
+ */
+uint8_t lamp_cal_pct_to_pwm(uint8_t pct)
+{
+	const LAMP_CAL_POINT_T* p_pts = lamp_cal_curve.points;
+	uint8_t 				last  = lamp_cal_curve.count - 1;
+
+	if (pct == 0)
+	{
+		return 0;
+	}
+
+	if (pct <= p_pts[0].output_pct)
+	{
+		return p_pts[0].pwm;
+	}
+
+	for (int idx = 1; idx <= last; idx++)
+	{
+		if (pct <= p_pts[idx].output_pct)
+		{
+			return lamp_cal_lerp(pct,
+								 p_pts[idx - 1].output_pct, p_pts[idx].output_pct,
+								 p_pts[idx - 1].pwm, 		p_pts[idx].pwm);
+		}
+	}
+
+	return p_pts[last].pwm;
+}
+
+/**
+ * @brief Converts a latched status frequency into an output percentage
+ *
+ * Only points with a status frequency (i.e. dimmed points) take part. Past
+ * the top dimmed point the last segment is extended, up to 100 %, so outputs
+ * between it and the steady 100 % point still get a value
+ *
+ * @param freq_hz Latched status frequency
+ * @return int Output in percentage, -1 if out of the calibrated range
+ */
+int lamp_cal_freq_to_pct(int freq_hz)
+{
+	const LAMP_CAL_POINT_T* p_prev = NULL;
+	const LAMP_CAL_POINT_T* p_base = NULL;										/* Point under p_prev */
+
+	for (int idx = 0; idx < lamp_cal_curve.count; idx++)
+	{
+		const LAMP_CAL_POINT_T* p_pt = &lamp_cal_curve.points[idx];
+
+		if (p_pt->freq_hz == 0)
+		{
+			continue;
+		}
+
+		if (p_prev != NULL)
+		{
+			int lo = MIN(p_prev->freq_hz, p_pt->freq_hz);
+			int hi = MAX(p_prev->freq_hz, p_pt->freq_hz);
+
+			if ((freq_hz >= lo) && (freq_hz <= hi))
+			{
+				return lamp_cal_lerp(freq_hz,
+									 p_prev->freq_hz,    p_pt->freq_hz,
+									 p_prev->output_pct, p_pt->output_pct);
+			}
+		}
+		else if (freq_hz == p_pt->freq_hz)
+		{
+			return p_pt->output_pct;
+		}
+
+		p_base = p_prev;
+		p_prev = p_pt;
+	}
+
+	if ((p_base != NULL) && 
+		((freq_hz > p_prev->freq_hz) == (p_prev->freq_hz > p_base->freq_hz)))
+	{
+		int pct = lamp_cal_lerp(freq_hz,
+								p_base->freq_hz,    p_prev->freq_hz,
+								p_base->output_pct, p_prev->output_pct);
+
+		return MIN(pct, 100);
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Classifies a latched status frequency into a dimmed power level
+ * 
+ * @param freq_hz Latched status frequency
+ * @return LAMP_PWR_LEVEL_E Level whose band contains the frequency, 
+ * @ref LAMP_PWR_UNKNOWN_C if none
+ */
+LAMP_PWR_LEVEL_E lamp_cal_classify_freq(int freq_hz)
+{
+	for (int idx = 0; idx < count_of(lamp_cal_sweep_levels); idx++)
+	{
+		const LAMP_CAL_BAND_T* p_band = &lamp_cal_bands.level[lamp_cal_sweep_levels[idx]];
+
+		if ((freq_hz > p_band->lo_hz) && (freq_hz < p_band->hi_hz))
+		{
+			return lamp_cal_sweep_levels[idx];
+		}
+	}
+
+	return LAMP_PWR_UNKNOWN_C;
+}
+
+/**
+ * @brief Starts the status frequency band calibration sweep
+ * 
+ * The lamp must be a running dimmable one. Each dimmed level is commanded in 
+ * turn and the latched frequencies are recorded, see 
+ * @ref lamp_cal_band_sweep_on_latch
+ * 
+ * The output requested through the safety logic caps the sweep, it must 
+ * allow every swept level
+ * 
+ * @return true 
+ * @return false Lamp is not in a state where it can be swept
+ */
+bool lamp_cal_band_sweep_start(void)
+{
+	if ((lamp_get_type() != LAMP_TYPE_DIMMABLE_C) || 
+		(lamp_get_lamp_state() != LAMP_STATE_RUNNING_C))
+	{
+		printf("Reject band sweep, lamp not running or not dimmable\n");
+		return false;
+	}
+
+	if (lamp_get_requested_power_pct() < 
+		lamp_get_power_level_pct(lamp_cal_sweep_levels[count_of(lamp_cal_sweep_levels) - 1]))
+	{
+		printf("Reject band sweep, output capped below the swept levels\n");
+		return false;
+	}
+
+	lamp_cal_sweep_step  = 0;
+	lamp_cal_sweep_count = 0;
+	lamp_cal_sweep_state = LAMP_CAL_SWEEP_RUNNING_C;
+
+	printf("Band sweep started\n");
+
+	return true;
+}
+
+/**
+ * @brief Aborts a running band calibration sweep
+ * 
+ * Bands in use are left untouched
+ * 
+ * @return 	void
+ */
+void lamp_cal_band_sweep_abort(void)
+{
+	if (lamp_cal_sweep_state == LAMP_CAL_SWEEP_RUNNING_C)
+	{
+		printf("Band sweep aborted\n");
+		lamp_cal_sweep_state = LAMP_CAL_SWEEP_FAILED_C;
+	}
+}
+
+/**
+ * @brief Returns whether the band calibration sweep is in progress
+ * 
+ * @return true 
+ * @return false 
+ */
+bool lamp_cal_band_sweep_is_running(void)
+{
+	return lamp_cal_sweep_state == LAMP_CAL_SWEEP_RUNNING_C;
+}
+
+/**
+ * @brief Returns the level the sweep wants commanded
+ * 
+ * @return LAMP_PWR_LEVEL_E 
+ */
+LAMP_PWR_LEVEL_E lamp_cal_band_sweep_get_level(void)
+{
+	return lamp_cal_sweep_levels[lamp_cal_sweep_step];
+}
+
+/**
+ * @brief Feeds a latched status frequency to the band calibration sweep
+ * 
+ * Called once per latch (1 s) by the lamp driver while the sweep runs
+ * 
+ * @param freq_hz Latched status frequency
+ * 
+ * @return 	void
+ */
+void lamp_cal_band_sweep_on_latch(int freq_hz)
+{
+	if (lamp_cal_sweep_state != LAMP_CAL_SWEEP_RUNNING_C)
+	{
+		return;
+	}
+
+	if (lamp_get_lamp_state() != LAMP_STATE_RUNNING_C)
+	{
+		lamp_cal_band_sweep_abort();
+		return;
+	}
+
+	if (lamp_cal_sweep_count++ < LAMP_CAL_SWEEP_SETTLE_C)
+	{
+		return;
+	}
+
+	uint8_t sample = lamp_cal_sweep_count - LAMP_CAL_SWEEP_SETTLE_C - 1;
+
+	if (sample == 0)
+	{
+		lamp_cal_sweep_stats[lamp_cal_sweep_step].min_hz = UINT16_MAX;
+		lamp_cal_sweep_stats[lamp_cal_sweep_step].max_hz = 0;
+		lamp_cal_sweep_stats[lamp_cal_sweep_step].sum_hz = 0;
+	}
+
+	lamp_cal_sweep_stats[lamp_cal_sweep_step].min_hz  = MIN(lamp_cal_sweep_stats[lamp_cal_sweep_step].min_hz, freq_hz);
+	lamp_cal_sweep_stats[lamp_cal_sweep_step].max_hz  = MAX(lamp_cal_sweep_stats[lamp_cal_sweep_step].max_hz, freq_hz);
+	lamp_cal_sweep_stats[lamp_cal_sweep_step].sum_hz += freq_hz;
+
+	if (sample + 1 < LAMP_CAL_SWEEP_SAMPLES_C)
+	{
+		return;
+	}
+
+	printf("Band sweep %s: %d..%dHz avg %dHz\n", 
+		   lamp_get_power_level_string(lamp_cal_sweep_levels[lamp_cal_sweep_step]),
+		   lamp_cal_sweep_stats[lamp_cal_sweep_step].min_hz,
+		   lamp_cal_sweep_stats[lamp_cal_sweep_step].max_hz,
+		   lamp_cal_sweep_stats[lamp_cal_sweep_step].sum_hz / LAMP_CAL_SWEEP_SAMPLES_C);
+
+	lamp_cal_sweep_count = 0;
+
+	if (++lamp_cal_sweep_step < count_of(lamp_cal_sweep_levels))
+	{
+		return;
+	}
+
+	lamp_cal_sweep_step  = 0;
+	lamp_cal_sweep_state = lamp_cal_band_sweep_fit() ? LAMP_CAL_SWEEP_DONE_C : 
+													   LAMP_CAL_SWEEP_FAILED_C;
+}
+
+/**
+ * @brief Selects the calibration point to edit
+ * @note This function can be called via external command
+ *
+ * @param idx Point index
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_cal_cmd_set_index(uint16_t idx)
+{
+	if (idx >= LAMP_CAL_MAX_POINTS_C)
+	{
+		return 0;
+	}
+
+	lamp_cal_edit_idx = idx;
+
+	return 1;
+}
+
+/**
+ * @brief Returns the calibration point being edited
+ * @note This function can be called via external command
+ *
+ * @param idx Not used. The function need to comply with format.
+ * @return int16_t Point index
+ */
+int16_t lamp_cal_cmd_get_index(uint16_t idx)
+{
+	return lamp_cal_edit_idx;
+}
+
+/**
+ * @brief Sets the number of points of the edited curve
+ * @note This function can be called via external command
+ *
+ * @param count Points count
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_cal_cmd_set_count(uint16_t count)
+{
+	if ((count < LAMP_CAL_MIN_POINTS_C) || (count > LAMP_CAL_MAX_POINTS_C))
+	{
+		return 0;
+	}
+
+	lamp_cal_edit.count = count;
+
+	return 1;
+}
+
+/**
+ * @brief Returns the number of points of the edited curve
+ * @note This function can be called via external command
+ *
+ * @param count Not used. The function need to comply with format.
+ * @return int16_t Points count
+ */
+int16_t lamp_cal_cmd_get_count(uint16_t count)
+{
+	return lamp_cal_edit.count;
+}
+
+/**
+ * @brief Sets the PWM level of the edited point
+ * @note This function can be called via external command
+ *
+ * @param pwm PWM level
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_cal_cmd_set_pwm(uint16_t pwm)
+{
+	if (pwm > LAMP_CAL_PWM_MAX_C)
+	{
+		return 0;
+	}
+
+	lamp_cal_edit.points[lamp_cal_edit_idx].pwm = pwm;
+
+	return 1;
+}
+
+/**
+ * @brief Returns the PWM level of the edited point
+ * @note This function can be called via external command
+ *
+ * @param pwm Not used. The function need to comply with format.
+ * @return int16_t PWM level
+ */
+int16_t lamp_cal_cmd_get_pwm(uint16_t pwm)
+{
+	return lamp_cal_edit.points[lamp_cal_edit_idx].pwm;
+}
+
+/**
+ * @brief Sets the measured optical output of the edited point
+ * @note This function can be called via external command
+ *
+ * @param pct Output in percentage
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_cal_cmd_set_output(uint16_t pct)
+{
+	if ((pct == 0) || (pct > 100))
+	{
+		return 0;
+	}
+
+	lamp_cal_edit.points[lamp_cal_edit_idx].output_pct = pct;
+
+	return 1;
+}
+
+/**
+ * @brief Returns the measured optical output of the edited point
+ * @note This function can be called via external command
+ *
+ * @param pct Not used. The function need to comply with format.
+ * @return int16_t Output in percentage
+ */
+int16_t lamp_cal_cmd_get_output(uint16_t pct)
+{
+	return lamp_cal_edit.points[lamp_cal_edit_idx].output_pct;
+}
+
+/**
+ * @brief Sets the status frequency of the edited point
+ * @note This function can be called via external command
+ *
+ * @param freq_hz Status frequency, 0 if steady
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_cal_cmd_set_freq(uint16_t freq_hz)
+{
+	lamp_cal_edit.points[lamp_cal_edit_idx].freq_hz = freq_hz;
+
+	return 1;
+}
+
+/**
+ * @brief Returns the status frequency of the edited point
+ * @note This function can be called via external command
+ *
+ * @param freq_hz Not used. The function need to comply with format.
+ * @return int16_t Status frequency
+ */
+int16_t lamp_cal_cmd_get_freq(uint16_t freq_hz)
+{
+	return lamp_cal_edit.points[lamp_cal_edit_idx].freq_hz;
+}
+
+/**
+ * @brief Commits or discards the edited curve
+ * @note This function can be called via external command
+ *
+ * On commit the curve is validated, made active and stored in flash
+ *
+ * @param b_commit 1: validate, apply and store, 0: discard edits
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_cal_cmd_write(uint16_t b_commit)
+{
+	if (b_commit == 0)
+	{
+		lamp_cal_edit = lamp_cal_curve;
+		return 1;
+	}
+
+	if ((b_commit != 1) || !lamp_cal_is_valid(&lamp_cal_edit))
+	{
+		return 0;
+	}
+
+	lamp_cal_curve = lamp_cal_edit;
+
+	lamp_cal_check_dim_pct();
+
+	persistance_set_lamp_cal(&lamp_cal_curve);
+	persistance_write_region();
+
+	return 1;
+}
+
+
+/**
+ * @brief Starts or aborts the band calibration sweep
+ * @note This function can be called via external command
+ * 
+ * @param b_start 1: start, 0: abort
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_cal_cmd_set_sweep(uint16_t b_start)
+{
+	if (b_start == 0)
+	{
+		lamp_cal_band_sweep_abort();
+		return 1;
+	}
+
+	return (b_start == 1) && lamp_cal_band_sweep_start();
+}
+
+/**
+ * @brief Returns the band calibration sweep status
+ * @note This function can be called via external command
+ * 
+ * @param state Not used. The function need to comply with format.
+ * @return int16_t @ref LAMP_CAL_SWEEP_E
+ */
+int16_t lamp_cal_cmd_get_sweep(uint16_t state)
+{
+	return lamp_cal_sweep_state;
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Returns whether a curve can be used for interpolation
+ *
+ * Requires output strictly increasing, ending at 100% and PWM in range
+ *
+ * @param p_curve Curve to check
+ * @return true
+ * @return false
+ */
+static bool lamp_cal_is_valid(const LAMP_CAL_CURVE_T* p_curve)
+{
+	if ((p_curve->count < LAMP_CAL_MIN_POINTS_C) ||
+		(p_curve->count > LAMP_CAL_MAX_POINTS_C))
+	{
+		return false;
+	}
+
+	for (int idx = 0; idx < p_curve->count; idx++)
+	{
+		if ((p_curve->points[idx].pwm > LAMP_CAL_PWM_MAX_C) ||
+			(p_curve->points[idx].output_pct == 0))
+		{
+			return false;
+		}
+
+		if ((idx > 0) &&
+			(p_curve->points[idx].output_pct <= p_curve->points[idx - 1].output_pct))
+		{
+			return false;
+		}
+	}
+
+	return p_curve->points[p_curve->count - 1].output_pct == 100;
+}
+
+/**
+ * @brief Returns whether bands can be used for classification
+ * 
+ * Requires every dimmed band to be well formed, above the steady threshold 
+ * and not overlapping the next level
+ * 
+ * @param p_bands Bands to check
+ * @return true 
+ * @return false 
+ */
+static bool lamp_cal_bands_are_valid(const LAMP_CAL_BANDS_T* p_bands)
+{
+	uint16_t prev_hi_hz = LAMP_CAL_SWEEP_MIN_HZ_C;
+
+	for (int idx = 0; idx < count_of(lamp_cal_sweep_levels); idx++)
+	{
+		const LAMP_CAL_BAND_T* p_band = &p_bands->level[lamp_cal_sweep_levels[idx]];
+
+		if ((p_band->lo_hz < prev_hi_hz) || (p_band->hi_hz <= p_band->lo_hz))
+		{
+			return false;
+		}
+
+		prev_hi_hz = p_band->hi_hz;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Fits the bands from the recorded sweep and stores them in flash
+ * 
+ * Each band is the observed spread widened by a margin. Adjacent bands that 
+ * would overlap are split halfway between their means. The bands are only 
+ * marked dirty, the persistance write-behind commits them once the lamp is 
+ * steady again
+ * 
+ * @return true 
+ * @return false Recorded data is not usable, bands in use are kept
+ */
+static bool lamp_cal_band_sweep_fit(void)
+{
+	LAMP_CAL_BANDS_T bands = {0};
+
+	for (int idx = 0; idx < count_of(lamp_cal_sweep_levels); idx++)
+	{
+		LAMP_CAL_BAND_T* p_band = &bands.level[lamp_cal_sweep_levels[idx]];
+		uint16_t 		 avg_hz = lamp_cal_sweep_stats[idx].sum_hz / LAMP_CAL_SWEEP_SAMPLES_C;
+		uint16_t 		 margin = MAX(LAMP_CAL_BAND_MARGIN_HZ_C, avg_hz / 10);
+
+		if (lamp_cal_sweep_stats[idx].min_hz < LAMP_CAL_SWEEP_MIN_HZ_C)
+		{
+			printf("Band sweep failed, %s status is steady\n", 
+				   lamp_get_power_level_string(lamp_cal_sweep_levels[idx]));
+			return false;
+		}
+
+		p_band->lo_hz = MAX(lamp_cal_sweep_stats[idx].min_hz - margin, LAMP_CAL_SWEEP_MIN_HZ_C);
+		p_band->hi_hz = lamp_cal_sweep_stats[idx].max_hz + margin;
+
+		if (idx > 0)
+		{
+			LAMP_CAL_BAND_T* p_prev = &bands.level[lamp_cal_sweep_levels[idx - 1]];
+			uint16_t 		 prev_avg_hz = lamp_cal_sweep_stats[idx - 1].sum_hz / LAMP_CAL_SWEEP_SAMPLES_C;
+
+			if (p_prev->hi_hz >= p_band->lo_hz)
+			{
+				uint16_t split_hz = (prev_avg_hz + avg_hz) / 2;
+
+				p_prev->hi_hz = split_hz;
+				p_band->lo_hz = split_hz;
+			}
+		}
+	}
+
+	if (!lamp_cal_bands_are_valid(&bands))
+	{
+		printf("Band sweep failed, levels are not separable\n");
+		return false;
+	}
+
+	for (int idx = 0; idx < count_of(lamp_cal_sweep_levels); idx++)
+	{
+		printf("Band %s: %d..%dHz\n", 
+			   lamp_get_power_level_string(lamp_cal_sweep_levels[idx]),
+			   bands.level[lamp_cal_sweep_levels[idx]].lo_hz,
+			   bands.level[lamp_cal_sweep_levels[idx]].hi_hz);
+	}
+
+	lamp_cal_bands = bands;
+
+	persistance_set_lamp_bands(&lamp_cal_bands);
+
+	return true;
+}
+
+/**
+ * @brief Linear interpolation with rounding
+ *
+ * @return int y at x on the segment (x0, y0) - (x1, y1)
+ */
+static int lamp_cal_lerp(int x, int x0, int x1, int y0, int y1)
+{
+	if (x1 == x0)
+	{
+		return y0;
+	}
+
+	int num = (y1 - y0) * (x - x0);
+	int den = x1 - x0;
+
+	if (den < 0)
+	{
+		num = -num;
+		den = -den;
+	}
+
+	return y0 + ((num >= 0) ? (num + den / 2) : (num - den / 2)) / den;
+}
+
+/**
+ * @brief Raises the user dim set-point to the lowest output the curve reaches
+ *
+ * A set-point under the curve would turn the lamp off, see 
+ * @ref lamp_request_power_pct
+ *
+ * @return 	void
+ */
+static void lamp_cal_check_dim_pct(void)
+{
+	if (persistance_get_dim_pct() < lamp_cal_get_min_pct())
+	{
+		printf("Dim set-point %d%% under the curve, raised to %d%%\n",
+			   persistance_get_dim_pct(), lamp_cal_get_min_pct());
+		persistance_set_dim_pct(lamp_cal_get_min_pct());
+	}
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,121 @@
+/**
+ * @file      lamp_cal.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for per-unit lamp dimming calibration
+ *
+ */
+
+#ifndef _D_LAMP_CAL_H_
+#define _D_LAMP_CAL_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lamp.h"
+
+
+/* Exported defines ----------------------------------------------------------*/
+
+#define LAMP_CAL_MAX_POINTS_C		6
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @struct LAMP_CAL_POINT_T
+ * @brief Single measured point of the dimming curve
+ *
+ * Used in persistance region; bump its key version if changed
+ *
+ */
+typedef struct __packed {
+	uint8_t  pwm;																/* PIN_PWM_LAMP level */
+	uint8_t  output_pct;														/* Measured optical output (%) */
+	uint16_t freq_hz;															/* Ballast status frequency, 0 if steady */
+} LAMP_CAL_POINT_T;
+
+/**
+ * @struct LAMP_CAL_CURVE_T
+ * @brief Dimming curve, points sorted by increasing output
+ *
+ * Used in persistance region; bump its key version if changed
+ *
+ */
+typedef struct __packed {
+	uint8_t 		 count;
+	uint8_t 		 _reserved;
+	LAMP_CAL_POINT_T points[LAMP_CAL_MAX_POINTS_C];
+} LAMP_CAL_CURVE_T;
+
+/**
+ * @struct LAMP_CAL_BAND_T
+ * @brief Status frequency window reported by the ballast for a power level
+ *
+ * Used in persistance region; bump its key version if changed
+ *
+ */
+typedef struct __packed {
+	uint16_t lo_hz;
+	uint16_t hi_hz;
+} LAMP_CAL_BAND_T;
+
+/**
+ * @struct LAMP_CAL_BANDS_T
+ * @brief Classification bands, indexed by @ref LAMP_PWR_LEVEL_E
+ *
+ * Only dimmed levels are used, off and 100% report a steady status line
+ *
+ * Used in persistance region; bump its key version if changed
+ *
+ */
+typedef struct __packed {
+	LAMP_CAL_BAND_T level[LAMP_PWR_MAX_SETTINGS_C];
+} LAMP_CAL_BANDS_T;
+
+/**
+ * @enum LAMP_CAL_SWEEP_E
+ * @brief Band calibration sweep status
+ *
+ */
+typedef enum {
+	LAMP_CAL_SWEEP_IDLE_C = 0,
+	LAMP_CAL_SWEEP_RUNNING_C,
+	LAMP_CAL_SWEEP_DONE_C,
+	LAMP_CAL_SWEEP_FAILED_C
+} LAMP_CAL_SWEEP_E;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void lamp_cal_load(void);
+uint8_t lamp_cal_get_min_pct(void);
+uint8_t lamp_cal_pct_to_pwm(uint8_t pct);
+int lamp_cal_freq_to_pct(int freq_hz);
+LAMP_PWR_LEVEL_E lamp_cal_classify_freq(int freq_hz);
+
+bool lamp_cal_band_sweep_start(void);
+void lamp_cal_band_sweep_abort(void);
+bool lamp_cal_band_sweep_is_running(void);
+LAMP_PWR_LEVEL_E lamp_cal_band_sweep_get_level(void);
+void lamp_cal_band_sweep_on_latch(int freq_hz);
+
+int16_t lamp_cal_cmd_set_index(uint16_t idx);
+int16_t lamp_cal_cmd_get_index(uint16_t idx);
+int16_t lamp_cal_cmd_set_count(uint16_t count);
+int16_t lamp_cal_cmd_get_count(uint16_t count);
+int16_t lamp_cal_cmd_set_pwm(uint16_t pwm);
+int16_t lamp_cal_cmd_get_pwm(uint16_t pwm);
+int16_t lamp_cal_cmd_set_output(uint16_t pct);
+int16_t lamp_cal_cmd_get_output(uint16_t pct);
+int16_t lamp_cal_cmd_set_freq(uint16_t freq_hz);
+int16_t lamp_cal_cmd_get_freq(uint16_t freq_hz);
+int16_t lamp_cal_cmd_write(uint16_t b_commit);
+int16_t lamp_cal_cmd_set_sweep(uint16_t b_start);
+int16_t lamp_cal_cmd_get_sweep(uint16_t state);
+
+
+#endif /* _D_LAMP_CAL_H_ */
+
+/*** END OF FILE ***/
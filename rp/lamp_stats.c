@@ -0,0 +1,507 @@
+/**
+ * @file      lamp_stats.c
+ * @author    The OSLUV Project
+ * @brief     Lamp lifetime counters for bulb replacement planning
+ * @schematic lamp_controller.SchDoc
+ *
+ * Burn time per commanded level and the strike, restrike, failed-off and
+ * full-power test outcomes are counted in RAM from the lamp state transitions.
+ * Supply cutoffs are counted too, and the last one is kept for post-mortem.
+ *
+ * Counters are checkpointed as one record per flash page, appended round-robin
+ * over the lamp stats region (@ref flash_map.h). The newest valid record wins
+ * at boot, so a sector is only erased once every FLASH_SECTOR_SIZE /
+ * FLASH_PAGE_SIZE checkpoints and the previous sector still holds a good copy
+ * while it is. At the periodic rate this is well below an erase per sector per
+ * day.
+ *
+ * A supply cutoff is saved at once only into an already erased page. A sector
+ * erase masks interrupts for tens of ms, so it waits for the 12V rail to be
+ * back in its window.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+#include <pico/stdlib.h>
+#include <pico/flash.h>
+#include <hardware/flash.h>
+
+#include "lamp_stats.h"
+#include "flash_map.h"
+
+
+/* Private typedef -----------------------------------------------------------*/
+
+/**
+ * @struct LAMP_STATS_RECORD_T
+ * @brief Flash record, one per page
+ *
+ */
+typedef struct __packed {
+	uint32_t 	 magic;
+	uint32_t 	 seq;															/* Increments on every checkpoint */
+	LAMP_STATS_T stats;
+	uint32_t 	 checksum;														/* FNV-1a up to this field */
+} LAMP_STATS_RECORD_T;
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define LAMP_STATS_MAGIC_VAL_C			0x4c535402
+#define LAMP_STATS_PAGES_C				(FLASH_MAP_LAMP_STATS_SIZE_C / FLASH_PAGE_SIZE)
+#define LAMP_STATS_PAGES_PER_SECTOR_C	(FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+#define LAMP_STATS_PERIOD_US_C			(15ULL * 60 * 1000 * 1000)				/* Checkpoint of burn time */
+#define LAMP_STATS_HOLDOFF_US_C			(60ULL * 1000 * 1000)					/* Minimum between event checkpoints */
+
+static_assert(sizeof(LAMP_STATS_RECORD_T) <= FLASH_PAGE_SIZE, "Lamp stats record exceeds a flash page");
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static LAMP_STATS_T 	lamp_stats 			= {0};
+static uint64_t 		lamp_stats_frac_us[LAMP_PWR_MAX_SETTINGS_C] = {0};		/* Burn time not yet in whole seconds */
+static uint64_t 		lamp_stats_last_us 	= 0;
+static uint64_t 		lamp_stats_ckpt_us 	= 0;								/* Last checkpoint */
+
+static uint32_t 		lamp_stats_seq 		 = 0;
+static uint16_t 		lamp_stats_next_page = 0;
+
+static bool 			b_lamp_stats_is_dirty  = false;
+static bool 			b_lamp_stats_is_urgent = false;							/* Event to save without waiting the period */
+static bool 			b_lamp_stats_is_forced = false;							/* Checkpoint requested over command port */
+static bool 			b_lamp_stats_is_cutoff = false;							/* Cutoff to save, no erase until the supply is back */
+
+static uint8_t 			lamp_stats_page_buf[FLASH_PAGE_SIZE] __aligned(4);
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static const LAMP_STATS_RECORD_T* lamp_stats_get_record(uint16_t page);
+static uint32_t lamp_stats_checksum(const LAMP_STATS_RECORD_T* p_record);
+static bool lamp_stats_page_is_blank(uint16_t page);
+static void lamp_stats_checkpoint(void);
+static void lamp_stats_retry_later(void);
+static void lamp_stats_erase_inner(void* p_offset);
+static void lamp_stats_program_inner(void* p_offset);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Restores the counters from the newest valid flash record
+ *
+ * @return 	void
+ */
+void lamp_stats_init(void)
+{
+	const LAMP_STATS_RECORD_T* p_newest = NULL;
+	uint16_t 				   newest_page = 0;
+
+	for (uint16_t page = 0; page < LAMP_STATS_PAGES_C; page++)
+	{
+		const LAMP_STATS_RECORD_T* p_record = lamp_stats_get_record(page);
+
+		if ((p_record->magic != LAMP_STATS_MAGIC_VAL_C) ||
+			(p_record->checksum != lamp_stats_checksum(p_record)))
+		{
+			continue;
+		}
+
+		if ((p_newest == NULL) || ((int32_t)(p_record->seq - p_newest->seq) > 0))
+		{
+			p_newest    = p_record;
+			newest_page = page;
+		}
+	}
+
+	if (p_newest != NULL)
+	{
+		lamp_stats 			 = p_newest->stats;
+		lamp_stats_seq 		 = p_newest->seq;
+		lamp_stats_next_page = (newest_page + 1) % LAMP_STATS_PAGES_C;
+
+		printf("Lamp stats restored, record %lu\n", (unsigned long)lamp_stats_seq);
+	}
+	else
+	{
+		memset(&lamp_stats, 0, sizeof(lamp_stats));
+		lamp_stats_seq 		 = 0;
+		lamp_stats_next_page = 0;
+
+		printf("Lamp stats empty\n");
+	}
+
+	lamp_stats_last_us = time_us_64();
+	lamp_stats_ckpt_us = lamp_stats_last_us;
+}
+
+/**
+ * @brief Accumulates burn time and checkpoints the counters when due
+ *
+ * Burn time is only counted while the lamp is lit, at the level the ballast
+ * reports, not the one commanded during a strike or a restrike. At most one 
+ * flash operation is done per call
+ *
+ * @return 	void
+ */
+void lamp_stats_update(void)
+{
+	uint64_t 		 now   = time_us_64();
+	LAMP_STATE_E 	 state = lamp_get_lamp_state();
+	LAMP_PWR_LEVEL_E level;
+
+	if (((state == LAMP_STATE_RUNNING_C) || (state == LAMP_STATE_FULLPOWER_TEST_C)) &&
+		lamp_get_reported_power_level(&level) && 
+		(level != LAMP_PWR_OFF_C))
+	{
+		lamp_stats_frac_us[level] += now - lamp_stats_last_us;
+
+		if (lamp_stats_frac_us[level] >= (1000*1000))
+		{
+			lamp_stats.on_s[level] 	  += lamp_stats_frac_us[level] / (1000*1000);
+			lamp_stats_frac_us[level] %= (1000*1000);
+
+			b_lamp_stats_is_dirty = true;
+		}
+	}
+
+	lamp_stats_last_us = now;
+
+	if (!b_lamp_stats_is_dirty)
+	{
+		return;
+	}
+
+	if (b_lamp_stats_is_forced ||
+		((now - lamp_stats_ckpt_us) > LAMP_STATS_PERIOD_US_C) ||
+		(b_lamp_stats_is_urgent && ((now - lamp_stats_ckpt_us) > LAMP_STATS_HOLDOFF_US_C)))
+	{
+		lamp_stats_checkpoint();
+	}
+}
+
+/**
+ * @brief Counts the events of a lamp state transition
+ *
+ * @param from Leaving state
+ * @param to Entered state
+ *
+ * @return 	void
+ */
+void lamp_stats_on_transition(LAMP_STATE_E from, LAMP_STATE_E to)
+{
+	switch (to)
+	{
+		case LAMP_STATE_STARTING_C:
+			if ((from == LAMP_STATE_OFF_C) || (from == LAMP_STATE_FAILED_OFF_C))
+			{
+				lamp_stats.strikes++;
+			}
+		break;
+
+		case LAMP_STATE_RESTRIKE_ATTEMPT_1_C:
+		case LAMP_STATE_RESTRIKE_ATTEMPT_2_C:
+		case LAMP_STATE_RESTRIKE_ATTEMPT_3_C:
+			lamp_stats.restrikes++;
+		break;
+
+		case LAMP_STATE_FAILED_OFF_C:
+			lamp_stats.failed_off++;
+			b_lamp_stats_is_urgent = true;
+		break;
+
+		case LAMP_STATE_OFF_C:
+			b_lamp_stats_is_urgent = true;										/* Power is often cut next */
+		break;
+
+		default:
+		break;
+	}
+
+	if (from == LAMP_STATE_FULLPOWER_TEST_C)
+	{
+		if (to == LAMP_STATE_RUNNING_C)
+		{
+			lamp_stats.fullpower_pass++;
+		}
+		else if (to == LAMP_STATE_RESTRIKE_COOLDOWN_1_C)
+		{
+			lamp_stats.fullpower_fail++;
+			b_lamp_stats_is_urgent = true;
+		}
+	}
+
+	b_lamp_stats_is_dirty = true;
+}
+
+/**
+ * @brief Records a supply cutoff and saves it on the next update
+ *
+ * Saved at once only if the next page is erased, see lamp_stats_checkpoint()
+ *
+ * @param p_event Cutoff record from the sense driver
+ *
+ * @return 	void
+ */
+void lamp_stats_on_supply_cutoff(const SENSE_CUTOFF_EVENT_T* p_event)
+{
+	lamp_stats.supply_cutoffs++;
+	lamp_stats.last_cutoff = *p_event;
+
+	b_lamp_stats_is_dirty  = true;
+	b_lamp_stats_is_forced = true;
+	b_lamp_stats_is_cutoff = true;
+}
+
+/**
+ * @brief Returns the lifetime counters, including the not yet saved part
+ *
+ * @return const LAMP_STATS_T*
+ */
+const LAMP_STATS_T* lamp_stats_get(void)
+{
+	return &lamp_stats;
+}
+
+/**
+ * @brief Requests an immediate checkpoint of the counters
+ * @note This function can be called via external command
+ *
+ * @param b_now 1: checkpoint on next update
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t lamp_stats_cmd_checkpoint(uint16_t b_now)
+{
+	if (b_now != 1)
+	{
+		return 0;
+	}
+
+	b_lamp_stats_is_dirty  = true;
+	b_lamp_stats_is_forced = true;
+
+	return 1;
+}
+
+/**
+ * @brief Formats all the counters as a single line
+ * @note This function can be called via external command
+ *
+ * Burn times are in seconds for 20/40/70/100%, full-power tests as pass/fail
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t lamp_stats_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+	int text_len = snprintf((char*)p_buf, len,
+							"ON=%lu/%lu/%lu/%lu,STR=%lu,RST=%lu,FOFF=%lu,FP=%lu/%lu,SEQ=%lu",
+							(unsigned long)lamp_stats.on_s[LAMP_PWR_20PCT_C],
+							(unsigned long)lamp_stats.on_s[LAMP_PWR_40PCT_C],
+							(unsigned long)lamp_stats.on_s[LAMP_PWR_70PCT_C],
+							(unsigned long)lamp_stats.on_s[LAMP_PWR_100PCT_C],
+							(unsigned long)lamp_stats.strikes,
+							(unsigned long)lamp_stats.restrikes,
+							(unsigned long)lamp_stats.failed_off,
+							(unsigned long)lamp_stats.fullpower_pass,
+							(unsigned long)lamp_stats.fullpower_fail,
+							(unsigned long)lamp_stats_seq);
+
+	return (text_len < 0) ? 0 : MIN(text_len, len - 1);
+}
+
+
+/**
+ * @brief Formats the supply cutoff count and last cutoff record
+ * @note This function can be called via external command
+ *
+ * Rails are VBUS/12V/24V in mV, time is since the boot the cutoff happened in
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t lamp_stats_cmd_get_cutoff_text(uint8_t* p_buf, uint16_t len)
+{
+	int text_len = snprintf((char*)p_buf, len,
+							"N=%lu,RAIL=%u,MS=%lu,MV=%u/%u/%u",
+							(unsigned long)lamp_stats.supply_cutoffs,
+							lamp_stats.last_cutoff.rail,
+							(unsigned long)lamp_stats.last_cutoff.time_ms,
+							lamp_stats.last_cutoff.rail_mv[SENSE_RAIL_VBUS_C],
+							lamp_stats.last_cutoff.rail_mv[SENSE_RAIL_12V_C],
+							lamp_stats.last_cutoff.rail_mv[SENSE_RAIL_24V_C]);
+
+	return (text_len < 0) ? 0 : MIN(text_len, len - 1);
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Returns the record stored at a page of the lamp stats region
+ *
+ * @param page Page index in the region
+ * @return const LAMP_STATS_RECORD_T* Memory-mapped record
+ */
+static const LAMP_STATS_RECORD_T* lamp_stats_get_record(uint16_t page)
+{
+	return (const LAMP_STATS_RECORD_T*)(XIP_BASE + FLASH_MAP_LAMP_STATS_OFFSET_C +
+										(page * FLASH_PAGE_SIZE));
+}
+
+/**
+ * @brief FNV-1a over the record up to the checksum field
+ *
+ * @param p_record Record to check
+ * @return uint32_t
+ */
+static uint32_t lamp_stats_checksum(const LAMP_STATS_RECORD_T* p_record)
+{
+	const uint8_t* p_byte = (const uint8_t*)p_record;
+	uint32_t 	   hash   = 0x811c9dc5;
+
+	for (size_t idx = 0; idx < offsetof(LAMP_STATS_RECORD_T, checksum); idx++)
+	{
+		hash ^= p_byte[idx];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Returns whether a page is erased and can be programmed
+ *
+ * @param page Page index in the region
+ * @return true
+ * @return false
+ */
+static bool lamp_stats_page_is_blank(uint16_t page)
+{
+	const uint8_t* p_byte = (const uint8_t*)lamp_stats_get_record(page);
+
+	for (int idx = 0; idx < FLASH_PAGE_SIZE; idx++)
+	{
+		if (p_byte[idx] != 0xff)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Writes the counters to the next page of the region
+ *
+ * A used page must be erased first; the sector erase and the page program are
+ * done on separate calls so each stall is a single flash operation. Status
+ * edges are missed while flash runs, so the lamp frequency window is restarted
+ * afterwards. After a supply cutoff the erase waits for the supply to be back.
+ *
+ * Sequence and page only move on once the page is programmed. A failed flash
+ * operation is retried after LAMP_STATS_HOLDOFF_US_C.
+ *
+ * @return 	void
+ */
+static void lamp_stats_checkpoint(void)
+{
+	uint32_t offset = FLASH_MAP_LAMP_STATS_OFFSET_C + (lamp_stats_next_page * FLASH_PAGE_SIZE);
+
+	if (!lamp_stats_page_is_blank(lamp_stats_next_page))
+	{
+		if ((lamp_stats_next_page % LAMP_STATS_PAGES_PER_SECTOR_C) != 0)
+		{
+			/* Never erase the sector holding the newest record, skip to the next one */
+			lamp_stats_next_page = ((lamp_stats_next_page / LAMP_STATS_PAGES_PER_SECTOR_C + 1) *
+									LAMP_STATS_PAGES_PER_SECTOR_C) % LAMP_STATS_PAGES_C;
+			return;
+		}
+
+		if (b_lamp_stats_is_cutoff && !lamp_is_power_ok())
+		{
+			return;																/* No erase while the rail collapses */
+		}
+
+		int result = flash_safe_execute(lamp_stats_erase_inner, (void*)(uintptr_t)offset, 100);
+
+		lamp_restart_status_window();
+
+		if (result != PICO_OK)
+		{
+			printf("Lamp stats erase failed (%d)\n", result);
+			lamp_stats_retry_later();
+		}
+		return;
+	}
+
+	LAMP_STATS_RECORD_T* p_record = (LAMP_STATS_RECORD_T*)lamp_stats_page_buf;
+
+	memset(lamp_stats_page_buf, 0xff, sizeof(lamp_stats_page_buf));
+
+	p_record->magic    = LAMP_STATS_MAGIC_VAL_C;
+	p_record->seq 	   = lamp_stats_seq + 1;
+	p_record->stats    = lamp_stats;
+	p_record->checksum = lamp_stats_checksum(p_record);
+
+	int result = flash_safe_execute(lamp_stats_program_inner, (void*)(uintptr_t)offset, 100);
+
+	lamp_restart_status_window();
+
+	if (result != PICO_OK)
+	{
+		printf("Lamp stats program failed (%d)\n", result);
+		lamp_stats_retry_later();
+		return;
+	}
+
+	lamp_stats_seq 		 = p_record->seq;
+	lamp_stats_next_page = (lamp_stats_next_page + 1) % LAMP_STATS_PAGES_C;
+	lamp_stats_ckpt_us 	 = time_us_64();
+
+	b_lamp_stats_is_dirty  = false;
+	b_lamp_stats_is_urgent = false;
+	b_lamp_stats_is_forced = false;
+	b_lamp_stats_is_cutoff = false;
+}
+
+/**
+ * @brief Holds the pending checkpoint back for LAMP_STATS_HOLDOFF_US_C
+ *
+ * @return 	void
+ */
+static void lamp_stats_retry_later(void)
+{
+	lamp_stats_ckpt_us 	   = time_us_64();
+	b_lamp_stats_is_urgent = true;
+	b_lamp_stats_is_forced = false;
+}
+
+/**
+ * @brief Erases the lamp stats sector starting at the given offset
+ *
+ */
+static void lamp_stats_erase_inner(void* p_offset)
+{
+	flash_range_erase((uint32_t)(uintptr_t)p_offset, FLASH_SECTOR_SIZE);
+}
+
+/**
+ * @brief Programs the page buffer at the given offset
+ *
+ */
+static void lamp_stats_program_inner(void* p_offset)
+{
+	flash_range_program((uint32_t)(uintptr_t)p_offset, lamp_stats_page_buf, FLASH_PAGE_SIZE);
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,56 @@
+/**
+ * @file      lamp_stats.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for lamp lifetime counters
+ *
+ */
+
+#ifndef _D_LAMP_STATS_H_
+#define _D_LAMP_STATS_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lamp.h"
+#include "sense.h"
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @struct LAMP_STATS_T
+ * @brief Lamp lifetime counters
+ *
+ * Stored in the lamp stats flash region; bump magic if changed
+ *
+ */
+typedef struct __packed {
+	uint32_t on_s[LAMP_PWR_MAX_SETTINGS_C];										/* Burn time per commanded level (s) */
+	uint32_t strikes;															/* Starts requested from off */
+	uint32_t restrikes;															/* Restrike attempts */
+	uint32_t failed_off;														/* All restrike attempts failed */
+	uint32_t fullpower_pass;													/* Full-power tests passed */
+	uint32_t fullpower_fail;													/* Full-power tests timed out */
+	uint32_t supply_cutoffs;													/* Supply out of window trips */
+	SENSE_CUTOFF_EVENT_T last_cutoff;
+} LAMP_STATS_T;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void lamp_stats_init(void);
+void lamp_stats_update(void);
+void lamp_stats_on_transition(LAMP_STATE_E from, LAMP_STATE_E to);
+void lamp_stats_on_supply_cutoff(const SENSE_CUTOFF_EVENT_T* p_event);
+const LAMP_STATS_T* lamp_stats_get(void);
+
+int16_t lamp_stats_cmd_checkpoint(uint16_t b_now);
+uint16_t lamp_stats_cmd_get_text(uint8_t* p_buf, uint16_t len);
+uint16_t lamp_stats_cmd_get_cutoff_text(uint8_t* p_buf, uint16_t len);
+
+
+#endif /* _D_LAMP_STATS_H_ */
+
+/*** END OF FILE ***/
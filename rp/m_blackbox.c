@@ -0,0 +1,568 @@
+/**
+ * @file      m_blackbox.c
+ * @author    The OSLUV Project
+ * @brief     Module for the black-box event ring, for post-mortem analysis
+ *
+ * Lamp state transitions, supply cutoffs and power excursions, radar dropouts,
+ * safety decisions and the reboot reason are logged as fixed size binary
+ * events. Logging only appends to a RAM queue; m_blackbox_update() packs the
+ * queue into pages appended round-robin over the black-box region
+ * (@ref flash_map.h), the oldest sector being erased when the ring wraps.
+ *
+ * A page is written once full, or after M_BLACKBOX_MAX_AGE_MS_C, and only
+ * while the lamp is steady, so the flash stall never lands on a strike.
+ * Failures and cutoffs are written on the next update as power may be gone
+ * soon after, but never before the strike window ends. At most one flash
+ * operation is done per update.
+ *
+ * The sector the ring enters next is erased ahead while idle. Right after a
+ * supply cutoff pages are only programmed, an erase would mask interrupts
+ * for its whole length while the rail collapses.
+ *
+ * The ring is read back oldest first with G:BB, a few events per reply, after
+ * rewinding with S:BB:0.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/vreg_and_chip_reset.h"
+#include "m_blackbox.h"
+#include "flash_map.h"
+#include "lamp.h"
+#include "sense.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define M_BLACKBOX_MAGIC_VAL_C          0x42424f58
+#define M_BLACKBOX_PAGES_C              (FLASH_MAP_BLACKBOX_SIZE_C / FLASH_PAGE_SIZE)
+#define M_BLACKBOX_PAGES_PER_SECTOR_C   (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define M_BLACKBOX_EVTS_PER_PAGE_C      20
+#define M_BLACKBOX_RAM_EVTS_C           32                                      /* Queue not yet in flash */
+#define M_BLACKBOX_RAM_HIGH_C           (M_BLACKBOX_RAM_EVTS_C - 4)             /* Written even if the lamp is not steady */
+#define M_BLACKBOX_MAX_AGE_MS_C         (60 * 1000)                             /* Oldest queued event */
+#define M_BLACKBOX_EVT_TEXT_LEN_C       29                                      /* Hex event and separator */
+#define M_BLACKBOX_RETRY_MS_C           1000                                    /* Flash not reached, wait before the next try */
+#define M_BLACKBOX_CUTOFF_HOLD_MS_C     5000                                    /* No erase after a cutoff, supply back or not */
+
+
+/* Private typedef -----------------------------------------------------------*/
+
+/**
+ * @struct M_BLACKBOX_PAGE_T
+ * @brief Flash page
+ *
+ */
+typedef struct __packed {
+    uint32_t         magic;
+    uint32_t         seq;                                                       /* Increments on every page */
+    uint16_t         boot;                                                      /* Increments on every boot */
+    uint8_t          count;                                                     /* Events used */
+    uint8_t          _reserved;
+    M_BLACKBOX_EVT_T evts[M_BLACKBOX_EVTS_PER_PAGE_C];
+    uint32_t         checksum;                                                  /* FNV-1a up to this field */
+} M_BLACKBOX_PAGE_T;
+
+static_assert(sizeof(M_BLACKBOX_PAGE_T) <= FLASH_PAGE_SIZE, "Black-box page exceeds a flash page");
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static M_BLACKBOX_EVT_T m_blackbox_queue[M_BLACKBOX_RAM_EVTS_C];
+static uint8_t          m_blackbox_head = 0;                                    /* Oldest queued event */
+static uint8_t          m_blackbox_count = 0;
+static uint32_t         m_blackbox_dropped = 0;                                 /* Queue overflows since boot */
+
+static uint32_t         m_blackbox_seq = 0;                                     /* Last page written */
+static uint16_t         m_blackbox_next_page = 0;
+static uint16_t         m_blackbox_boot = 0;
+
+static bool             b_m_blackbox_is_urgent = false;                         /* Write without waiting for a steady lamp */
+static bool             b_m_blackbox_is_forced = false;                         /* Write all, requested over command port */
+static bool             b_m_blackbox_is_power_ok = true;
+static bool             b_m_blackbox_is_cutoff = false;                         /* Erases held, see m_blackbox_may_erase() */
+static uint32_t         m_blackbox_cutoff_ms = 0;
+static absolute_time_t  m_blackbox_retry_at;
+
+static uint32_t         m_blackbox_cursor_seq = 0;                              /* Download position */
+static uint8_t          m_blackbox_cursor_evt = 0;
+
+static uint8_t          m_blackbox_page_buf[FLASH_PAGE_SIZE] __aligned(4);
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static const M_BLACKBOX_PAGE_T* m_blackbox_get_page(uint16_t page);
+static bool m_blackbox_page_is_valid(const M_BLACKBOX_PAGE_T* p_page);
+static uint32_t m_blackbox_checksum(const M_BLACKBOX_PAGE_T* p_page);
+static bool m_blackbox_page_is_blank(uint16_t page);
+static bool m_blackbox_may_erase(void);
+static void m_blackbox_erase_ahead(void);
+static void m_blackbox_flush(void);
+static void m_blackbox_erase_inner(void* p_offset);
+static void m_blackbox_program_inner(void* p_offset);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Black-box module initialization procedure
+ *
+ * Finds the end of the ring and logs the reboot reason, as early as possible
+ * in the boot
+ *
+ */
+void m_blackbox_init(void)
+{
+    const M_BLACKBOX_PAGE_T* p_newest    = NULL;
+    uint16_t                 newest_page = 0;
+
+    for (uint16_t page = 0; page < M_BLACKBOX_PAGES_C; page++)
+    {
+        const M_BLACKBOX_PAGE_T* p_page = m_blackbox_get_page(page);
+
+        if (!m_blackbox_page_is_valid(p_page))
+        {
+            continue;
+        }
+
+        if ((p_newest == NULL) || ((int32_t)(p_page->seq - p_newest->seq) > 0))
+        {
+            p_newest    = p_page;
+            newest_page = page;
+        }
+    }
+
+    if (p_newest != NULL)
+    {
+        m_blackbox_seq       = p_newest->seq;
+        m_blackbox_boot      = p_newest->boot + 1;
+        m_blackbox_next_page = (newest_page + 1) % M_BLACKBOX_PAGES_C;
+    }
+    else
+    {
+        m_blackbox_seq       = 0;
+        m_blackbox_boot      = 1;
+        m_blackbox_next_page = 0;
+    }
+
+    printf("Black box boot %u, page %lu\n", m_blackbox_boot, (unsigned long)m_blackbox_seq);
+
+    m_blackbox_log(M_BLACKBOX_EVT_BOOT_C,
+                   watchdog_caused_reboot(),
+                   0,
+                   vreg_and_chip_reset_hw->chip_reset);
+
+    b_m_blackbox_is_urgent = true;
+}
+
+/**
+ * @brief Tracks the supply and writes the queued events when due
+ *
+ * @return  void
+ */
+void m_blackbox_update(void)
+{
+    bool b_is_power_ok = lamp_is_power_ok();
+
+    if (b_is_power_ok != b_m_blackbox_is_power_ok)
+    {
+        b_m_blackbox_is_power_ok = b_is_power_ok;
+
+        m_blackbox_log(M_BLACKBOX_EVT_SUPPLY_POWER_C, b_is_power_ok, g_sense_12v_mv, g_sense_24v_mv);
+    }
+
+    if (lamp_is_warming() || !time_reached(m_blackbox_retry_at))
+    {
+        return;                                                                 /* Urgent events too, the strike comes first */
+    }
+
+    if (m_blackbox_count == 0)
+    {
+        b_m_blackbox_is_urgent = false;
+        b_m_blackbox_is_forced = false;
+
+        if (lamp_is_steady())
+        {
+            m_blackbox_erase_ahead();
+        }
+
+        return;
+    }
+
+    uint32_t age_ms = to_ms_since_boot(get_absolute_time()) - m_blackbox_queue[m_blackbox_head].time_ms;
+
+    if (b_m_blackbox_is_urgent ||
+        b_m_blackbox_is_forced ||
+        (m_blackbox_count >= M_BLACKBOX_RAM_HIGH_C) ||
+        (lamp_is_steady() && ((m_blackbox_count >= M_BLACKBOX_EVTS_PER_PAGE_C) ||
+                              (age_ms >= M_BLACKBOX_MAX_AGE_MS_C))))
+    {
+        m_blackbox_flush();
+    }
+}
+
+/**
+ * @brief Queues an event, the oldest one is dropped when the queue is full
+ *
+ * From the main loop only. Lamp failures and supply cutoffs are written on
+ * the next update.
+ *
+ * @param type @ref M_BLACKBOX_EVT_E
+ * @param code See @ref M_BLACKBOX_EVT_E
+ * @param aux See @ref M_BLACKBOX_EVT_E
+ * @param value See @ref M_BLACKBOX_EVT_E
+ */
+void m_blackbox_log(M_BLACKBOX_EVT_E type, uint8_t code, uint16_t aux, uint32_t value)
+{
+    M_BLACKBOX_EVT_T* p_evt;
+
+    if (m_blackbox_count >= M_BLACKBOX_RAM_EVTS_C)
+    {
+        m_blackbox_head = (m_blackbox_head + 1) % M_BLACKBOX_RAM_EVTS_C;
+        m_blackbox_count--;
+        m_blackbox_dropped++;
+    }
+
+    p_evt = &m_blackbox_queue[(m_blackbox_head + m_blackbox_count) % M_BLACKBOX_RAM_EVTS_C];
+
+    p_evt->time_ms = to_ms_since_boot(get_absolute_time());
+    p_evt->type    = type;
+    p_evt->code    = code;
+    p_evt->aux     = aux;
+    p_evt->value   = value;
+
+    m_blackbox_count++;
+
+    if ((type == M_BLACKBOX_EVT_SUPPLY_CUTOFF_C) ||
+        ((type == M_BLACKBOX_EVT_LAMP_STATE_C) && (code == LAMP_STATE_FAILED_OFF_C)))
+    {
+        b_m_blackbox_is_urgent = true;
+    }
+
+    if (type == M_BLACKBOX_EVT_SUPPLY_CUTOFF_C)
+    {
+        b_m_blackbox_is_cutoff = true;
+        m_blackbox_cutoff_ms   = p_evt->time_ms;
+    }
+}
+
+/**
+ * @brief Rewinds the download or writes the queue now
+ * @note This function can be called via external command
+ *
+ * @param value 0: rewind to the oldest event, 1: write all queued events
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t m_blackbox_cmd_set(uint16_t value)
+{
+    if (value == 0)
+    {
+        m_blackbox_cursor_seq = 0;
+        m_blackbox_cursor_evt = 0;
+
+        return 1;
+    }
+
+    if (value == 1)
+    {
+        b_m_blackbox_is_forced = true;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Formats the next stored events and advances the download
+ * @note This function can be called via external command
+ *
+ * Events are hex boot(4) time_ms(8) type(2) code(2) aux(4) value(8), separated
+ * by ';'. Once all are read the reply is END with the boot number, last page,
+ * queued and dropped events.
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t m_blackbox_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+    const M_BLACKBOX_PAGE_T* p_next = NULL;
+    int                      text_len = 0;
+
+    for (uint16_t page = 0; page < M_BLACKBOX_PAGES_C; page++)
+    {
+        const M_BLACKBOX_PAGE_T* p_page = m_blackbox_get_page(page);
+
+        if (m_blackbox_page_is_valid(p_page) &&
+            (p_page->seq >= m_blackbox_cursor_seq) &&
+            ((p_next == NULL) || (p_page->seq < p_next->seq)))
+        {
+            p_next = p_page;
+        }
+    }
+
+    if (p_next == NULL)
+    {
+        text_len = snprintf((char*)p_buf, len, "END,BOOT=%u,SEQ=%lu,PEND=%u,DROP=%lu",
+                            m_blackbox_boot,
+                            (unsigned long)m_blackbox_seq,
+                            m_blackbox_count,
+                            (unsigned long)m_blackbox_dropped);
+
+        return (text_len < 0) ? 0 : MIN(text_len, len - 1);
+    }
+
+    if (p_next->seq != m_blackbox_cursor_seq)
+    {
+        m_blackbox_cursor_seq = p_next->seq;
+        m_blackbox_cursor_evt = 0;
+    }
+
+    while ((m_blackbox_cursor_evt < p_next->count) &&
+           ((text_len + M_BLACKBOX_EVT_TEXT_LEN_C) < len))
+    {
+        const M_BLACKBOX_EVT_T* p_evt = &p_next->evts[m_blackbox_cursor_evt];
+
+        text_len += snprintf((char*)p_buf + text_len, len - text_len,
+                             "%s%04x%08lx%02x%02x%04x%08lx",
+                             (text_len > 0) ? ";" : "",
+                             p_next->boot,
+                             (unsigned long)p_evt->time_ms,
+                             p_evt->type,
+                             p_evt->code,
+                             p_evt->aux,
+                             (unsigned long)p_evt->value);
+
+        m_blackbox_cursor_evt++;
+    }
+
+    if (m_blackbox_cursor_evt >= p_next->count)
+    {
+        m_blackbox_cursor_seq = p_next->seq + 1;
+        m_blackbox_cursor_evt = 0;
+    }
+
+    return MIN(text_len, len - 1);
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Returns a page of the black-box region
+ *
+ * @param page Page index in the region
+ * @return const M_BLACKBOX_PAGE_T* Memory-mapped page
+ */
+static const M_BLACKBOX_PAGE_T* m_blackbox_get_page(uint16_t page)
+{
+    return (const M_BLACKBOX_PAGE_T*)(XIP_BASE + FLASH_MAP_BLACKBOX_OFFSET_C + (page * FLASH_PAGE_SIZE));
+}
+
+/**
+ * @brief Checks the magic, count and checksum of a page
+ *
+ * @param p_page Page to check
+ * @return true
+ * @return false
+ */
+static bool m_blackbox_page_is_valid(const M_BLACKBOX_PAGE_T* p_page)
+{
+    return (p_page->magic == M_BLACKBOX_MAGIC_VAL_C) &&
+           (p_page->count <= M_BLACKBOX_EVTS_PER_PAGE_C) &&
+           (p_page->checksum == m_blackbox_checksum(p_page));
+}
+
+/**
+ * @brief FNV-1a over the page up to the checksum field
+ *
+ * @param p_page Page to check
+ * @return uint32_t
+ */
+static uint32_t m_blackbox_checksum(const M_BLACKBOX_PAGE_T* p_page)
+{
+    const uint8_t* p_byte = (const uint8_t*)p_page;
+    uint32_t       hash   = 0x811c9dc5;
+
+    for (size_t idx = 0; idx < offsetof(M_BLACKBOX_PAGE_T, checksum); idx++)
+    {
+        hash ^= p_byte[idx];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Returns whether a page is erased and can be programmed
+ *
+ * @param page Page index in the region
+ * @return true
+ * @return false
+ */
+static bool m_blackbox_page_is_blank(uint16_t page)
+{
+    const uint8_t* p_byte = (const uint8_t*)m_blackbox_get_page(page);
+
+    for (int idx = 0; idx < FLASH_PAGE_SIZE; idx++)
+    {
+        if (p_byte[idx] != 0xff)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns whether a sector erase is allowed now
+ *
+ * Not within M_BLACKBOX_CUTOFF_HOLD_MS_C of a supply cutoff, nor after it
+ * until the supply is back
+ *
+ * @return true
+ * @return false
+ */
+static bool m_blackbox_may_erase(void)
+{
+    if (b_m_blackbox_is_cutoff)
+    {
+        if (((to_ms_since_boot(get_absolute_time()) - m_blackbox_cutoff_ms) < M_BLACKBOX_CUTOFF_HOLD_MS_C) ||
+            !lamp_is_power_ok())
+        {
+            return false;
+        }
+
+        b_m_blackbox_is_cutoff = false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Erases the sector the ring enters next, if used, so that urgent
+ * events only need a page program
+ *
+ * @return  void
+ */
+static void m_blackbox_erase_ahead(void)
+{
+    uint32_t offset = FLASH_MAP_BLACKBOX_OFFSET_C + (m_blackbox_next_page * FLASH_PAGE_SIZE);
+
+    if (((m_blackbox_next_page % M_BLACKBOX_PAGES_PER_SECTOR_C) != 0) ||
+        m_blackbox_page_is_blank(m_blackbox_next_page) ||
+        !m_blackbox_may_erase())
+    {
+        return;
+    }
+
+    int status = flash_safe_execute(m_blackbox_erase_inner, (void*)(uintptr_t)offset, 100);
+    lamp_restart_status_window();
+
+    if (status != PICO_OK)
+    {
+        printf("Black box erase failed %d\n", status);
+        m_blackbox_retry_at = make_timeout_time_ms(M_BLACKBOX_RETRY_MS_C);
+    }
+}
+
+/**
+ * @brief Writes up to a page of queued events to the next page of the ring
+ *
+ * A used page must be erased first; the sector erase and the page program are
+ * done on separate calls so each stall is a single flash operation. Events
+ * stay queued if flash could not be reached, or if the page is used and
+ * erasing is not allowed.
+ *
+ * @return  void
+ */
+static void m_blackbox_flush(void)
+{
+    uint32_t offset = FLASH_MAP_BLACKBOX_OFFSET_C + (m_blackbox_next_page * FLASH_PAGE_SIZE);
+
+    if (!m_blackbox_page_is_blank(m_blackbox_next_page))
+    {
+        if ((m_blackbox_next_page % M_BLACKBOX_PAGES_PER_SECTOR_C) != 0)
+        {
+            /* Torn page, start over in the next sector */
+            m_blackbox_next_page = ((m_blackbox_next_page / M_BLACKBOX_PAGES_PER_SECTOR_C + 1) *
+                                    M_BLACKBOX_PAGES_PER_SECTOR_C) % M_BLACKBOX_PAGES_C;
+            return;
+        }
+
+        m_blackbox_erase_ahead();
+        return;
+    }
+
+    M_BLACKBOX_PAGE_T* p_page = (M_BLACKBOX_PAGE_T*)m_blackbox_page_buf;
+    uint8_t            count  = MIN(m_blackbox_count, M_BLACKBOX_EVTS_PER_PAGE_C);
+
+    memset(m_blackbox_page_buf, 0xff, sizeof(m_blackbox_page_buf));
+
+    p_page->magic     = M_BLACKBOX_MAGIC_VAL_C;
+    p_page->seq       = m_blackbox_seq + 1;
+    p_page->boot      = m_blackbox_boot;
+    p_page->count     = count;
+    p_page->_reserved = 0xff;
+
+    for (uint8_t idx = 0; idx < count; idx++)
+    {
+        p_page->evts[idx] = m_blackbox_queue[(m_blackbox_head + idx) % M_BLACKBOX_RAM_EVTS_C];
+    }
+
+    p_page->checksum = m_blackbox_checksum(p_page);
+
+    int status = flash_safe_execute(m_blackbox_program_inner, (void*)(uintptr_t)offset, 100);
+    lamp_restart_status_window();
+
+    if (status != PICO_OK)
+    {
+        printf("Black box program failed %d\n", status);
+        m_blackbox_retry_at = make_timeout_time_ms(M_BLACKBOX_RETRY_MS_C);
+        return;
+    }
+
+    m_blackbox_seq       = p_page->seq;
+    m_blackbox_next_page = (m_blackbox_next_page + 1) % M_BLACKBOX_PAGES_C;
+    m_blackbox_head      = (m_blackbox_head + count) % M_BLACKBOX_RAM_EVTS_C;
+    m_blackbox_count    -= count;
+
+    if (m_blackbox_count == 0)
+    {
+        b_m_blackbox_is_urgent = false;
+        b_m_blackbox_is_forced = false;
+    }
+}
+
+/**
+ * @brief Erases the black-box sector starting at the given offset
+ *
+ */
+static void m_blackbox_erase_inner(void* p_offset)
+{
+    flash_range_erase((uint32_t)(uintptr_t)p_offset, FLASH_SECTOR_SIZE);
+}
+
+/**
+ * @brief Programs the page buffer at the given offset
+ *
+ */
+static void m_blackbox_program_inner(void* p_offset)
+{
+    flash_range_program((uint32_t)(uintptr_t)p_offset, m_blackbox_page_buf, FLASH_PAGE_SIZE);
+}
+
+/*** END OF FILE ***/
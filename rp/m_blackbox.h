@@ -0,0 +1,60 @@
+/**
+ * @file      m_blackbox.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for black-box event ring module
+ *
+ */
+
+#ifndef _M_BLACKBOX_H_
+#define _M_BLACKBOX_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum M_BLACKBOX_EVT_E
+ * @brief Event types, append only as they are stored
+ *
+ */
+typedef enum {
+    M_BLACKBOX_EVT_BOOT_C = 1,                                                  /* code: watchdog reboot, value: CHIP_RESET register */
+    M_BLACKBOX_EVT_LAMP_STATE_C,                                                /* code: entered state, aux: left state */
+    M_BLACKBOX_EVT_SUPPLY_CUTOFF_C,                                             /* code: rail, aux: 12V mV, value: VBUS mV << 16 | 24V mV */
+    M_BLACKBOX_EVT_SUPPLY_POWER_C,                                              /* code: power ok, aux: 12V mV, value: 24V mV */
+    M_BLACKBOX_EVT_RADAR_DROPOUT_C,                                             /* value: ms since the last report */
+    M_BLACKBOX_EVT_SAFETY_C                                                     /* code: output cap %, aux: distance cm (0xffff no radar) */
+} M_BLACKBOX_EVT_E;
+
+/**
+ * @struct M_BLACKBOX_EVT_T
+ * @brief Stored event
+ *
+ */
+typedef struct __packed {
+    uint32_t time_ms;                                                           /* Since boot, see the page boot number */
+    uint8_t  type;                                                              /* @ref M_BLACKBOX_EVT_E */
+    uint8_t  code;
+    uint16_t aux;
+    uint32_t value;
+} M_BLACKBOX_EVT_T;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void m_blackbox_init(void);
+void m_blackbox_update(void);
+void m_blackbox_log(M_BLACKBOX_EVT_E type, uint8_t code, uint16_t aux, uint32_t value);
+
+int16_t m_blackbox_cmd_set(uint16_t value);
+uint16_t m_blackbox_cmd_get_text(uint8_t* p_buf, uint16_t len);
+
+
+#endif /* _M_BLACKBOX_H_ */
+
+/*** END OF FILE ***/
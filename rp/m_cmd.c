@@ -14,28 +14,103 @@
 #include "pico/time.h"
 #include "m_cmd.h"
 #include "d_uart_cmd.h"
+#include "d_usb_cmd.h"
 #include "lamp.h"
 #include "ui_main.h"
+#include "lamp_cal.h"
+#include "lamp_stats.h"
+#include "sense.h"
+#include "d_i2c_bus.h"
+#include "mag.h"
+#include "m_idle.h"
+#include "d_sysclk.h"
+#include "persistance.h"
+#include "m_blackbox.h"
+#include "m_cmd_bin.h"
+#include "m_telemetry.h"
+#include "m_cmd_baud.h"
 
 
 /* Private define ------------------------------------------------------------*/
 
-#define CMD_MAX_INST_LEN_C      16
-#define CMD_MAX_PARAM_LEN_C     16
-#define CMD_MAX_VAL_LEN_C       16
 #define CMD_MAX_LEN_C           64
-
-#if CMD_MAX_LEN_C < (CMD_MAX_INST_LEN_C + CMD_MAX_PARAM_LEN_C + CMD_MAX_VAL_LEN_C + 8)
-#warning "CMD_MAX_LEN_C is not enough."
-#endif
+#define CMD_MAX_TEXT_LEN_C      160                                             /* Text replies, i.e. bulk readouts */
+#define CMD_MAX_REPLY_LEN_C     MAX(CMD_MAX_TEXT_LEN_C, M_CMD_BIN_MAX_FRAME_C)  /* Longest reply of either protocol */
 
 #define CMD_SEPARATOR_CHAR_C    ':'
 #define CMD_CR_CHAR_C           '\r'
 #define CMD_LF_CHAR_C           '\n'
-#define CMD_INST_SET_S          "S"
-#define CMD_INST_GET_S          "G"
-#define CMD_PARAM_LAMP_CTL_ID_S "L"
-#define CMD_PARAM_LAMP_DIM_ID_S "D"
+#define CMD_EOL_S               "\r\n"
+#define CMD_MAX_PARAM_CHARS_C   3                                               /* Packed into the dispatch key */
+
+#define CMD_PARAM_LAMP_CTL_ID_C CMD_PARAM_C('L', 0,   0)
+#define CMD_PARAM_LAMP_DIM_ID_C CMD_PARAM_C('D', 0,   0)
+#define CMD_PARAM_CAL_IDX_ID_C  CMD_PARAM_C('C', 'I', 0)                        /* Calibration point being edited */
+#define CMD_PARAM_CAL_CNT_ID_C  CMD_PARAM_C('C', 'N', 0)                        /* Calibration points count */
+#define CMD_PARAM_CAL_PWM_ID_C  CMD_PARAM_C('C', 'P', 0)                        /* Calibration point PWM level */
+#define CMD_PARAM_CAL_OUT_ID_C  CMD_PARAM_C('C', 'O', 0)                        /* Calibration point optical output */
+#define CMD_PARAM_CAL_FRQ_ID_C  CMD_PARAM_C('C', 'F', 0)                        /* Calibration point status frequency */
+#define CMD_PARAM_CAL_WR_ID_C   CMD_PARAM_C('C', 'W', 0)                        /* Calibration commit (1) / discard (0) */
+#define CMD_PARAM_CAL_BAND_ID_C CMD_PARAM_C('C', 'B', 0)                        /* Status band sweep start (1) / abort (0) */
+#define CMD_PARAM_LAMP_STATS_C  CMD_PARAM_C('T', 0,   0)                        /* Lamp lifetime counters / checkpoint (1) */
+#define CMD_PARAM_CUTOFF_C      CMD_PARAM_C('F', 0,   0)                        /* Supply cutoff count and last record */
+#define CMD_PARAM_RAILS_C       CMD_PARAM_C('V', 0,   0)                        /* Rails statistics */
+#define CMD_PARAM_RAILS_WIN_C   CMD_PARAM_C('V', 'W', 0)                        /* Rails statistics window (ms) */
+#define CMD_PARAM_I2C_BUS_C     CMD_PARAM_C('I', 'B', 0)                        /* I2C bus counters per device */
+#define CMD_PARAM_DIFFUSER_C    CMD_PARAM_C('M', 'D', 0)                        /* Diffuser detection / capture absent (0) or present (1) */
+#define CMD_PARAM_IDLE_C        CMD_PARAM_C('I', 'D', 0)                        /* Idle share, sleeps and last wake sources */
+#define CMD_PARAM_SYSCLK_C      CMD_PARAM_C('C', 'K', 0)                        /* System clock level, kHz and switch counters */
+#define CMD_PARAM_PERSISTANCE_C CMD_PARAM_C('P', 'S', 0)                        /* Persistance log position and counters */
+#define CMD_PARAM_BLACKBOX_C    CMD_PARAM_C('B', 'B', 0)                        /* Black-box events download / rewind (0) or write (1) */
+#define CMD_PARAM_BINARY_C      CMD_PARAM_C('B', 'N', 0)                        /* Binary protocol counters */
+#define CMD_PARAM_TELEMETRY_C   CMD_PARAM_C('T', 'S', 0)                        /* Telemetry subscription mask */
+#define CMD_PARAM_TELEM_RATE_C  CMD_PARAM_C('T', 'R', 0)                        /* Telemetry period, 0 on change */
+#define CMD_PARAM_BAUD_C        CMD_PARAM_C('B', 'R', 0)                        /* Command port baud rate / 100 */
+#define CMD_PARAM_BAUD_BOOT_C   CMD_PARAM_C('B', 'P', 0)                        /* Store current (1) / default (0) boot rate */
+
+/* Commands list: instruction, parameter, value callback, text callback.
+ * Expanded into the dispatch switch, a duplicated command fails to build. */
+#define CMD_LIST(X) \
+    X(CMD_INST_SET_C, CMD_PARAM_LAMP_CTL_ID_C, ui_main_lamp_set_stt,      0) \
+    X(CMD_INST_GET_C, CMD_PARAM_LAMP_CTL_ID_C, ui_main_lamp_get_stt,      0) \
+    X(CMD_INST_SET_C, CMD_PARAM_LAMP_DIM_ID_C, ui_main_lamp_set_dim,      0) \
+    X(CMD_INST_GET_C, CMD_PARAM_LAMP_DIM_ID_C, ui_main_lamp_get_dim,      0) \
+    X(CMD_INST_SET_C, CMD_PARAM_CAL_IDX_ID_C,  lamp_cal_cmd_set_index,    0) \
+    X(CMD_INST_GET_C, CMD_PARAM_CAL_IDX_ID_C,  lamp_cal_cmd_get_index,    0) \
+    X(CMD_INST_SET_C, CMD_PARAM_CAL_CNT_ID_C,  lamp_cal_cmd_set_count,    0) \
+    X(CMD_INST_GET_C, CMD_PARAM_CAL_CNT_ID_C,  lamp_cal_cmd_get_count,    0) \
+    X(CMD_INST_SET_C, CMD_PARAM_CAL_PWM_ID_C,  lamp_cal_cmd_set_pwm,      0) \
+    X(CMD_INST_GET_C, CMD_PARAM_CAL_PWM_ID_C,  lamp_cal_cmd_get_pwm,      0) \
+    X(CMD_INST_SET_C, CMD_PARAM_CAL_OUT_ID_C,  lamp_cal_cmd_set_output,   0) \
+    X(CMD_INST_GET_C, CMD_PARAM_CAL_OUT_ID_C,  lamp_cal_cmd_get_output,   0) \
+    X(CMD_INST_SET_C, CMD_PARAM_CAL_FRQ_ID_C,  lamp_cal_cmd_set_freq,     0) \
+    X(CMD_INST_GET_C, CMD_PARAM_CAL_FRQ_ID_C,  lamp_cal_cmd_get_freq,     0) \
+    X(CMD_INST_SET_C, CMD_PARAM_CAL_WR_ID_C,   lamp_cal_cmd_write,        0) \
+    X(CMD_INST_SET_C, CMD_PARAM_CAL_BAND_ID_C, lamp_cal_cmd_set_sweep,    0) \
+    X(CMD_INST_GET_C, CMD_PARAM_CAL_BAND_ID_C, lamp_cal_cmd_get_sweep,    0) \
+    X(CMD_INST_SET_C, CMD_PARAM_LAMP_STATS_C,  lamp_stats_cmd_checkpoint, 0) \
+    X(CMD_INST_GET_C, CMD_PARAM_LAMP_STATS_C,  0,                         lamp_stats_cmd_get_text) \
+    X(CMD_INST_GET_C, CMD_PARAM_CUTOFF_C,      0,                         lamp_stats_cmd_get_cutoff_text) \
+    X(CMD_INST_GET_C, CMD_PARAM_RAILS_C,       0,                         sense_cmd_get_text) \
+    X(CMD_INST_SET_C, CMD_PARAM_RAILS_WIN_C,   sense_cmd_set_window,      0) \
+    X(CMD_INST_GET_C, CMD_PARAM_RAILS_WIN_C,   sense_cmd_get_window,      0) \
+    X(CMD_INST_GET_C, CMD_PARAM_I2C_BUS_C,     0,                         i2c_bus_cmd_get_text) \
+    X(CMD_INST_SET_C, CMD_PARAM_DIFFUSER_C,    mag_cmd_set_diffuser_cal,  0) \
+    X(CMD_INST_GET_C, CMD_PARAM_DIFFUSER_C,    0,                         mag_cmd_get_diffuser_text) \
+    X(CMD_INST_GET_C, CMD_PARAM_IDLE_C,        0,                         m_idle_cmd_get_text) \
+    X(CMD_INST_GET_C, CMD_PARAM_SYSCLK_C,      0,                         sysclk_cmd_get_text) \
+    X(CMD_INST_GET_C, CMD_PARAM_PERSISTANCE_C, 0,                         persistance_cmd_get_text) \
+    X(CMD_INST_SET_C, CMD_PARAM_BLACKBOX_C,    m_blackbox_cmd_set,        0) \
+    X(CMD_INST_GET_C, CMD_PARAM_BLACKBOX_C,    0,                         m_blackbox_cmd_get_text) \
+    X(CMD_INST_GET_C, CMD_PARAM_BINARY_C,      0,                         m_cmd_bin_cmd_get_text) \
+    X(CMD_INST_SET_C, CMD_PARAM_TELEMETRY_C,   m_telemetry_cmd_set_signals, 0) \
+    X(CMD_INST_GET_C, CMD_PARAM_TELEMETRY_C,   0,                         m_telemetry_cmd_get_text) \
+    X(CMD_INST_SET_C, CMD_PARAM_TELEM_RATE_C,  m_telemetry_cmd_set_period, 0) \
+    X(CMD_INST_GET_C, CMD_PARAM_TELEM_RATE_C,  m_telemetry_cmd_get_period, 0) \
+    X(CMD_INST_SET_C, CMD_PARAM_BAUD_C,        m_cmd_baud_cmd_set,        0) \
+    X(CMD_INST_GET_C, CMD_PARAM_BAUD_C,        0,                         m_cmd_baud_cmd_get_text) \
+    X(CMD_INST_SET_C, CMD_PARAM_BAUD_BOOT_C,   m_cmd_baud_cmd_set_boot,   0) \
+    X(CMD_INST_GET_C, CMD_PARAM_BAUD_BOOT_C,   m_cmd_baud_cmd_get_boot,   0)
 
 #define CMD_OK_S                "OK"
 #define CMD_ERR_S               "ERR"
@@ -46,13 +121,20 @@
 
 /* Private typedef -----------------------------------------------------------*/
 
+/**
+ * @struct CMD_LINK_T
+ * @brief Framing state of a port
+ *
+ */
 typedef struct {
-
-    uint8_t inst[CMD_MAX_INST_LEN_C];
-    uint8_t param[CMD_MAX_PARAM_LEN_C];
-    int16_t (*p_callback)(uint16_t);
-
-} CMD_CTL_T;
+    const CMD_PORT_T* p_port;
+    uint8_t           buf[CMD_MAX_LEN_C];                                       /* Line being framed */
+    uint16_t          idx;
+    bool              b_is_overflow;                                            /* Line longer than the buffer */
+    bool              b_is_bin;                                                 /* Binary frame being received */
+    absolute_time_t   tmout;
+    M_CMD_BIN_LINK_T  bin;
+} CMD_LINK_T;
 
 
 /* Global variables  ---------------------------------------------------------*/
@@ -67,25 +149,24 @@ int16_t lamp_set_dim(uint16_t value);
 int16_t lamp_get_dim(uint16_t value);
 / * Only for testing */
 
-static const CMD_CTL_T  cmd_list[] = 
-{
-    {CMD_INST_SET_S, CMD_PARAM_LAMP_CTL_ID_S, ui_main_lamp_set_stt },
-    {CMD_INST_GET_S, CMD_PARAM_LAMP_CTL_ID_S, ui_main_lamp_get_stt },
-    {CMD_INST_SET_S, CMD_PARAM_LAMP_DIM_ID_S, ui_main_lamp_set_dim },
-    {CMD_INST_GET_S, CMD_PARAM_LAMP_DIM_ID_S, ui_main_lamp_get_dim },
-    {0,              0,                       0                 }
+static const CMD_PORT_T cmd_ports[CMD_LINK_MAX_C] = {
+    [CMD_LINK_UART_C] = { uart_cmd_get_data, uart_cmd_send_data, uart_cmd_get_tx_free, uart_cmd_is_tx_idle, m_cmd_baud_feed },
+    [CMD_LINK_USB_C]  = { usb_cmd_get_data,  usb_cmd_send_data,  usb_cmd_get_tx_free,  usb_cmd_is_tx_idle,  0 },
 };
 
-static uint8_t          cmd_buf[CMD_MAX_LEN_C];
-static uint16_t         cmd_idx;
-
-static absolute_time_t  cmd_tmout;
+static CMD_LINK_T       cmd_links[CMD_LINK_MAX_C];
+static CMD_LINK_E       cmd_current_link = CMD_LINK_MAX_C;                      /* Port of the command being run */
 
 
 /* Callback prototypes -------------------------------------------------------*/
 /* Private function prototypes -----------------------------------------------*/
 
-static void m_cmd_process(void);
+static void m_cmd_link_handler(CMD_LINK_T* p_link);
+static void m_cmd_link_reset(CMD_LINK_T* p_link);
+static void m_cmd_process(CMD_LINK_T* p_link);
+static uint32_t m_cmd_get_key(const char* p_inst, const char* p_param);
+static void m_cmd_reply_err(const CMD_PORT_T* p_port, const char* p_inst, const char* p_param,
+                            const char* p_value);
 
 
 /* Exported functions --------------------------------------------------------*/
@@ -96,69 +177,103 @@ static void m_cmd_process(void);
  */
 void m_cmd_init(void)
 {
-    cmd_idx = 0;
+    for (uint8_t link = 0; link < CMD_LINK_MAX_C; link++)
+    {
+        cmd_links[link].p_port     = &cmd_ports[link];
+        cmd_links[link].bin.p_port = &cmd_ports[link];
+        cmd_links[link].bin.tx_len = 0;
+
+        m_cmd_link_reset(&cmd_links[link]);
+    }
 
     uart_cmd_init();
+    usb_cmd_init();
+
+    m_cmd_baud_init();
 }
 
 /**
- * @brief Handles external commands over dedicated serial port
+ * @brief Handles external commands over the serial port and the USB port
+ * 
+ * A baud rate switch (@ref m_cmd_baud.c) drops whatever was being framed on
+ * the serial port.
  * 
  */
 void m_cmd_handler(void)
 {
-    uint16_t data_len;
-    uint8_t string[CMD_MAX_LEN_C];
-
-    data_len = uart_cmd_get_rcvd_data_len();
-    if (data_len) 
+    if (m_cmd_baud_update())
     {
-        if ((cmd_idx + data_len) >= CMD_MAX_LEN_C)
+        if (cmd_links[CMD_LINK_UART_C].b_is_bin)
         {
-            sprintf(string, 
-                    "\r\n:%s\r\n",
-                    CMD_ERR_S);
-
-            uart_cmd_send_data(string, strlen(string));
-        }
-        else 
-        {
-            data_len = uart_cmd_get_data(cmd_buf + cmd_idx, data_len);
-            if (data_len)
-            {
-                cmd_idx += data_len;
-                if (strchr(cmd_buf, CMD_CR_CHAR_C) || 
-                    strchr(cmd_buf, CMD_LF_CHAR_C))                             /* End of command has been received ? */
-                {
-                    m_cmd_process();
-
-                    memset(cmd_buf, 0, sizeof(cmd_buf));
-
-                    cmd_idx = 0;
-
-                    cmd_tmout = 0;
-                }
-                else
-                {
-                    cmd_tmout =  make_timeout_time_ms (CMD_TMOUT_MS_C);
-                }
-            }
+            m_cmd_bin_abort(&cmd_links[CMD_LINK_UART_C].bin);
         }
+
+        m_cmd_link_reset(&cmd_links[CMD_LINK_UART_C]);
     }
-    else if ((cmd_tmout != 0) && (get_absolute_time() > cmd_tmout))             /* Is timeout over? */
+
+    usb_cmd_update();                                                           /* Room for the replies below */
+
+    for (uint8_t link = 0; link < CMD_LINK_MAX_C; link++)
     {
-        cmd_tmout = 0;
+        cmd_current_link = link;
 
-        memset(cmd_buf, 0, sizeof(cmd_buf));
+        m_cmd_link_handler(&cmd_links[link]);
+    }
 
-        cmd_idx = 0;
+    cmd_current_link = CMD_LINK_MAX_C;
+}
 
-        sprintf(string, 
-                "\r\n:%s\r\n",
-                CMD_TMOUT_S);
+/**
+ * @brief Finds the callbacks of a command
+ *
+ * Shared by the ASCII and the binary protocols
+ *
+ * @param key Command key, see CMD_KEY_C()
+ * @param p_ctl Callbacks found
+ * @return true Command found
+ * @return false Unknown command
+ */
+bool m_cmd_lookup(uint32_t key, CMD_CTL_T* p_ctl)
+{
+#define CMD_CASE(inst, param, callback, text_callback)                          \
+        case CMD_KEY_C(inst, param):                                            \
+            p_ctl->p_callback      = (callback);                                \
+            p_ctl->p_text_callback = (text_callback);                           \
+            return true;
 
-        uart_cmd_send_data(string, strlen(string));
+    switch (key)
+    {
+        CMD_LIST(CMD_CASE)
+
+        default:
+            return false;
     }
+
+#undef CMD_CASE
+}
+
+/**
+ * @brief Returns the port the command being run came from
+ *
+ * For callbacks that depend on the port, i.e. a stream replying where it was
+ * subscribed
+ *
+ * @return CMD_LINK_E @ref CMD_LINK_MAX_C outside of a command
+ */
+CMD_LINK_E m_cmd_get_link(void)
+{
+    return cmd_current_link;
+}
+
+/**
+ * @brief Returns the calls of a port
+ *
+ * @param link Port
+ * @return const CMD_PORT_T* 0 if no such port
+ */
+const CMD_PORT_T* m_cmd_get_port(CMD_LINK_E link)
+{
+    return (link < CMD_LINK_MAX_C) ? &cmd_ports[link] : 0;
 }
 
 /* Callback functions --------------------------------------------------------*/
@@ -204,229 +319,292 @@ int16_t lamp_get_dim(uint16_t value)
 /* Private functions ---------------------------------------------------------*/
 
 /**
- * @brief Processes the received command and executes defined routine according 
- * to commands list @ref cmd_list.
+ * @brief Handles the commands received on a port
  * 
- * @note Initial commands format is I:P:V where I is for Instruction (i.e. SET 
- * or GET), P is for Parameter (i.e. Lamp state, lamp dim setting) and V is for
- * Value needed to set to the required parameter.
+ * Frames lines out of the reception buffer and executes every complete one 
+ * in order, each with its own reply, so a batch is handled in a single pass.
+ * A partial line is kept across calls until its end or CMD_TMOUT_MS_C of 
+ * silence. Reception stops while the transmission buffer has no room left 
+ * for a reply, the rest of the batch waits in the reception buffer.
  * 
- * @note If the received command is not found in the commands list @ref cmd_list
- *  error will be notified back to sender. Or if the value is not validated by 
- * the corresponding callback an error will be notified back to sender.
+ * A frame delimiter byte switches to the binary protocol (@ref m_cmd_bin.c) 
+ * up to the end of the frame, a partial ASCII line is dropped.
+ * 
+ * @param p_link Port and its framing state
  */
-static void m_cmd_process(void)
+static void m_cmd_link_handler(CMD_LINK_T* p_link)
 {
-    uint8_t idx;
-    uint8_t *p_arg_sta, *p_arg_end;
-    uint8_t string[CMD_MAX_LEN_C];
-    uint8_t args_found, args_valid;
-    uint8_t inst_str[CMD_MAX_INST_LEN_C];
-    uint8_t param_str[CMD_MAX_PARAM_LEN_C];
-    uint8_t value_str[CMD_MAX_VAL_LEN_C];
-    uint16_t value;
-
-    memset(inst_str, 0, sizeof(inst_str));
-    memset(param_str, 0, sizeof(param_str));
-    memset(value_str, 0, sizeof(value_str));
-    args_found = 0;
-    
-    /* Get all command parameters */
-    idx = 0;
-    while ((cmd_list[idx].inst[0] != 0) && (args_found == 0))
+    const CMD_PORT_T* p_port = p_link->p_port;
+    uint8_t           data;
+    bool              b_is_rcvd = false;
+    uint8_t           string[CMD_MAX_LEN_C];
+
+    while (p_port->p_get_tx_free() >= CMD_MAX_REPLY_LEN_C)                     /* Room for a reply ? */
     {
-        memset(string, 0, sizeof(string));
-        strcpy(string, cmd_list[idx].inst);
-        string[strlen(cmd_list[idx].inst)] = CMD_SEPARATOR_CHAR_C;
+        if (p_port->p_get_data(&data, 1) == 0)
+        {
+            break;
+        }
+
+        b_is_rcvd = true;
 
-        p_arg_sta = strstr(cmd_buf, string);
-        if (p_arg_sta != 0)
+        if (p_link->b_is_bin)
         {
-            strcpy(inst_str, cmd_list[idx].inst);
+            p_link->b_is_bin = m_cmd_bin_rx(&p_link->bin, data);
+        }
+        else if (data == M_CMD_BIN_DELIM_C)                                     /* Binary frame ? */
+        {
+            m_cmd_bin_start(&p_link->bin);
 
-            p_arg_end = strchr(p_arg_sta, CMD_SEPARATOR_CHAR_C);
-            if (p_arg_end != 0)
+            p_link->b_is_bin      = true;
+            p_link->idx           = 0;
+            p_link->b_is_overflow = false;
+        }
+        else if ((data == CMD_CR_CHAR_C) || (data == CMD_LF_CHAR_C))            /* End of command ? */
+        {
+            if (p_link->b_is_overflow)
             {
-                p_arg_sta = p_arg_end + 1;
-                p_arg_end = strchr(p_arg_sta, CMD_SEPARATOR_CHAR_C);
-                if (p_arg_end != 0)
-                {
-                    strncpy(param_str, p_arg_sta, (p_arg_end - p_arg_sta));
-
-                    strcpy(value_str, p_arg_end + 1);
-
-                    if ((value_str[0] != CMD_CR_CHAR_C) &&
-                        (value_str[0] != CMD_LF_CHAR_C))                        /* value argument is not empty? */
-                    {
-                        p_arg_end = strchr(value_str, CMD_CR_CHAR_C);
-                        if (p_arg_end)
-                        {
-                            *p_arg_end = 0;
-                        }
-                        else
-                        {
-                            p_arg_end = strchr(value_str, CMD_LF_CHAR_C);
-                            if (p_arg_end)
-                            {
-                                *p_arg_end = 0;
-                            }
-                        }
-
-                        value = atoi(value_str);
-
-                        args_found = 1;
-                    }
-                    else
-                    {
-                        value_str[0] = 0;                                       /* Since argument is empty, make sure is null */
-                    }
-                }
-                else 
-                {
-                    p_arg_end = strchr(p_arg_sta, CMD_CR_CHAR_C);
-                    if (p_arg_end != 0)                                         /* End of command ? */
-                    {
-                        strncpy(param_str, p_arg_sta, (p_arg_end - p_arg_sta));
-
-                        args_found = 1;
-                    }
-                    else 
-                    {
-                        p_arg_end = strchr(p_arg_sta, CMD_LF_CHAR_C);
-                        if (p_arg_end != 0)                                     /* End of command ? */
-                        {
-                            strncpy(param_str, p_arg_sta, (p_arg_end - p_arg_sta));
-
-                            args_found = 1;
-                        }
-                    }
-                }
+                sprintf(string, 
+                        "\r\n:%s\r\n",
+                        CMD_ERR_S);
+
+                p_port->p_send_data(string, strlen(string));
+            }
+            else if (p_link->idx > 0)                                           /* Not the LF of a CR LF ? */
+            {
+                p_link->buf[p_link->idx] = 0;
+
+                m_cmd_process(p_link);
             }
-        }
 
-        if (!args_found)
+            p_link->idx           = 0;
+            p_link->b_is_overflow = false;
+        }
+        else if (p_link->idx < (CMD_MAX_LEN_C - 1))
+        {
+            p_link->buf[p_link->idx++] = data;
+        }
+        else
         {
-            idx++;
+            p_link->b_is_overflow = true;                                       /* Dropped up to its end */
         }
     }
 
-    if (args_found)
+    if ((p_link->idx == 0) && !p_link->b_is_overflow && !p_link->b_is_bin)
     {
-        args_valid = 0;
+        p_link->tmout = 0;
+    }
+    else if (b_is_rcvd)
+    {
+        p_link->tmout = make_timeout_time_ms(CMD_TMOUT_MS_C);
+    }
+    else if ((p_link->tmout != 0) && (get_absolute_time() > p_link->tmout) && p_link->b_is_bin)
+    {
+        p_link->tmout    = 0;
+        p_link->b_is_bin = false;
 
-        while (cmd_list[idx].inst[0] != 0)
-        {
-            if (strcmp(cmd_list[idx].inst, inst_str) == 0)
-            {
-                if (strcmp(cmd_list[idx].param, param_str) == 0)
-                {
-                    if (cmd_list[idx].p_callback != 0)
-                    {
-                        if (value_str[0] != 0)                                  /* Value argument was received? */
-                        {
-                            args_valid = 1;
-
-                            if (cmd_list[idx].p_callback(value))
-                            {
-                                sprintf(string, 
-                                        "%s:%s:%d:%s\r\n",
-                                        inst_str,
-                                        param_str,
-                                        value,
-                                        CMD_OK_S);
-
-                                uart_cmd_send_data(string, strlen(string));
-                            }
-                            else
-                            {
-                                /* Value invalid for the received parameter */
-
-                                sprintf(string, 
-                                        "%s:%s:%d:%s\r\n",
-                                        inst_str,
-                                        param_str,
-                                        value,
-                                        CMD_ERR_S);
-
-                                uart_cmd_send_data(string, strlen(string));
-                            }
-                        }
-                        else
-                        {
-                            args_valid = 1;
-                            
-                            sprintf(string, 
-                                    "%s:%s:%d\r\n",
-                                    inst_str,
-                                    param_str,
-                                    cmd_list[idx].p_callback(0));
-
-                            uart_cmd_send_data(string, strlen(string));
-                        }
-                    }
-                    else
-                    {
-                        if (strlen(value_str))
-                        {
-                            sprintf(string, 
-                                    "%s:%s:%s:%s\r\n",
-                                    inst_str,
-                                    param_str,
-                                    value_str,
-                                    CMD_ERR_S);
-                        }
-                        else
-                        {
-                            sprintf(string, 
-                                    "%s:%s:%s\r\n",
-                                    inst_str,
-                                    param_str,
-                                    CMD_ERR_S);
-                        }
-
-                        uart_cmd_send_data(string, strlen(string));
-                    }
-                }
-            }
+        m_cmd_bin_abort(&p_link->bin);                                          /* No ASCII reply on a binary link */
+    }
+    else if ((p_link->tmout != 0) && (get_absolute_time() > p_link->tmout))    /* Is timeout over? */
+    {
+        p_link->tmout         = 0;
+        p_link->idx           = 0;
+        p_link->b_is_overflow = false;
 
-            idx++;
-        }
+        sprintf(string, 
+                "\r\n:%s\r\n",
+                CMD_TMOUT_S);
 
-        if (!args_valid)
-        {
-            sprintf(string, 
-                    "%s:%s:%s:%s\r\n",
-                    inst_str,
-                    param_str,
-                    value_str,
-                    CMD_ERR_S);
-
-            uart_cmd_send_data(string, strlen(string));
-        }
+        p_port->p_send_data(string, strlen(string));
+    }
+}
+
+/**
+ * @brief Drops whatever a port was framing
+ * 
+ * @param p_link Port and its framing state
+ */
+static void m_cmd_link_reset(CMD_LINK_T* p_link)
+{
+    p_link->idx           = 0;
+    p_link->b_is_overflow = false;
+    p_link->b_is_bin      = false;
+    p_link->tmout         = 0;
+
+    m_cmd_bin_start(&p_link->bin);
+}
+
+/**
+ * @brief Processes the received command and executes defined routine according
+ * to commands list @ref CMD_LIST.
+ *
+ * @note Initial commands format is I:P:V where I is for Instruction (i.e. SET
+ * or GET), P is for Parameter (i.e. Lamp state, lamp dim setting) and V is for
+ * Value needed to set to the required parameter.
+ *
+ * @note The framed line in @ref CMD_LINK_T buf is split in place, then instruction and parameter are packed
+ * into a key dispatched by a switch, so the cost does not grow with the list.
+ *
+ * @note If the received command is not found in the commands list @ref CMD_LIST
+ *  error will be notified back to sender. Or if the value is not validated by
+ * the corresponding callback an error will be notified back to sender.
+ *
+ * @param p_link Port the line was framed on, replies go back to it
+ */
+static void m_cmd_process(CMD_LINK_T* p_link)
+{
+    const CMD_PORT_T* p_port = p_link->p_port;
+    char*             p_inst = (char*)p_link->buf;
+    char*             p_param;
+    char*             p_value;
+    char*             p_end;
+    CMD_CTL_T         ctl;
+    uint8_t           string[CMD_MAX_LEN_C];
+
+    p_end = p_inst + strlen(p_inst);
+
+    p_param = strchr(p_inst, CMD_SEPARATOR_CHAR_C);
+    if (p_param != 0)
+    {
+        *p_param++ = 0;
+    }
+    else
+    {
+        p_param = p_end;
+    }
+
+    p_value = strchr(p_param, CMD_SEPARATOR_CHAR_C);
+    if (p_value != 0)
+    {
+        *p_value++ = 0;
     }
     else
     {
-        if (strlen(value_str))
+        p_value = p_end;
+    }
+
+    if (!m_cmd_lookup(m_cmd_get_key(p_inst, p_param), &ctl))
+    {
+        m_cmd_reply_err(p_port, p_inst, p_param, p_value);
+        return;
+    }
+
+    if (p_port->p_feed != 0)
+    {
+        p_port->p_feed();                                                       /* Host is there at this rate */
+    }
+
+    if ((ctl.p_text_callback != 0) && (p_value[0] == 0))
+    {
+        uint8_t text[CMD_MAX_TEXT_LEN_C];
+        uint16_t text_len;
+
+        text_len = sprintf(text, "%s:%s:", p_inst, p_param);
+        text_len += ctl.p_text_callback(text + text_len,
+                                        sizeof(text) - text_len - 2);
+        text_len += sprintf(text + text_len, CMD_EOL_S);
+
+        p_port->p_send_data(text, text_len);
+    }
+    else if (ctl.p_callback != 0)
+    {
+        if (p_value[0] != 0)                                                    /* Value argument was received? */
         {
-            sprintf(string, 
-                    "%s:%s:%s:%s\r\n",
-                    inst_str,
-                    param_str,
-                    value_str,
-                    CMD_ERR_S);
+            uint16_t value = atoi(p_value);
+
+            sprintf(string,
+                    "%s:%s:%d:%s\r\n",
+                    p_inst,
+                    p_param,
+                    value,
+                    ctl.p_callback(value) ? CMD_OK_S : CMD_ERR_S);
         }
         else
         {
-            sprintf(string, 
-                    "%s:%s:%s\r\n",
-                    inst_str,
-                    param_str,
-                    CMD_ERR_S);
+            sprintf(string,
+                    "%s:%s:%d\r\n",
+                    p_inst,
+                    p_param,
+                    ctl.p_callback(0));
         }
 
-        uart_cmd_send_data(string, strlen(string));
+        p_port->p_send_data(string, strlen(string));
+    }
+    else
+    {
+        m_cmd_reply_err(p_port, p_inst, p_param, p_value);
     }
 }
 
+/**
+ * @brief Packs an instruction and a parameter into a dispatch key
+ *
+ * @param p_inst Instruction, a single character
+ * @param p_param Parameter, up to CMD_MAX_PARAM_CHARS_C characters
+ * @return uint32_t Key as built by CMD_KEY_C(), 0 if malformed
+ */
+static uint32_t m_cmd_get_key(const char* p_inst, const char* p_param)
+{
+    uint32_t param = 0;
+    uint8_t  idx;
+
+    if ((p_inst[0] == 0) || (p_inst[1] != 0) || (p_param[0] == 0))
+    {
+        return 0;
+    }
+
+    for (idx = 0; idx < CMD_MAX_PARAM_CHARS_C; idx++)
+    {
+        param <<= 8;
+
+        if (p_param[0] != 0)
+        {
+            param |= (uint8_t)*p_param++;
+        }
+    }
+
+    if (p_param[0] != 0)
+    {
+        return 0;
+    }
+
+    return CMD_KEY_C(p_inst[0], param);
+}
+
+/**
+ * @brief Notifies an invalid command back to sender
+ *
+ * @param p_port Port the command came from
+ * @param p_inst Instruction received
+ * @param p_param Parameter received
+ * @param p_value Value received, may be empty
+ */
+static void m_cmd_reply_err(const CMD_PORT_T* p_port, const char* p_inst, const char* p_param,
+                            const char* p_value)
+{
+    uint8_t string[CMD_MAX_LEN_C];
+
+    if (p_value[0] != 0)
+    {
+        snprintf(string,
+                 sizeof(string),
+                 "%s:%s:%s:%s\r\n",
+                 p_inst,
+                 p_param,
+                 p_value,
+                 CMD_ERR_S);
+    }
+    else
+    {
+        snprintf(string,
+                 sizeof(string),
+                 "%s:%s:%s\r\n",
+                 p_inst,
+                 p_param,
+                 CMD_ERR_S);
+    }
+
+    p_port->p_send_data(string, strlen(string));
+}
 
 /*** END OF FILE ***/
\ No newline at end of file
@@ -2,7 +2,7 @@
  * @file      m_cmd.h
  * @author    The OSLUV Project
  * @brief     Functions prototypes for external commands module
- *  
+ *
  */
 
 #ifndef _M_CMD_H_
@@ -12,6 +12,54 @@
 /* Exported includes ---------------------------------------------------------*/
 
 #include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported defines ----------------------------------------------------------*/
+
+/* Command key: instruction character, then up to three parameter characters,
+ * zero padded. Also the item key of the binary protocol, big endian. */
+#define CMD_PARAM_C(c0, c1, c2) (((uint32_t)(c0) << 16) | ((uint32_t)(c1) << 8) | (uint32_t)(c2))
+#define CMD_KEY_C(inst, param)  (((uint32_t)(inst) << 24) | (param))
+
+#define CMD_INST_SET_C          'S'
+#define CMD_INST_GET_C          'G'
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum CMD_LINK_E
+ * @brief Ports carrying commands
+ *
+ */
+typedef enum {
+    CMD_LINK_UART_C = 0,                                                        /* Dedicated serial port */
+    CMD_LINK_USB_C,                                                             /* USB CDC, shared with debug stdio */
+    CMD_LINK_MAX_C                                                              /* No command in progress */
+} CMD_LINK_E;
+
+typedef struct {
+
+    int16_t (*p_callback)(uint16_t);
+    uint16_t (*p_text_callback)(uint8_t*, uint16_t);                           /* Replies text instead of a value */
+
+} CMD_CTL_T;
+
+/**
+ * @struct CMD_PORT_T
+ * @brief Byte stream carrying commands, same calls as the UART driver
+ *
+ */
+typedef struct {
+
+    uint16_t (*p_get_data)(uint8_t*, uint16_t);
+    uint16_t (*p_send_data)(uint8_t*, uint16_t);
+    uint16_t (*p_get_tx_free)(void);
+    bool (*p_is_tx_idle)(void);                                                 /* Nothing left queued */
+    void (*p_feed)(void);                                                       /* Valid command received, optional */
+
+} CMD_PORT_T;
 
 
 /* Exported variables --------------------------------------------------------*/
@@ -19,8 +67,11 @@
 
 void m_cmd_init(void);
 void m_cmd_handler(void);
+bool m_cmd_lookup(uint32_t key, CMD_CTL_T* p_ctl);
+CMD_LINK_E m_cmd_get_link(void);
+const CMD_PORT_T* m_cmd_get_port(CMD_LINK_E link);
 
 
 #endif /* _M_CMD_H_ */
 
-/*** END OF FILE ***/
\ No newline at end of file
+/*** END OF FILE ***/
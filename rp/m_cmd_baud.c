@@ -0,0 +1,287 @@
+/**
+ * @file      m_cmd_baud.c
+ * @author    The OSLUV Project
+ * @brief     Module for the command port baud rate negotiation
+ *
+ * The command port starts at 9600 baud, about 960 bytes/s. A host moves both
+ * ends to a faster rate with S:BR:<baud / 100>, i.e. S:BR:9216 for 921600:
+ *
+ *   1. The reply is sent at the current rate, the port switches once it has
+ *      left the line. The host switches after reading it.
+ *   2. The host sends any command at the new rate within
+ *      M_CMD_BAUD_CONFIRM_MS_C, else the port falls back to 9600.
+ *   3. From then on, M_CMD_BAUD_SILENCE_MS_C without a command also falls
+ *      back to 9600, so a host that lost track finds the port at 9600 again.
+ *
+ * S:BP:1 stores the current rate as boot rate, S:BP:0 restores 9600. The
+ * boot rate is watched for silence from power up, like a confirmed link.
+ * G:BR reports the actual rate from the divisor and its error in ppm.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "m_cmd_baud.h"
+#include "m_cmd.h"
+#include "m_idle.h"
+#include "d_uart_cmd.h"
+#include "persistance.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define M_CMD_BAUD_UNIT_C           100                                         /* Command value is baud / 100 */
+#define M_CMD_BAUD_DEF_DIV_C        96                                          /* 9600 baud */
+#define M_CMD_BAUD_CONFIRM_MS_C     2000                                        /* First command at the new rate */
+#define M_CMD_BAUD_SILENCE_MS_C     30000                                       /* Host gone, back to default */
+#define M_CMD_BAUD_POLL_MS_C        1                                           /* Accept reply draining */
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static const uint16_t       m_cmd_baud_divs[] = { 96, 1152, 2304, 4608, 9216 };
+
+static M_CMD_BAUD_STATE_E   m_cmd_baud_state = M_CMD_BAUD_STATE_DEFAULT_C;
+static uint16_t             m_cmd_baud_next_div = M_CMD_BAUD_DEF_DIV_C;         /* Rate after the switch */
+static absolute_time_t      m_cmd_baud_deadline;                                /* Confirm or silence */
+
+static uint32_t             m_cmd_baud_switches = 0;                            /* Since boot */
+static uint32_t             m_cmd_baud_fallbacks = 0;
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static bool m_cmd_baud_is_valid(uint16_t baud_div);
+static void m_cmd_baud_apply(uint16_t baud_div);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Applies the stored boot rate
+ *
+ * @note Called once the command port is initialized and the persistance
+ * region read
+ *
+ */
+void m_cmd_baud_init(void)
+{
+    uint16_t baud_div = persistance_get_cmd_baud_div();
+
+    m_cmd_baud_state = M_CMD_BAUD_STATE_DEFAULT_C;
+
+    if (m_cmd_baud_is_valid(baud_div) && (baud_div != M_CMD_BAUD_DEF_DIV_C))
+    {
+        m_cmd_baud_apply(baud_div);
+
+        m_cmd_baud_state    = M_CMD_BAUD_STATE_LINK_C;
+        m_cmd_baud_deadline = make_timeout_time_ms(M_CMD_BAUD_SILENCE_MS_C);
+    }
+}
+
+/**
+ * @brief Switches the rate when due and falls back on silence
+ *
+ * @note Called before reading the port, data framed at the old rate is
+ * meaningless after a switch
+ *
+ * @return true The rate changed, reception was flushed
+ * @return false
+ */
+bool m_cmd_baud_update(void)
+{
+    switch (m_cmd_baud_state)
+    {
+        case M_CMD_BAUD_STATE_SWITCH_C:
+            if (!uart_cmd_is_tx_idle())
+            {
+                m_idle_wake_by(make_timeout_time_ms(M_CMD_BAUD_POLL_MS_C));
+                return false;
+            }
+
+            m_cmd_baud_apply(m_cmd_baud_next_div);
+            m_cmd_baud_switches++;
+
+            if (m_cmd_baud_next_div == M_CMD_BAUD_DEF_DIV_C)
+            {
+                m_cmd_baud_state = M_CMD_BAUD_STATE_DEFAULT_C;
+            }
+            else
+            {
+                m_cmd_baud_state    = M_CMD_BAUD_STATE_CONFIRM_C;
+                m_cmd_baud_deadline = make_timeout_time_ms(M_CMD_BAUD_CONFIRM_MS_C);
+            }
+
+            return true;
+
+        case M_CMD_BAUD_STATE_CONFIRM_C:
+        case M_CMD_BAUD_STATE_LINK_C:
+            if (!time_reached(m_cmd_baud_deadline))
+            {
+                m_idle_wake_by(m_cmd_baud_deadline);
+                return false;
+            }
+
+            m_cmd_baud_apply(M_CMD_BAUD_DEF_DIV_C);
+            m_cmd_baud_fallbacks++;
+
+            m_cmd_baud_state = M_CMD_BAUD_STATE_DEFAULT_C;
+
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Notes a valid command from the host, the link is alive
+ *
+ */
+void m_cmd_baud_feed(void)
+{
+    if ((m_cmd_baud_state == M_CMD_BAUD_STATE_CONFIRM_C) ||
+        (m_cmd_baud_state == M_CMD_BAUD_STATE_LINK_C))
+    {
+        m_cmd_baud_state    = M_CMD_BAUD_STATE_LINK_C;
+        m_cmd_baud_deadline = make_timeout_time_ms(M_CMD_BAUD_SILENCE_MS_C);
+    }
+}
+
+/**
+ * @brief Checks whether a rate switch waits for the line to go idle
+ *
+ * Streams hold their data meanwhile, else the switch never happens
+ *
+ * @return true Accepted, not applied yet
+ * @return false
+ */
+bool m_cmd_baud_is_switch_pending(void)
+{
+    return m_cmd_baud_state == M_CMD_BAUD_STATE_SWITCH_C;
+}
+
+/**
+ * @brief Requests a new command port rate
+ * @note This function can be called via external command
+ *
+ * Only accepted on the serial port, the rate is its own
+ *
+ * @param baud_div Baud rate / 100: 96, 1152, 2304, 4608 or 9216
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t m_cmd_baud_cmd_set(uint16_t baud_div)
+{
+    if ((m_cmd_get_link() != CMD_LINK_UART_C) || !m_cmd_baud_is_valid(baud_div))
+    {
+        return 0;
+    }
+
+    m_cmd_baud_next_div = baud_div;
+    m_cmd_baud_state    = M_CMD_BAUD_STATE_SWITCH_C;                            /* After this reply */
+
+    return 1;
+}
+
+/**
+ * @brief Gets the rate, its divisor error and the link state as text
+ * @note This function can be called via external command
+ *
+ * ERR is the actual rate error in ppm at the current system clock, ST is
+ * @ref M_CMD_BAUD_STATE_E
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t m_cmd_baud_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+    uint32_t baud     = uart_cmd_get_baudrate();
+    uint32_t actual   = uart_cmd_get_actual_baudrate();
+    int32_t  err_ppm  = (int32_t)((((int64_t)actual - baud) * 1000000) / baud);
+    int      text_len = snprintf((char*)p_buf, len,
+                                 "BAUD=%lu,ACT=%lu,ERR=%ld,ST=%u,BOOT=%u,SW=%lu,FB=%lu",
+                                 (unsigned long)baud,
+                                 (unsigned long)actual,
+                                 (long)err_ppm,
+                                 m_cmd_baud_state,
+                                 persistance_get_cmd_baud_div(),
+                                 (unsigned long)m_cmd_baud_switches,
+                                 (unsigned long)m_cmd_baud_fallbacks);
+
+    return (text_len < 0) ? 0 : MIN(text_len, len - 1);
+}
+
+/**
+ * @brief Stores the boot rate
+ * @note This function can be called via external command
+ *
+ * Only accepted on the serial port
+ *
+ * @param value 1: current rate, 0: 9600
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t m_cmd_baud_cmd_set_boot(uint16_t value)
+{
+    if ((m_cmd_get_link() != CMD_LINK_UART_C) || (value > 1))
+    {
+        return 0;
+    }
+
+    persistance_set_cmd_baud_div(value ? (uart_cmd_get_baudrate() / M_CMD_BAUD_UNIT_C) :
+                                         M_CMD_BAUD_DEF_DIV_C);
+
+    return 1;
+}
+
+/**
+ * @brief Gets the boot rate
+ * @note This function can be called via external command
+ *
+ * @param value Unused
+ * @return int16_t Baud rate / 100
+ */
+int16_t m_cmd_baud_cmd_get_boot(uint16_t value)
+{
+    uint16_t baud_div = persistance_get_cmd_baud_div();
+
+    return m_cmd_baud_is_valid(baud_div) ? baud_div : M_CMD_BAUD_DEF_DIV_C;
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Checks a rate against the supported ones
+ *
+ * @param baud_div Baud rate / 100
+ * @return true Supported
+ * @return false
+ */
+static bool m_cmd_baud_is_valid(uint16_t baud_div)
+{
+    for (uint8_t idx = 0; idx < count_of(m_cmd_baud_divs); idx++)
+    {
+        if (m_cmd_baud_divs[idx] == baud_div)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Switches the port to a rate
+ *
+ * @param baud_div Baud rate / 100
+ */
+static void m_cmd_baud_apply(uint16_t baud_div)
+{
+    uart_cmd_set_baudrate((uint32_t)baud_div * M_CMD_BAUD_UNIT_C);
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,48 @@
+/**
+ * @file      m_cmd_baud.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for command port baud rate negotiation module
+ *
+ */
+
+#ifndef _M_CMD_BAUD_H_
+#define _M_CMD_BAUD_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum M_CMD_BAUD_STATE_E
+ * @brief Link state
+ *
+ */
+typedef enum {
+    M_CMD_BAUD_STATE_DEFAULT_C = 0,                                             /* Default rate, nothing to watch */
+    M_CMD_BAUD_STATE_SWITCH_C,                                                  /* Accept reply leaving at the old rate */
+    M_CMD_BAUD_STATE_CONFIRM_C,                                                 /* New rate, waiting for the first command */
+    M_CMD_BAUD_STATE_LINK_C                                                     /* New rate, silence watched */
+} M_CMD_BAUD_STATE_E;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void m_cmd_baud_init(void);
+bool m_cmd_baud_update(void);
+void m_cmd_baud_feed(void);
+bool m_cmd_baud_is_switch_pending(void);
+
+int16_t m_cmd_baud_cmd_set(uint16_t baud_div);
+uint16_t m_cmd_baud_cmd_get_text(uint8_t* p_buf, uint16_t len);
+int16_t m_cmd_baud_cmd_set_boot(uint16_t value);
+int16_t m_cmd_baud_cmd_get_boot(uint16_t value);
+
+
+#endif /* _M_CMD_BAUD_H_ */
+
+/*** END OF FILE ***/
@@ -0,0 +1,436 @@
+/**
+ * @file      m_cmd_bin.c
+ * @author    The OSLUV Project
+ * @brief     Module for binary framed external commands
+ *
+ * Runs alongside the ASCII protocol on the same port and the same commands
+ * list (@ref m_cmd_lookup). A frame starts with a delimiter byte, which never
+ * begins an ASCII command, so the protocol is detected on the first byte:
+ *
+ *   0x00 | COBS(payload) | 0x00
+ *
+ *   request payload : seq | item... | CRC-16
+ *   request item    : key(4) | type(1) | value (U16 / I16 only)
+ *   reply payload   : seq | item... | CRC-16
+ *   reply item      : key(4) | status(1) | type(1) | value
+ *
+ * The key is the command key of CMD_KEY_C(), i.e. 'G' 'C' 'K' 0. Multi-byte
+ * fields are big endian, the CRC is CRC-16/CCITT (0x1021, 0xffff) over the
+ * payload. Items are handled in order, a set reply has no value, a get reply
+ * is I16 or TEXT. A frame with the sequence number of the previous one is a
+ * retry and gets the previous reply again, without running the items twice.
+ * Frames failing COBS or CRC are dropped without reply.
+ *
+ * Each port has its own reception and retry state (@ref M_CMD_BIN_LINK_T),
+ * the counters are for all ports.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "m_cmd_bin.h"
+#include "m_cmd.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define M_CMD_BIN_MAX_REPLY_C       250                                         /* Reply payload, CRC included */
+#define M_CMD_BIN_CRC_LEN_C         2
+#define M_CMD_BIN_REQ_ITEM_LEN_C    5                                           /* Key and type */
+#define M_CMD_BIN_REPLY_ITEM_LEN_C  6                                           /* Key, status and type */
+#define M_CMD_BIN_MAX_TEXT_C        255
+
+#if (M_CMD_BIN_MAX_REPLY_C + (M_CMD_BIN_MAX_REPLY_C / 254) + 3) > M_CMD_BIN_MAX_FRAME_C
+#warning "M_CMD_BIN_MAX_FRAME_C is not enough for an encoded reply."
+#endif
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static uint8_t          m_cmd_bin_reply[M_CMD_BIN_MAX_REPLY_C];                 /* Built, then encoded into the link */
+
+static uint32_t         m_cmd_bin_frames = 0;                                   /* Since boot */
+static uint32_t         m_cmd_bin_retries = 0;
+static uint32_t         m_cmd_bin_bad_frames = 0;                               /* COBS, CRC or item errors */
+static uint32_t         m_cmd_bin_overflows = 0;                                /* Requests too long or aborted */
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static void m_cmd_bin_process(M_CMD_BIN_LINK_T* p_link);
+static uint16_t m_cmd_bin_run_item(uint32_t key, uint8_t type, uint16_t value, uint16_t pos);
+static int32_t m_cmd_bin_cobs_decode(uint8_t* p_buf, uint16_t len);
+static uint16_t m_cmd_bin_cobs_encode(const uint8_t* p_src, uint16_t len, uint8_t* p_dst);
+static uint16_t m_cmd_bin_crc16(uint16_t crc, const uint8_t* p_data, uint16_t len);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Starts the reception of a frame, on its leading delimiter
+ *
+ * @param p_link Port state
+ */
+void m_cmd_bin_start(M_CMD_BIN_LINK_T* p_link)
+{
+    p_link->rx_len        = 0;
+    p_link->b_is_overflow = false;
+}
+
+/**
+ * @brief Handles a received byte of a frame
+ *
+ * @param p_link Port state
+ * @param data Byte received
+ * @return true Frame still being received
+ * @return false Frame ended and handled, back to the ASCII protocol
+ */
+bool m_cmd_bin_rx(M_CMD_BIN_LINK_T* p_link, uint8_t data)
+{
+    if (data == M_CMD_BIN_DELIM_C)
+    {
+        if ((p_link->rx_len == 0) && !p_link->b_is_overflow)                    /* Repeated leading delimiter ? */
+        {
+            return true;
+        }
+
+        if (p_link->b_is_overflow)
+        {
+            m_cmd_bin_overflows++;
+        }
+        else
+        {
+            m_cmd_bin_process(p_link);
+        }
+
+        m_cmd_bin_start(p_link);
+
+        return false;
+    }
+
+    if (p_link->rx_len < M_CMD_BIN_MAX_RX_C)
+    {
+        p_link->rx_buf[p_link->rx_len++] = data;
+    }
+    else
+    {
+        p_link->b_is_overflow = true;                                           /* Dropped up to its end */
+    }
+
+    return true;
+}
+
+/**
+ * @brief Drops a frame left unterminated
+ *
+ * @param p_link Port state
+ */
+void m_cmd_bin_abort(M_CMD_BIN_LINK_T* p_link)
+{
+    m_cmd_bin_overflows++;
+
+    m_cmd_bin_start(p_link);
+}
+
+/**
+ * @brief Gets the binary protocol counters as text
+ *
+ * Frames handled, retries answered from the previous reply, bad frames and
+ * overflowed or aborted frames, since boot
+ *
+ * @param p_buf Text buffer
+ * @param len Buffer length
+ * @return uint16_t Text length
+ *
+ * @note This function can be called via external command
+ */
+uint16_t m_cmd_bin_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+    int text_len = snprintf((char*)p_buf, len, "FR=%lu,RT=%lu,BAD=%lu,OVF=%lu",
+                            (unsigned long)m_cmd_bin_frames,
+                            (unsigned long)m_cmd_bin_retries,
+                            (unsigned long)m_cmd_bin_bad_frames,
+                            (unsigned long)m_cmd_bin_overflows);
+
+    return (text_len < 0) ? 0 : MIN(text_len, len - 1);
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Checks a received frame, runs its items and sends the reply
+ *
+ * @param p_link Port state
+ */
+static void m_cmd_bin_process(M_CMD_BIN_LINK_T* p_link)
+{
+    int32_t  len = m_cmd_bin_cobs_decode(p_link->rx_buf, p_link->rx_len);
+    uint8_t* p_req = p_link->rx_buf;
+    uint16_t end, idx, pos, crc;
+
+    if (len < (1 + M_CMD_BIN_CRC_LEN_C))
+    {
+        m_cmd_bin_bad_frames++;
+        return;
+    }
+
+    end = len - M_CMD_BIN_CRC_LEN_C;
+    crc = ((uint16_t)p_req[end] << 8) | p_req[end + 1];
+
+    if (m_cmd_bin_crc16(0xffff, p_req, end) != crc)
+    {
+        m_cmd_bin_bad_frames++;
+        return;
+    }
+
+    if (p_link->p_port->p_feed != 0)
+    {
+        p_link->p_port->p_feed();
+    }
+
+    if ((p_link->tx_len != 0) && (p_req[0] == p_link->last_seq))                /* Retry ? */
+    {
+        m_cmd_bin_retries++;
+
+        p_link->p_port->p_send_data(p_link->tx_frame, p_link->tx_len);
+        return;
+    }
+
+    m_cmd_bin_frames++;
+
+    m_cmd_bin_reply[0] = p_req[0];
+    pos = 1;
+    idx = 1;
+
+    while (idx < end)
+    {
+        uint32_t key;
+        uint8_t  type;
+        uint16_t value = 0;
+
+        if ((end - idx) < M_CMD_BIN_REQ_ITEM_LEN_C)
+        {
+            m_cmd_bin_bad_frames++;
+            break;
+        }
+
+        key  = ((uint32_t)p_req[idx] << 24) | ((uint32_t)p_req[idx + 1] << 16) |
+               ((uint32_t)p_req[idx + 2] << 8) | p_req[idx + 3];
+        type = p_req[idx + 4];
+        idx += M_CMD_BIN_REQ_ITEM_LEN_C;
+
+        if ((type == M_CMD_BIN_TYPE_U16_C) || (type == M_CMD_BIN_TYPE_I16_C))
+        {
+            if ((end - idx) < 2)
+            {
+                m_cmd_bin_bad_frames++;
+                break;
+            }
+
+            value = ((uint16_t)p_req[idx] << 8) | p_req[idx + 1];
+            idx  += 2;
+        }
+        else if (type != M_CMD_BIN_TYPE_NONE_C)                                 /* Cannot be skipped */
+        {
+            m_cmd_bin_bad_frames++;
+            break;
+        }
+
+        if ((pos + M_CMD_BIN_REPLY_ITEM_LEN_C + M_CMD_BIN_CRC_LEN_C) > M_CMD_BIN_MAX_REPLY_C)
+        {
+            break;                                                              /* Item not run, ask again */
+        }
+
+        pos = m_cmd_bin_run_item(key, type, value, pos);
+    }
+
+    crc = m_cmd_bin_crc16(0xffff, m_cmd_bin_reply, pos);
+    m_cmd_bin_reply[pos++] = crc >> 8;
+    m_cmd_bin_reply[pos++] = crc & 0xff;
+
+    p_link->tx_frame[0] = M_CMD_BIN_DELIM_C;
+    p_link->tx_len      = 1 + m_cmd_bin_cobs_encode(m_cmd_bin_reply, pos, &p_link->tx_frame[1]);
+    p_link->tx_frame[p_link->tx_len++] = M_CMD_BIN_DELIM_C;
+    p_link->last_seq    = m_cmd_bin_reply[0];
+
+    p_link->p_port->p_send_data(p_link->tx_frame, p_link->tx_len);
+}
+
+/**
+ * @brief Runs a request item and appends its reply item
+ *
+ * Same rules as the ASCII protocol: a get runs the text callback if any,
+ * else the value callback with 0; a set runs the value callback
+ *
+ * @param key Command key, see CMD_KEY_C()
+ * @param type Request value type @ref M_CMD_BIN_TYPE_E
+ * @param value Request value
+ * @param pos Reply position, room for a reply item header is checked
+ * @return uint16_t Reply position after the item
+ */
+static uint16_t m_cmd_bin_run_item(uint32_t key, uint8_t type, uint16_t value, uint16_t pos)
+{
+    uint8_t*  p_item = &m_cmd_bin_reply[pos];
+    uint16_t  room   = M_CMD_BIN_MAX_REPLY_C - M_CMD_BIN_CRC_LEN_C - pos - M_CMD_BIN_REPLY_ITEM_LEN_C;
+    CMD_CTL_T ctl;
+
+    p_item[0] = key >> 24;
+    p_item[1] = key >> 16;
+    p_item[2] = key >> 8;
+    p_item[3] = key;
+    p_item[4] = M_CMD_BIN_STATUS_OK_C;
+    p_item[5] = M_CMD_BIN_TYPE_NONE_C;
+    pos      += M_CMD_BIN_REPLY_ITEM_LEN_C;
+
+    if (!m_cmd_lookup(key, &ctl))
+    {
+        p_item[4] = M_CMD_BIN_STATUS_UNKNOWN_C;
+    }
+    else if ((ctl.p_text_callback != 0) && (type == M_CMD_BIN_TYPE_NONE_C))
+    {
+        if (room < 2)
+        {
+            p_item[4] = M_CMD_BIN_STATUS_NO_ROOM_C;
+        }
+        else
+        {
+            uint16_t text_len = ctl.p_text_callback(&p_item[7], MIN(room - 1, M_CMD_BIN_MAX_TEXT_C));
+
+            p_item[5] = M_CMD_BIN_TYPE_TEXT_C;
+            p_item[6] = text_len;
+            pos      += 1 + text_len;
+        }
+    }
+    else if ((ctl.p_callback != 0) && (type != M_CMD_BIN_TYPE_NONE_C))
+    {
+        p_item[4] = ctl.p_callback(value) ? M_CMD_BIN_STATUS_OK_C : M_CMD_BIN_STATUS_ERR_C;
+    }
+    else if (ctl.p_callback != 0)
+    {
+        if (room < 2)
+        {
+            p_item[4] = M_CMD_BIN_STATUS_NO_ROOM_C;
+        }
+        else
+        {
+            int16_t result = ctl.p_callback(0);
+
+            p_item[5] = M_CMD_BIN_TYPE_I16_C;
+            p_item[6] = (uint16_t)result >> 8;
+            p_item[7] = (uint16_t)result & 0xff;
+            pos      += 2;
+        }
+    }
+    else
+    {
+        p_item[4] = M_CMD_BIN_STATUS_ERR_C;
+    }
+
+    return pos;
+}
+
+/**
+ * @brief Decodes a COBS frame in place
+ *
+ * @param p_buf Encoded frame, without delimiters
+ * @param len Encoded length
+ * @return int32_t Decoded length, -1 if malformed
+ */
+static int32_t m_cmd_bin_cobs_decode(uint8_t* p_buf, uint16_t len)
+{
+    uint16_t src = 0;
+    uint16_t dst = 0;
+
+    while (src < len)
+    {
+        uint8_t code = p_buf[src++];
+
+        if ((code == 0) || ((src + code - 1) > len))
+        {
+            return -1;
+        }
+
+        for (uint8_t idx = 1; idx < code; idx++)
+        {
+            p_buf[dst++] = p_buf[src++];
+        }
+
+        if ((code != 0xff) && (src < len))
+        {
+            p_buf[dst++] = 0;
+        }
+    }
+
+    return dst;
+}
+
+/**
+ * @brief Encodes a payload with COBS
+ *
+ * @param p_src Payload
+ * @param len Payload length
+ * @param p_dst Encoded frame, without delimiters, len + len / 254 + 1 bytes
+ * @return uint16_t Encoded length
+ */
+static uint16_t m_cmd_bin_cobs_encode(const uint8_t* p_src, uint16_t len, uint8_t* p_dst)
+{
+    uint16_t code_idx = 0;
+    uint16_t dst      = 1;
+    uint8_t  code     = 1;
+
+    for (uint16_t idx = 0; idx < len; idx++)
+    {
+        if (p_src[idx] == 0)
+        {
+            p_dst[code_idx] = code;
+            code_idx        = dst++;
+            code            = 1;
+        }
+        else
+        {
+            p_dst[dst++] = p_src[idx];
+            code++;
+
+            if (code == 0xff)
+            {
+                p_dst[code_idx] = code;
+                code_idx        = dst++;
+                code            = 1;
+            }
+        }
+    }
+
+    p_dst[code_idx] = code;
+
+    return dst;
+}
+
+/**
+ * @brief CRC-16/CCITT, bitwise
+ *
+ * @param crc Running value, 0xffff to start
+ * @param p_data Data
+ * @param len Data length
+ * @return uint16_t
+ */
+static uint16_t m_cmd_bin_crc16(uint16_t crc, const uint8_t* p_data, uint16_t len)
+{
+    for (uint16_t idx = 0; idx < len; idx++)
+    {
+        crc ^= (uint16_t)p_data[idx] << 8;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,79 @@
+/**
+ * @file      m_cmd_bin.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for binary framed commands module
+ *
+ */
+
+#ifndef _M_CMD_BIN_H_
+#define _M_CMD_BIN_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "m_cmd.h"
+
+
+/* Exported defines ----------------------------------------------------------*/
+
+#define M_CMD_BIN_DELIM_C           0x00                                        /* Frame delimiter, never inside a COBS frame */
+#define M_CMD_BIN_MAX_FRAME_C       260                                         /* Encoded reply with both delimiters */
+#define M_CMD_BIN_MAX_RX_C          128                                         /* Encoded request, without delimiters */
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum M_CMD_BIN_TYPE_E
+ * @brief Item value types
+ *
+ */
+typedef enum {
+    M_CMD_BIN_TYPE_NONE_C = 0,                                                  /* Get request, set reply */
+    M_CMD_BIN_TYPE_U16_C,                                                       /* 2 bytes, big endian */
+    M_CMD_BIN_TYPE_I16_C,                                                       /* 2 bytes, big endian */
+    M_CMD_BIN_TYPE_TEXT_C                                                       /* Length byte, then the text */
+} M_CMD_BIN_TYPE_E;
+
+/**
+ * @enum M_CMD_BIN_STATUS_E
+ * @brief Reply item status
+ *
+ */
+typedef enum {
+    M_CMD_BIN_STATUS_OK_C = 0,
+    M_CMD_BIN_STATUS_ERR_C,                                                     /* Value rejected or wrong request form */
+    M_CMD_BIN_STATUS_UNKNOWN_C,                                                 /* No such command */
+    M_CMD_BIN_STATUS_NO_ROOM_C                                                  /* Reply frame full, ask again */
+} M_CMD_BIN_STATUS_E;
+
+/**
+ * @struct M_CMD_BIN_LINK_T
+ * @brief Frame reception and retry state of a port
+ *
+ */
+typedef struct {
+    const CMD_PORT_T* p_port;
+    uint8_t           rx_buf[M_CMD_BIN_MAX_RX_C];
+    uint16_t          rx_len;
+    bool              b_is_overflow;
+    uint8_t           tx_frame[M_CMD_BIN_MAX_FRAME_C];                          /* Kept to answer a retry */
+    uint16_t          tx_len;
+    uint8_t           last_seq;
+} M_CMD_BIN_LINK_T;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void m_cmd_bin_start(M_CMD_BIN_LINK_T* p_link);
+bool m_cmd_bin_rx(M_CMD_BIN_LINK_T* p_link, uint8_t data);
+void m_cmd_bin_abort(M_CMD_BIN_LINK_T* p_link);
+
+uint16_t m_cmd_bin_cmd_get_text(uint8_t* p_buf, uint16_t len);
+
+
+#endif /* _M_CMD_BIN_H_ */
+
+/*** END OF FILE ***/
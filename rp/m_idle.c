@@ -0,0 +1,148 @@
+/**
+ * @file      m_idle.c
+ * @author    The OSLUV Project
+ * @brief     Module for tickless idle of the main loop
+ *
+ * While the display is dark and the lamp is steady nothing in the main loop
+ * needs to run until either an interrupt hands over new data or a module
+ * deadline expires. Modules report their next deadline with m_idle_wake_by()
+ * on every pass and interrupt handlers flag themselves with m_idle_wake(),
+ * then m_idle_sleep() waits on WFE up to the earliest deadline.
+ *
+ * Interrupts that only accumulate (ADC DMA, lamp status edges) wake the core
+ * briefly but do not resume the loop. The sleep is capped at
+ * M_IDLE_MAX_SLEEP_MS_C so every poll keeps a bounded latency.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "m_idle.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define M_IDLE_MAX_SLEEP_MS_C   20                                              /* Longest sleep without any deadline */
+#define M_IDLE_MIN_SLEEP_US_C   200                                             /* Shorter sleeps are not worth it */
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static volatile uint32_t    m_idle_wake_flags;
+static absolute_time_t      m_idle_deadline;
+static bool                 b_m_idle_has_deadline;
+
+static uint64_t             m_idle_slept_us;                                    /* Since the last query */
+static uint64_t             m_idle_window_start_us;
+static uint32_t             m_idle_sleeps;
+static uint32_t             m_idle_last_wake_flags;
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Flags a wake-up source and wakes the core if sleeping
+ *
+ * Safe to call from interrupt context
+ *
+ * @param source @ref M_IDLE_WAKE_E
+ */
+void m_idle_wake(M_IDLE_WAKE_E source)
+{
+    m_idle_wake_flags |= source;
+    __sev();
+}
+
+/**
+ * @brief Reports a module deadline, the earliest one of the pass is kept
+ *
+ * Called from the main loop on every pass, deadlines are dropped after each
+ * sleep
+ *
+ * @param deadline Time the module needs to run again
+ */
+void m_idle_wake_by(absolute_time_t deadline)
+{
+    if (!b_m_idle_has_deadline ||
+        (absolute_time_diff_us(deadline, m_idle_deadline) > 0))
+    {
+        m_idle_deadline       = deadline;
+        b_m_idle_has_deadline = true;
+    }
+}
+
+/**
+ * @brief Sleeps until a wake-up source is flagged or the earliest deadline
+ *
+ * @return  void
+ */
+void m_idle_sleep(void)
+{
+    absolute_time_t start    = get_absolute_time();
+    absolute_time_t deadline = make_timeout_time_ms(M_IDLE_MAX_SLEEP_MS_C);
+
+    if (b_m_idle_has_deadline &&
+        (absolute_time_diff_us(m_idle_deadline, deadline) > 0))
+    {
+        deadline = m_idle_deadline;
+    }
+
+    b_m_idle_has_deadline = false;
+
+    if ((m_idle_wake_flags != 0) ||
+        (absolute_time_diff_us(start, deadline) < M_IDLE_MIN_SLEEP_US_C))
+    {
+        m_idle_wake_flags = 0;
+        return;
+    }
+
+    while (m_idle_wake_flags == 0)
+    {
+        if (best_effort_wfe_or_timeout(deadline))
+        {
+            break;
+        }
+    }
+
+    uint32_t irq_state = save_and_disable_interrupts();
+    m_idle_last_wake_flags = m_idle_wake_flags;
+    m_idle_wake_flags      = 0;
+    restore_interrupts(irq_state);
+
+    m_idle_slept_us += absolute_time_diff_us(start, get_absolute_time());
+    m_idle_sleeps++;
+}
+
+/**
+ * @brief Gets the idle share since the last query as text
+ *
+ * @param p_buf Text buffer
+ * @param len Buffer length
+ * @return uint16_t Text length
+ *
+ * @note This function can be called via external command
+ */
+uint16_t m_idle_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+    uint64_t now_us    = time_us_64();
+    uint64_t window_us = now_us - m_idle_window_start_us;
+    uint32_t idle_pm   = (window_us > 0) ? (uint32_t)((m_idle_slept_us * 1000) / window_us) : 0;
+
+    int text_len = snprintf((char*)p_buf, len, "%lu.%lu%%,%lu,%lx",
+                            (unsigned long)(idle_pm / 10),
+                            (unsigned long)(idle_pm % 10),
+                            (unsigned long)m_idle_sleeps,
+                            (unsigned long)m_idle_last_wake_flags);
+
+    m_idle_slept_us        = 0;
+    m_idle_sleeps          = 0;
+    m_idle_window_start_us = now_us;
+
+    return MIN(text_len, len - 1);
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,46 @@
+/**
+ * @file      m_idle.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for tickless idle module
+ *
+ */
+
+#ifndef _M_IDLE_H_
+#define _M_IDLE_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include "pico/time.h"
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum M_IDLE_WAKE_E
+ * @brief Wake-up sources, bit mask
+ *
+ */
+typedef enum {
+    M_IDLE_WAKE_BUTTON_C = (1 << 0),                                            /* Debounced button event queued */
+    M_IDLE_WAKE_RADAR_C  = (1 << 1),                                            /* Radar report received */
+    M_IDLE_WAKE_CMD_C    = (1 << 2),                                            /* External command data received */
+    M_IDLE_WAKE_IMU_C    = (1 << 3),                                            /* IMU motion / 6D interrupt */
+    M_IDLE_WAKE_SUPPLY_C = (1 << 4),                                            /* Supply cutoff tripped */
+    M_IDLE_WAKE_I2C_C    = (1 << 5)                                             /* I2C bus completion to hand over */
+} M_IDLE_WAKE_E;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void m_idle_wake(M_IDLE_WAKE_E source);
+void m_idle_wake_by(absolute_time_t deadline);
+void m_idle_sleep(void);
+
+uint16_t m_idle_cmd_get_text(uint8_t* p_buf, uint16_t len);
+
+
+#endif /* _M_IDLE_H_ */
+
+/*** END OF FILE ***/
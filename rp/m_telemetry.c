@@ -0,0 +1,421 @@
+/**
+ * @file      m_telemetry.c
+ * @author    The OSLUV Project
+ * @brief     Module for subscription based telemetry streaming
+ *
+ * A host subscribes once to a set of signals (@ref M_TELEMETRY_SIG_E) with
+ * S:TS:<mask> and gets a record line on the port the subscription came from,
+ * serial or USB, instead of polling each parameter:
+ *
+ *   T:<ms>,S=2,L=100/100,F=1000,V=5012/12010/24050,A=12,R=140,SL=Req 100%
+ *
+ * S:TR:<ms> streams at that period, 0 streams on change: a record is sent
+ * when a signal moves past its deadband, at most every
+ * M_TELEMETRY_MIN_PERIOD_MS_C. Records go through the non-blocking TX path
+ * and are dropped, and counted, rather than crowding out command replies.
+ *
+ * A record is only queued once the line is idle, so at a slow rate the stream
+ * paces itself to the port and leaves gaps for a baud rate or system clock
+ * switch, which wait for an idle line. It is held while a switch is pending.
+ *
+ */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "m_telemetry.h"
+#include "m_cmd.h"
+#include "m_cmd_bin.h"
+#include "m_cmd_baud.h"
+#include "m_idle.h"
+#include "lamp.h"
+#include "sense.h"
+#include "imu.h"
+#include "radar.h"
+#include "safety_logic.h"
+
+
+/* Private define ------------------------------------------------------------*/
+
+#define M_TELEMETRY_LINE_LEN_C      160
+#define M_TELEMETRY_DESC_LEN_C      32                                          /* Safety decision text kept */
+#define M_TELEMETRY_MIN_PERIOD_MS_C 50                                          /* Fastest stream, about the 9600 baud limit */
+#define M_TELEMETRY_TX_RESERVE_C    M_CMD_BIN_MAX_FRAME_C                       /* Left for command replies */
+#define M_TELEMETRY_TX_POLL_MS_C    5                                           /* Line idle check */
+
+#define M_TELEMETRY_FREQ_BAND_C     5                                           /* On change deadbands */
+#define M_TELEMETRY_RAIL_BAND_C     200
+#define M_TELEMETRY_TILT_BAND_C     2
+#define M_TELEMETRY_RADAR_BAND_C    5
+
+
+/* Private typedef -----------------------------------------------------------*/
+
+/**
+ * @struct M_TELEMETRY_SAMPLE_T
+ * @brief Signals at one point in time
+ *
+ */
+typedef struct {
+    uint8_t  state;
+    uint8_t  reported_pct;                                                      /* 0xff not known yet */
+    uint8_t  commanded_pct;
+    int      freq_hz;
+    uint16_t rail_mv[SENSE_RAIL_MAX_C];
+    int      tilt_deg;
+    int      radar_cm;
+    char     safety[M_TELEMETRY_DESC_LEN_C];
+} M_TELEMETRY_SAMPLE_T;
+
+
+/* Private variables  --------------------------------------------------------*/
+
+static uint16_t             m_telemetry_mask = 0;                               /* @ref M_TELEMETRY_SIG_E, 0 not subscribed */
+static uint16_t             m_telemetry_period_ms = 1000;                       /* 0 on change */
+static CMD_LINK_E           m_telemetry_link = CMD_LINK_UART_C;                 /* Port streamed to */
+
+static M_TELEMETRY_SAMPLE_T m_telemetry_sent;                                   /* Last record */
+static uint64_t             m_telemetry_sent_us = 0;
+static bool                 b_m_telemetry_is_sent = false;                      /* A record went since subscribing */
+
+static uint64_t             m_telemetry_loop_last_us = 0;                       /* Main loop period since the last record */
+static uint64_t             m_telemetry_loop_sum_us = 0;
+static uint32_t             m_telemetry_loop_cnt = 0;
+static uint32_t             m_telemetry_loop_max_us = 0;
+
+static uint32_t             m_telemetry_records = 0;                            /* Since subscribing */
+static uint32_t             m_telemetry_dropped = 0;
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static void m_telemetry_sample(M_TELEMETRY_SAMPLE_T* p_sample);
+static bool m_telemetry_is_changed(const M_TELEMETRY_SAMPLE_T* p_sample);
+static uint16_t m_telemetry_format(const M_TELEMETRY_SAMPLE_T* p_sample, uint64_t now_us,
+                                   char* p_line, uint16_t len);
+
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Measures the main loop and streams a record when due
+ *
+ * Called once per main loop pass
+ *
+ */
+void m_telemetry_update(void)
+{
+    const CMD_PORT_T*    p_port = m_cmd_get_port(m_telemetry_link);
+    M_TELEMETRY_SAMPLE_T sample;
+    char                 line[M_TELEMETRY_LINE_LEN_C];
+    uint64_t             now_us = time_us_64();
+    uint64_t             since_us = now_us - m_telemetry_sent_us;
+    uint16_t             line_len;
+    bool                 b_is_due;
+
+    if (m_telemetry_loop_last_us != 0)
+    {
+        uint32_t loop_us = (uint32_t)(now_us - m_telemetry_loop_last_us);
+
+        m_telemetry_loop_sum_us += loop_us;
+        m_telemetry_loop_cnt++;
+        m_telemetry_loop_max_us  = MAX(m_telemetry_loop_max_us, loop_us);
+    }
+
+    m_telemetry_loop_last_us = now_us;
+
+    if (m_telemetry_mask == 0)
+    {
+        return;
+    }
+
+    if (m_cmd_baud_is_switch_pending() || !p_port->p_is_tx_idle())
+    {
+        m_idle_wake_by(make_timeout_time_ms(M_TELEMETRY_TX_POLL_MS_C));         /* Record goes late, not dropped */
+        return;
+    }
+
+    if (m_telemetry_period_ms != 0)
+    {
+        b_is_due = !b_m_telemetry_is_sent || (since_us >= (m_telemetry_period_ms * 1000ULL));
+
+        if (!b_is_due)
+        {
+            m_idle_wake_by(from_us_since_boot(m_telemetry_sent_us + (m_telemetry_period_ms * 1000ULL)));
+            return;
+        }
+
+        m_telemetry_sample(&sample);
+    }
+    else
+    {
+        if (b_m_telemetry_is_sent && (since_us < (M_TELEMETRY_MIN_PERIOD_MS_C * 1000ULL)))
+        {
+            return;
+        }
+
+        m_telemetry_sample(&sample);
+
+        if (b_m_telemetry_is_sent && !m_telemetry_is_changed(&sample))
+        {
+            return;
+        }
+    }
+
+    line_len = m_telemetry_format(&sample, now_us, line, sizeof(line));
+
+    m_telemetry_sent_us   = now_us;
+    b_m_telemetry_is_sent = true;
+
+    if (p_port->p_get_tx_free() < (line_len + M_TELEMETRY_TX_RESERVE_C))
+    {
+        m_telemetry_dropped++;                                                  /* Next record in a period */
+        return;
+    }
+
+    p_port->p_send_data((uint8_t*)line, line_len);
+
+    m_telemetry_sent        = sample;
+    m_telemetry_records++;
+    m_telemetry_loop_sum_us = 0;
+    m_telemetry_loop_cnt    = 0;
+    m_telemetry_loop_max_us = 0;
+}
+
+/**
+ * @brief Subscribes to a set of signals
+ * @note This function can be called via external command
+ *
+ * Records are streamed to the port the command came from
+ *
+ * @param mask @ref M_TELEMETRY_SIG_E, 0 to stop the stream
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t m_telemetry_cmd_set_signals(uint16_t mask)
+{
+    if (mask & ~M_TELEMETRY_SIG_ALL_C)
+    {
+        return 0;
+    }
+
+    if (m_cmd_get_link() != CMD_LINK_MAX_C)
+    {
+        m_telemetry_link = m_cmd_get_link();
+    }
+
+    m_telemetry_mask      = mask;
+    b_m_telemetry_is_sent = false;                                              /* First record right away */
+    m_telemetry_records   = 0;
+    m_telemetry_dropped   = 0;
+
+    return 1;
+}
+
+/**
+ * @brief Gets the subscription and its counters as text
+ * @note This function can be called via external command
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t m_telemetry_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+    int text_len = snprintf((char*)p_buf, len, "MASK=%x,MS=%u,REC=%lu,DROP=%lu",
+                            m_telemetry_mask,
+                            m_telemetry_period_ms,
+                            (unsigned long)m_telemetry_records,
+                            (unsigned long)m_telemetry_dropped);
+
+    return (text_len < 0) ? 0 : MIN(text_len, len - 1);
+}
+
+/**
+ * @brief Sets the stream period
+ * @note This function can be called via external command
+ *
+ * @param period_ms 0: on change, else M_TELEMETRY_MIN_PERIOD_MS_C at least
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t m_telemetry_cmd_set_period(uint16_t period_ms)
+{
+    if ((period_ms != 0) && (period_ms < M_TELEMETRY_MIN_PERIOD_MS_C))
+    {
+        return 0;
+    }
+
+    m_telemetry_period_ms = period_ms;
+
+    return 1;
+}
+
+/**
+ * @brief Gets the stream period
+ * @note This function can be called via external command
+ *
+ * @param value Unused
+ * @return int16_t Period in ms, 0 on change
+ */
+int16_t m_telemetry_cmd_get_period(uint16_t value)
+{
+    return m_telemetry_period_ms;
+}
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Samples the subscribed signals
+ *
+ * @param p_sample Sample, fields not subscribed are left zero
+ */
+static void m_telemetry_sample(M_TELEMETRY_SAMPLE_T* p_sample)
+{
+    memset(p_sample, 0, sizeof(*p_sample));
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_STATE_C)
+    {
+        p_sample->state = lamp_get_lamp_state();
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_LEVEL_C)
+    {
+        if (!lamp_get_reported_power_pct(&p_sample->reported_pct))
+        {
+            p_sample->reported_pct = 0xff;
+        }
+
+        p_sample->commanded_pct = lamp_get_commanded_power_pct();
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_FREQ_C)
+    {
+        p_sample->freq_hz = lamp_get_raw_freq();
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_RAILS_C)
+    {
+        p_sample->rail_mv[SENSE_RAIL_VBUS_C] = g_sense_vbus_mv;
+        p_sample->rail_mv[SENSE_RAIL_12V_C]  = g_sense_12v_mv;
+        p_sample->rail_mv[SENSE_RAIL_24V_C]  = g_sense_24v_mv;
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_TILT_C)
+    {
+        p_sample->tilt_deg = imu_get_pointing_down_angle();
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_RADAR_C)
+    {
+        p_sample->radar_cm = radar_get_distance_cm();
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_SAFETY_C)
+    {
+        strncpy(p_sample->safety, safety_logic_get_state_desc(), sizeof(p_sample->safety) - 1);
+    }
+}
+
+/**
+ * @brief Checks a sample against the last record and the deadbands
+ *
+ * Loop timing never triggers a record on its own
+ *
+ * @param p_sample Sample
+ * @return true A signal moved past its deadband
+ * @return false
+ */
+static bool m_telemetry_is_changed(const M_TELEMETRY_SAMPLE_T* p_sample)
+{
+    const M_TELEMETRY_SAMPLE_T* p_sent = &m_telemetry_sent;
+
+    for (int rail = 0; rail < SENSE_RAIL_MAX_C; rail++)
+    {
+        if (abs((int)p_sample->rail_mv[rail] - (int)p_sent->rail_mv[rail]) >= M_TELEMETRY_RAIL_BAND_C)
+        {
+            return true;
+        }
+    }
+
+    return (p_sample->state != p_sent->state) ||
+           (p_sample->reported_pct != p_sent->reported_pct) ||
+           (p_sample->commanded_pct != p_sent->commanded_pct) ||
+           (abs(p_sample->freq_hz - p_sent->freq_hz) >= M_TELEMETRY_FREQ_BAND_C) ||
+           (abs(p_sample->tilt_deg - p_sent->tilt_deg) >= M_TELEMETRY_TILT_BAND_C) ||
+           (abs(p_sample->radar_cm - p_sent->radar_cm) >= M_TELEMETRY_RADAR_BAND_C) ||
+           (strcmp(p_sample->safety, p_sent->safety) != 0);
+}
+
+/**
+ * @brief Formats a record line of the subscribed signals
+ *
+ * @param p_sample Sample
+ * @param now_us Record time
+ * @param p_line Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the line
+ */
+static uint16_t m_telemetry_format(const M_TELEMETRY_SAMPLE_T* p_sample, uint64_t now_us,
+                                   char* p_line, uint16_t len)
+{
+    int pos = snprintf(p_line, len, "T:%lu", (unsigned long)(now_us / 1000));
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_STATE_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",S=%u", p_sample->state);
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_LEVEL_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",L=%d/%u",
+                        (p_sample->reported_pct == 0xff) ? -1 : p_sample->reported_pct,
+                        p_sample->commanded_pct);
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_FREQ_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",F=%d", p_sample->freq_hz);
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_RAILS_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",V=%u/%u/%u",
+                        p_sample->rail_mv[SENSE_RAIL_VBUS_C],
+                        p_sample->rail_mv[SENSE_RAIL_12V_C],
+                        p_sample->rail_mv[SENSE_RAIL_24V_C]);
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_TILT_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",A=%d", p_sample->tilt_deg);
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_RADAR_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",R=%d", p_sample->radar_cm);
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_SAFETY_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",SL=%s", p_sample->safety);
+    }
+
+    if (m_telemetry_mask & M_TELEMETRY_SIG_LOOP_C)
+    {
+        pos += snprintf(p_line + pos, len - pos, ",LP=%lu/%lu",
+                        (unsigned long)((m_telemetry_loop_cnt > 0) ?
+                                        (m_telemetry_loop_sum_us / m_telemetry_loop_cnt) : 0),
+                        (unsigned long)m_telemetry_loop_max_us);
+    }
+
+    pos = MIN(pos, len - 3);
+    pos += snprintf(p_line + pos, len - pos, "\r\n");
+
+    return pos;
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,49 @@
+/**
+ * @file      m_telemetry.h
+ * @author    The OSLUV Project
+ * @brief     Functions prototypes for telemetry streaming module
+ *
+ */
+
+#ifndef _M_TELEMETRY_H_
+#define _M_TELEMETRY_H_
+
+
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum M_TELEMETRY_SIG_E
+ * @brief Streamed signals, bit mask of the subscription
+ *
+ */
+typedef enum {
+    M_TELEMETRY_SIG_STATE_C  = (1 << 0),                                        /* S=  Lamp state */
+    M_TELEMETRY_SIG_LEVEL_C  = (1 << 1),                                        /* L=  Reported / commanded output % */
+    M_TELEMETRY_SIG_FREQ_C   = (1 << 2),                                        /* F=  Status frequency (Hz) */
+    M_TELEMETRY_SIG_RAILS_C  = (1 << 3),                                        /* V=  VBUS / 12V / 24V (mV) */
+    M_TELEMETRY_SIG_TILT_C   = (1 << 4),                                        /* A=  Pointing down angle (deg) */
+    M_TELEMETRY_SIG_RADAR_C  = (1 << 5),                                        /* R=  Radar distance (cm), -1 stale */
+    M_TELEMETRY_SIG_SAFETY_C = (1 << 6),                                        /* SL= Safety decision */
+    M_TELEMETRY_SIG_LOOP_C   = (1 << 7),                                        /* LP= Main loop period mean / max (us) */
+    M_TELEMETRY_SIG_ALL_C    = 0xff
+} M_TELEMETRY_SIG_E;
+
+
+/* Exported functions prototypes ---------------------------------------------*/
+
+void m_telemetry_update(void);
+
+int16_t m_telemetry_cmd_set_signals(uint16_t mask);
+uint16_t m_telemetry_cmd_get_text(uint8_t* p_buf, uint16_t len);
+int16_t m_telemetry_cmd_set_period(uint16_t period_ms);
+int16_t m_telemetry_cmd_get_period(uint16_t value);
+
+
+#endif /* _M_TELEMETRY_H_ */
+
+/*** END OF FILE ***/
@@ -5,32 +5,60 @@
  * @hwref     U8 (TMAG5273)
  * @schematic lamp_controller.SchDoc
  *  
+ * The sensor stays in standby and converts on demand: every poll reads the 
+ * previous conversion in one burst from X_MSB_RESULT to CONV_STATUS, and the 
+ * trigger bit of that read's register address starts the next one. The 
+ * values are only taken when CONV_STATUS flags a completed conversion, so the 
+ * update rate is MAG_POLL_MS_C whatever the main loop timing.
+ * 
+ * A diffuser or accessory is keyed by a magnet close to the sensor. The field 
+ * magnitude is compared to calibrated thresholds with hysteresis, and a new 
+ * state must hold for MAG_DIFFUSER_DEBOUNCE_C samples. Without calibration or 
+ * without fresh samples the diffuser is reported absent, which selects the 
+ * longer safety distances.
+ *  
  */
 
 
 /* Includes ------------------------------------------------------------------*/
 
-#include <hardware/i2c.h>
 #include <pico/stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 
 #include "pins.h"
+#include "mag.h"
+#include "fixmath.h"
+#include "persistance.h"
+#include "d_i2c_bus.h"
+#include "m_idle.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 
-#define MAG_I2C_PORT_C          I2C_INST
 #define MAG_IC_ADDR_C           0x35
-#define MAG_REG_DEV_CFG_1_C     0x01
-#define MAG_REG_DEV_CFG_2_C     0x02
+#define MAG_I2C_BAUD_C          (400*1000)
+#define MAG_POLL_MS_C           20
+#define MAG_REG_DEV_CFG_1_C     0x00
+#define MAG_REG_DEV_CFG_2_C     0x01
+#define MAG_REG_SENSOR_CFG_1_C  0x02
 #define MAG_REG_X_MSB_RES_C     0x12
 #define MAG_REG_X_LSB_RES_C     0x13
 #define MAG_REG_Y_MSB_RES_C     0x14
 #define MAG_REG_Y_LSB_RES_C     0x15
 #define MAG_REG_Z_MSB_RES_C     0x16
 #define MAG_REG_Z_LSB_RES_C     0x17
+#define MAG_REG_CONV_STATUS_C   0x18
+#define MAG_REG_TRIGGER_C       0x80                                            /* Register address MSB, starts a conversion */
+
+#define MAG_CONV_STATUS_RDY_C   (1 << 0)                                        /* RESULT_STATUS: conversion complete */
+#define MAG_CONV_STATUS_POR_C   (1 << 4)                                        /* Device was reset */
+
+#define MAG_DIFFUSER_DEBOUNCE_C 25                                              /* Samples, 0.5 s at MAG_POLL_MS_C */
+#define MAG_STALE_MS_C          (10 * MAG_POLL_MS_C)                            /* No sample for this long reads as absent */
+#define MAG_CAL_SAMPLES_C       16                                              /* Averaged per calibration capture */
+#define MAG_CAL_MIN_SPAN_C      200                                             /* LSB between absent and present */
 
 
 /* Global variables  ---------------------------------------------------------*/
@@ -39,10 +67,39 @@ int16_t g_mag_x, g_mag_y, g_mag_z = 0;
 
 
 /* Private variables  --------------------------------------------------------*/
+
+static I2C_BUS_REQ_T   mag_req;
+static uint8_t         mag_data[MAG_REG_CONV_STATUS_C - MAG_REG_X_MSB_RES_C + 1]; /* X, Y, Z MSB first, then CONV_STATUS */
+static absolute_time_t mag_next_poll;
+static uint32_t        mag_sample_cnt = 0;
+static bool            b_mag_is_configured = false;
+static absolute_time_t mag_last_sample;
+static uint16_t        mag_magnitude = 0;
+
+static MAG_DIFFUSER_CAL_T mag_diffuser_cal = {0};                               /* All zero when not calibrated */
+static bool            b_mag_is_diffused = false;
+static uint8_t         mag_diffuser_cnt = 0;                                    /* Consecutive samples against the state */
+
+static struct {
+    int8_t   target;                                                            /* -1 idle, 0 absent, 1 present */
+    uint8_t  cnt;
+    uint32_t sum;
+    uint16_t ref[2];                                                            /* Captured magnitude, absent then present */
+    bool     b_has_absent;                                                      /* ref[0] captured, the present capture may follow */
+} mag_cal = {.target = -1};
+
+
+/* Callback prototypes -------------------------------------------------------*/
+
+static void mag_on_result(I2C_BUS_REQ_T* p_req);
+
+
 /* Private function prototypes -----------------------------------------------*/
 
-static inline int mag_read(uint8_t dev_addr, int data_len, uint8_t* p_data_rd);
 static inline int mag_write(uint8_t dev_addr, uint8_t data_wr);
+static bool mag_configure(void);
+static void mag_update_diffuser(void);
+static void mag_update_cal(void);
 
 
 /* Exported functions --------------------------------------------------------*/
@@ -55,8 +112,25 @@ static inline int mag_write(uint8_t dev_addr, uint8_t data_wr);
  */
 void mag_init(void)
 {
-    mag_write(MAG_REG_DEV_CFG_1_C, (0x04 << 2) | (0x02 << 0));                  /* CONV_AVG: 16x average, I2C_RD: 1-byte I2C read command for 8 bit sensor MSB data and conversion status */
-    mag_write(MAG_REG_DEV_CFG_2_C, (0x03 << 5) | (0x01 << 4));                  /* THR_HYST: ? , LP_LN: Low noise mode */
+    i2c_bus_add_device(I2C_BUS_DEV_MAG_C, MAG_IC_ADDR_C, MAG_I2C_BAUD_C);
+
+    mag_req = (I2C_BUS_REQ_T){
+        .dev        = I2C_BUS_DEV_MAG_C,
+        .reg        = MAG_REG_X_MSB_RES_C | MAG_REG_TRIGGER_C,
+        .b_is_read  = true,
+        .len        = sizeof(mag_data),
+        .p_data     = mag_data,
+        .p_callback = mag_on_result,
+    };
+
+    if (g_persistance_region.mag_diffuser.off_lsb < g_persistance_region.mag_diffuser.on_lsb)
+    {
+        mag_diffuser_cal = g_persistance_region.mag_diffuser;
+    }
+
+    b_mag_is_configured = mag_configure();
+    mag_next_poll       = make_timeout_time_ms(MAG_POLL_MS_C);
+    mag_last_sample     = get_absolute_time();
 }
 
 /**
@@ -66,45 +140,244 @@ void mag_init(void)
  */
 void mag_update(void)
 {
-    uint8_t buf[2];
+    if ((absolute_time_diff_us(get_absolute_time(), mag_next_poll) > 0) ||
+        (mag_req.result == I2C_BUS_RES_PENDING_C))
+    {
+        m_idle_wake_by(mag_next_poll);
+        return;
+    }
+
+    mag_next_poll = make_timeout_time_ms(MAG_POLL_MS_C);
+    m_idle_wake_by(mag_next_poll);
+
+    if (!b_mag_is_configured)
+    {
+        b_mag_is_configured = mag_configure();                                  /* Not there at boot, or lost power */
+        return;
+    }
+
+    i2c_bus_submit(&mag_req);
+}
+
+/**
+ * @brief Returns the number of conversions read so far
+ * 
+ * Changes when g_mag_x/y/z hold a new sample
+ * 
+ * @return uint32_t 
+ */
+uint32_t mag_get_sample_count(void)
+{
+    return mag_sample_cnt;
+}
+
+/**
+ * @brief Returns the field magnitude of the last sample
+ * 
+ * @return uint16_t Sensor LSB
+ */
+uint16_t mag_get_magnitude(void)
+{
+    return mag_magnitude;
+}
+
+/**
+ * @brief Returns whether a magnet-keyed diffuser is fitted
+ * 
+ * @return true Calibrated, fresh and stable above the threshold
+ * @return false 
+ */
+bool mag_is_diffuser_present(void)
+{
+    return b_mag_is_diffused && 
+           (absolute_time_diff_us(mag_last_sample, get_absolute_time()) < (MAG_STALE_MS_C * 1000LL));
+}
+
+/**
+ * @brief Captures the calibration reference without or with the diffuser
+ * @note This function can be called via external command
+ * 
+ * Averages the next MAG_CAL_SAMPLES_C samples. The absent reference must be 
+ * captured first. Once the present reference is captured the thresholds are 
+ * set at one and two thirds between the two and stored, provided they are far 
+ * enough apart. A new capture restarts one still running.
+ * 
+ * @param b_present 0: diffuser removed, 1: diffuser fitted
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t mag_cmd_set_diffuser_cal(uint16_t b_present)
+{
+    if ((b_present > 1) ||
+        ((b_present == 1) && !mag_cal.b_has_absent))
+    {
+        return 0;
+    }
 
-    mag_read(MAG_REG_X_MSB_RES_C, 2, buf);
-    *(uint16_t*)&g_mag_x = (buf[0] << 8) | buf[1];
+    if (b_present == 0)
+    {
+        mag_cal.b_has_absent = false;                                           /* Replaced by this capture */
+    }
 
-    mag_read(MAG_REG_Y_MSB_RES_C, 2, buf);
-    *(uint16_t*)&g_mag_y = (buf[0] << 8) | buf[1];
+    mag_cal.cnt    = 0;
+    mag_cal.sum    = 0;
+    mag_cal.target = b_present;
 
-    mag_read(MAG_REG_Z_MSB_RES_C, 2, buf);
-    *(uint16_t*)&g_mag_z = (buf[0] << 8) | buf[1];
+    return 1;
+}
+
+/**
+ * @brief Formats the diffuser detection state as a single line
+ * @note This function can be called via external command
+ * 
+ * Magnitude, on and off thresholds in sensor LSB, then the state
+ * 
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t mag_cmd_get_diffuser_text(uint8_t* p_buf, uint16_t len)
+{
+    int text_len = snprintf((char*)p_buf, len,
+                            "M=%u,ON=%u,OFF=%u,D=%u",
+                            mag_magnitude,
+                            mag_diffuser_cal.on_lsb,
+                            mag_diffuser_cal.off_lsb,
+                            mag_is_diffuser_present());
+
+    return MIN(text_len, len - 1);
+}
+
+
+/* Callback functions --------------------------------------------------------*/
+
+/**
+ * @brief Results read completed, the next conversion is running
+ * 
+ * @param p_req Results request
+ */
+static void mag_on_result(I2C_BUS_REQ_T* p_req)
+{
+    uint8_t conv_status = mag_data[MAG_REG_CONV_STATUS_C - MAG_REG_X_MSB_RES_C];
+
+    if (p_req->result != I2C_BUS_RES_OK_C)
+    {
+        return;
+    }
+
+    if (conv_status & MAG_CONV_STATUS_POR_C)
+    {
+        b_mag_is_configured = false;                                            /* Back to defaults, the data is not ours */
+        return;
+    }
+
+    if (!(conv_status & MAG_CONV_STATUS_RDY_C))
+    {
+        return;
+    }
+
+    g_mag_x = (int16_t)((mag_data[0] << 8) | mag_data[1]);
+    g_mag_y = (int16_t)((mag_data[2] << 8) | mag_data[3]);
+    g_mag_z = (int16_t)((mag_data[4] << 8) | mag_data[5]);
+
+    mag_magnitude   = MIN(fixmath_isqrt(((uint32_t)((int32_t)g_mag_x * g_mag_x)) +     /* Up to 3 * 2^30 */
+                                        ((uint32_t)((int32_t)g_mag_y * g_mag_y)) + 
+                                        ((uint32_t)((int32_t)g_mag_z * g_mag_z))), UINT16_MAX);
+    mag_last_sample = get_absolute_time();
+    mag_sample_cnt++;
+
+    mag_update_diffuser();
+    mag_update_cal();
 }
 
 
 /* Private functions ---------------------------------------------------------*/
 
 /**
- * @brief Reads multiple data bytes from magnet sensor
+ * @brief Sets the conversion up, standby and triggered by I2C command
  * 
- * @param dev_addr IC device I2C address 
- * @param data_len Data length to read from device
- * @param p_data_rd Pointer to buffer where to deliver read data
- * @return int 1 - Read operation failed
- * @return int 0 - Read operation succeed
+ * The status write clears the power-on flag, so a later reset shows up in 
+ * CONV_STATUS
+ * 
+ * @return true Sensor answered
+ * @return false 
  */
-static inline int mag_read(uint8_t dev_addr, int data_len, uint8_t* p_data_rd)
+static bool mag_configure(void)
 {
-    if (i2c_write_timeout_us(MAG_I2C_PORT_C, MAG_IC_ADDR_C, &dev_addr, 1, true, 1000) <0)
+    int err = 0;
+
+    err |= mag_write(MAG_REG_DEV_CFG_1_C, (0x04 << 2) | (0x00 << 0));           /* CONV_AVG: 16x average, I2C_RD: 3-byte read command */
+    err |= mag_write(MAG_REG_DEV_CFG_2_C, (0x01 << 4) | (0x00 << 2) | 0x00);    /* LP_LN: Low noise, TRIGGER_MODE: I2C command, OPERATING_MODE: Standby */
+    err |= mag_write(MAG_REG_SENSOR_CFG_1_C, (0x07 << 4));                      /* MAG_CH_EN: X, Y, Z */
+    err |= mag_write(MAG_REG_CONV_STATUS_C, MAG_CONV_STATUS_POR_C);             /* POR: cleared by writing 1 */
+
+    return (err == 0);
+}
+
+/**
+ * @brief Diffuser state, hysteresis then debounce
+ * 
+ */
+static void mag_update_diffuser(void)
+{
+    bool b_is_against;
+
+    if (mag_diffuser_cal.on_lsb == 0)
+    {
+        b_mag_is_diffused = false;                                              /* Not calibrated */
+        return;
+    }
+
+    b_is_against = b_mag_is_diffused ? (mag_magnitude <= mag_diffuser_cal.off_lsb) : 
+                                       (mag_magnitude >= mag_diffuser_cal.on_lsb);
+
+    if (!b_is_against)
     {
-        printf("mag_read fail: addr\n");
-        return 1;
+        mag_diffuser_cnt = 0;
     }
+    else if (++mag_diffuser_cnt >= MAG_DIFFUSER_DEBOUNCE_C)
+    {
+        b_mag_is_diffused = !b_mag_is_diffused;
+        mag_diffuser_cnt  = 0;
+    }
+}
+
+/**
+ * @brief Calibration capture in progress
+ * 
+ */
+static void mag_update_cal(void)
+{
+    uint16_t span;
 
-    if (i2c_read_timeout_us(MAG_I2C_PORT_C, MAG_IC_ADDR_C, p_data_rd, data_len, false, 1000) <0)
+    if (mag_cal.target == -1)
     {
-        printf("mag_read fail: data\n");
-        return 1;
+        return;
     }
 
-    return 0;
+    mag_cal.sum += mag_magnitude;
+
+    if (++mag_cal.cnt < MAG_CAL_SAMPLES_C)
+    {
+        return;
+    }
+
+    mag_cal.ref[mag_cal.target] = mag_cal.sum / MAG_CAL_SAMPLES_C;
+    mag_cal.b_has_absent       |= (mag_cal.target == 0);
+
+    if ((mag_cal.target == 1) && 
+        (mag_cal.ref[1] >= (mag_cal.ref[0] + MAG_CAL_MIN_SPAN_C)))
+    {
+        span = mag_cal.ref[1] - mag_cal.ref[0];
+
+        mag_diffuser_cal.off_lsb = mag_cal.ref[0] + (span / 3);
+        mag_diffuser_cal.on_lsb  = mag_cal.ref[0] + ((2 * span) / 3);
+        b_mag_is_diffused        = false;
+        mag_diffuser_cnt         = 0;
+
+        persistance_set_mag_diffuser(&mag_diffuser_cal);                        /* Committed by persistance_update() */
+    }
+
+    mag_cal.target = -1;
 }
 
 /**
@@ -117,15 +390,7 @@ static inline int mag_read(uint8_t dev_addr, int data_len, uint8_t* p_data_rd)
  */
 static inline int mag_write(uint8_t dev_addr, uint8_t data_wr)
 {
-    uint8_t buf[] = {dev_addr, data_wr};
-
-    if (i2c_write_timeout_us(MAG_I2C_PORT_C, MAG_IC_ADDR_C, buf, 2, false, 1000) <0)
-    {
-        printf("mag_write fail\n");
-        return 1;
-    }
-
-    return 0;
+    return (i2c_bus_xfer_blocking(I2C_BUS_DEV_MAG_C, dev_addr, false, &data_wr, 1) != I2C_BUS_RES_OK_C);
 }
 
 /*** END OF FILE ***/
@@ -12,6 +12,22 @@
 /* Exported includes ---------------------------------------------------------*/
 
 #include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @struct MAG_DIFFUSER_CAL_T
+ * @brief Field magnitude thresholds for the magnet keying a diffuser
+ *
+ * Used in persistance region; bump its key version if changed
+ *
+ */
+typedef struct __packed {
+    uint16_t on_lsb;                                                            /* Present at or above */
+    uint16_t off_lsb;                                                           /* Absent at or below, under on_lsb */
+} MAG_DIFFUSER_CAL_T;
 
 
 /* Exported variables --------------------------------------------------------*/
@@ -23,6 +39,12 @@ extern int16_t g_mag_x, g_mag_y, g_mag_z;
 
 void mag_init(void);
 void mag_update(void);
+uint32_t mag_get_sample_count(void);
+uint16_t mag_get_magnitude(void);
+bool mag_is_diffuser_present(void);
+
+int16_t mag_cmd_set_diffuser_cal(uint16_t b_present);
+uint16_t mag_cmd_get_diffuser_text(uint8_t* p_buf, uint16_t len);
 
 
 #endif /* _D_MAG_H_ */
@@ -21,10 +21,13 @@
 
 #include "st7789.h"
 #include "pins.h"
+#include "d_sysclk.h"
+#include "d_i2c_bus.h"
 #include "imu.h"
 #include "mag.h"
 #include "usbpd.h"
 #include "lamp.h"
+#include "lamp_stats.h"
 #include "buttons.h"
 #include "sense.h"
 #include "radar.h"
@@ -38,6 +41,10 @@
 #include "ui_debug.h"
 
 #include "m_cmd.h"
+#include "m_idle.h"
+#include "m_blackbox.h"
+#include "m_telemetry.h"
+#include "fixmath.h"
 
 #include "font.c"
 
@@ -48,6 +55,7 @@ void main(void)
 {	
 	display_screen_off();
 	stdio_init_all();
+	sysclk_init();
 
 	gpio_init(4);
 	gpio_init(5);
@@ -56,6 +64,7 @@ void main(void)
 	gpio_set_dir(5, GPIO_IN);
 	gpio_set_dir(6, GPIO_IN);
 
+	m_blackbox_init();
 	persistance_read_region();
 	printf("g_persistance_region.factory_lamp_type = %d\n", 
 		   g_persistance_region.factory_lamp_type);
@@ -68,16 +77,22 @@ void main(void)
 	ui_loading_splash_image_open(NULL);
 
 	buttons_init();
+	i2c_bus_init();
 	imu_init();
 	mag_init();
 	lamp_init();
+	lamp_stats_init();
 	sense_init();
 	radar_init();
 	fan_init();
 	//radio_init();
+	usbpd_init();
 	usbpd_negotiate(true);
 	fan_set_speed(100);
 	m_cmd_init();
+#if defined(_FIXMATH_ENABLE_BENCH_)
+	fixmath_bench();
+#endif
 
 	sleep_ms(250);
 	sense_update();
@@ -127,18 +142,25 @@ void main(void)
 	
 	while (1)
 	{
+		sysclk_update();
 		m_cmd_handler();
 		sense_update();
 		buttons_update();
+		i2c_bus_update();
 		imu_update();
 		mag_update();
 		radar_update();
 		usbpd_update();
 		lamp_update();
+		lamp_stats_update();
+		m_blackbox_update();
+		m_telemetry_update();
 		
 		if (lamp_is_power_ok())
 		{
-			if (g_buttons_released) 
+			bool b_is_moved = imu_get_motion_event();
+
+			if (g_buttons_released || b_is_moved) 
 			{
 				last_activity_us = time_us_64();
 
@@ -149,6 +171,8 @@ void main(void)
 					b_is_screen_dark = false;
 				}
 			}
+
+			safety_logic_update();												// Before the UI pass, tilt may have just changed
 			
 			// ----------- UI & DISPLAY ---------------------------------- 
 			if (!b_is_screen_dark ||
@@ -161,6 +185,7 @@ void main(void)
 					last_activity_us = time_us_64();
 				}
 
+				sysclk_request(SYSCLK_LEVEL_NOMINAL_C);							// Low clock only while dark
 				lv_timer_handler();
 				ui_main_update();         										// Normal widgets                
 				ui_debug_update();
@@ -174,14 +199,24 @@ void main(void)
 				b_is_screen_dark = true;
 			}
 
+			buttons_set_keypad_enabled(!b_is_screen_dark);						// Presses while dark, the wake one too, never reach the UI
+
 			// static int cycle= 0;
 			// printf("Mainloop... %d\n", cycle++);
 
-			safety_logic_update();
+			persistance_update();												// Write-behind settings commit
+
+			// ----------- IDLE ------------------------------------------ 
+			if (b_is_screen_dark && lamp_is_steady())
+			{
+				m_idle_sleep();													// Until an interrupt or a deadline
+			}
 		}
 		else 
 		{
+			sysclk_request(SYSCLK_LEVEL_NOMINAL_C);
 			ui_loading_show_psu();
+			persistance_update();
 		}
 	}
 }
@@ -1,31 +1,150 @@
 /**
  * @file      persistance.c
  * @author    The OSLUV Project
- * @brief     Driver for 
+ * @brief     Driver for settings and per-unit calibration storage
  * @schematic lamp_controller.SchDoc
- *  
+ *
+ * Settings live in RAM (@ref g_persistance_region) and are stored as an
+ * append-only log of key records over the persistance log region
+ * (@ref flash_map.h). A write programs the changed keys into the next blank
+ * page; records carry a sequence number, the key layout version and a CRC-16,
+ * and the newest valid record of each key wins at boot.
+ *
+ * The first page of every sector holds all the keys, so once the log has
+ * moved on a sector holds nothing live and is erased when the log wraps back
+ * into it. That is one erase every FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE writes,
+ * rotating over the sectors, and the sectors not yet erased still cover a
+ * torn page.
+ *
+ * Setters only mark their key dirty, persistance_update() commits from the
+ * main loop once the settings have been quiet for PERSISTANCE_QUIET_MS_C and
+ * the lamp is steady, so a slider drag costs a single page. The commit is
+ * forced after PERSISTANCE_MAX_DELAY_MS_C and as soon as the 12V rail trends
+ * towards its cutoff, while there is still time to program a page.
+ *
+ * A sector erase keeps the flash busy with interrupts masked for up to a few
+ * hundred ms, so the sector the log enters next is erased ahead of time while
+ * the lamp is steady. The brown-out commit only ever programs a page, and
+ * gives up rather than erase.
+ *
  */
 
 
 /* Includes ------------------------------------------------------------------*/
 
+#include <pico/stdlib.h>
 #include <hardware/flash.h>
 #include <pico/flash.h>
+#include <stddef.h>
+#include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include "persistance.h"
-#include "ui_main.h"
+#include "flash_map.h"
+#include "sense.h"
+#include "m_idle.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
+
+/**
+ * @enum PERSISTANCE_KEY_E
+ * @brief Stored keys, one per @ref PERSISTANCE_REGION_T field
+ *
+ * Append only, a key id is never reused
+ *
+ */
+typedef enum {
+	PERSISTANCE_KEY_POWER_ON_C = 0,
+	PERSISTANCE_KEY_RADAR_ON_C,
+	PERSISTANCE_KEY_DIM_PCT_C,
+	PERSISTANCE_KEY_LAMP_TYPE_C,
+	PERSISTANCE_KEY_LAMP_CAL_C,
+	PERSISTANCE_KEY_LAMP_BANDS_C,
+	PERSISTANCE_KEY_MAG_DIFFUSER_C,
+	PERSISTANCE_KEY_CMD_BAUD_C,
+	PERSISTANCE_KEY_MAX_C
+} PERSISTANCE_KEY_E;
+
+/**
+ * @struct PERSISTANCE_REC_HDR_T
+ * @brief Log record header, the value follows
+ *
+ */
+typedef struct __packed {
+	uint8_t  key;																/* @ref PERSISTANCE_KEY_E, erased space reads 0xff */
+	uint8_t  ver;																/* Value layout version of the key */
+	uint8_t  len;																/* Value bytes following the header */
+	uint8_t  _reserved;
+	uint32_t seq;																/* Log order, increments on every record */
+	uint16_t crc;																/* CRC-16/CCITT over the header up to here and the value */
+} PERSISTANCE_REC_HDR_T;
+
+/**
+ * @struct PERSISTANCE_KEY_T
+ * @brief Where a key lives in the RAM mirror
+ *
+ */
+typedef struct {
+	uint16_t offset;
+	uint8_t  len;
+	uint8_t  ver;
+} PERSISTANCE_KEY_T;
+
+/**
+ * @struct PERSISTANCE_LEGACY_T
+ * @brief Single sector layout of previous firmware
+ *
+ * Each layout appended fields to the previous one, see
+ * persistance_legacy_layouts
+ *
+ */
+typedef struct __packed {
+	uint32_t 			 magic;
+	PERSISTANCE_REGION_T region;
+} PERSISTANCE_LEGACY_T;
+
+/**
+ * @struct PERSISTANCE_LEGACY_LAYOUT_T
+ * @brief A single sector layout, by its magic
+ *
+ */
+typedef struct {
+	uint32_t magic;
+	uint16_t len;																/* Region bytes after the magic */
+} PERSISTANCE_LEGACY_LAYOUT_T;
+
+
 /* Private define ------------------------------------------------------------*/
 
-#define PERSISTANCE_MAGIC_VAL_C 	0xb8870200
-#define PERSISTANCE_FLASH_OFFSET_C 	(PICO_FLASH_SIZE_BYTES - 4096) 				/* Stored in the very last 4 kB sector */
+#define PERSISTANCE_LEGACY_DIM_IDX_MAGIC_C 0xb8870200							/* Dim stored as index 0–3 (20/40/70/100 %) */
+#define PERSISTANCE_LEGACY_OFFSET_C 	FLASH_MAP_PERSISTANCE_OFFSET_C
+
+#define PERSISTANCE_LOG_OFFSET_C		FLASH_MAP_PERSISTANCE_LOG_OFFSET_C
+#define PERSISTANCE_PAGES_C				(FLASH_MAP_PERSISTANCE_LOG_SIZE_C / FLASH_PAGE_SIZE)
+#define PERSISTANCE_PAGES_PER_SECTOR_C	(FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+#define PERSISTANCE_KEY_ALL_C			((1UL << PERSISTANCE_KEY_MAX_C) - 1)
+#define PERSISTANCE_KEY_DEF(field, version) \
+										{ offsetof(PERSISTANCE_REGION_T, field), \
+										  sizeof(((PERSISTANCE_REGION_T*)0)->field), \
+										  (version) }
+
+#define PERSISTANCE_QUIET_MS_C			2000									/* No change for this long before a commit */
+#define PERSISTANCE_MAX_DELAY_MS_C		10000									/* Commit latency bound from the first change */
+#define PERSISTANCE_BROWNOUT_MV_C		11000									/* 12V mean below, ahead of the 10.5 V cutoff */
+#define PERSISTANCE_BROWNOUT_DROP_MV_C	400										/* 12V mean drop between two sense windows */
+#define PERSISTANCE_SECTOR_UNKNOWN_C	0xffff
 
 #define PERSISTANCE_DEF_POWER_ON_C	1											/* Lamp on   */
 #define PERSISTANCE_DEF_RADAR_ON_C  0											/* Radar off */
-#define PERSISTANCE_DEF_DIM_IDX_C	3											/* 0–3  (20/40/70/100 %) */
+#define PERSISTANCE_DEF_DIM_PCT_C	100											/* 1–100 % */
+#define PERSISTANCE_DEF_CMD_BAUD_DIV_C 96										/* 9600 baud */
+
+static_assert(sizeof(PERSISTANCE_REGION_T) + (PERSISTANCE_KEY_MAX_C * sizeof(PERSISTANCE_REC_HDR_T)) <= FLASH_PAGE_SIZE,
+			  "All persistance keys must fit in a flash page");
+static_assert((FLASH_MAP_PERSISTANCE_LOG_SIZE_C / FLASH_SECTOR_SIZE) >= 2,
+			  "Persistance log needs two sectors at least");
 
 
 /* Global variables  ---------------------------------------------------------*/
@@ -35,76 +154,213 @@ PERSISTANCE_REGION_T g_persistance_region = {0};
 
 /* Private variables  --------------------------------------------------------*/
 
-static bool 				b_persistance_is_dirty = false;
-static const uint8_t*		p_persistance_flash_region = 
-							(const uint8_t *)(XIP_BASE + PERSISTANCE_FLASH_OFFSET_C);
+static const PERSISTANCE_KEY_T persistance_keys[PERSISTANCE_KEY_MAX_C] = {
+	[PERSISTANCE_KEY_POWER_ON_C]     = PERSISTANCE_KEY_DEF(power_on, 1),
+	[PERSISTANCE_KEY_RADAR_ON_C]     = PERSISTANCE_KEY_DEF(radar_on, 1),
+	[PERSISTANCE_KEY_DIM_PCT_C]      = PERSISTANCE_KEY_DEF(dim_pct, 1),
+	[PERSISTANCE_KEY_LAMP_TYPE_C]    = PERSISTANCE_KEY_DEF(factory_lamp_type, 1),
+	[PERSISTANCE_KEY_LAMP_CAL_C]     = PERSISTANCE_KEY_DEF(lamp_cal, 1),
+	[PERSISTANCE_KEY_LAMP_BANDS_C]   = PERSISTANCE_KEY_DEF(lamp_bands, 1),
+	[PERSISTANCE_KEY_MAG_DIFFUSER_C] = PERSISTANCE_KEY_DEF(mag_diffuser, 1),
+	[PERSISTANCE_KEY_CMD_BAUD_C]     = PERSISTANCE_KEY_DEF(cmd_baud_div, 1),
+};
+
+static uint32_t 			persistance_dirty_keys = 0;							/* Bit per @ref PERSISTANCE_KEY_E */
+static uint32_t 			persistance_seq 	   = 0;							/* Last record written */
+static uint16_t 			persistance_next_page  = 0;
+static uint32_t 			persistance_writes 	   = 0;							/* Since boot */
+static uint32_t 			persistance_erases 	   = 0;							/* Since boot */
+
+static absolute_time_t 		persistance_first_change;							/* Oldest uncommitted change */
+static absolute_time_t 		persistance_last_change;
+static uint32_t 			persistance_sense_seq  = 0;
+static uint16_t 			persistance_last_12v_mv = 0;
+static uint32_t 			persistance_last_latency_ms = 0;
+static uint32_t 			persistance_max_latency_ms  = 0;
+static uint32_t 			persistance_brownouts  = 0;							/* Commits forced by the 12V trend */
+static uint16_t 			persistance_ahead_sector = PERSISTANCE_SECTOR_UNKNOWN_C; /* Sector the log enters next, once checked */
+static bool 				b_persistance_is_ahead_blank = false;
+
+static uint8_t 				persistance_page_buf[FLASH_PAGE_SIZE] __aligned(4);
+
+static const PERSISTANCE_LEGACY_LAYOUT_T persistance_legacy_layouts[] = {		/* Migrated once into the log */
+	{ PERSISTANCE_LEGACY_DIM_IDX_MAGIC_C, offsetof(PERSISTANCE_REGION_T, lamp_cal) },
+	{ 0xb8870201, offsetof(PERSISTANCE_REGION_T, lamp_bands) },
+	{ 0xb8870202, offsetof(PERSISTANCE_REGION_T, mag_diffuser) },
+	{ 0xb8870203, offsetof(PERSISTANCE_REGION_T, cmd_baud_div) },
+};
 
 
 /* Private function prototypes -----------------------------------------------*/
 
-static void write_persistance_region_inner(void*);
+static void persistance_set_defaults(void);
+static bool persistance_migrate_legacy(void);
+static const uint8_t* persistance_get_page(uint16_t page);
+static uint16_t persistance_parse_record(const uint8_t* p_page, uint16_t pos,
+										 const PERSISTANCE_REC_HDR_T** pp_hdr);
+static uint16_t persistance_crc16(uint16_t crc, const uint8_t* p_data, uint16_t len);
+static bool persistance_is_blank(uint16_t page, uint16_t pages);
+static void persistance_build_page(uint32_t keys);
+static void persistance_set_dirty(PERSISTANCE_KEY_E key, bool b_is_changed);
+static bool persistance_commit(bool b_may_erase);
+static void persistance_erase_ahead(void);
+static bool persistance_is_brownout(void);
+static void persistance_erase_inner(void* p_offset);
+static void persistance_program_inner(void* p_offset);
 
 
 /* Exported functions --------------------------------------------------------*/
 
 /**
- * @brief Gets persistence data from assigned memory region
- * 
- * @return 	void  
- * 
+ * @brief Restores the newest value of every key from the log
+ *
+ * Keys missing from the log keep their default. Without any record the
+ * previous single sector region is migrated, if valid.
+ *
+ * @return 	void
+ *
  */
 void persistance_read_region(void)
 {
-	memcpy(&g_persistance_region, p_persistance_flash_region, sizeof(g_persistance_region));
+	uint32_t newest_seq[PERSISTANCE_KEY_MAX_C];
+	uint32_t found_keys   = 0;
+	bool 	 b_has_record = false;
+	uint16_t newest_page  = 0;
 
-	if (g_persistance_region.magic != PERSISTANCE_MAGIC_VAL_C)
+	persistance_set_defaults();
+
+	for (uint16_t page = 0; page < PERSISTANCE_PAGES_C; page++)
 	{
-		memset(&g_persistance_region, 0, sizeof(g_persistance_region));
+		const uint8_t* 				 p_page = persistance_get_page(page);
+		const PERSISTANCE_REC_HDR_T* p_hdr;
+		uint16_t 					 pos = 0;
+		uint16_t 					 rec_len;
+
+		while ((rec_len = persistance_parse_record(p_page, pos, &p_hdr)) != 0)
+		{
+			uint8_t  key = p_hdr->key;
+			uint32_t bit = 1UL << (key % 32);
+
+			if (!b_has_record || ((int32_t)(p_hdr->seq - persistance_seq) > 0))
+			{
+				persistance_seq = p_hdr->seq;
+				newest_page 	= page;
+				b_has_record 	= true;
+			}
+
+			if ((key < PERSISTANCE_KEY_MAX_C) &&
+				(p_hdr->ver == persistance_keys[key].ver) &&
+				(p_hdr->len == persistance_keys[key].len) &&
+				(!(found_keys & bit) || ((int32_t)(p_hdr->seq - newest_seq[key]) > 0)))
+			{
+				memcpy((uint8_t*)&g_persistance_region + persistance_keys[key].offset,
+					   &p_page[pos + sizeof(*p_hdr)],
+					   persistance_keys[key].len);
+
+				newest_seq[key] = p_hdr->seq;
+				found_keys 	   |= bit;
+			}
+
+			pos += rec_len;
+		}
+	}
 
-		g_persistance_region.magic 	  = PERSISTANCE_MAGIC_VAL_C;
-		g_persistance_region.power_on   = PERSISTANCE_DEF_POWER_ON_C;
-        g_persistance_region.radar_on   = PERSISTANCE_DEF_RADAR_ON_C;
-        g_persistance_region.dim_index  = PERSISTANCE_DEF_DIM_IDX_C;
+	if (b_has_record)
+	{
+		persistance_next_page  = (newest_page + 1) % PERSISTANCE_PAGES_C;
+		persistance_dirty_keys = 0;
 
-		b_persistance_is_dirty = true;
+		printf("Persistance restored, record %lu\n", (unsigned long)persistance_seq);
+	}
+	else
+	{
+		if (persistance_migrate_legacy())
+		{
+			printf("Persistance migrated from the single sector region\n");
+		}
+
+		persistance_next_page  	 = 0;
+		persistance_dirty_keys 	 = PERSISTANCE_KEY_ALL_C;
+		persistance_first_change = get_absolute_time();
+		persistance_last_change  = persistance_first_change;
 	}
 }
 
 /**
- * @brief Stores the persistence data at assigned memory region
- * 
+ * @brief Appends the changed keys to the log now
+ *
+ * Blocking, for factory and calibration paths; settings commit through
+ * persistance_update(). A single page program, but entering a sector erases it
+ * first unless done ahead, and stores all the keys. Keys stay dirty if flash
+ * could not be reached.
+ *
  */
 void persistance_write_region(void)
 {
-	if (!b_persistance_is_dirty) 
+	persistance_commit(true);
+}
+
+/**
+ * @brief Commits the dirty keys when due, from the main loop after the UI pass
+ *
+ * Due once the settings were quiet for PERSISTANCE_QUIET_MS_C with the lamp
+ * steady, forced at PERSISTANCE_MAX_DELAY_MS_C or on a 12V brown-out trend.
+ * With nothing to commit and the lamp steady, the next sector is erased ahead.
+ *
+ */
+void persistance_update(void)
+{
+	bool b_is_brownout = persistance_is_brownout();
+
+	if (persistance_dirty_keys == 0)
 	{
+		if (!b_is_brownout && lamp_is_steady() &&
+			(persistance_last_12v_mv >= PERSISTANCE_BROWNOUT_MV_C))				/* Not on a sagging rail */
+		{
+			persistance_erase_ahead();
+		}
+
 		return;
 	}
 
-	flash_safe_execute(write_persistance_region_inner, NULL, 100);
+	absolute_time_t quiet_end = delayed_by_ms(persistance_last_change, PERSISTANCE_QUIET_MS_C);
+	absolute_time_t max_end   = delayed_by_ms(persistance_first_change, PERSISTANCE_MAX_DELAY_MS_C);
 
-	b_persistance_is_dirty = false;
+	if (b_is_brownout)
+	{
+		persistance_brownouts++;
 
-	printf("writing to persistance region");
+		persistance_commit(false);
+	}
+	else if (time_reached(max_end) ||
+			 (time_reached(quiet_end) && lamp_is_steady()))
+	{
+		persistance_commit(true);
+	}
+	else
+	{
+		m_idle_wake_by(quiet_end);
+	}
 }
 
 /**
  * @brief Sets a new persistence lamp power state
- * 
+ *
  * @param b_pwr_on The new state to set
  */
 void persistance_set_power_state(bool b_pwr_on)
 {
-	b_persistance_is_dirty |= (g_persistance_region.power_on != b_pwr_on);
+	persistance_set_dirty(PERSISTANCE_KEY_POWER_ON_C,
+						  (g_persistance_region.power_on != b_pwr_on));
 
-    g_persistance_region.power_on = b_pwr_on; 
+    g_persistance_region.power_on = b_pwr_on;
 }
 
 /**
  * @brief Gets the current persistence lamp power state
- * 
- * @return true 
- * @return false 
+ *
+ * @return true
+ * @return false
  */
 bool persistance_get_power_state(void)
 {
@@ -113,21 +369,22 @@ bool persistance_get_power_state(void)
 
 /**
  * @brief Sets a new persistence radar state
- * 
+ *
  * @param b_radar_on The new state to set
  */
 void persistance_set_radar_state(bool b_radar_on)
 {
-	b_persistance_is_dirty |= (g_persistance_region.radar_on != b_radar_on);
+	persistance_set_dirty(PERSISTANCE_KEY_RADAR_ON_C,
+						  (g_persistance_region.radar_on != b_radar_on));
 
 	g_persistance_region.radar_on = b_radar_on;
 }
 
 /**
  * @brief Gets the current persistence radar state
- * 
- * @return true 
- * @return false 
+ *
+ * @return true
+ * @return false
  */
 bool persistance_get_radar_state(void)
 {
@@ -135,48 +392,515 @@ bool persistance_get_radar_state(void)
 }
 
 /**
- * @brief Sets a new persistence dim level by index 
- * @ref UI_MAIN_MAX_DIM_LEVELS_C
- * 
- * @param idx 
+ * @brief Sets a new persistence dim level in percentage
+ *
+ * @param pct Output set-point, clamped to 1–100 %
  */
-void persistance_set_dim_index(uint8_t idx)
+void persistance_set_dim_pct(uint8_t pct)
 {
-	if (idx > UI_MAIN_MAX_DIM_INDEX_C) 
+	if (pct > 100)
+	{
+		pct = 100;
+	}
+	if (pct == 0)
 	{
-		idx = UI_MAIN_MAX_DIM_INDEX_C;
+		pct = 1;
 	}
 
-	b_persistance_is_dirty |= (g_persistance_region.dim_index != idx);
+	persistance_set_dirty(PERSISTANCE_KEY_DIM_PCT_C,
+						  (g_persistance_region.dim_pct != pct));
+
+	g_persistance_region.dim_pct = pct;
+}
+
+/**
+ * @brief Gets the current persistence dim level in percentage
+ *
+ * @return uint8_t
+ */
+uint8_t persistance_get_dim_pct(void)
+{
+	return g_persistance_region.dim_pct;
+}
+
+/**
+ * @brief Sets a new persistence lamp calibration curve
+ *
+ * @param p_curve The curve to store @ref LAMP_CAL_CURVE_T
+ */
+void persistance_set_lamp_cal(const LAMP_CAL_CURVE_T* p_curve)
+{
+	persistance_set_dirty(PERSISTANCE_KEY_LAMP_CAL_C,
+						  (memcmp(&g_persistance_region.lamp_cal,
+								  p_curve,
+								  sizeof(*p_curve)) != 0));
+
+	g_persistance_region.lamp_cal = *p_curve;
+}
+
+/**
+ * @brief Sets new persistence status frequency classification bands
+ *
+ * @param p_bands The bands to store @ref LAMP_CAL_BANDS_T
+ */
+void persistance_set_lamp_bands(const LAMP_CAL_BANDS_T* p_bands)
+{
+	persistance_set_dirty(PERSISTANCE_KEY_LAMP_BANDS_C,
+						  (memcmp(&g_persistance_region.lamp_bands,
+								  p_bands,
+								  sizeof(*p_bands)) != 0));
+
+	g_persistance_region.lamp_bands = *p_bands;
+}
 
-	g_persistance_region.dim_index = idx;
+/**
+ * @brief Sets new persistence diffuser magnet thresholds
+ *
+ * @param p_cal The thresholds to store @ref MAG_DIFFUSER_CAL_T
+ */
+void persistance_set_mag_diffuser(const MAG_DIFFUSER_CAL_T* p_cal)
+{
+	persistance_set_dirty(PERSISTANCE_KEY_MAG_DIFFUSER_C,
+						  (memcmp(&g_persistance_region.mag_diffuser,
+								  p_cal,
+								  sizeof(*p_cal)) != 0));
+
+	g_persistance_region.mag_diffuser = *p_cal;
 }
 
 /**
- * @brief Gets the current persistence dim level by index 
- * @ref UI_MAIN_MAX_DIM_LEVELS_C
- * 
- * @return uint8_t 
+ * @brief Sets the lamp type concluded by the factory type test
+ *
+ * @param lamp_type @ref LAMP_TYPE_E
  */
-uint8_t persistance_get_dim_index(void)
+void persistance_set_factory_lamp_type(uint8_t lamp_type)
 {
-	return g_persistance_region.dim_index;
+	persistance_set_dirty(PERSISTANCE_KEY_LAMP_TYPE_C,
+						  (g_persistance_region.factory_lamp_type != lamp_type));
+
+	g_persistance_region.factory_lamp_type = lamp_type;
+}
+
+/**
+ * @brief Sets the command port baud rate used at boot
+ *
+ * @param baud_div Baud rate / 100
+ */
+void persistance_set_cmd_baud_div(uint16_t baud_div)
+{
+	persistance_set_dirty(PERSISTANCE_KEY_CMD_BAUD_C,
+						  (g_persistance_region.cmd_baud_div != baud_div));
+
+	g_persistance_region.cmd_baud_div = baud_div;
+}
+
+/**
+ * @brief Gets the command port baud rate used at boot
+ *
+ * @return uint16_t Baud rate / 100, checked by the caller
+ */
+uint16_t persistance_get_cmd_baud_div(void)
+{
+	return g_persistance_region.cmd_baud_div;
+}
+
+/**
+ * @brief Formats the log position and counters as a single line
+ * @note This function can be called via external command
+ *
+ * Writes, erases and brown-out commits are counted since boot, LAT is the
+ * last and the longest commit latency in ms
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t persistance_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+	int text_len = snprintf((char*)p_buf, len,
+							"SEQ=%lu,PAGE=%u/%u,WR=%lu,ER=%lu,DIRTY=%lx,LAT=%lu/%lu,BO=%lu",
+							(unsigned long)persistance_seq,
+							persistance_next_page,
+							PERSISTANCE_PAGES_C,
+							(unsigned long)persistance_writes,
+							(unsigned long)persistance_erases,
+							(unsigned long)persistance_dirty_keys,
+							(unsigned long)persistance_last_latency_ms,
+							(unsigned long)persistance_max_latency_ms,
+							(unsigned long)persistance_brownouts);
+
+	return (text_len < 0) ? 0 : MIN(text_len, len - 1);
 }
 
 
 /* Private functions ---------------------------------------------------------*/
 
 /**
- * @brief Writes the persistence data at assigned memory region
- * 
+ * @brief Loads the default of every key
+ *
+ */
+static void persistance_set_defaults(void)
+{
+	memset(&g_persistance_region, 0, sizeof(g_persistance_region));
+
+	g_persistance_region.power_on = PERSISTANCE_DEF_POWER_ON_C;
+	g_persistance_region.radar_on = PERSISTANCE_DEF_RADAR_ON_C;
+	g_persistance_region.dim_pct  = PERSISTANCE_DEF_DIM_PCT_C;
+	g_persistance_region.cmd_baud_div = PERSISTANCE_DEF_CMD_BAUD_DIV_C;
+}
+
+/**
+ * @brief Loads the single sector region of previous firmware, any layout
+ *
+ * Fields the layout did not have yet keep their default
+ *
+ * @return true Region found and loaded
+ * @return false
+ */
+static bool persistance_migrate_legacy(void)
+{
+	const PERSISTANCE_LEGACY_T* p_legacy =
+		(const PERSISTANCE_LEGACY_T*)(XIP_BASE + PERSISTANCE_LEGACY_OFFSET_C);
+
+	for (uint8_t idx = 0; idx < count_of(persistance_legacy_layouts); idx++)
+	{
+		if (p_legacy->magic != persistance_legacy_layouts[idx].magic)
+		{
+			continue;
+		}
+
+		memcpy(&g_persistance_region, &p_legacy->region, persistance_legacy_layouts[idx].len);
+
+		if (p_legacy->magic == PERSISTANCE_LEGACY_DIM_IDX_MAGIC_C)
+		{
+			uint8_t dim_idx = MIN(p_legacy->region.dim_pct, LAMP_PWR_100PCT_C - LAMP_PWR_20PCT_C);
+
+			g_persistance_region.dim_pct = lamp_get_power_level_pct(LAMP_PWR_20PCT_C + dim_idx);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Returns a page of the persistance log
+ *
+ * @param page Page index in the region
+ * @return const uint8_t* Memory-mapped page
+ */
+static const uint8_t* persistance_get_page(uint16_t page)
+{
+	return (const uint8_t*)(XIP_BASE + PERSISTANCE_LOG_OFFSET_C + (page * FLASH_PAGE_SIZE));
+}
+
+/**
+ * @brief Checks the record at a position of a page
+ *
+ * Records of unknown keys are valid too, so they can be skipped
+ *
+ * @param p_page Page
+ * @param pos Record position in the page
+ * @param pp_hdr Record header
+ * @return uint16_t Record length, 0 at the end of the page or a bad record
+ */
+static uint16_t persistance_parse_record(const uint8_t* p_page, uint16_t pos,
+										 const PERSISTANCE_REC_HDR_T** pp_hdr)
+{
+	const PERSISTANCE_REC_HDR_T* p_hdr = (const PERSISTANCE_REC_HDR_T*)&p_page[pos];
+	uint16_t 					 crc;
+
+	if (((pos + sizeof(*p_hdr)) > FLASH_PAGE_SIZE) || (p_hdr->key == 0xff) ||
+		((pos + sizeof(*p_hdr) + p_hdr->len) > FLASH_PAGE_SIZE))
+	{
+		return 0;
+	}
+
+	crc = persistance_crc16(0xffff, (const uint8_t*)p_hdr, offsetof(PERSISTANCE_REC_HDR_T, crc));
+	crc = persistance_crc16(crc, &p_page[pos + sizeof(*p_hdr)], p_hdr->len);
+
+	if (crc != p_hdr->crc)
+	{
+		return 0;
+	}
+
+	*pp_hdr = p_hdr;
+
+	return sizeof(*p_hdr) + p_hdr->len;
+}
+
+/**
+ * @brief CRC-16/CCITT, bitwise
+ *
+ * @param crc Running value, 0xffff to start
+ * @param p_data Data
+ * @param len Data length
+ * @return uint16_t
+ */
+static uint16_t persistance_crc16(uint16_t crc, const uint8_t* p_data, uint16_t len)
+{
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		crc ^= (uint16_t)p_data[idx] << 8;
+
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+/**
+ * @brief Returns whether pages are erased and can be programmed
+ *
+ * @param page First page index in the region
+ * @param pages Number of pages
+ * @return true
+ * @return false
+ */
+static bool persistance_is_blank(uint16_t page, uint16_t pages)
+{
+	const uint32_t* p_word = (const uint32_t*)persistance_get_page(page);
+
+	for (uint32_t idx = 0; idx < (pages * FLASH_PAGE_SIZE / sizeof(uint32_t)); idx++)
+	{
+		if (p_word[idx] != 0xffffffff)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Fills the page buffer with a record per key
+ *
+ * @param keys Bit per @ref PERSISTANCE_KEY_E
+ */
+static void persistance_build_page(uint32_t keys)
+{
+	uint16_t pos = 0;
+
+	memset(persistance_page_buf, 0xff, sizeof(persistance_page_buf));
+
+	for (int key = 0; key < PERSISTANCE_KEY_MAX_C; key++)
+	{
+		const PERSISTANCE_KEY_T* p_key   = &persistance_keys[key];
+		const uint8_t* 			 p_value = (const uint8_t*)&g_persistance_region + p_key->offset;
+		PERSISTANCE_REC_HDR_T 	 hdr;
+
+		if (!(keys & (1UL << key)))
+		{
+			continue;
+		}
+
+		hdr.key 	  = key;
+		hdr.ver 	  = p_key->ver;
+		hdr.len 	  = p_key->len;
+		hdr._reserved = 0xff;
+		hdr.seq 	  = ++persistance_seq;
+		hdr.crc 	  = persistance_crc16(persistance_crc16(0xffff,
+															(const uint8_t*)&hdr,
+															offsetof(PERSISTANCE_REC_HDR_T, crc)),
+										  p_value,
+										  p_key->len);
+
+		memcpy(&persistance_page_buf[pos], &hdr, sizeof(hdr));
+		memcpy(&persistance_page_buf[pos + sizeof(hdr)], p_value, p_key->len);
+
+		pos += sizeof(hdr) + p_key->len;
+	}
+}
+
+/**
+ * @brief Flags a key to be written if its value changed
+ *
+ * @param key @ref PERSISTANCE_KEY_E
+ * @param b_is_changed
+ */
+static void persistance_set_dirty(PERSISTANCE_KEY_E key, bool b_is_changed)
+{
+	if (b_is_changed)
+	{
+		if (persistance_dirty_keys == 0)
+		{
+			persistance_first_change = get_absolute_time();
+		}
+
+		persistance_dirty_keys |= (1UL << key);
+		persistance_last_change  = get_absolute_time();
+	}
+}
+
+/**
+ * @brief Appends the changed keys to the next page of the log
+ *
+ * Entering a sector stores all the keys, and erases the sector first if it
+ * was not erased ahead and erasing is allowed
+ *
+ * @param b_may_erase false on the brown-out path, page programming only
+ * @return true Written, or nothing to write
+ * @return false Keys left dirty
+ */
+static bool persistance_commit(bool b_may_erase)
+{
+	uint32_t keys = persistance_dirty_keys;
+
+	if (keys == 0)
+	{
+		return true;
+	}
+
+	if (((persistance_next_page % PERSISTANCE_PAGES_PER_SECTOR_C) != 0) &&
+		!persistance_is_blank(persistance_next_page, 1))
+	{
+		/* Torn page, start over in the next sector */
+		persistance_next_page = ((persistance_next_page / PERSISTANCE_PAGES_PER_SECTOR_C + 1) *
+								 PERSISTANCE_PAGES_PER_SECTOR_C) % PERSISTANCE_PAGES_C;
+	}
+
+	if ((persistance_next_page % PERSISTANCE_PAGES_PER_SECTOR_C) == 0)
+	{
+		uint32_t offset = PERSISTANCE_LOG_OFFSET_C + (persistance_next_page * FLASH_PAGE_SIZE);
+		uint16_t sector = persistance_next_page / PERSISTANCE_PAGES_PER_SECTOR_C;
+
+		if ((persistance_ahead_sector != sector) || !b_persistance_is_ahead_blank)
+		{
+			if (!persistance_is_blank(persistance_next_page, PERSISTANCE_PAGES_PER_SECTOR_C))
+			{
+				if (!b_may_erase ||
+					(flash_safe_execute(persistance_erase_inner, (void*)(uintptr_t)offset, 100) != PICO_OK))
+				{
+					return false;
+				}
+
+				persistance_erases++;
+			}
+		}
+
+		persistance_ahead_sector = PERSISTANCE_SECTOR_UNKNOWN_C;				/* Entered, the next one is due */
+
+		keys = PERSISTANCE_KEY_ALL_C;
+	}
+
+	persistance_build_page(keys);
+
+	if (flash_safe_execute(persistance_program_inner,
+						   (void*)(uintptr_t)(PERSISTANCE_LOG_OFFSET_C + (persistance_next_page * FLASH_PAGE_SIZE)),
+						   100) != PICO_OK)
+	{
+		return false;
+	}
+
+	persistance_next_page  = (persistance_next_page + 1) % PERSISTANCE_PAGES_C;
+	persistance_dirty_keys = 0;
+	persistance_writes++;
+
+	persistance_last_latency_ms = (uint32_t)(absolute_time_diff_us(persistance_first_change,
+																   get_absolute_time()) / 1000);
+	persistance_max_latency_ms  = MAX(persistance_max_latency_ms, persistance_last_latency_ms);
+
+	lamp_restart_status_window();												// Flash stalled the status counting
+
+	printf("writing to persistance region, record %lu\n", (unsigned long)persistance_seq);
+
+	return true;
+}
+
+/**
+ * @brief Erases the sector the log enters next, while nothing is pressing
+ *
+ * Once the log is past the first page of a sector, that page holds all the
+ * keys and the next sector holds nothing live. Checked once per sector.
+ *
  */
-static void write_persistance_region_inner(void*)
+static void persistance_erase_ahead(void)
 {
-	flash_range_erase(PERSISTANCE_FLASH_OFFSET_C, FLASH_SECTOR_SIZE);
+	uint16_t sector = ((persistance_next_page + PERSISTANCE_PAGES_PER_SECTOR_C - 1) /
+					   PERSISTANCE_PAGES_PER_SECTOR_C) % (PERSISTANCE_PAGES_C / PERSISTANCE_PAGES_PER_SECTOR_C);
+	uint32_t offset = PERSISTANCE_LOG_OFFSET_C + (sector * FLASH_SECTOR_SIZE);
+
+	if (persistance_ahead_sector != sector)
+	{
+		persistance_ahead_sector 	 = sector;
+		b_persistance_is_ahead_blank = persistance_is_blank(sector * PERSISTANCE_PAGES_PER_SECTOR_C,
+															 PERSISTANCE_PAGES_PER_SECTOR_C);
+	}
 
-	flash_range_program(PERSISTANCE_FLASH_OFFSET_C, 
-						(const uint8_t*)&g_persistance_region,
-						sizeof(g_persistance_region));
+	if (b_persistance_is_ahead_blank)
+	{
+		return;
+	}
+
+	if (flash_safe_execute(persistance_erase_inner, (void*)(uintptr_t)offset, 100) != PICO_OK)
+	{
+		return;
+	}
+
+	persistance_erases++;
+	b_persistance_is_ahead_blank = true;
+
+	lamp_restart_status_window();												// Flash stalled the status counting
+}
+
+/**
+ * @brief Checks the 12V trend on each new sense window
+ *
+ * A brown-out is the mean crossing below PERSISTANCE_BROWNOUT_MV_C or falling
+ * by PERSISTANCE_BROWNOUT_DROP_MV_C within a window, a lamp without 12V does
+ * not trip it. The drop alone is ignored until the lamp is steady, the rail
+ * sags that much at every strike.
+ *
+ * @return true The rail is going down
+ * @return false
+ */
+static bool persistance_is_brownout(void)
+{
+	SENSE_RAIL_STATS_T stats;
+	uint32_t 		   seq = sense_get_stats_seq();
+	bool 			   b_is_brownout;
+
+	if (seq == persistance_sense_seq)
+	{
+		return false;
+	}
+
+	persistance_sense_seq = seq;
+
+	sense_get_rail_stats(SENSE_RAIL_12V_C, &stats);
+
+	b_is_brownout = (persistance_last_12v_mv >= PERSISTANCE_BROWNOUT_MV_C) &&
+					((stats.mean_mv < PERSISTANCE_BROWNOUT_MV_C) ||
+					 (lamp_is_steady() &&
+					  ((persistance_last_12v_mv - stats.mean_mv) >= PERSISTANCE_BROWNOUT_DROP_MV_C)));
+
+	persistance_last_12v_mv = stats.mean_mv;
+
+	return b_is_brownout;
+}
+
+/**
+ * @brief Erases a sector of the persistance log, flash safe context
+ *
+ * @param p_offset Flash offset of the sector
+ */
+static void persistance_erase_inner(void* p_offset)
+{
+	flash_range_erase((uint32_t)(uintptr_t)p_offset, FLASH_SECTOR_SIZE);
+}
+
+/**
+ * @brief Programs the page buffer, flash safe context
+ *
+ * @param p_offset Flash offset of the page
+ */
+static void persistance_program_inner(void* p_offset)
+{
+	flash_range_program((uint32_t)(uintptr_t)p_offset, persistance_page_buf, FLASH_PAGE_SIZE);
 }
 
 /*** END OF FILE ***/
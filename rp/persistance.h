@@ -13,16 +13,28 @@
 
 #include <stdint.h>
 #include "lamp.h"
+#include "lamp_cal.h"
+#include "mag.h"
 
 
 /* Exported typedef ----------------------------------------------------------*/
 
+/**
+ * @struct PERSISTANCE_REGION_T
+ * @brief RAM mirror of the persistance log, one key per field
+ *
+ * Field order is the legacy single sector layout after its magic, keep it
+ *
+ */
 typedef struct __packed {
-    uint32_t magic;          /* guard */
     uint8_t  power_on;       /* 1 = lamp on */
     uint8_t  radar_on;       /* 1 = radar enabled */
-    uint8_t  dim_index;      /* 0–3  (20/40/70/100 %) */
+    uint8_t  dim_pct;        /* Lamp output set-point, 1–100 % */
 	uint8_t  factory_lamp_type;
+	LAMP_CAL_CURVE_T lamp_cal; /* Per-unit dimming curve */
+	LAMP_CAL_BANDS_T lamp_bands; /* Per-unit status frequency bands */
+	MAG_DIFFUSER_CAL_T mag_diffuser; /* Diffuser magnet thresholds */
+	uint16_t cmd_baud_div;   /* Command port baud rate at boot / 100 */
 } PERSISTANCE_REGION_T;
 
 
@@ -35,13 +47,22 @@ extern PERSISTANCE_REGION_T g_persistance_region;
 
 void persistance_read_region(void);
 void persistance_write_region(void);
+void persistance_update(void);
 
 void persistance_set_power_state(bool b_pwr_on);
 bool persistance_get_power_state(void);
 void persistance_set_radar_state(bool b_radar_on);
 bool persistance_get_radar_state(void);
-void persistance_set_dim_index(uint8_t idx);
-uint8_t persistance_get_dim_index(void);
+void persistance_set_dim_pct(uint8_t pct);
+uint8_t persistance_get_dim_pct(void);
+void persistance_set_lamp_cal(const LAMP_CAL_CURVE_T* p_curve);
+void persistance_set_lamp_bands(const LAMP_CAL_BANDS_T* p_bands);
+void persistance_set_mag_diffuser(const MAG_DIFFUSER_CAL_T* p_cal);
+void persistance_set_factory_lamp_type(uint8_t lamp_type);
+void persistance_set_cmd_baud_div(uint16_t baud_div);
+uint16_t persistance_get_cmd_baud_div(void);
+
+uint16_t persistance_cmd_get_text(uint8_t* p_buf, uint16_t len);
 
 
 #endif /* _D_PERSISTANCE_H_ */
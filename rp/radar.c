@@ -21,6 +21,9 @@
 #include "pins.h"
 #include "lamp.h"
 #include "radar.h"
+#include "m_idle.h"
+#include "d_sysclk.h"
+#include "m_blackbox.h"
 
 
 /* Compile-time --------------------------------------------------------------*/
@@ -61,6 +64,7 @@ static uint64_t			 radar_last_good_time_us     = 0;
 static RADAR_REPORT_T	 radar_last_report;
 static uint64_t 		 radar_last_report_time = 0;
 static uint64_t 		 radar_last_reinit_time = 0;
+static uint32_t 		 radar_uart_baudrate    = 9600;						/* Restored on system clock changes */
 
 volatile uint8_t 		 radar_uart_rx_buffer[256];
 volatile int			 radar_uart_rx_ptr = 0;
@@ -73,6 +77,7 @@ volatile bool 			 b_radar_is_message_ok;
 /* Callback prototypes -------------------------------------------------------*/
 
 void radar_uart_rx_callback(void);
+static bool radar_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz);
 
 
 /* Private function prototypes -----------------------------------------------*/
@@ -102,7 +107,7 @@ void dbgf(const char *fmt, ...);
  */
 void radar_init(void)
 {
-	uart_init(UART_INST_MMWAVE, 9600);
+	uart_init(UART_INST_MMWAVE, radar_uart_baudrate);
     gpio_set_function(PIN_MMWAVE_RX, GPIO_FUNC_UART);
     gpio_set_function(PIN_MMWAVE_TX, GPIO_FUNC_UART);
     uart_set_format(UART_INST_MMWAVE, 8, 1, UART_PARITY_NONE);
@@ -116,6 +121,8 @@ void radar_init(void)
 
     irq_set_exclusive_handler(UART_IRQ, radar_uart_rx_callback);
     irq_set_enabled(UART_IRQ, true);
+
+	sysclk_add_listener(radar_sysclk_callback);
 }
 
 /**
@@ -135,6 +142,9 @@ void radar_update(void)
 	    (time_us_64() - radar_last_reinit_time) > (1000 * 3000) && 
 		lamp_get_switched_12v())
 	{
+		m_blackbox_log(M_BLACKBOX_EVT_RADAR_DROPOUT_C, 0, 0,
+					   (uint32_t)((time_us_64() - radar_last_report_time) / 1000));
+
 		radar_init_comms();
 		radar_last_reinit_time = time_us_64();
 	}
@@ -297,6 +307,29 @@ void radar_uart_rx_callback(void)
     }
 }
 
+/**
+ * @brief Keeps the UART baud rate across system clock changes
+ * 
+ * A report being received while the clock changes is lost and resynced by 
+ * the reception timeout, as any other broken report
+ * 
+ * @param phase @ref SYSCLK_PHASE_E
+ * @param sys_hz New system clock
+ * @return true Ready / done
+ * @return false Still transmitting, defer the change
+ */
+static bool radar_sysclk_callback(SYSCLK_PHASE_E phase, uint32_t sys_hz)
+{
+	if (phase == SYSCLK_PHASE_PREPARE_C)
+	{
+		return !(uart_get_hw(UART_INST_MMWAVE)->fr & UART_UARTFR_BUSY_BITS);
+	}
+
+	uart_set_baudrate(UART_INST_MMWAVE, radar_uart_baudrate);
+
+	return true;
+}
+
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -362,6 +395,8 @@ static void radar_process_rx_msg(void)
 
 	memcpy((char*)&radar_message, (char*)radar_uart_rx_buffer, sizeof(radar_message));
 	b_radar_is_message_ok = true;
+
+	m_idle_wake(M_IDLE_WAKE_RADAR_C);
 }
 
 /**
@@ -448,6 +483,8 @@ static void radar_reinit(int baudrate)
 {
 	int actual_baudrate = uart_set_baudrate(UART_INST_MMWAVE, baudrate);
 
+	radar_uart_baudrate = baudrate;
+
     // printf("actual_baudrate: %d\n", actual_baudrate);
 
     uart_set_irq_enables(UART_INST_MMWAVE, false, false);
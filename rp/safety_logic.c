@@ -13,6 +13,8 @@
 #include "lamp.h"
 #include "radar.h"
 #include "imu.h"
+#include "mag.h"
+#include "m_blackbox.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
@@ -70,20 +72,22 @@ static BREAK_ROW_T breaks[LAMP_PWR_100PCT_C] = {
 };
 #endif
 
-static LAMP_PWR_LEVEL_E safety_logic_cap = LAMP_PWR_100PCT_C;
+static uint8_t 			safety_logic_cap_pct = 100;
 
 static char 			safety_logic_action_desc[128] = {0};
-static LAMP_PWR_LEVEL_E safety_logic_debounce_new_level = LAMP_PWR_OFF_C;
+static uint8_t 			safety_logic_debounce_new_pct = 0;
 static uint64_t 		safety_logic_debounce_new_time = 0;
 
 static bool 			b_safety_logic_is_radar_enabled = false;
+static uint8_t 			safety_logic_logged_pct = 0xff;							/* Last decision sent to the black box */
 
 
 /* Private function prototypes -----------------------------------------------*/
 
 static int safety_logic_get_tilt_break(void);
 static int safety_logic_get_distance_for_break_row(BREAK_ROW_T* p_row, bool b_is_diffused, bool b_is_high_tilt);
-static int safety_logic_get_power_for_distance(int distance, bool b_is_diffused, bool b_is_high_tilt);
+static uint8_t safety_logic_get_pct_for_distance(int distance, bool b_is_diffused, bool b_is_high_tilt);
+static void safety_logic_log_decision(uint8_t pct, int distance);
 
 
 /* Exported functions --------------------------------------------------------*/
@@ -117,13 +121,14 @@ void safety_logic_update(void)
 	if (distance == -1)
 	{
 		sprintf(safety_logic_action_desc, "Radar failed -- 100%%");
-		lamp_request_power_level(safety_logic_cap);
+		lamp_request_power_pct(safety_logic_cap_pct);
+		safety_logic_log_decision(safety_logic_cap_pct, distance);
 
 		return;
 	}
 
-	LAMP_PWR_LEVEL_E lamp_pwr = safety_logic_get_power_for_distance(distance, 
-													   false, 
+	uint8_t lamp_pct = safety_logic_get_pct_for_distance(distance, 
+													   mag_is_diffuser_present(), 
 													   safety_logic_is_high_tilt());
 
 	/* Ignore requests to strike if the lamp is off but the requested distance 
@@ -131,38 +136,39 @@ void safety_logic_update(void)
 	 * the radar
 	 */
 	if ((lamp_get_requested_power_level() == LAMP_PWR_OFF_C) && 
-		(lamp_pwr != LAMP_PWR_100PCT_C) && 
-		(lamp_pwr != LAMP_PWR_OFF_C))
+		(lamp_pct != 100) && 
+		(lamp_pct != 0))
 	{
 		sprintf(safety_logic_action_desc, 
-				"Tooclose/%s", 
-					lamp_get_power_level_string(lamp_pwr));
+				"Tooclose/%d%%", 
+				lamp_pct);
 
 		return; 																// Can't strike to anything but 100%
 	}
 
-	if (lamp_pwr != safety_logic_debounce_new_level)
+	if (lamp_pct != safety_logic_debounce_new_pct)
 	{
-		safety_logic_debounce_new_level = lamp_pwr;
+		safety_logic_debounce_new_pct  = lamp_pct;
 		safety_logic_debounce_new_time = time_us_64();
 	}
 
 	
-	uint64_t debounce_us = (lamp_pwr == LAMP_PWR_OFF_C) ? DEBOUNCE_US_OFF : DEBOUNCE_US_ON;
+	uint64_t debounce_us = (lamp_pct == 0) ? DEBOUNCE_US_OFF : DEBOUNCE_US_ON;
 
 	if ((time_us_64() - safety_logic_debounce_new_time) > debounce_us)
 	{
 		sprintf(safety_logic_action_desc, 
-				"Req %s", 
-				lamp_get_power_level_string(lamp_pwr));
+				"Req %d%%", 
+				lamp_pct);
 
-		lamp_request_power_level(safety_logic_cap < lamp_pwr ? safety_logic_cap : lamp_pwr);
+		lamp_request_power_pct(MIN(safety_logic_cap_pct, lamp_pct));			// Highest allowed output, not the next coarse step
+		safety_logic_log_decision(MIN(safety_logic_cap_pct, lamp_pct), distance);
 	}
 	else
 	{
 		sprintf(safety_logic_action_desc, 
-				"Debounce for req %s", 
-				lamp_get_power_level_string(lamp_pwr));
+				"Debounce for req %d%%", 
+				lamp_pct);
 	}
 }
 
@@ -209,13 +215,13 @@ void safety_logic_toggle_radar_enabled_state(void)
 #endif
 
 /**
- * @brief Sets the CAP power level
+ * @brief Sets the CAP output in percentage
  * 
- * @param pwr_level 
+ * @param pct User set-point, the safety logic never requests more than this
  */
-void safety_logic_set_cap_power(LAMP_PWR_LEVEL_E pwr_level)
+void safety_logic_set_cap_pct(uint8_t pct)
 {
-	safety_logic_cap = pwr_level;
+	safety_logic_cap_pct = pct;
 }
 
 
@@ -260,14 +266,14 @@ static int safety_logic_get_distance_for_break_row(BREAK_ROW_T* p_row, bool b_is
 }
 
 /**
- * @brief Get the power level for a distance
+ * @brief Get the highest allowed output for a distance
  * 
  * @param distance Distance in centimeters
  * @param b_is_diffused 
  * @param b_is_high_tilt 
- * @return int 
+ * @return uint8_t Output in percentage
  */
-static int safety_logic_get_power_for_distance(int distance, bool b_is_diffused, bool b_is_high_tilt)
+static uint8_t safety_logic_get_pct_for_distance(int distance, bool b_is_diffused, bool b_is_high_tilt)
 {
 #if 0
 	for (LAMP_PWR_LEVEL_E idx = 0; idx < LAMP_PWR_100PCT_C; idx++)
@@ -276,15 +282,30 @@ static int safety_logic_get_power_for_distance(int distance, bool b_is_diffused,
 												   b_is_diffused, 
 												   b_is_high_tilt))
 		{
-			return idx;
+			return lamp_get_power_level_pct(idx);
 		}
 	}
 
-	return LAMP_PWR_100PCT_C;
+	return 100;
 #else
-	return (distance <= 110) ? LAMP_PWR_OFF_C : LAMP_PWR_100PCT_C;
+	return (distance <= 110) ? 0 : 100;
 #endif
 }
 
+/**
+ * @brief Logs a decision to the black box when the output changes
+ * 
+ * @param pct Output in percentage
+ * @param distance Distance in cm, -1 without radar
+ */
+static void safety_logic_log_decision(uint8_t pct, int distance)
+{
+	if (pct != safety_logic_logged_pct)
+	{
+		safety_logic_logged_pct = pct;
+
+		m_blackbox_log(M_BLACKBOX_EVT_SAFETY_C, pct, (uint16_t)distance, 0);
+	}
+}
 
 /*** END OF FILE ***/
@@ -3,40 +3,146 @@
  * @author    The OSLUV Project
  * @brief     Driver for voltages sensing
  * @schematic lamp_controller.SchDoc
- *  
+ *
+ * The ADC free-runs in round-robin over the sensed rails and the internal
+ * temperature sensor. Two DMA channels chained to each other fill a pair of
+ * small blocks in turn; each block completion interrupts, and the block is
+ * checked against the cutoff windows and folded into the statistics.
+ *
+ * While armed, an out-of-window 12V cuts the lamp enable, 24V and 12V straight
+ * from the interrupt, so the reaction does not depend on the main loop; the
+ * lamp driver then catches up with the state change.
+ *
+ * Each block is one oversampled value per channel (sum of
+ * SENSE_ROUNDS_PER_BLOCK_C samples). Over a configurable window these give
+ * mean, min, max and ripple per channel, published as a snapshot that
+ * @ref sense_update and the readers only copy.
+ *
  */
 
 
 /* Includes ------------------------------------------------------------------*/
 
+#include <stdio.h>
 #include <hardware/adc.h>
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <hardware/irq.h>
+#include <hardware/pwm.h>
+#include <hardware/sync.h>
+#include <pico/stdlib.h>
+#include "sense.h"
 #include "pins.h"
+#include "m_idle.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
+
+/**
+ * @struct SENSE_ACC_T
+ * @brief Window accumulator of oversampled values
+ *
+ */
+typedef struct {
+	uint32_t sum;
+	uint16_t min;
+	uint16_t max;
+} SENSE_ACC_T;
+
+
 /* Private define ------------------------------------------------------------*/
 
-#define SENSE_PIN_ADC0_C	26
+#define SENSE_PIN_ADC0_C		26
+#define SENSE_ADC_TEMP_C		4												/* Internal temperature sensor input */
+
+#define SENSE_CH_TEMP_C			SENSE_RAIL_MAX_C								/* Channel index after the rails */
+#define SENSE_CH_MAX_C			(SENSE_RAIL_MAX_C + 1)
+
+#define SENSE_R1_C				100000											/* Divider top */
+#define SENSE_R2_C				10000											/* Divider bottom */
+#define SENSE_VREF_MV_C			3300
+#define SENSE_ADC_RANGE_C		(1 << 12)
+
+#define SENSE_RR_MASK_C			((1 << (PIN_VSENSE_VBUS - SENSE_PIN_ADC0_C)) | \
+								 (1 << (PIN_VSENSE_12V  - SENSE_PIN_ADC0_C)) | \
+								 (1 << (PIN_VSENSE_24V  - SENSE_PIN_ADC0_C)) | \
+								 (1 << SENSE_ADC_TEMP_C))
+#define SENSE_ADC_CLKDIV_C		599.f											/* 48 MHz / 600 = 80 ksps, 20 ksps per channel */
+
+#define SENSE_ROUNDS_PER_BLOCK_C 4												/* Oversampling, 200 us per block */
+#define SENSE_BLOCK_LEN_C		(SENSE_ROUNDS_PER_BLOCK_C * SENSE_CH_MAX_C)
+#define SENSE_BLOCK_BITS_C		5												/* log2 of block size in bytes, DMA write ring */
+#define SENSE_BLOCKS_PER_MS_C	5
+
+#define SENSE_WINDOW_DEF_MS_C	100
+#define SENSE_WINDOW_MIN_MS_C	1
+#define SENSE_WINDOW_MAX_MS_C	10000
+
+#define SENSE_CUTOFF_SAMPLES_C	2												/* Consecutive out-of-window samples to trip */
+
+#define SENSE_MV_TO_RAW(mv)		((uint16_t)(((uint32_t)(mv) * SENSE_R2_C / (SENSE_R1_C + SENSE_R2_C)) * \
+											SENSE_ADC_RANGE_C / SENSE_VREF_MV_C))
+
+static_assert((SENSE_BLOCK_LEN_C * sizeof(uint16_t)) == (1 << SENSE_BLOCK_BITS_C), "Block must fill the DMA ring");
 
 
 /* Global variables  ---------------------------------------------------------*/
 
-float g_sense_vbus, g_sense_12v, g_sense_24v = 0;
+uint16_t g_sense_vbus_mv, g_sense_12v_mv, g_sense_24v_mv = 0;
+int16_t  g_sense_temp_dc = 0;
 
 
 /* Private variables  --------------------------------------------------------*/
+
+/* Cutoff windows in raw counts, same limits as the former lamp_update check */
+static const struct {
+	uint16_t lo_raw;
+	uint16_t hi_raw;
+} sense_window[SENSE_RAIL_MAX_C] = {
+	[SENSE_RAIL_VBUS_C] = {0, 				 	  SENSE_ADC_RANGE_C},			/* Not monitored */
+	[SENSE_RAIL_12V_C]  = {SENSE_MV_TO_RAW(10500), SENSE_MV_TO_RAW(13500)},
+	[SENSE_RAIL_24V_C]  = {0, 				 	  SENSE_ADC_RANGE_C},			/* Not monitored */
+};
+
+static uint16_t 			sense_block[2][SENSE_BLOCK_LEN_C] __aligned(1 << SENSE_BLOCK_BITS_C);
+static uint 				sense_dma_chno[2];
+
+static uint16_t 			sense_last_raw[SENSE_RAIL_MAX_C] = {0};				/* Last sample, for the cutoff record */
+static uint8_t 				sense_out_count[SENSE_RAIL_MAX_C] = {0};
+
+static SENSE_ACC_T 			sense_acc[SENSE_CH_MAX_C];
+static uint16_t 			sense_acc_count  = 0;
+static volatile uint16_t 	sense_window_len = SENSE_WINDOW_DEF_MS_C * SENSE_BLOCKS_PER_MS_C;
+static SENSE_ACC_T 			sense_snapshot[SENSE_CH_MAX_C];						/* Last complete window, sum is the mean */
+static volatile uint32_t 	sense_snapshot_seq = 0;
+
+static volatile bool 		b_sense_cutoff_is_armed   = false;
+static volatile bool 		b_sense_cutoff_is_tripped = false;
+static SENSE_CUTOFF_EVENT_T sense_cutoff_event;
+
+
+/* Callback prototypes -------------------------------------------------------*/
+
+static void sense_dma_irq_handler(void);
+
+
 /* Private function prototypes -----------------------------------------------*/
 
-static float sense_convert_adc_sample(uint16_t sample);
+static void sense_process_block(const uint16_t* p_block);
+static void sense_acc_reset(void);
+static uint16_t sense_raw_to_mv(uint32_t raw);
+static uint16_t sense_oversampled_to_mv(uint32_t value);
+static int16_t sense_oversampled_to_temp_dc(uint32_t value);
+static void sense_cutoff(SENSE_RAIL_E rail);
 
 
 /* Exported functions --------------------------------------------------------*/
 
 /**
  * @brief Voltages sensing initialization procedure
- * 
- * @return 	void  
- * 
+ *
+ * @return 	void
+ *
  */
 void sense_init(void)
 {
@@ -45,42 +151,392 @@ void sense_init(void)
     adc_gpio_init(PIN_VSENSE_VBUS);
     adc_gpio_init(PIN_VSENSE_12V);
     adc_gpio_init(PIN_VSENSE_24V);
+	adc_set_temp_sensor_enabled(true);
+
+	adc_set_round_robin(SENSE_RR_MASK_C);
+	adc_set_clkdiv(SENSE_ADC_CLKDIV_C);
+	adc_fifo_setup(true, true, 1, false, false);								/* DREQ on every sample */
+	adc_select_input(PIN_VSENSE_VBUS - SENSE_PIN_ADC0_C);
+
+	sense_acc_reset();
+
+	sense_dma_chno[0] = dma_claim_unused_channel(true);
+	sense_dma_chno[1] = dma_claim_unused_channel(true);
+
+	for (int idx = 0; idx < 2; idx++)
+	{
+		dma_channel_config cfg = dma_channel_get_default_config(sense_dma_chno[idx]);
+
+		channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+		channel_config_set_read_increment(&cfg, false);
+		channel_config_set_write_increment(&cfg, true);
+		channel_config_set_ring(&cfg, true, SENSE_BLOCK_BITS_C);				/* Rewinds by itself, even if the IRQ is late */
+		channel_config_set_dreq(&cfg, DREQ_ADC);
+		channel_config_set_chain_to(&cfg, sense_dma_chno[idx ^ 1]);
+
+		dma_channel_configure(sense_dma_chno[idx], &cfg,
+							  sense_block[idx],
+							  &adc_hw->fifo,
+							  SENSE_BLOCK_LEN_C,
+							  false);
+
+		dma_channel_set_irq1_enabled(sense_dma_chno[idx], true);
+	}
+
+	irq_set_exclusive_handler(DMA_IRQ_1, sense_dma_irq_handler);
+	irq_set_priority(DMA_IRQ_1, PICO_HIGHEST_IRQ_PRIORITY);
+	irq_set_enabled(DMA_IRQ_1, true);
+
+	dma_channel_start(sense_dma_chno[0]);
+	adc_run(true);
 }
 
 /**
- * @brief   Updates voltages readings
- * 
- * @return 	void  
+ * @brief   Updates voltages readings from the last statistics window
+ *
+ * @return 	void
  */
 void sense_update(void)
 {
-	adc_select_input(PIN_VSENSE_VBUS - SENSE_PIN_ADC0_C);
-	g_sense_vbus = sense_convert_adc_sample(adc_read());
+	SENSE_RAIL_STATS_T stats;
 
-	adc_select_input(PIN_VSENSE_12V - SENSE_PIN_ADC0_C);
-	g_sense_12v = sense_convert_adc_sample(adc_read());
+	sense_get_rail_stats(SENSE_RAIL_VBUS_C, &stats);
+	g_sense_vbus_mv = stats.mean_mv;
 
-	adc_select_input(PIN_VSENSE_24V - SENSE_PIN_ADC0_C);
-	g_sense_24v = sense_convert_adc_sample(adc_read());
+	sense_get_rail_stats(SENSE_RAIL_12V_C, &stats);
+	g_sense_12v_mv = stats.mean_mv;
+
+	sense_get_rail_stats(SENSE_RAIL_24V_C, &stats);
+	g_sense_24v_mv = stats.mean_mv;
+
+	uint32_t irq_state = save_and_disable_interrupts();
+	uint32_t temp_mean = sense_snapshot[SENSE_CH_TEMP_C].sum;
+	restore_interrupts(irq_state);
+
+	g_sense_temp_dc = sense_oversampled_to_temp_dc(temp_mean);
+}
+
+/**
+ * @brief Copies the statistics of the last complete window of a rail
+ *
+ * @param rail @ref SENSE_RAIL_E
+ * @param p_stats Filled with the statistics
+ *
+ * @return 	void
+ */
+void sense_get_rail_stats(SENSE_RAIL_E rail, SENSE_RAIL_STATS_T* p_stats)
+{
+	uint32_t irq_state = save_and_disable_interrupts();
+	SENSE_ACC_T snapshot = sense_snapshot[rail];
+	restore_interrupts(irq_state);
+
+	p_stats->mean_mv   = sense_oversampled_to_mv(snapshot.sum);
+	p_stats->min_mv    = sense_oversampled_to_mv(snapshot.min);
+	p_stats->max_mv    = sense_oversampled_to_mv(snapshot.max);
+	p_stats->ripple_mv = p_stats->max_mv - p_stats->min_mv;
+}
+
+/**
+ * @brief Returns the number of statistics windows completed
+ *
+ * Lets readers tell a fresh snapshot from the one they already have
+ *
+ * @return uint32_t
+ */
+uint32_t sense_get_stats_seq(void)
+{
+	return sense_snapshot_seq;
+}
+
+/**
+ * @brief Arms or disarms the supply cutoff
+ *
+ * Armed by the lamp driver while the switched 12V is on
+ *
+ * @param b_armed
+ *
+ * @return 	void
+ */
+void sense_set_cutoff_armed(bool b_armed)
+{
+	for (int rail = 0; rail < SENSE_RAIL_MAX_C; rail++)
+	{
+		sense_out_count[rail] = 0;
+	}
+
+	b_sense_cutoff_is_armed = b_armed;
+}
+
+/**
+ * @brief Returns the pending cutoff event, if the cutoff tripped
+ *
+ * @param p_event Filled with the event record
+ * @return true Cutoff tripped and is not cleared yet
+ * @return false
+ */
+bool sense_get_cutoff_event(SENSE_CUTOFF_EVENT_T* p_event)
+{
+	if (!b_sense_cutoff_is_tripped)
+	{
+		return false;
+	}
+
+	*p_event = sense_cutoff_event;
+
+	return true;
+}
+
+/**
+ * @brief Acknowledges a tripped cutoff
+ *
+ * The cutoff stays disarmed until the 12V is switched on again
+ *
+ * @return 	void
+ */
+void sense_clear_cutoff(void)
+{
+	b_sense_cutoff_is_tripped = false;
+}
+
+/**
+ * @brief Sets the statistics window length
+ * @note This function can be called via external command
+ *
+ * @param window_ms Window in ms
+ * @return int16_t (0: failed, 1: suceed)
+ */
+int16_t sense_cmd_set_window(uint16_t window_ms)
+{
+	if ((window_ms < SENSE_WINDOW_MIN_MS_C) || (window_ms > SENSE_WINDOW_MAX_MS_C))
+	{
+		return 0;
+	}
+
+	sense_window_len = window_ms * SENSE_BLOCKS_PER_MS_C;
+
+	return 1;
+}
+
+/**
+ * @brief Returns the statistics window length
+ * @note This function can be called via external command
+ *
+ * @param window_ms Not used. The function need to comply with format.
+ * @return int16_t Window in ms
+ */
+int16_t sense_cmd_get_window(uint16_t window_ms)
+{
+	return sense_window_len / SENSE_BLOCKS_PER_MS_C;
+}
+
+/**
+ * @brief Formats the rails statistics as a single line
+ * @note This function can be called via external command
+ *
+ * Each rail as mean/min/max/ripple in mV, then the die temperature in C
+ *
+ * @param p_buf Destination buffer
+ * @param len Buffer size
+ * @return uint16_t Length of the text
+ */
+uint16_t sense_cmd_get_text(uint8_t* p_buf, uint16_t len)
+{
+	static const char* rail_str[SENSE_RAIL_MAX_C] = {"VBUS", "12V", "24V"};
+	SENSE_RAIL_STATS_T stats;
+	int 			   text_len = 0;
+
+	for (int rail = 0; (rail < SENSE_RAIL_MAX_C) && (text_len < len); rail++)
+	{
+		sense_get_rail_stats(rail, &stats);
+
+		text_len += snprintf((char*)p_buf + text_len, len - text_len,
+							 "%s=%u/%u/%u/%u,",
+							 rail_str[rail],
+							 stats.mean_mv,
+							 stats.min_mv,
+							 stats.max_mv,
+							 stats.ripple_mv);
+	}
+
+	if (text_len < len)
+	{
+		text_len += snprintf((char*)p_buf + text_len, len - text_len,
+							 "T=%d", g_sense_temp_dc / 10);
+	}
+
+	return MIN(text_len, len - 1);
+}
+
+
+/* Callback functions --------------------------------------------------------*/
+
+/**
+ * @brief DMA block completion interrupt
+ *
+ */
+static void sense_dma_irq_handler(void)
+{
+	for (int idx = 0; idx < 2; idx++)
+	{
+		if (dma_channel_get_irq1_status(sense_dma_chno[idx]))
+		{
+			dma_channel_acknowledge_irq1(sense_dma_chno[idx]);
+
+			sense_process_block(sense_block[idx]);
+		}
+	}
 }
 
 
 /* Private functions ---------------------------------------------------------*/
 
 /**
- * @brief Converts an ADC sample to a human readable voltage
- * 
- * @param adc_sample ADC channel sample
- * @return float 
+ * @brief Checks the cutoff windows and accumulates one block
+ *
+ * @param p_block Samples, SENSE_ROUNDS_PER_BLOCK_C rounds in channel order
+ *
+ * @return 	void
  */
-static float sense_convert_adc_sample(uint16_t adc_sample)
+static void sense_process_block(const uint16_t* p_block)
 {
-	float reading = ((float)adc_sample) * (3.3f / (float)(1 << 12));
-	float r1 = 100000;
-	float r2 = 10000;
-	float voltage = (reading * (r1 + r2)) / r2;
+	uint32_t oversampled[SENSE_CH_MAX_C] = {0};
+
+	for (int round = 0; round < SENSE_ROUNDS_PER_BLOCK_C; round++)
+	{
+		for (int ch = 0; ch < SENSE_CH_MAX_C; ch++)
+		{
+			uint16_t raw = *p_block++;
+
+			oversampled[ch] += raw;
+
+			if (ch >= SENSE_RAIL_MAX_C)
+			{
+				continue;
+			}
+
+			sense_last_raw[ch] = raw;
+
+			if ((raw >= sense_window[ch].lo_raw) && (raw <= sense_window[ch].hi_raw))
+			{
+				sense_out_count[ch] = 0;
+			}
+			else if (b_sense_cutoff_is_armed &&
+					 (++sense_out_count[ch] >= SENSE_CUTOFF_SAMPLES_C))
+			{
+				sense_cutoff(ch);
+			}
+		}
+	}
+
+	for (int ch = 0; ch < SENSE_CH_MAX_C; ch++)
+	{
+		sense_acc[ch].sum += oversampled[ch];
+		sense_acc[ch].min  = MIN(sense_acc[ch].min, oversampled[ch]);
+		sense_acc[ch].max  = MAX(sense_acc[ch].max, oversampled[ch]);
+	}
+
+	if (++sense_acc_count >= sense_window_len)
+	{
+		for (int ch = 0; ch < SENSE_CH_MAX_C; ch++)
+		{
+			sense_snapshot[ch] 	   = sense_acc[ch];
+			sense_snapshot[ch].sum = sense_acc[ch].sum / sense_acc_count;
+		}
+
+		sense_snapshot_seq++;
+
+		sense_acc_reset();
+	}
+}
+
+/**
+ * @brief Starts a new statistics window
+ *
+ * @return 	void
+ */
+static void sense_acc_reset(void)
+{
+	for (int ch = 0; ch < SENSE_CH_MAX_C; ch++)
+	{
+		sense_acc[ch].sum = 0;
+		sense_acc[ch].min = UINT16_MAX;
+		sense_acc[ch].max = 0;
+	}
+
+	sense_acc_count = 0;
+}
+
+/**
+ * @brief Converts an ADC sample to rail millivolts
+ *
+ * @param raw ADC channel sample
+ * @return uint16_t
+ */
+static uint16_t sense_raw_to_mv(uint32_t raw)
+{
+	return (raw * SENSE_VREF_MV_C / SENSE_ADC_RANGE_C) *
+		   (SENSE_R1_C + SENSE_R2_C) / SENSE_R2_C;
+}
+
+/**
+ * @brief Converts an oversampled value to rail millivolts
+ *
+ * The extra resolution is kept until after the divider scaling
+ *
+ * @param value Sum of SENSE_ROUNDS_PER_BLOCK_C samples
+ * @return uint16_t
+ */
+static uint16_t sense_oversampled_to_mv(uint32_t value)
+{
+	return ((uint64_t)value * SENSE_VREF_MV_C * (SENSE_R1_C + SENSE_R2_C)) /
+		   ((uint64_t)SENSE_ADC_RANGE_C * SENSE_ROUNDS_PER_BLOCK_C * SENSE_R2_C);
+}
+
+/**
+ * @brief Converts an oversampled temperature sensor value to 0.1 Celsius
+ *
+ * Typical sensor, 706 mV at 27 C and -1.721 mV/C from the RP2040 datasheet, 
+ * not calibrated per unit
+ *
+ * @param value Sum of SENSE_ROUNDS_PER_BLOCK_C samples
+ * @return int16_t
+ */
+static int16_t sense_oversampled_to_temp_dc(uint32_t value)
+{
+	int32_t uv = ((uint64_t)value * SENSE_VREF_MV_C * 1000) / 
+				 (SENSE_ADC_RANGE_C * SENSE_ROUNDS_PER_BLOCK_C);
+
+	return 270 - ((uv - 706000) / 172);											/* 1.721 mV/C = 172.1 uV per 0.1 C */
+}
+
+/**
+ * @brief Cuts the lamp supplies and records the event
+ *
+ * Runs in interrupt context, only register writes
+ *
+ * @param rail Rail out of window
+ *
+ * @return 	void
+ */
+static void sense_cutoff(SENSE_RAIL_E rail)
+{
+	gpio_put(PIN_ENABLE_LAMP, false);
+	gpio_put(PIN_ENABLE_24V, false);
+	pwm_set_gpio_level(PIN_ENABLE_12V, 0);
+
+	b_sense_cutoff_is_armed = false;
+
+	sense_cutoff_event.time_ms = to_ms_since_boot(get_absolute_time());
+	sense_cutoff_event.rail    = rail;
+
+	for (int idx = 0; idx < SENSE_RAIL_MAX_C; idx++)
+	{
+		sense_cutoff_event.rail_mv[idx] = sense_raw_to_mv(sense_last_raw[idx]);
+	}
+
+	b_sense_cutoff_is_tripped = true;
 
-	return voltage;
+	m_idle_wake(M_IDLE_WAKE_SUPPLY_C);
 }
 
 /*** END OF FILE ***/
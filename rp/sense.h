@@ -2,24 +2,82 @@
  * @file      sense.h
  * @author    The OSLUV Project
  * @brief     Functions prototypes for voltages sensing driver
- *  
+ *
  */
 
 #ifndef _D_SENSE_H_
 #define _D_SENSE_H_
 
 
+/* Exported includes ---------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* Exported typedef ----------------------------------------------------------*/
+
+/**
+ * @enum SENSE_RAIL_E
+ * @brief Sensed supply rails, in ADC round-robin order
+ *
+ */
+typedef enum {
+	SENSE_RAIL_VBUS_C = 0,
+	SENSE_RAIL_12V_C,
+	SENSE_RAIL_24V_C,
+	SENSE_RAIL_MAX_C
+} SENSE_RAIL_E;
+
+/**
+ * @struct SENSE_RAIL_STATS_T
+ * @brief Rail statistics over the last window
+ *
+ */
+typedef struct {
+	uint16_t mean_mv;
+	uint16_t min_mv;
+	uint16_t max_mv;
+	uint16_t ripple_mv;															/* max - min */
+} SENSE_RAIL_STATS_T;
+
+/**
+ * @struct SENSE_CUTOFF_EVENT_T
+ * @brief Supply cutoff record for post-mortem analysis
+ *
+ * Stored in the lamp stats flash region; bump its magic if changed
+ *
+ */
+typedef struct __packed {
+	uint32_t time_ms;															/* Since boot */
+	uint16_t rail_mv[SENSE_RAIL_MAX_C];											/* All rails at the tripping sample */
+	uint8_t  rail;																/* @ref SENSE_RAIL_E out of window */
+	uint8_t  _reserved;
+} SENSE_CUTOFF_EVENT_T;
+
+
 /* Exported variables --------------------------------------------------------*/
 
-extern float g_sense_vbus, g_sense_12v, g_sense_24v;
+extern uint16_t g_sense_vbus_mv, g_sense_12v_mv, g_sense_24v_mv;
+extern int16_t  g_sense_temp_dc;												/* Die temperature, 0.1 C */
 
 
 /* Exported functions prototypes ---------------------------------------------*/
 
 void sense_init();
 void sense_update();
+void sense_get_rail_stats(SENSE_RAIL_E rail, SENSE_RAIL_STATS_T* p_stats);
+uint32_t sense_get_stats_seq(void);
+
+void sense_set_cutoff_armed(bool b_armed);
+bool sense_get_cutoff_event(SENSE_CUTOFF_EVENT_T* p_event);
+void sense_clear_cutoff(void);
+
+int16_t sense_cmd_set_window(uint16_t window_ms);
+int16_t sense_cmd_get_window(uint16_t window_ms);
+uint16_t sense_cmd_get_text(uint8_t* p_buf, uint16_t len);
 
 
 #endif /* _D_SENSE_H_ */
 
-/*** END OF FILE ***/
\ No newline at end of file
+/*** END OF FILE ***/
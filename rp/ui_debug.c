@@ -88,9 +88,9 @@ void ui_debug_update(void)
 
     lamp_get_reported_power_level(&rep);
 
-    ADD_TEXT("Lamp Req %s / Cmd %s\n", 
-             lamp_get_power_level_string(lamp_get_requested_power_level()),
-             lamp_get_power_level_string(lamp_get_commanded_power_level()));
+    ADD_TEXT("Lamp Req %d%% / Cmd %d%%\n", 
+             lamp_get_requested_power_pct(),
+             lamp_get_commanded_power_pct());
 
     ADD_TEXT("     Rep %s (%dHz)\n", 
              lamp_get_power_level_string(rep),
@@ -104,23 +104,26 @@ void ui_debug_update(void)
 
     ADD_TEXT("Lamp Type %s\n", type_strs[lamp_get_type()]);
 
-    ADD_TEXT("IMU: %+.2f/%+.2f/%+.2f\n", g_imu_x, g_imu_y, g_imu_z);
+    ADD_TEXT("IMU: %+5d/%+5d/%+5dmg\n", g_imu_x_mg, g_imu_y_mg, g_imu_z_mg);
 
-    ADD_TEXT("Mag: %+ 5d/%+ 5d/%+ 5d\n", g_mag_x, g_mag_y, g_mag_z);
+    ADD_TEXT("Mag: %+ 5d/%+ 5d/%+ 5d %s\n", g_mag_x, g_mag_y, g_mag_z,
+             mag_is_diffuser_present()?"Diff":"");
 
     ADD_TEXT("12V Switched %s / 24V Reg %s\n", 
              lamp_get_switched_12v()?"ON ":"off", 
              lamp_get_switched_24v()?"ON ":"off");
 
-    ADD_TEXT("VBUS: %.1f/12V: %.1f/12V: %.1f/24V\n", 
-             g_sense_vbus, 
-             g_sense_12v, 
-             g_sense_24v);
+    ADD_TEXT("VBUS: %d.%d/12V: %d.%d/12V: %d.%d/24V\n", 
+             g_sense_vbus_mv / 1000, (g_sense_vbus_mv / 100) % 10, 
+             g_sense_12v_mv / 1000, (g_sense_12v_mv / 100) % 10, 
+             g_sense_24v_mv / 1000, (g_sense_24v_mv / 100) % 10);
 
-    ADD_TEXT("USB %s %s/%.1fA\n", 
+    ADD_TEXT("Die %dC\n", g_sense_temp_dc / 10);
+
+    ADD_TEXT("USB %s %s/%d.%dA\n", 
              usbpd_get_is_trying_for_12v()?"Req 12V":"Req 5V", 
              usbpd_get_is_12v()?"Got 12V":"Got 5V", 
-             ((float)usbpd_get_negotiated_mA())/1000.);
+             usbpd_get_negotiated_mA() / 1000, (usbpd_get_negotiated_mA() / 100) % 10);
 
     RADAR_REPORT_T* r      = radar_debug_get_report();
     int             r_time = radar_debug_get_report_time();
@@ -19,6 +19,7 @@
 #include "ui_main.h"
 #include "safety_logic.h"
 #include "persistance.h"
+#include "lamp_cal.h"
 #include <string.h>
 
 
@@ -26,7 +27,7 @@
 /* Private define ------------------------------------------------------------*/
 
 #define UI_COLOR_ACCENT_C   lv_color_hex(0x5600FF)
-#define UI_MAIN_LAMP_PWR_C  LAMP_PWR_100PCT_C
+#define UI_MAIN_LAMP_PCT_C  100
 
 
 /* Global variables  ---------------------------------------------------------*/
@@ -99,6 +100,7 @@ static inline void ui_main_set_debug_tools(void);
 static void ui_main_theme_init(void);
 static void ui_main_set_tilt(uint16_t deg);
 static void ui_main_styles_init(void);
+static uint8_t ui_main_pct_to_dim_index(uint8_t pct);
 
 
 /* Exported functions --------------------------------------------------------*/
@@ -135,13 +137,12 @@ void ui_main_update(void)
     bool power_on = lv_obj_has_state(ui_sw_power, LV_STATE_CHECKED);
     bool radar_on = lv_obj_has_state(ui_sw_radar, LV_STATE_CHECKED);
 	bool inactive = !power_on;
-	LAMP_PWR_LEVEL_E intensity_setting = UI_MAIN_LAMP_PWR_C;
+	uint8_t intensity_pct = UI_MAIN_LAMP_PCT_C;
 
-	/* Get current User set-point lamp power level  */
+	/* Get current User set-point lamp output       */
 	if (ui_show_dim_b)
     {
-		int intensity_setting_int = lv_slider_get_value(ui_slider_intensity);
-        intensity_setting = LAMP_PWR_20PCT_C + intensity_setting_int;
+        intensity_pct = persistance_get_dim_pct();
 	}
 	
 	/* Update lamp status                           */
@@ -158,11 +159,7 @@ void ui_main_update(void)
 					   (s == LAMP_STATE_FAILED_OFF_C)          ? "Lamp off - ERROR" :
 					   (s == LAMP_STATE_FULLPOWER_TEST_C)      ? "Calibrating..." : "STATUS UNKNOWN";
     
-	int pct_req = (intensity_setting == LAMP_PWR_20PCT_C) ?  20 :
-				  (intensity_setting == LAMP_PWR_40PCT_C) ?  40 :
-				  (intensity_setting == LAMP_PWR_70PCT_C) ?  70 :
-				  (intensity_setting == LAMP_PWR_100PCT_C)? 100 : 0;
-	LAMP_PWR_LEVEL_E  cmd = lamp_get_commanded_power_level();                   // What has been sent to pwm
+	int pct_req = intensity_pct;
 	int pct_cmd;
 	bool warming = lamp_is_warming();
 
@@ -173,17 +170,8 @@ void ui_main_update(void)
 	}
     else 
     {
-	    pct_cmd = (cmd == LAMP_PWR_20PCT_C) ?  20 :
-				  (cmd == LAMP_PWR_40PCT_C) ?  40 :
-				  (cmd == LAMP_PWR_70PCT_C) ?  70 :
-				  (cmd == LAMP_PWR_100PCT_C)? 100 : 0;                          // LAMP_PWR_OFF_C or unknown
+	    pct_cmd = lamp_get_commanded_power_pct();                               // What has been sent to pwm
 	}
-    LAMP_PWR_LEVEL_E rep;                                                       // Reported level
-	lamp_get_reported_power_level(&rep);   
-    int pct_rep = (rep == LAMP_PWR_20PCT_C) ?  20 :
-				  (rep == LAMP_PWR_40PCT_C) ?  40 :
-				  (rep == LAMP_PWR_70PCT_C) ?  70 :
-				  (rep == LAMP_PWR_100PCT_C)? 100 : 0;
 				
 	bool radar_active = radar_on && pct_cmd < pct_req && power_on;
 	if (radar_active)
@@ -213,12 +201,12 @@ void ui_main_update(void)
         if (radar_on)
         {
             safety_logic_set_radar_enabled_state(true);
-            safety_logic_set_cap_power(intensity_setting);
+            safety_logic_set_cap_pct(intensity_pct);
         }
         else
         {
             safety_logic_set_radar_enabled_state(false);
-            lamp_request_power_level(intensity_setting);
+            lamp_request_power_pct(intensity_pct);
         }
     }
 
@@ -283,7 +271,6 @@ int16_t ui_main_lamp_set_stt(uint16_t req_state)
         //if (lamp_pwr_lvl != LAMP_PWR_OFF_C)                                     // Lamp is ON ?
         {
             persistance_set_power_state(0);
-            persistance_write_region();
 
             lv_obj_set_state(ui_sw_power, LV_STATE_CHECKED, false);             // Update function will update lamp's state
         }
@@ -299,7 +286,6 @@ int16_t ui_main_lamp_set_stt(uint16_t req_state)
             display_screen_on();
 
             persistance_set_power_state(1);
-            persistance_write_region();
 
             lv_obj_set_state(ui_sw_power, LV_STATE_CHECKED, true);              // Update function will update lamp's state
         }
@@ -327,51 +313,26 @@ int16_t ui_main_lamp_get_stt(uint16_t state)
  * @note This function can be called via external command
  * @note If level is not valid, returns failed
  * 
- * @param level Dim level to set to lamp
- * @return int16_t (0: failed, 1: suceed)
+ * @param level Dim level to set to lamp, in 1 % steps down to the lowest 
+ * calibrated output
+ * @return int16_t (0: failed, level: suceed)
  */
 int16_t ui_main_lamp_set_dim(uint16_t level)
 {
-    LAMP_PWR_LEVEL_E lamp_pwr_level;
-
-    lamp_pwr_level = LAMP_PWR_UNKNOWN_C;
-    switch (level)
+    if ((level < lamp_cal_get_min_pct()) || (level > 100))
     {
-        case 0:
-            //lamp_pwr_level = LAMP_PWR_OFF_C;
-            return 0;
-        break;
-
-        case 20:
-            lamp_pwr_level = LAMP_PWR_20PCT_C;
-        break;
-        
-        case 40:
-            lamp_pwr_level = LAMP_PWR_40PCT_C;
-        break;
-        
-        case 70:
-            lamp_pwr_level = LAMP_PWR_70PCT_C;
-        break;
-        
-        case 100:
-            lamp_pwr_level = LAMP_PWR_100PCT_C;
-        break;
-
-        default:
-            return 0;
-        break;
+        return 0;
     }
 
-    if (ui_show_dim_b && (lamp_pwr_level < LAMP_PWR_MAX_SETTINGS_C))
+    if (ui_show_dim_b)
     {
         display_screen_on();
 
-        lamp_pwr_level -= LAMP_PWR_20PCT_C;
-
-        persistance_set_dim_index(lamp_pwr_level);
+        persistance_set_dim_pct(level);
 
-        lv_slider_set_value(ui_slider_intensity, lamp_pwr_level, LV_ANIM_OFF);
+        lv_slider_set_value(ui_slider_intensity, 
+                            ui_main_pct_to_dim_index(level), 
+                            LV_ANIM_OFF);
 
         return level;
     }
@@ -388,43 +349,13 @@ int16_t ui_main_lamp_set_dim(uint16_t level)
  */
 int16_t ui_main_lamp_get_dim(uint16_t level)
 {
-    int dim_setting;
-    LAMP_PWR_LEVEL_E lamp_pwr_lvl;
     int16_t dim_level;
 
     dim_level = 100;
 	
 	if (ui_show_dim_b) 
     {
-		dim_setting  = lv_slider_get_value(ui_slider_intensity);
-        lamp_pwr_lvl = LAMP_PWR_20PCT_C + dim_setting;
-	
-        switch (lamp_pwr_lvl)
-        {
-            case LAMP_PWR_OFF_C:
-                dim_level = 0;
-            break;
-
-            case LAMP_PWR_20PCT_C:
-                dim_level = 20;
-            break;
-            
-            case LAMP_PWR_40PCT_C:
-                dim_level = 40;
-            break;
-            
-            case LAMP_PWR_70PCT_C:
-                dim_level = 70;
-            break;
-            
-            case LAMP_PWR_100PCT_C:
-                dim_level = 100;
-            break;
-
-            default:
-                dim_level = 100;
-            break;
-        }
+        dim_level = persistance_get_dim_pct();
 	}
 
     return dim_level;
@@ -443,26 +374,23 @@ static void ui_main_back_to_menu_callback(lv_event_t * e)
     ui_main_open();    // reopen the main menu ui_screen
 }
 
-/* --- persistence write helpers --------------------------------- */
+/* --- persistence write helpers, committed by persistance_update() - */
 static void ui_main_sw_power_changed_callback(lv_event_t * e)
 {
     bool on = lv_obj_has_state(lv_event_get_target(e), LV_STATE_CHECKED);
     persistance_set_power_state(on);
-    persistance_write_region();                        /* flash only if value changed */
 }
 
 static void ui_main_sw_radar_changed_callback(lv_event_t * e)
 {
     bool on = lv_obj_has_state(lv_event_get_target(e), LV_STATE_CHECKED);
     persistance_set_radar_state(on);
-    persistance_write_region();
 }
 
 static void ui_main_slider_int_changed_callback(lv_event_t * e)
 {
     uint8_t idx = lv_slider_get_value(lv_event_get_target(e)); /* 0–3 */
-    persistance_set_dim_index(idx);
-    persistance_write_region();
+    persistance_set_dim_pct(MAX(ui_dim_levels[idx], lamp_cal_get_min_pct())); /* Lowest tick may sit under the curve */
 }
 
 /**
@@ -659,7 +587,9 @@ static inline void ui_main_set_lamp_dim_slider(void)
     
     lv_slider_set_range(ui_slider_intensity, 0, 3);                             /* 4 ticks */
     //lv_slider_set_value(ui_slider_intensity, 3, LV_ANIM_OFF);                 /* Default level 3 = 100% */
-    lv_slider_set_value(ui_slider_intensity, persistance_get_dim_index(), LV_ANIM_OFF);
+    lv_slider_set_value(ui_slider_intensity, 
+                        ui_main_pct_to_dim_index(persistance_get_dim_pct()), 
+                        LV_ANIM_OFF);
     lv_obj_add_event_cb(ui_slider_intensity, ui_main_slider_int_changed_callback, LV_EVENT_VALUE_CHANGED, NULL);
     lv_group_add_obj(ui_lv_group, ui_slider_intensity);
     lv_obj_add_event_cb(ui_slider_intensity, ui_main_focus_sync_callback, LV_EVENT_FOCUSED,   ui_lbl_slider);
@@ -916,5 +846,23 @@ static void ui_main_styles_init(void)
 	lv_style_set_text_color(&ui_style_inactive, lv_color_hex(0xc0c0c0));
 }
 
+/**
+ * @brief Maps an output percentage to the nearest lower slider tick
+ * 
+ * @param pct Output in percentage
+ * @return uint8_t Slider index @ref ui_dim_levels
+ */
+static uint8_t ui_main_pct_to_dim_index(uint8_t pct)
+{
+    uint8_t idx = UI_MAIN_MAX_DIM_INDEX_C;
+
+    while ((idx > 0) && (pct < ui_dim_levels[idx]))
+    {
+        idx--;
+    }
+
+    return idx;
+}
+
 
 /*** END OF FILE ***/
@@ -4,12 +4,14 @@
  * @brief     Driver for power negociations IC controller (STUSB4500)
  * @schematic lamp_controller.SchDoc
  *  
+ * The status read by the getters is refreshed every USBPD_POLL_MS_C through 
+ * the shared bus queue, the getters return the last values.
+ *  
  */
 
 
 /* Includes ------------------------------------------------------------------*/
 
-#include <hardware/i2c.h>
 #include <pico/stdlib.h>
 
 #include <stdio.h>
@@ -19,16 +21,20 @@
 #include "pins.h"
 #include "usbpd.h"
 #include "lamp.h"
+#include "d_i2c_bus.h"
+#include "m_idle.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 
-#define USBPD_I2C_PORT_C 		        I2C_INST
 #define USBPD_ADDR_C 			        0x28
+#define USBPD_I2C_BAUD_C 		        (400*1000)
+#define USBPD_POLL_MS_C 		        500
 
 #define USBPD_REG_TYPEC_STATUS_C        0x15
 #define USBPD_REG_PD_COMMAND_CTRL_C     0x1A
+#define USBPD_REG_STATUS_1_C            0x21                                    /* VBUS, 100 mV */
 #define USBPD_REG_TX_HEADER_LOW_C       0x51
 #define USBPD_REG_DPM_PDO_NUMB_C        0x70
 #define USBPD_REG_DPM_SNK_PDO1_0_C      0x85
@@ -43,6 +49,17 @@
 
 bool trying_up = false;
 
+static I2C_BUS_REQ_T   usbpd_req[3];                                           /* Status 1, Type-C status, RDO */
+static uint8_t         usbpd_status_1 = 0;
+static uint8_t         usbpd_typec_status = 0;
+static usbpd_rdo_t     usbpd_rdo = {0};
+static absolute_time_t usbpd_next_poll;
+
+
+/* Callback prototypes -------------------------------------------------------*/
+
+static void usbpd_on_poll(I2C_BUS_REQ_T* p_req);
+
 
 /* Private function prototypes -----------------------------------------------*/
 
@@ -57,12 +74,54 @@ static void usbpd_print_rdo(usbpd_rdo_t rdo);
 
 /* Exported functions --------------------------------------------------------*/
 
+/**
+ * @brief USB PD controller initialization procedure
+ * 
+ */
+void usbpd_init(void)
+{
+	static const uint8_t reg[3] = {USBPD_REG_STATUS_1_C, USBPD_REG_TYPEC_STATUS_C, USBPD_REG_RDO_REG_STATUS_0_C};
+	static uint8_t* const p_dst[3] = {&usbpd_status_1, &usbpd_typec_status, (uint8_t*)&usbpd_rdo};
+	static const uint16_t len[3] = {1, 1, sizeof(usbpd_rdo)};
+
+	i2c_bus_add_device(I2C_BUS_DEV_USBPD_C, USBPD_ADDR_C, USBPD_I2C_BAUD_C);
+
+	for (int idx = 0; idx < 3; idx++)
+	{
+		usbpd_req[idx] = (I2C_BUS_REQ_T){
+			.dev        = I2C_BUS_DEV_USBPD_C,
+			.reg        = reg[idx],
+			.b_is_read  = true,
+			.len        = len[idx],
+			.p_data     = p_dst[idx],
+			.p_callback = usbpd_on_poll,
+		};
+	}
+}
+
 /**
  * @brief USB PD controller task handling
  * 
  */
 void usbpd_update(void)
 {
+	if (absolute_time_diff_us(get_absolute_time(), usbpd_next_poll) > 0)
+	{
+		m_idle_wake_by(usbpd_next_poll);
+		return;
+	}
+
+	usbpd_next_poll = make_timeout_time_ms(USBPD_POLL_MS_C);
+	m_idle_wake_by(usbpd_next_poll);
+
+	for (int idx = 0; idx < 3; idx++)
+	{
+		if (usbpd_req[idx].result != I2C_BUS_RES_PENDING_C)
+		{
+			i2c_bus_submit(&usbpd_req[idx]);
+		}
+	}
+
 	// printf("\n\n\n\n\n\n\n");
 
 	// uint8_t c_status = 0;
@@ -167,11 +226,7 @@ void usbpd_negotiate(bool up)
  */
 bool usbpd_get_is_12v(void)
 {
-	uint8_t mv_from_status1 = 0;
-
-	usbpd_read(0x21, 1, &mv_from_status1);
-
-	return (mv_from_status1 == 120);
+	return (usbpd_status_1 == 120);
 }
 
 /**
@@ -192,20 +247,32 @@ bool usbpd_get_is_trying_for_12v(void)
  */
 int usbpd_get_negotiated_mA(void)
 {
-	uint8_t c_status = 0;
-	usbpd_rdo_t rdo = {0};
-
-	usbpd_read(USBPD_REG_TYPEC_STATUS_C, 1, &c_status);
-
-	if (c_status == 0) 
+	if (usbpd_typec_status == 0) 
 	{
 		return 0;
 	}
 
-	usbpd_read(USBPD_REG_RDO_REG_STATUS_0_C, 4, (uint8_t*)&rdo);
+	return usbpd_rdo.fixed.operating_current * 10;
+
+}
+
 
-	return rdo.fixed.operating_current * 10;
+/* Callback functions --------------------------------------------------------*/
 
+/**
+ * @brief Status read completed
+ * 
+ * A failed read may leave the destination partly written, it is cleared so 
+ * the getters report nothing negotiated
+ * 
+ * @param p_req Request of one register
+ */
+static void usbpd_on_poll(I2C_BUS_REQ_T* p_req)
+{
+	if (p_req->result != I2C_BUS_RES_OK_C)
+	{
+		memset(p_req->p_data, 0, p_req->len);
+	}
 }
 
 
@@ -221,25 +288,7 @@ int usbpd_get_negotiated_mA(void)
  */
 static inline int usbpd_read(uint8_t addr_l, int len, uint8_t* out)
 {
-	int e = 0;
-
-	e = i2c_write_timeout_us(USBPD_I2C_PORT_C, USBPD_ADDR_C, &addr_l, 1, true, 1000);
-    if (e < 0)
-    {
-        printf("usbpd_read fail: addr: %d\n", e);
-
-        return 1;
-    }
-
-	e = i2c_read_timeout_us(USBPD_I2C_PORT_C, USBPD_ADDR_C, out, len, false, 1000);
-    if (e < 0)
-    {
-        printf("usbpd_read fail: data: %d\n", e);
-
-        return 1;
-    }
-
-    return 0;
+	return (i2c_bus_xfer_blocking(I2C_BUS_DEV_USBPD_C, addr_l, true, out, len) != I2C_BUS_RES_OK_C);
 }
 
 /**
@@ -252,21 +301,7 @@ static inline int usbpd_read(uint8_t addr_l, int len, uint8_t* out)
  */
 static inline int usbpd_write(uint8_t addr_l, int len, uint8_t* value)
 {
-    uint8_t buf[len + 1];
-    int e = 0;
-
-    buf[0] = addr_l;
-    memcpy(buf+1, value, len);
-
-	e = i2c_write_timeout_us(USBPD_I2C_PORT_C, USBPD_ADDR_C, buf, len+1, false, 1000);
-    if (e < 0)
-    {
-        printf("usbpd_write fail: %d\n", e);
-
-        return 1;
-    }
-
-    return 0;
+	return (i2c_bus_xfer_blocking(I2C_BUS_DEV_USBPD_C, addr_l, false, value, len) != I2C_BUS_RES_OK_C);
 }
 
 /**
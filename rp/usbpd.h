@@ -88,6 +88,7 @@ static_assert(sizeof(usbpd_rdo_t) == 4);
 
 /* Exported functions prototypes ---------------------------------------------*/
 
+void usbpd_init(void);
 void usbpd_update(void);
 void usbpd_negotiate(bool up);
 bool usbpd_get_is_12v(void);